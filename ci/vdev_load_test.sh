@@ -0,0 +1,124 @@
+#!/bin/bash
+#
+# Runs a number of virtual devices on this host and reports CPU and memory usage of each device.
+#
+# Usage: vdev_load_test.sh [-n count] [-t seconds] [-e executable] [-i device_id] [-s state_dir] [-- device options]
+#
+#   -n  number of devices to run (default: 10)
+#   -t  measurement period in seconds (default: 60)
+#   -e  virtual device executable (default: build/target/main/platform-3/main)
+#   -i  ID of the first device, as 24 hex digits. The following devices use consecutive IDs
+#   -s  directory where the state directories of the devices are created (default: a temporary directory)
+#
+# Remaining arguments are passed to every device, e.g. -- --server_key server_key.der --device_key device_key.der
+#
+# Devices are given a few seconds to connect before the measurement starts. CPU usage is
+# reported as a percentage of a single core over the measurement period.
+
+count=10
+period=60
+warmup=5
+exe=$(dirname $BASH_SOURCE)/../build/target/main/platform-3/main
+first_id=000000000000000000000001
+state_dir=
+
+while getopts "n:t:e:i:s:" opt; do
+  case $opt in
+    n) count=$OPTARG ;;
+    t) period=$OPTARG ;;
+    e) exe=$OPTARG ;;
+    i) first_id=$OPTARG ;;
+    s) state_dir=$OPTARG ;;
+    *) sed -n '3,17p' $BASH_SOURCE; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+function die {
+  echo "$@" >&2
+  exit 1
+}
+
+[ -x "$exe" ] || die "Virtual device executable not found: $exe"
+[ -d /proc/self ] || die "This script requires procfs"
+
+if [ -z "$state_dir" ]; then
+  state_dir=$(mktemp -d)
+fi
+
+pids=()
+
+function cleanup {
+  for pid in "${pids[@]}"; do
+    kill $pid 2>/dev/null
+  done
+  wait 2>/dev/null
+}
+
+trap cleanup EXIT
+
+# Total CPU time of a process in clock ticks
+function cpu_ticks {
+  # Skip the command name, which may contain spaces
+  local stat=$(cat /proc/$1/stat 2>/dev/null) || return 1
+  stat=${stat##*) }
+  local fields=($stat)
+  # utime and stime are fields 14 and 15 of the stat file
+  echo $(( ${fields[11]} + ${fields[12]} ))
+}
+
+# Value of a field in /proc/<pid>/status in kB
+function status_field {
+  awk -v name="$2:" '$1 == name { print $2 }' /proc/$1/status 2>/dev/null
+}
+
+echo "Starting $count devices in $state_dir"
+for ((i = 0; i < count; i++)); do
+  id=$(printf "%024x" $(( 16#${first_id: -12} + i )))
+  id=${first_id:0:12}${id: -12}
+  dir=$state_dir/$id
+  mkdir -p $dir
+  "$exe" --device_id $id --state $dir "$@" > $dir/device.log 2>&1 &
+  pids+=($!)
+done
+
+sleep $warmup
+
+declare -A start_ticks
+for pid in "${pids[@]}"; do
+  start_ticks[$pid]=$(cpu_ticks $pid)
+done
+
+echo "Measuring for $period seconds"
+sleep $period
+
+hz=$(getconf CLK_TCK)
+total_cpu=0
+total_rss=0
+running=0
+
+printf "%-8s %-26s %8s %10s %10s %8s\n" "PID" "DEVICE" "CPU %" "RSS kB" "PEAK kB" "THREADS"
+for ((i = 0; i < count; i++)); do
+  pid=${pids[$i]}
+  id=$(printf "%024x" $(( 16#${first_id: -12} + i )))
+  id=${first_id:0:12}${id: -12}
+  ticks=$(cpu_ticks $pid)
+  if [ -z "$ticks" ] || [ -z "${start_ticks[$pid]}" ]; then
+    printf "%-8s %-26s %8s\n" $pid $id "exited"
+    continue
+  fi
+  cpu=$(( (ticks - start_ticks[$pid]) * 10000 / (hz * period) ))
+  rss=$(status_field $pid VmRSS)
+  peak=$(status_field $pid VmHWM)
+  threads=$(status_field $pid Threads)
+  printf "%-8s %-26s %5d.%02d %10s %10s %8s\n" $pid $id $((cpu / 100)) $((cpu % 100)) $rss $peak $threads
+  total_cpu=$((total_cpu + cpu))
+  total_rss=$((total_rss + rss))
+  running=$((running + 1))
+done
+
+[ $running -gt 0 ] || die "No devices are running, see device.log in $state_dir"
+
+avg_cpu=$((total_cpu / running))
+printf "%d of %d devices running, average CPU %d.%02d%%, average RSS %d kB, total RSS %d kB\n" \
+    $running $count $((avg_cpu / 100)) $((avg_cpu % 100)) $((total_rss / running)) $total_rss
@@ -32,6 +32,14 @@ namespace FileTransfer {
         };
     };
 
+    namespace Format {
+        enum Enum {
+            BINARY = 0x00,      // raw binary
+            COMPRESSED = 0x01,  // compressed with miniz (raw deflate)
+            DELTA = 0x02        // delta against an installed module, see FirmwareDeltaHeader
+        };
+    };
+
     struct __attribute__((packed)) Chunk
     {
         uint16_t size;
@@ -54,7 +62,11 @@ namespace FileTransfer {
          * 2 means application-provided storage
          */
         Store::Enum store;
-        uint8_t reserved;       // padding
+
+        /**
+         * A combination of Format flags describing how the file data is encoded.
+         */
+        uint8_t format;
     };
 
     PARTICLE_STATIC_ASSERT(Chunk_size, sizeof(Chunk)==12);
@@ -222,6 +222,7 @@ protected:
 		}
 		else
 		{
+			publisher.process_deferred(channel, callbacks.millis());
 			ProtocolError error = pinger.process(
 					callbacks.millis() - last_message_millis, [this]
 					{	return ping();});
@@ -246,6 +247,7 @@ protected:
 	 * @arg \p DESCRIBE_APPLICATION
 	 * @arg \p DESCRIBE_METRICS
 	 * @arg \p DESCRIBE_SYSTEM
+	 * @param metrics The diagnostic sources to include in a metrics message (optional)
 	 *
 	 * @returns \s ProtocolError result value
 	 * @retval \p particle::protocol::NO_ERROR
@@ -253,7 +255,8 @@ protected:
 	 * @sa particle::protocol::ProtocolError
 	 */
 	ProtocolError generate_and_send_description(MessageChannel& channel, Message& message,
-												size_t header_size, int desc_flags);
+												size_t header_size, int desc_flags,
+												const spark_protocol_describe_metrics* metrics = nullptr);
 
 	/**
 	 * Produces and transmits (PIGGYBACK) a describe message.
@@ -328,6 +331,39 @@ public:
 		chunkedTransfer.set_fast_ota(data);
 	}
 
+	/**
+	 * Sets the number of confirmable messages that may be awaiting acknowledgement at the same time.
+	 * Protocols that do not use CoAP reliability ignore this setting.
+	 */
+	virtual void set_nstart(unsigned nstart)
+	{
+	}
+
+	/**
+	 * Sets the maximum number of event subscriptions.
+	 */
+	void set_subscription_limit(unsigned limit)
+	{
+		subscriptions.set_limit(limit);
+	}
+
+	/**
+	 * Sets the rate limit for events whose name starts with the given prefix.
+	 */
+	ProtocolError set_event_rate_limit(const char* prefix, system_tick_t interval, uint16_t burst)
+	{
+		return publisher.set_rate_limit(prefix, interval, burst);
+	}
+
+	/**
+	 * Sets the maximum time in milliseconds an event can be deferred until a rate limit token is
+	 * available. Deferred events are sent from the event loop.
+	 */
+	void set_event_rate_limit_wait(system_tick_t wait)
+	{
+		publisher.set_max_wait(wait);
+	}
+
 	void set_handlers(CommunicationsHandlers& handlers)
 	{
 		copy_and_init(&this->handlers, sizeof(this->handlers), &handlers, handlers.size);
@@ -385,13 +421,15 @@ public:
 	 * @arg \p DESCRIBE_APPLICATION
 	 * @arg \p DESCRIBE_METRICS
 	 * @arg \p DESCRIBE_SYSTEM
+	 * @param metrics The diagnostic sources to include in a metrics message. If
+	 *                \p nullptr, all sources are included
 	 *
 	 * @returns \s ProtocolError result value
 	 * @retval \p particle::protocol::NO_ERROR
 	 *
 	 * @sa particle::protocol::ProtocolError
 	 */
-	ProtocolError post_description(int desc_flags);
+	ProtocolError post_description(int desc_flags, const spark_protocol_describe_metrics* metrics = nullptr);
 
 	// Returns true on success, false on sending timeout or rate-limiting failure
 	bool send_event(const char *event_name, const char *data, int ttl,
@@ -429,7 +467,7 @@ public:
 		return success;
 	}
 
-	void build_describe_message(Appender& appender, int desc_flags);
+	void build_describe_message(Appender& appender, int desc_flags, const spark_protocol_describe_metrics* metrics = nullptr);
 
 	inline bool add_event_handler(const char *event_name, EventHandler handler)
 	{
@@ -19,6 +19,11 @@ namespace particle { namespace protocol {
 #endif
 
 #define MAX_SUBSCRIPTIONS (6)       // 2 system and 4 application
+#define SUBSCRIPTION_BLOCK_SIZE (4) // Number of subscriptions allocated at a time beyond MAX_SUBSCRIPTIONS
+
+#ifndef CHUNKED_TRANSFER_WRITE_BUFFER_SIZE
+#define CHUNKED_TRANSFER_WRITE_BUFFER_SIZE (1024) // Adjacent OTA chunks are coalesced into writes of up to this size, 0 to disable
+#endif
 
 enum ProtocolError
 {
@@ -80,6 +85,13 @@ const size_t MAX_EVENT_DATA_LENGTH   = 622;
 // Timeout in milliseconds given to receive an acknowledgement for a published event
 const unsigned SEND_EVENT_ACK_TIMEOUT = 20000;
 
+// Maximum number of event name prefixes that can have their own rate limit
+const size_t MAX_EVENT_RATE_LIMIT_RULES = 4;
+const size_t MAX_EVENT_RATE_LIMIT_PREFIX_LENGTH = 16;
+
+// Maximum number of events waiting for a rate limit token
+const size_t MAX_DEFERRED_EVENTS = 4;
+
 #ifndef PROTOCOL_BUFFER_SIZE
     #define PROTOCOL_BUFFER_SIZE 800
 #endif
@@ -105,7 +117,11 @@ namespace Connection
 enum Enum
 {
     PING = 0,
-    FAST_OTA = 1
+    FAST_OTA = 1,
+    NSTART = 2, // Maximum number of unacknowledged confirmable messages, 0 for no limit
+    EVENT_RATE_LIMIT = 3, // Rate limit for events matching a name prefix, passed as event_rate_limit_t
+    EVENT_RATE_LIMIT_WAIT = 4, // Maximum time in milliseconds an event can be deferred until a rate limit token is available
+    SUBSCRIPTION_LIMIT = 5 // Maximum number of event subscriptions, MAX_SUBSCRIPTIONS by default
 };
 }
 
@@ -124,6 +140,12 @@ enum Enum {
 };
 }
 
+namespace PrepareFlag {
+enum Enum {
+    DRY_RUN       = 0x01  // Only check the file descriptor
+};
+}
+
 typedef uint32_t keepalive_source_t;
 
 typedef struct
@@ -132,6 +154,14 @@ typedef struct
     keepalive_source_t keepalive_source;
 } connection_properties_t;
 
+typedef struct
+{
+    uint16_t size;
+    const char* prefix; // Event name prefix, an empty string sets the default application limit
+    system_tick_t interval; // Milliseconds between tokens, 0 for no limit
+    uint16_t burst; // Maximum number of events sent at once
+} event_rate_limit_t;
+
 namespace KeepAliveSource {
 enum Enum {
     USER   = 1<<0,   // set by user in wiring
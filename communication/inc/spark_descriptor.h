@@ -109,7 +109,7 @@ struct SparkDescriptor
      * @param append		Opaque data to be passed to appender
      * @param flags		0x01 - append as binary daata, otherwise append as json
      * @param page		A key to select which metrics data to output. Presently unused and should be 0, which means the default metrics.
-     * @param reserved	For future expansion.
+     * @param reserved	Optional pointer to spark_protocol_describe_metrics selecting the diagnostic sources to output.
      * @return
      */
     bool (*append_metrics)(appender_fn appender, void* append, uint32_t flags, uint32_t page, void* reserved);
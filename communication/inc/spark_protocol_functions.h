@@ -203,6 +203,12 @@ typedef struct {
 
 int spark_protocol_get_describe_data(ProtocolFacade* protocol, spark_protocol_describe_data* limits, void* reserved);
 
+typedef struct {
+	uint16_t size;				// size of this structure
+	uint16_t count;				// number of diagnostic source IDs
+	const uint16_t* ids;		// diagnostic sources to include in the metrics, or NULL to include all sources
+} spark_protocol_describe_metrics;
+
 /**
  * @brief Publish vitals information
  *
@@ -215,7 +221,9 @@ int spark_protocol_get_describe_data(ProtocolFacade* protocol, spark_protocol_de
  * @arg \p DESCRIBE_APPLICATION
  * @arg \p DESCRIBE_METRICS
  * @arg \p DESCRIBE_SYSTEM
- * @param[in,out] reserved Reserved for future use (default value: \p NULL).
+ * @param[in] reserved If \p desc_flags is \p DESCRIBE_METRICS, an optional pointer to
+ *                     \p spark_protocol_describe_metrics selecting the diagnostic sources to
+ *                     include in the message (default value: \p NULL).
  *
  * @returns \p ProtocolError result code
  * @retval \p ProtocolError::NO_ERROR
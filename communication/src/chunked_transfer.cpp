@@ -21,12 +21,16 @@
 #include "service_debug.h"
 #include "coap.h"
 #include <algorithm>
+#include <cstdlib>
 
 namespace particle { namespace protocol {
 
 ProtocolError ChunkedTransfer::handle_update_begin(
         token_t token, Message& message, MessageChannel& channel)
 {
+    // the server may restart a transfer without finishing the previous one
+    interrupt();
+
     uint8_t flags = 0;
     chunk_count = 0;
     int actual_len = message.length();
@@ -50,6 +54,9 @@ ProtocolError ChunkedTransfer::handle_update_begin(
         file.store = FileTransfer::Store::Enum(decode_uint8(queue + 15));
         file.file_address = decode_uint32(queue + 16);
         file.chunk_address = file.file_address;
+        // bits 1 and 2 of the flags specify how the file data is encoded. Encoded data is decoded
+        // as a stream, so it has to be saved in order
+        file.format = (flags >> 1) & (FileTransfer::Format::COMPRESSED | FileTransfer::Format::DELTA);
     }
     else
     {
@@ -58,13 +65,19 @@ ProtocolError ChunkedTransfer::handle_update_begin(
         file.store = FileTransfer::Store::FIRMWARE;
         file.file_address = 0;
         file.chunk_address = 0;
+        file.format = FileTransfer::Format::BINARY;
     }
     // check the parameters only
-    bool success = !callbacks->prepare_for_firmware_update(file, 1, NULL);
+    bool success = !callbacks->prepare_for_firmware_update(file, PrepareFlag::DRY_RUN, NULL);
     if (success)
     {
         success = file.chunk_count(file.chunk_size) < MAX_CHUNKS;
     }
+    if (success)
+    {
+        chunk_size = file.chunk_size;
+        success = allocate_bitmap();
+    }
     Message response;
     channel.response(message, response, 16);
     size_t size = success ?
@@ -87,25 +100,45 @@ ProtocolError ChunkedTransfer::handle_update_begin(
             chunk_index = 0;
             chunk_size = file.chunk_size; // save chunk size since the descriptor size is overwritten
             updating = 1;
+            failed = false;
+            fast_ota = flags & 1;
             Message updateReady;
             channel.create(updateReady);
-            // updateReady will have the maximum capacity
-            int offset = updateReady.capacity() - chunk_bitmap_size();
-            bitmap = queue+offset; // this relies on the fact that we know the channels use a static buffer
+
+            // chunks arrive in order without fast OTA and are acknowledged once saved,
+            // so they are only buffered in fast OTA mode
+            if (fast_ota && CHUNKED_TRANSFER_WRITE_BUFFER_SIZE >= chunk_size)
+            {
+                write_buffer = (uint8_t*)malloc(CHUNKED_TRANSFER_WRITE_BUFFER_SIZE);
+            }
+            write_address = file.file_address;
+            write_length = 0;
+            write_chunk = 0;
+            write_chunk_count = 0;
+            // encoded chunks received out of order are held in the write buffer until the chunks
+            // before them arrive. Without the buffer, encoded chunks are requested in order
+            if (file.format != FileTransfer::Format::BINARY && !write_buffer)
+            {
+                fast_ota = false;
+            }
+            ordered = fast_ota && file.format != FileTransfer::Format::BINARY;
 
             // when not in fast OTA mode, the chunk missing buffer is set to 1 since the protocol
-            // handles missing chunks one by one. Also we don't know the actual size of the file to
-            // know the correct size of the bitmap.
-            set_chunks_received(flags & 1 ? 0 : 0xFF);
+            // handles missing chunks one by one.
+            set_chunks_received(fast_ota ? 0 : 0xFF);
 
             // send update_reaady - use fast OTA if available
-            size_t size = Messages::update_ready(updateReady.buf(), 0, token, (flags & 0x1), channel.is_unreliable());
+            size_t size = Messages::update_ready(updateReady.buf(), 0, token, fast_ota, channel.is_unreliable());
             updateReady.set_length(size);
             updateReady.set_confirm_received(true);
             error = channel.send(updateReady);
             if (error)
                 DEBUG("error sending updateReady");
         }
+        else
+        {
+            free_buffers();
+        }
     }
     return error;
 }
@@ -172,7 +205,7 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
         const uint8_t* chunk = queue + payload;
         file.chunk_size = message.length() - payload;
         file.chunk_address = file.file_address + (chunk_index * chunk_size);
-        if (chunk_index >= MAX_CHUNKS)
+        if (chunk_index >= MAX_CHUNKS || chunk_index >= file.chunk_count(chunk_size))
         {
             WARN("invalid chunk index %d", chunk_index);
             return NO_ERROR;
@@ -184,13 +217,25 @@ ProtocolError ChunkedTransfer::handle_chunk(token_t token, Message& message,
                 crc_valid, fast_ota, updating);
         if (crc_valid)
         {
-            callbacks->save_firmware_chunk(file, chunk, NULL);
+            if (!fast_ota || !is_chunk_received(chunk_index))
+            {
+                flag_chunk_received(chunk_index);
+                save_chunk(chunk_index, chunk, file.chunk_size);
+                if (failed)
+                {
+                    abort();
+                }
+            }
+            else
+            {
+                DEBUG("duplicate chunk %d", chunk_index);
+            }
             if (!fast_ota)
             {
                 // message is confirmable for regular OTA or when
-                response_size = Messages::chunk_received(response.buf(), 0, token, ChunkReceivedCode::OK, channel.is_unreliable());
+                response_size = Messages::chunk_received(response.buf(), 0, token,
+                        failed ? ChunkReceivedCode::BAD : ChunkReceivedCode::OK, channel.is_unreliable());
             }
-            flag_chunk_received(chunk_index);
             chunk_index++;
         }
         else
@@ -253,14 +298,20 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
     Message response;
 
     DEBUG("update done received");
-    chunk_index_t index = next_chunk_missing(0);
+    // chunks that cannot be written are requested again
+    flush_chunks();
+    if (failed && is_updating())
+    {
+        abort();
+    }
+    chunk_index_t index = is_updating() ? next_chunk_missing(0) : NO_CHUNKS_MISSING;
     bool missing = index != NO_CHUNKS_MISSING;
     uint8_t* queue = message.buf();
     message_id_t msg_id = CoAP::message_id(queue);
     response.set_id(msg_id);
 
     notify_update_done(message, response, channel, token,
-                       missing ? ChunkReceivedCode::BAD : ChunkReceivedCode::OK);
+                       (missing || failed) ? ChunkReceivedCode::BAD : ChunkReceivedCode::OK);
     ProtocolError error = channel.send(response);
     // how can we busy wait for the server to ACK this?
     if (error)
@@ -276,6 +327,7 @@ ProtocolError ChunkedTransfer::handle_update_done(token_t token, Message& messag
     {
         DEBUG("update done - all done!");
         reset_updating();
+        free_buffers();
         callbacks->finish_firmware_update(file, UpdateFlag::SUCCESS, NULL);
     }
     else
@@ -315,7 +367,6 @@ ProtocolError ChunkedTransfer::send_missing_chunks(MessageChannel& channel,
         buf[(sent * 2) + 7] = idx >> 8;
         buf[(sent * 2) + 8] = idx & 0xFF;
 
-        missed_chunk_index = idx;
         idx++;
         sent++;
     }
@@ -346,26 +397,231 @@ void ChunkedTransfer::cancel()
     {
         // was updating but had an error, inform the client
         WARN("handle received message failed - aborting transfer");
+        flush_chunks();
         callbacks->finish_firmware_update(file, 0, NULL);
     }
+    interrupt();
 }
 
+void ChunkedTransfer::abort()
+{
+    WARN("failed to save the file data - aborting transfer");
+    reset_updating();
+    free_buffers();
+    callbacks->finish_firmware_update(file, 0, NULL);
+}
+
+void ChunkedTransfer::interrupt()
+{
+    if (is_updating())
+    {
+        flush_chunks();
+    }
+    free_buffers();
+    reset_updating();
+}
+
+void ChunkedTransfer::free_buffers()
+{
+    free(write_buffer);
+    write_buffer = nullptr;
+    write_length = 0;
+    free(bitmap);
+    bitmap = nullptr;
+    bitmap_size = 0;
+}
+
+bool ChunkedTransfer::allocate_bitmap()
+{
+    const unsigned size = chunk_bitmap_size();
+    if (bitmap && bitmap_size == size)
+    {
+        return true;
+    }
+    free(bitmap);
+    // never allocate 0 bytes so that an empty file still has a bitmap
+    bitmap = (uint8_t*)malloc(size ? size : 1);
+    bitmap_size = bitmap ? size : 0;
+    return bitmap;
+}
+
+int ChunkedTransfer::save_chunk(chunk_index_t idx, const uint8_t* chunk, size_t length)
+{
+    if (ordered)
+    {
+        return hold_chunk(idx, chunk, length);
+    }
+    const uint32_t address = file.file_address + idx * chunk_size;
+    if (!write_buffer || length > CHUNKED_TRANSFER_WRITE_BUFFER_SIZE)
+    {
+        flush_chunks();
+        FileTransfer::Descriptor descriptor = file;
+        descriptor.chunk_address = address;
+        descriptor.chunk_size = length;
+        const int result = callbacks->save_firmware_chunk(descriptor, chunk, NULL);
+        if (result == SYSTEM_ERROR_ABORTED)
+        {
+            failed = true;
+        }
+        else if (result && fast_ota)
+        {
+            clear_chunk_received(idx);
+            first_missing = std::min(first_missing, idx);
+        }
+        return result;
+    }
+    int result = 0;
+    if (write_length && (address != write_address + write_length ||
+            write_length + length > CHUNKED_TRANSFER_WRITE_BUFFER_SIZE))
+    {
+        result = flush_chunks();
+    }
+    if (!write_length)
+    {
+        write_address = address;
+        write_chunk = idx;
+        write_chunk_count = 0;
+    }
+    memcpy(write_buffer + write_length, chunk, length);
+    write_length += length;
+    write_chunk_count++;
+    // writes end at multiples of the buffer size from the start of the file, so that they are
+    // aligned with flash pages when chunks are received in order
+    if (write_length == CHUNKED_TRANSFER_WRITE_BUFFER_SIZE ||
+            (write_address + write_length - file.file_address) % CHUNKED_TRANSFER_WRITE_BUFFER_SIZE == 0)
+    {
+        const int error = flush_chunks();
+        if (!result)
+        {
+            result = error;
+        }
+    }
+    return result;
+}
+
+int ChunkedTransfer::hold_chunk(chunk_index_t idx, const uint8_t* chunk, size_t length)
+{
+    if (idx < write_chunk)
+    {
+        return 0; // already saved
+    }
+    const size_t offset = (idx - write_chunk) * chunk_size;
+    if (offset + length > CHUNKED_TRANSFER_WRITE_BUFFER_SIZE)
+    {
+        clear_chunk_received(idx);
+        first_missing = std::min(first_missing, idx);
+        return SYSTEM_ERROR_OUT_OF_RANGE;
+    }
+    memcpy(write_buffer + offset, chunk, length);
+    write_length = std::max(write_length, offset + length);
+    // the held chunks are flagged as received, the chunks in the gaps are not
+    const unsigned chunks = file.chunk_count(chunk_size);
+    chunk_index_t end = write_chunk;
+    while (end < chunks && is_chunk_received(end))
+    {
+        end++;
+    }
+    if (end == chunks || (end - write_chunk) * chunk_size + chunk_size > CHUNKED_TRANSFER_WRITE_BUFFER_SIZE)
+    {
+        return flush_chunks();
+    }
+    return 0;
+}
+
+int ChunkedTransfer::flush_chunks()
+{
+    if (!write_length)
+    {
+        return 0;
+    }
+    if (ordered)
+    {
+        // save the chunks up to the first gap and keep holding the chunks after it
+        const unsigned chunks = file.chunk_count(chunk_size);
+        chunk_index_t count = 0;
+        while (write_chunk + count < chunks && is_chunk_received(write_chunk + count) &&
+                (count + 1) * chunk_size <= CHUNKED_TRANSFER_WRITE_BUFFER_SIZE)
+        {
+            count++;
+        }
+        if (!count)
+        {
+            return 0;
+        }
+        const size_t length = std::min(size_t(count * chunk_size), write_length);
+        FileTransfer::Descriptor descriptor = file;
+        descriptor.chunk_address = write_address;
+        descriptor.chunk_size = length;
+        const int result = callbacks->save_firmware_chunk(descriptor, write_buffer, NULL);
+        if (result == SYSTEM_ERROR_ABORTED)
+        {
+            failed = true;
+        }
+        else if (result)
+        {
+            WARN("failed to save chunks %d to %d: %d", write_chunk, write_chunk + count - 1, result);
+            for (chunk_index_t i = 0; i < count; i++)
+            {
+                clear_chunk_received(write_chunk + i);
+            }
+            first_missing = std::min(first_missing, write_chunk);
+        }
+        else
+        {
+            memmove(write_buffer, write_buffer + length, write_length - length);
+            write_address += length;
+            write_length -= length;
+            write_chunk += count;
+        }
+        return result;
+    }
+    FileTransfer::Descriptor descriptor = file;
+    descriptor.chunk_address = write_address;
+    descriptor.chunk_size = write_length;
+    const int result = callbacks->save_firmware_chunk(descriptor, write_buffer, NULL);
+    if (result == SYSTEM_ERROR_ABORTED)
+    {
+        failed = true;
+    }
+    else if (result)
+    {
+        WARN("failed to save chunks %d to %d: %d", write_chunk, write_chunk + write_chunk_count - 1, result);
+        for (chunk_index_t i = 0; i < write_chunk_count; i++)
+        {
+            clear_chunk_received(write_chunk + i);
+        }
+        first_missing = std::min(first_missing, write_chunk);
+    }
+    write_length = 0;
+    return result;
+}
 
 chunk_index_t ChunkedTransfer::next_chunk_missing(chunk_index_t start)
 {
-    chunk_index_t chunk = NO_CHUNKS_MISSING;
-    chunk_index_t chunks = file.chunk_count(chunk_size);
-    chunk_index_t idx = start;
-    for (; idx < chunks; idx++)
+    const unsigned chunks = file.chunk_count(chunk_size);
+    unsigned idx = std::max(start, first_missing);
+    while (idx < chunks)
     {
-        if (!is_chunk_received(idx))
+        if ((idx & 7) == 0 && chunk_bitmap()[idx >> 3] == 0xFF)
+        {
+            // skip 8 received chunks at once
+            idx += 8;
+        }
+        else if (is_chunk_received(idx))
+        {
+            idx++;
+        }
+        else
         {
-            //serial_dump("next missing chunk %d from %d", idx, start);
-            chunk = idx;
             break;
         }
     }
-    return chunk;
+    if (start <= first_missing)
+    {
+        first_missing = std::min(idx, chunks);
+    }
+    //serial_dump("next missing chunk %d from %d", idx, start);
+    return idx < chunks ? chunk_index_t(idx) : NO_CHUNKS_MISSING;
 }
 
 void ChunkedTransfer::set_chunks_received(uint8_t value)
@@ -373,6 +629,7 @@ void ChunkedTransfer::set_chunks_received(uint8_t value)
     size_t bytes = chunk_bitmap_size();
     if (bytes)
         memset(bitmap, value, bytes);
+    first_missing = 0;
 }
 
 
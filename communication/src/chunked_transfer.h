@@ -43,14 +43,16 @@ public:
 	struct Callbacks
 	{
 		  /**
-		   * @param flags 1 dry run only.
+		   * @param flags A combination of PrepareFlag values.
 		   * Return 0 on success.
 		   */
 		  virtual int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*)=0;
 
 		  /**
-		   *
-		   * @return 0 on success
+		   * Saves `descriptor.chunk_size` bytes at `descriptor.chunk_address`. This may cover
+		   * several adjacent chunks.
+		   * @return 0 on success. `SYSTEM_ERROR_ABORTED` indicates that the transfer can't
+		   * continue, other errors cause the chunks to be requested again.
 		   */
 		  virtual int save_firmware_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void*)=0;
 
@@ -71,10 +73,6 @@ private:
 	system_tick_t last_chunk_millis;
 	FileTransfer::Descriptor file;
 
-	/**
-	 * Marks the indices of missed chunks not yet requested.
-	 */
-	chunk_index_t missed_chunk_index;
 	/**
 	 * Number of chunks received in the current flight of chunks (between UpdateBegin|UpdateDone and UpdateDone)
 	 */
@@ -83,13 +81,46 @@ private:
 	unsigned short chunk_index;
 	unsigned short chunk_size;
 
+	/**
+	 * Marks the chunks received so far. Chunks can be received in any order in fast OTA mode.
+	 */
 	uint8_t* bitmap;
+	unsigned bitmap_size;
+
+	/**
+	 * All chunks before this index have been received.
+	 */
+	chunk_index_t first_missing;
+
+	/**
+	 * Adjacent chunks are collected here and saved with a single write. When the file data is
+	 * saved in order, the buffer starts at the next chunk to save and also holds the chunks
+	 * received ahead of it.
+	 */
+	uint8_t* write_buffer;
+	uint32_t write_address;
+	size_t write_length;
+	chunk_index_t write_chunk;
+	chunk_index_t write_chunk_count;
 
 	Callbacks* callbacks;
 
+	bool fast_ota;
 	bool fast_ota_override;
 	bool fast_ota_value;
 
+	/**
+	 * Set when the file data is encoded and has to be saved in order while chunks are received
+	 * out of order.
+	 */
+	bool ordered;
+
+	/**
+	 * Set when the data of the current transfer cannot be saved at all. The transfer is aborted
+	 * rather than requesting the chunks again.
+	 */
+	bool failed;
+
 protected:
 
 	unsigned chunk_bitmap_size()
@@ -108,6 +139,11 @@ protected:
 		chunk_bitmap()[idx >> 3] |= uint8_t(1 << (idx & 7));
 	}
 
+	inline void clear_chunk_received(chunk_index_t idx)
+	{
+		chunk_bitmap()[idx >> 3] &= ~uint8_t(1 << (idx & 7));
+	}
+
 	inline bool is_chunk_received(chunk_index_t idx)
 	{
 		return (chunk_bitmap()[idx >> 3] & uint8_t(1 << (idx & 7)));
@@ -115,11 +151,50 @@ protected:
 
 	chunk_index_t next_chunk_missing(chunk_index_t start);
 	void set_chunks_received(uint8_t value);
+	bool allocate_bitmap();
+	void free_buffers();
+
+	/**
+	 * Saves a chunk, or adds it to the write buffer when it follows the chunks already buffered.
+	 */
+	int save_chunk(chunk_index_t idx, const uint8_t* chunk, size_t length);
+
+	/**
+	 * Adds a chunk to the write buffer at its offset from the next chunk to save, and saves the
+	 * buffered chunks once they fill the buffer without gaps. Chunks that don't fit in the buffer
+	 * are marked as missing so that they are requested again.
+	 */
+	int hold_chunk(chunk_index_t idx, const uint8_t* chunk, size_t length);
+
+	/**
+	 * Writes the buffered chunks, or only the chunks before the first gap when the data is saved
+	 * in order. Chunks that could not be written are marked as missing so that they are
+	 * requested again.
+	 */
+	int flush_chunks();
+
+	/**
+	 * Stops the current transfer and releases its buffers.
+	 */
+	void interrupt();
+
+	/**
+	 * Stops the current transfer after its data could not be saved and notifies the client.
+	 */
+	void abort();
+
 public:
 
 	ChunkedTransfer() :
-			updating(false), callbacks(nullptr), fast_ota_override(false), fast_ota_value(true)
+			updating(false), bitmap(nullptr), bitmap_size(0), first_missing(0), write_buffer(nullptr),
+			write_address(0), write_length(0), write_chunk(0), write_chunk_count(0), callbacks(nullptr),
+			fast_ota(false), fast_ota_override(false), fast_ota_value(true), ordered(false), failed(false)
+	{
+	}
+
+	~ChunkedTransfer()
 	{
+		free_buffers();
 	}
 
 	void init(Callbacks* callbacks)
@@ -129,8 +204,7 @@ public:
 
 	void reset()
 	{
-		reset_updating();
-		bitmap = nullptr;
+		interrupt();
 		last_chunk_millis = 0;
 	}
 
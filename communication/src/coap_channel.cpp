@@ -22,10 +22,86 @@
 #include "messages.h"
 #include "communication_diagnostic.h"
 
+#include <cstring>
+#include <new>
+
 namespace particle { namespace protocol {
 
 uint16_t CoAPMessage::message_count = 0;
 
+CoAPMessagePool& CoAPMessagePool::instance()
+{
+	static CoAPMessagePool pool;
+	return pool;
+}
+
+bool CoAPMessageIndex::grow()
+{
+	if (capacity >= MAX_CAPACITY)
+		return false;
+	const uint16_t old_capacity = capacity;
+	CoAPMessage** old_slots = slots;
+	const uint16_t new_capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+	CoAPMessage** new_slots = new(std::nothrow) CoAPMessage*[new_capacity];
+	if (!new_slots)
+		return false;
+	memset(new_slots, 0, new_capacity * sizeof(CoAPMessage*));
+	slots = new_slots;
+	capacity = new_capacity;
+	for (uint16_t i = 0; i < old_capacity; i++)
+	{
+		CoAPMessage* msg = old_slots[i];
+		if (msg)
+		{
+			uint16_t j = slot_for(msg->get_id());
+			while (slots[j])
+				j = (j + 1) & (capacity - 1);
+			slots[j] = msg;
+		}
+	}
+	delete[] old_slots;
+	return true;
+}
+
+bool CoAPMessageIndex::insert(CoAPMessage* message)
+{
+	// keep the load factor at or below 3/4
+	if ((count + 1) * 4 > capacity * 3 && !grow())
+		return false;
+	uint16_t i = slot_for(message->get_id());
+	while (slots[i])
+		i = (i + 1) & (capacity - 1);
+	slots[i] = message;
+	count++;
+	return true;
+}
+
+void CoAPMessageIndex::remove(message_id_t id)
+{
+	if (!count)
+		return;
+	const uint16_t mask = capacity - 1;
+	uint16_t i = slot_for(id);
+	while (slots[i] && !slots[i]->matches(id))
+		i = (i + 1) & mask;
+	if (!slots[i])
+		return;
+	slots[i] = nullptr;
+	count--;
+	// shift back following entries in the probe sequence so lookups don't need tombstones
+	for (uint16_t j = (i + 1) & mask; slots[j]; j = (j + 1) & mask)
+	{
+		const uint16_t k = slot_for(slots[j]->get_id());
+		const bool in_range = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+		if (!in_range)
+		{
+			slots[i] = slots[j];
+			slots[j] = nullptr;
+			i = j;
+		}
+	}
+}
+
 bool is_ack_or_reset(const uint8_t* buf, size_t len)
 {
 	if (len<1)
@@ -54,6 +130,54 @@ bool CoAPMessageStore::retransmit(CoAPMessage* msg, Channel& channel, system_tic
 	return retransmit;
 }
 
+ProtocolError CoAPMessageStore::add(CoAPMessage& message)
+{
+	// trying to add exactly the same message
+	if (from_id(message.get_id())==&message)
+		return NO_ERROR;
+
+	clear_message(message.get_id());
+	if (message.get_next() || message.get_prev())
+		return INVALID_STATE;
+	if (!index.insert(&message))
+		return INSUFFICIENT_STORAGE;
+	message.set_next(head);
+	if (head)
+		head->set_prev(&message);
+	else
+		tail = &message;
+	head = &message;
+	if (message.get_type()==CoAPType::CON)
+	{
+		confirmable_count++;
+		if (message.is_deferred())
+			deferred_count++;
+	}
+	return NO_ERROR;
+}
+
+void CoAPMessageStore::unlink(CoAPMessage* message)
+{
+	CoAPMessage* const next = message->get_next();
+	CoAPMessage* const prev = message->get_prev();
+	if (prev)
+		prev->set_next(next);
+	else
+		head = next;
+	if (next)
+		next->set_prev(prev);
+	else
+		tail = prev;
+	index.remove(message->get_id());
+	if (message->get_type()==CoAPType::CON)
+	{
+		confirmable_count--;
+		if (message->is_deferred())
+			deferred_count--;
+	}
+	message->removed();
+}
+
 void CoAPMessageStore::message_timeout(CoAPMessage& msg, Channel& channel)
 {
 	msg.notify_timeout();
@@ -69,20 +193,38 @@ void CoAPMessageStore::message_timeout(CoAPMessage& msg, Channel& channel)
 void CoAPMessageStore::process(system_tick_t time, Channel& channel)
 {
 	CoAPMessage* msg = head;
-	CoAPMessage* prev = nullptr;
 	while (msg!=nullptr)
 	{
-		if (time_has_passed(time, msg->get_timeout()) && !retransmit(msg, channel, time))
+		CoAPMessage* const next = msg->get_next();
+		if (!msg->is_deferred() && time_has_passed(time, msg->get_timeout()))
 		{
-			remove(msg, prev);
-			message_timeout(*msg, channel);
-			delete msg;
-			msg = (prev==nullptr) ? head : prev->get_next();
+			if (!retransmit(msg, channel, time))
+			{
+				unlink(msg);
+				message_timeout(*msg, channel);
+				delete msg;
+			}
+			else
+			{
+				congestion_backoff();
+			}
 		}
-		else
+		msg = next;
+	}
+	send_deferred(time, channel);
+}
+
+void CoAPMessageStore::send_deferred(system_tick_t time, Channel& channel)
+{
+	// messages are stored most recent first, so walk from the tail to send the oldest first
+	for (CoAPMessage* msg = tail; msg && deferred_count && has_send_window(); msg = msg->get_prev())
+	{
+		if (msg->is_deferred())
 		{
-			prev = msg;
-			msg = msg->get_next();
+			DEBUG("sending deferred message id=%x", msg->get_id());
+			msg->set_send_time(time);
+			deferred_count--;
+			retransmit(msg, channel, time);
 		}
 	}
 }
@@ -92,7 +234,7 @@ void CoAPMessageStore::process(system_tick_t time, Channel& channel)
  * Registers that this message has been sent from the application.
  * Confirmable messages, and ack/reset responses are cached.
  */
-ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time)
+ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time, bool may_defer)
 {
 	if (!msg.has_id())
 		return MISSING_MESSAGE_ID;
@@ -107,7 +249,13 @@ ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time)
 		{
 			return INSUFFICIENT_STORAGE;
 		}
-		if (coapType==CoAPType::CON)
+		// messages already waiting for the send window go first
+		if (coapType==CoAPType::CON && may_defer && (!has_send_window() || deferred_count>0))
+		{
+			DEBUG("send window full, deferring message id=%x", msg.get_id());
+			coapmsg->set_deferred(time);
+		}
+		else if (coapType==CoAPType::CON)
 		{
 			coapmsg->set_send_time(time);
 			coapmsg->prepare_retransmit(time);
@@ -116,7 +264,12 @@ ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time)
 		{
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
 		}
-		add(*coapmsg);
+		const ProtocolError error = add(*coapmsg);
+		if (error)
+		{
+			delete coapmsg;
+			return error;
+		}
 	}
 	return NO_ERROR;
 }
@@ -134,6 +287,11 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 		CoAPMessage* coap_msg = from_id(id);
 		if (coap_msg) {
 			g_coapRoundTripMSec = time - coap_msg->get_send_time();
+			g_coapRoundTripTime.record(time - coap_msg->get_send_time());
+			// grow the window back when a message is acknowledged without retransmission
+			if (coap_msg->get_transmit_count()==1 && window<nstart) {
+				window++;
+			}
 		}
 		if (msgtype==CoAPType::RESET) {
 			if (coap_msg) {
@@ -170,22 +328,16 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 			// the timeout here is ideally purely academic since the application will respond immediately with an ACK/RESET
 			// which will be stored in place of this message, with it's own timeout.
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
-			add(*coapmsg);
+			const ProtocolError error = add(*coapmsg);
+			if (error)
+			{
+				delete coapmsg;
+				return error;
+			}
 		}
 	}
 	// else it's a NON message - pass through
 	return NO_ERROR;
 }
 
-bool CoAPMessageStore::has_unacknowledged_requests() const
-{
-	// TODO: Use a message counter
-	for (const CoAPMessage* msg = head; msg != nullptr; msg = msg->get_next()) {
-		if (is_confirmable((uint8_t*)msg->get_data()))
-			return true;
-	}
-
-	return false;
-}
-
 }}
@@ -25,6 +25,7 @@
 #include "service_debug.h"
 
 #include "communication_diagnostic.h"
+#include "coap_message_pool.h"
 #include <limits>
 
 namespace particle
@@ -104,11 +105,16 @@ public:
 
 private:
 	/**
-	 * Messages are stored as a singly-linked list.
+	 * Messages are stored as a doubly-linked list.
 	 * This pointer is the next message in the list, or nullptr if this is the last message in the list.
 	 */
 	CoAPMessage* next;
 
+	/**
+	 * The previous message in the list, or nullptr if this is the first message in the list.
+	 */
+	CoAPMessage* prev;
+
 	/**
 	 * The time when the system will resend this message or give up sending
 	 * when the maximum number of transmits has been reached.
@@ -166,24 +172,42 @@ public:
 
 
 	/**
-	 * The number of outstanding messages allowed.
+	 * The number of outstanding messages recommended by RFC 7252.
 	 */
 	static const uint8_t NSTART = 1;
 
 
-	CoAPMessage(message_id_t id_) : next(nullptr), timeout(0), id(id_), transmit_count(0), delivered(nullptr), send_time(0), data_len(0) {
+	CoAPMessage(message_id_t id_) : next(nullptr), prev(nullptr), timeout(0), id(id_), transmit_count(0), delivered(nullptr), send_time(0), data_len(0) {
 		message_count++;
 	}
 
 	/**
-	 * Create a new CoAPMessage from the given Message instance. The returned CoAPMessage is dynamically allocated
-	 * and has an independent lifetime from the Message
+	 * CoAPMessage instances are allocated from the CoAPMessagePool.
+	 */
+	static void* operator new(size_t size)
+	{
+		return CoAPMessagePool::instance().alloc(size);
+	}
+
+	static void* operator new(size_t size, void* ptr)
+	{
+		return ptr;
+	}
+
+	static void operator delete(void* ptr)
+	{
+		CoAPMessagePool::instance().free(ptr);
+	}
+
+	/**
+	 * Create a new CoAPMessage from the given Message instance. The returned CoAPMessage is allocated
+	 * from the message pool and has an independent lifetime from the Message
 	 * instance. When no longer required, `delete` the CoAPMessage..
 	 */
 	static CoAPMessage* create(Message& msg, size_t data_len = 0)
 	{
 		size_t len = data_len && data_len<msg.length() ? data_len : msg.length();
-		uint8_t* memory = new uint8_t[sizeof(CoAPMessage)+len];
+		void* memory = CoAPMessagePool::instance().alloc(sizeof(CoAPMessage)+len);
 		if (memory) {
 			CoAPMessage* coapmsg = new (memory)CoAPMessage(msg.get_id());		// in-place new
 			coapmsg->set_data(msg.buf(), len);
@@ -201,10 +225,19 @@ public:
 
 	inline CoAPMessage* get_next() const { return next; }
 	inline void set_next(CoAPMessage* next) { this->next = next; }
+	inline CoAPMessage* get_prev() const { return prev; }
+	inline void set_prev(CoAPMessage* prev) { this->prev = prev; }
 	inline bool matches(message_id_t id) const { return this->id==id; }
 	inline message_id_t get_id() const { return id; }
-	inline void removed() { next = nullptr; }
+	inline void removed() { next = nullptr; prev = nullptr; }
 	inline system_tick_t get_timeout() const { return timeout; }
+	inline uint8_t get_transmit_count() const { return transmit_count; }
+
+	/**
+	 * Determines if this is a confirmable message that is queued waiting for the
+	 * send window to open and has not been transmitted yet.
+	 */
+	inline bool is_deferred() const { return transmit_count==0 && get_type()==CoAPType::CON; }
 
 	inline void set_delivered_handler(std::function<void(Delivery)>* handler) { this->delivered = handler; }
 
@@ -295,6 +328,16 @@ public:
 		transmit_count = MAX_RETRANSMIT+2;	// do not send this message.
 	}
 
+	/**
+	 * Marks this message as queued for its first transmission, which happens when the
+	 * message store has room in the send window.
+	 */
+	void set_deferred(system_tick_t time)
+	{
+		timeout = time;
+		transmit_count = 0;
+	}
+
     bool is_request() const
     {
     		switch (get_type()) {
@@ -308,6 +351,8 @@ public:
 
 };
 
+static_assert(sizeof(CoAPMessage)<=CoAPMessagePool::HEADER_SIZE, "CoAPMessagePool::HEADER_SIZE is too small");
+
 inline bool time_has_passed(system_tick_t now, system_tick_t tick)
 {
 	static_assert(sizeof(system_tick_t)==4, "system_tick_t should be 4 bytes");
@@ -323,6 +368,60 @@ inline bool time_has_passed(system_tick_t now, system_tick_t tick)
 
 
 
+/**
+ * An open-addressing hash index of the messages in a CoAPMessageStore, keyed by message ID.
+ */
+class CoAPMessageIndex
+{
+	CoAPMessage** slots;
+	uint16_t capacity;
+	uint16_t count;
+
+	static const uint16_t INITIAL_CAPACITY = 8;
+	// 16-bit message IDs need no more slots than this, and the capacity must fit in 16 bits
+	static const uint16_t MAX_CAPACITY = 0x8000;
+
+	inline uint16_t slot_for(message_id_t id) const
+	{
+		// Fibonacci hashing spreads sequential message IDs across the table
+		return uint16_t((uint32_t(id) * 2654435761u) >> 16) & (capacity - 1);
+	}
+
+	bool grow();
+
+public:
+	CoAPMessageIndex() : slots(nullptr), capacity(0), count(0) {}
+
+	~CoAPMessageIndex()
+	{
+		delete[] slots;
+	}
+
+	CoAPMessage* find(message_id_t id) const
+	{
+		if (!count)
+			return nullptr;
+		for (uint16_t i = slot_for(id);; i = (i + 1) & (capacity - 1))
+		{
+			CoAPMessage* msg = slots[i];
+			if (!msg || msg->matches(id))
+				return msg;
+		}
+	}
+
+	/**
+	 * Adds a message to the index. A message with the same ID must not already be indexed.
+	 */
+	bool insert(CoAPMessage* message);
+
+	/**
+	 * Removes the message with the given ID from the index.
+	 */
+	void remove(message_id_t id);
+
+	uint16_t size() const { return count; }
+};
+
 /**
  * A mix-in class that provides message resending for reliable delivery of messages.
  */
@@ -331,45 +430,61 @@ class CoAPMessageStore
 	LOG_CATEGORY("comm.coap");
 
 	/**
-	 * The head of the list of messages.
+	 * The head of the list of messages. This is the most recently added message.
 	 */
 	CoAPMessage* head;
 
 	/**
-	 * Retrieves the message with the given ID and the previous message.
-	 * If no message exists with the given id, nullptr is returned.
+	 * The tail of the list of messages. This is the oldest message.
 	 */
-	CoAPMessage* for_id(message_id_t id, CoAPMessage*& prev) const
-	{
-		prev = nullptr;
-		CoAPMessage* next = head;
-		while (next)
-		{
-			if (next->matches(id))
-				return next;
-			prev = next;
-			next = next->get_next();
-		}
-		return nullptr;
-	}
+	CoAPMessage* tail;
 
 	/**
-	 * Removes a message given the message to remove and the previous entry in the list.
+	 * Index of the messages in the list by message ID.
 	 */
-	void remove(CoAPMessage* message, CoAPMessage* previous)
+	CoAPMessageIndex index;
+
+	/**
+	 * The number of confirmable messages in the store, and how many of them are deferred.
+	 */
+	uint16_t confirmable_count;
+	uint16_t deferred_count;
+
+	/**
+	 * The maximum number of confirmable messages that may be awaiting acknowledgement
+	 * at the same time (NSTART in RFC 7252). 0 means no limit.
+	 */
+	uint8_t nstart;
+
+	/**
+	 * The current send window. This is reduced when a message has to be retransmitted
+	 * and grows back towards `nstart` as messages are acknowledged on the first attempt.
+	 */
+	uint8_t window;
+
+	/**
+	 * Unlinks a message from the list and the index.
+	 */
+	void unlink(CoAPMessage* message);
+
+	void message_timeout(CoAPMessage& msg, Channel& channel);
+
+	/**
+	 * Halves the send window after a retransmission.
+	 */
+	void congestion_backoff()
 	{
-		if (previous)
-			previous->set_next(message->get_next());
-		else
-			head = message->get_next();
-		message->removed();
+		window = window>1 ? window/2 : 1;
 	}
 
-	void message_timeout(CoAPMessage& msg, Channel& channel);
+	/**
+	 * Sends deferred messages in the order they were added while the send window allows.
+	 */
+	void send_deferred(system_tick_t time, Channel& channel);
 
 public:
 
-	CoAPMessageStore() : head(nullptr) {}
+	CoAPMessageStore() : head(nullptr), tail(nullptr), confirmable_count(0), deferred_count(0), nstart(0), window(0) {}
 
 	~CoAPMessageStore() {
 		clear();
@@ -380,7 +495,54 @@ public:
 		return head!=nullptr;
 	}
 
-	bool has_unacknowledged_requests() const;
+	bool has_unacknowledged_requests() const
+	{
+		return confirmable_count>0;
+	}
+
+	/**
+	 * Sets the maximum number of confirmable messages that may be awaiting acknowledgement
+	 * at the same time. Messages sent while the window is full are queued and transmitted
+	 * as earlier messages are acknowledged or time out. 0 disables the limit.
+	 */
+	void set_nstart(uint8_t nstart)
+	{
+		this->nstart = nstart;
+		this->window = nstart;
+	}
+
+	uint8_t get_nstart() const { return nstart; }
+
+	/**
+	 * Retrieves the current send window.
+	 */
+	uint8_t get_window() const { return window; }
+
+	/**
+	 * Retrieves the number of confirmable messages that have been transmitted and are
+	 * waiting for acknowledgement.
+	 */
+	unsigned in_flight() const
+	{
+		return confirmable_count - deferred_count;
+	}
+
+	/**
+	 * Determines if another confirmable message can be transmitted now.
+	 */
+	bool has_send_window() const
+	{
+		return !nstart || in_flight()<window;
+	}
+
+	/**
+	 * Determines if the message with the given ID is queued waiting for the send window.
+	 */
+	bool is_deferred(message_id_t id) const
+	{
+		const CoAPMessage* msg = from_id(id);
+		return msg && msg->is_deferred();
+	}
 
 	/**
 	 * Retrieves the current confirmable message that is still
@@ -389,9 +551,7 @@ public:
 	 */
 	CoAPMessage* from_id(message_id_t id) const
 	{
-		CoAPMessage* prev;
-		CoAPMessage* next = for_id(id, prev);
-		return next;
+		return index.find(id);
 	}
 
 	ProtocolError add(CoAPMessage* message)
@@ -402,19 +562,7 @@ public:
 	/**
 	 * Adds a message to this message store.
 	 */
-	ProtocolError add(CoAPMessage& message)
-	{
-		// trying to add exactly the same message
-		if (from_id(message.get_id())==&message)
-			return NO_ERROR;
-
-		clear_message(message.get_id());
-		if (message.get_next())
-			return INVALID_STATE;
-		message.set_next(head);
-		head = &message;
-		return NO_ERROR;
-	}
+	ProtocolError add(CoAPMessage& message);
 
 	/**
 	 * Removes a message from the store with the given id.
@@ -423,10 +571,9 @@ public:
 	 */
 	CoAPMessage* remove(message_id_t msg_id)
 	{
-		CoAPMessage* prev;
-		CoAPMessage* msg = for_id(msg_id, prev);
+		CoAPMessage* msg = from_id(msg_id);
 		if (msg) {
-			remove(msg, prev);
+			unlink(msg);
 		}
 		return msg;
 	}
@@ -454,8 +601,12 @@ public:
 	/**
 	 * Registers that this message has been sent from the application.
 	 * Confirmable messages, and ack/reset responses are cached.
+	 *
+	 * @param may_defer	When true, a confirmable message is queued rather than transmitted
+	 * 		if the send window is full. Use is_deferred() to determine if the caller should
+	 * 		send the message.
 	 */
-	ProtocolError send(Message& msg, system_tick_t time);
+	ProtocolError send(Message& msg, system_tick_t time, bool may_defer=false);
 
 	/**
 	 * Notifies the message store that a message has been received.
@@ -478,6 +629,7 @@ public:
 		{
 			delete remove(head->get_id());
 		}
+		window = nstart;
 	}
 
 };
@@ -567,6 +719,18 @@ public:
 		return server;
 	}
 
+	/**
+	 * Sets the number of confirmable client requests that may be awaiting acknowledgement
+	 * at the same time. 0 means no limit.
+	 */
+	void set_nstart(uint8_t nstart) {
+		client.set_nstart(nstart);
+	}
+
+	uint8_t get_nstart() const {
+		return client.get_nstart();
+	}
+
 	/**
 	 * Clear the message stores when the channel is initially established.
 	 */
@@ -592,8 +756,9 @@ public:
 
 		// determine the type of message.
 		CoAPMessageStore& store = msg.is_request() ? client : server;
-		ProtocolError error = store.send(msg, millis());
-		if (!error)
+		ProtocolError error = store.send(msg, millis(), true);
+		// deferred messages are sent by the store when the send window opens
+		if (!error && !store.is_deferred(msg.get_id()))
 			error = channel::send(msg);
 		return error;
 	}
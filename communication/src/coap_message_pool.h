@@ -0,0 +1,162 @@
+/**
+ ******************************************************************************
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+#pragma once
+
+#include "protocol_defs.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+
+/**
+ * Number of pooled blocks for small stored messages, such as acknowledgements and the
+ * headers of received confirmable messages.
+ */
+#ifndef COAP_MESSAGE_POOL_SMALL_COUNT
+#define COAP_MESSAGE_POOL_SMALL_COUNT 8
+#endif
+
+/**
+ * Maximum number of data bytes in a small pooled block.
+ */
+#ifndef COAP_MESSAGE_POOL_SMALL_SIZE
+#define COAP_MESSAGE_POOL_SMALL_SIZE 16
+#endif
+
+/**
+ * Number of pooled blocks that can hold a message of up to PROTOCOL_BUFFER_SIZE bytes.
+ */
+#ifndef COAP_MESSAGE_POOL_LARGE_COUNT
+#define COAP_MESSAGE_POOL_LARGE_COUNT 2
+#endif
+
+namespace particle { namespace protocol {
+
+/**
+ * A pool of fixed-size blocks with constant time allocation and deallocation.
+ */
+template<size_t BlockSize, size_t BlockCount>
+class FixedBlockPool
+{
+	union Block
+	{
+		Block* next;
+		uint8_t data[BlockSize];
+		uintptr_t align;
+	};
+
+	Block blocks[BlockCount ? BlockCount : 1];
+	Block* free_list;
+	size_t used;
+
+public:
+	static const size_t BLOCK_SIZE = BlockSize;
+	static const size_t BLOCK_COUNT = BlockCount;
+
+	FixedBlockPool() : free_list(nullptr), used(0)
+	{
+		for (size_t i = 0; i < BlockCount; i++)
+		{
+			blocks[i].next = free_list;
+			free_list = &blocks[i];
+		}
+	}
+
+	void* alloc(size_t size)
+	{
+		if (size > BlockSize || !free_list)
+			return nullptr;
+		Block* b = free_list;
+		free_list = b->next;
+		used++;
+		return b;
+	}
+
+	bool owns(const void* ptr) const
+	{
+		return BlockCount && ptr >= &blocks[0] && ptr < &blocks[BlockCount];
+	}
+
+	void free(void* ptr)
+	{
+		Block* b = static_cast<Block*>(ptr);
+		b->next = free_list;
+		free_list = b;
+		used--;
+	}
+
+	size_t in_use() const { return used; }
+};
+
+/**
+ * Allocates storage for CoAPMessage instances. Requests are served from a small-block and a
+ * large-block pool, falling back to the heap when a request does not fit or the pools are exhausted.
+ */
+class CoAPMessagePool
+{
+public:
+	// Space for the CoAPMessage fields that precede the message data
+	static const size_t HEADER_SIZE = 4 * sizeof(void*) + 16;
+
+private:
+
+	FixedBlockPool<HEADER_SIZE + COAP_MESSAGE_POOL_SMALL_SIZE, COAP_MESSAGE_POOL_SMALL_COUNT> small;
+	FixedBlockPool<HEADER_SIZE + PROTOCOL_BUFFER_SIZE, COAP_MESSAGE_POOL_LARGE_COUNT> large;
+	size_t heap_allocs;
+
+public:
+	CoAPMessagePool() : heap_allocs(0) {}
+
+	void* alloc(size_t size)
+	{
+		void* ptr = small.alloc(size);
+		if (!ptr)
+			ptr = large.alloc(size);
+		if (!ptr) {
+			ptr = ::operator new(size, std::nothrow);
+			if (ptr)
+				heap_allocs++;
+		}
+		return ptr;
+	}
+
+	void free(void* ptr)
+	{
+		if (small.owns(ptr))
+			small.free(ptr);
+		else if (large.owns(ptr))
+			large.free(ptr);
+		else if (ptr)
+			::operator delete(ptr);
+	}
+
+	/**
+	 * The number of pooled blocks currently allocated.
+	 */
+	size_t in_use() const { return small.in_use() + large.in_use(); }
+
+	/**
+	 * The number of allocations that were served from the heap.
+	 */
+	size_t heap_allocations() const { return heap_allocs; }
+
+	static CoAPMessagePool& instance();
+};
+
+}}
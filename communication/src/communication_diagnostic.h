@@ -1,7 +1,9 @@
 #include "spark_wiring_diagnostics.h"
 
-extern particle::SimpleUnsignedIntegerDiagnosticData g_rateLimitedEventsCounter;
+extern particle::AtomicUnsignedIntegerDiagnosticData g_rateLimitedEventsCounter;
+extern particle::AtomicUnsignedIntegerDiagnosticData g_rateLimitWaitCounter;
 extern particle::SimpleUnsignedIntegerDiagnosticData g_unacknowledgedMessageCounter;
 extern particle::SimpleUnsignedIntegerDiagnosticData g_trasmittedMessageCounter;
 extern particle::SimpleUnsignedIntegerDiagnosticData g_retransmittedMessageCounter;
 extern particle::SimpleUnsignedIntegerDiagnosticData g_coapRoundTripMSec;
+extern particle::HistogramDiagnosticData<> g_coapRoundTripTime;
@@ -33,6 +33,7 @@
 #include "coap_channel.h"
 #include "eckeygen.h"
 #include <limits>
+#include <algorithm>
 #include "logging.h"
 
 namespace particle {
@@ -105,6 +106,11 @@ public:
 		return result;
 	}
 
+	void set_nstart(unsigned nstart) override
+	{
+		channel.set_nstart(std::min(nstart, unsigned(std::numeric_limits<uint8_t>::max())));
+	}
+
 	int get_status(protocol_status* status) const override {
 		SPARK_ASSERT(status);
 		status->flags = 0;
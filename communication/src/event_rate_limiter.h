@@ -0,0 +1,347 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace particle
+{
+namespace protocol
+{
+
+/**
+ * A token bucket that releases one token every `interval` milliseconds and holds at most
+ * `burst` tokens.
+ *
+ * The bucket is implemented as a generic cell rate algorithm: the only state is the time at which
+ * the bucket will be full again, so taking a token is a single compare-and-swap and the bucket
+ * can be used from several threads without locking. That time is never 0, which marks a bucket
+ * that has not been used yet.
+ */
+class TokenBucket
+{
+	// Value of full_at for a bucket that has not been used since it was created or reset
+	static const system_tick_t FULL = 0;
+
+	std::atomic<system_tick_t> full_at;
+	std::atomic<system_tick_t> interval;
+	std::atomic<system_tick_t> tolerance;
+
+public:
+	/**
+	 * Upper bound for the time that can be waited for a token. Used to detect a
+	 * bucket that has been idle for longer than half the tick counter range.
+	 */
+	static const system_tick_t MAX_WAIT = 60 * 60 * 1000;
+
+	TokenBucket(system_tick_t interval = 0, uint16_t burst = 1) : full_at(FULL), interval(0), tolerance(0)
+	{
+		configure(interval, burst);
+	}
+
+	/**
+	 * Sets the rate and burst size. An interval of 0 disables rate limiting, a burst of 0
+	 * rejects every request.
+	 */
+	void configure(system_tick_t interval, uint16_t burst)
+	{
+		this->interval.store(interval, std::memory_order_relaxed);
+		this->tolerance.store(burst ? (burst - 1) * interval : system_tick_t(-1), std::memory_order_relaxed);
+	}
+
+	system_tick_t get_interval() const
+	{
+		return interval.load(std::memory_order_relaxed);
+	}
+
+	uint16_t get_burst() const
+	{
+		const system_tick_t i = interval.load(std::memory_order_relaxed);
+		const system_tick_t t = tolerance.load(std::memory_order_relaxed);
+		return (t == system_tick_t(-1)) ? 0 : (i ? t / i + 1 : 1);
+	}
+
+	/**
+	 * Takes a token. When no token is available and one will be within `max_wait` milliseconds,
+	 * that token is reserved for the caller.
+	 *
+	 * @return 0 if a token was taken, the number of milliseconds until the reserved token
+	 * becomes available, or -1 if no token could be taken.
+	 */
+	int32_t take(system_tick_t now, system_tick_t max_wait = 0)
+	{
+		system_tick_t t = full_at.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const system_tick_t i = interval.load(std::memory_order_relaxed);
+			const system_tick_t tol = tolerance.load(std::memory_order_relaxed);
+			if (!i)
+				return 0;
+			if (tol == system_tick_t(-1))
+				return -1;
+			system_tick_t start = t;
+			const int32_t ahead = int32_t(t - now);
+			if (t == FULL || ahead < 0 || system_tick_t(ahead) > tol + i + MAX_WAIT)
+				start = now;
+			const int32_t wait = int32_t(start - now - tol);
+			if (wait > 0 && system_tick_t(wait) > max_wait)
+				return -1;
+			system_tick_t next = start + i;
+			if (next == FULL)
+				next++;
+			if (full_at.compare_exchange_weak(t, next, std::memory_order_relaxed))
+				return wait > 0 ? wait : 0;
+		}
+	}
+
+	/**
+	 * Returns the number of milliseconds until a token is available.
+	 */
+	system_tick_t wait_time(system_tick_t now) const
+	{
+		const system_tick_t t = full_at.load(std::memory_order_relaxed);
+		const system_tick_t i = interval.load(std::memory_order_relaxed);
+		const system_tick_t tol = tolerance.load(std::memory_order_relaxed);
+		const int32_t ahead = int32_t(t - now);
+		if (!i || t == FULL || ahead < 0 || system_tick_t(ahead) <= tol || system_tick_t(ahead) > tol + i + MAX_WAIT)
+			return 0;
+		return ahead - tol;
+	}
+
+	void reset()
+	{
+		full_at.store(FULL, std::memory_order_relaxed);
+	}
+};
+
+/**
+ * Allows at most `N` events within any period of `window` milliseconds.
+ *
+ * Rejected events are recorded as well, so a sender needs to pause for a full window before its
+ * events are accepted again. This is the default limit for application events.
+ */
+template<size_t N>
+class EventWindow
+{
+	// Times of the last N + 1 events
+	std::atomic<system_tick_t> ticks[N + 1];
+	std::atomic<size_t> index;
+	const system_tick_t window;
+
+public:
+	explicit EventWindow(system_tick_t window) : index(0), window(window)
+	{
+		reset();
+	}
+
+	/**
+	 * Records an event. Returns `false` if the event exceeds the limit.
+	 */
+	bool take(system_tick_t now)
+	{
+		size_t i = index.load(std::memory_order_relaxed);
+		while (!index.compare_exchange_weak(i, (i + 1) % (N + 1), std::memory_order_relaxed)) {}
+		ticks[i].store(now, std::memory_order_relaxed);
+		const system_tick_t oldest = ticks[(i + 1) % (N + 1)].load(std::memory_order_relaxed);
+		return now - oldest >= window;
+	}
+
+	void reset()
+	{
+		for (auto& t: ticks)
+			t.store(system_tick_t(0) - window, std::memory_order_relaxed);
+	}
+};
+
+/**
+ * Allows at most `N` events per period of 65536 milliseconds (approximately one minute). Periods
+ * start at multiples of 65536 milliseconds. This is the default limit for system events.
+ */
+template<uint16_t N>
+class EventCounter
+{
+	// Period number in the upper 16 bits, number of events in the period in the lower 16 bits
+	std::atomic<uint32_t> state;
+
+public:
+	EventCounter() : state(0)
+	{
+	}
+
+	/**
+	 * Records an event. Returns `false` if the event exceeds the limit.
+	 */
+	bool take(system_tick_t now)
+	{
+		const uint32_t period = uint16_t(now >> 16);
+		uint32_t s = state.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			uint32_t next = (period << 16) | 1;
+			if ((s >> 16) == period)
+			{
+				if ((s & 0xffff) >= N)
+					return false;
+				next = s + 1;
+			}
+			if (state.compare_exchange_weak(s, next, std::memory_order_relaxed))
+				return true;
+		}
+	}
+
+	void reset()
+	{
+		state.store(0, std::memory_order_relaxed);
+	}
+};
+
+/**
+ * Selects the rate limit for an event based on the prefix of its name.
+ *
+ * Rules are token buckets matched by longest prefix. Events that do not match a rule are subject
+ * to the default limits: bursts of up to 4 application events per second, and 255 system events
+ * per minute. An empty prefix replaces the default limit for application events with a token
+ * bucket.
+ *
+ * Taking tokens is thread-safe. Rules should only be changed from a single thread.
+ */
+class EventRateLimiter
+{
+public:
+	static const system_tick_t APPLICATION_WINDOW = 1000;
+	static const size_t APPLICATION_BURST = 4;
+	static const uint16_t SYSTEM_BURST = 255;
+
+	EventRateLimiter() :
+			application_window(APPLICATION_WINDOW),
+			application_configured(false),
+			rule_count(0)
+	{
+	}
+
+	static bool is_system(const char* event_name)
+	{
+		return !strncmp(event_name, "spark", 5) || !strncmp(event_name, "particle", 8);
+	}
+
+	/**
+	 * Applies the default limit for application or system events.
+	 *
+	 * @return `true` if the event is rate limited.
+	 */
+	bool is_rate_limited(bool is_system_event, system_tick_t now)
+	{
+		if (is_system_event)
+			return !system.take(now);
+		if (application_configured.load(std::memory_order_acquire))
+			return application.take(now) < 0;
+		return !application_window.take(now);
+	}
+
+	/**
+	 * Takes a token for an event. Only events subject to a token bucket can wait for a token.
+	 *
+	 * @return 0 if a token was taken, the number of milliseconds until the reserved token
+	 * becomes available, or -1 if the event is rate limited.
+	 */
+	int32_t take(const char* event_name, system_tick_t now, system_tick_t max_wait = 0)
+	{
+		TokenBucket* bucket = bucket_for(event_name);
+		if (bucket)
+			return bucket->take(now, max_wait);
+		return is_rate_limited(is_system(event_name), now) ? -1 : 0;
+	}
+
+	/**
+	 * Sets the rate limit for events whose name starts with `prefix`.
+	 */
+	ProtocolError set_limit(const char* prefix, system_tick_t interval, uint16_t burst)
+	{
+		const size_t len = strlen(prefix);
+		if (!len)
+		{
+			application.configure(interval, burst);
+			application_configured.store(true, std::memory_order_release);
+			return NO_ERROR;
+		}
+		if (len > MAX_EVENT_RATE_LIMIT_PREFIX_LENGTH)
+			return INSUFFICIENT_STORAGE;
+		const size_t count = rule_count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!strcmp(rules[i].prefix, prefix))
+			{
+				rules[i].bucket.configure(interval, burst);
+				return NO_ERROR;
+			}
+		}
+		if (count == MAX_EVENT_RATE_LIMIT_RULES)
+			return INSUFFICIENT_STORAGE;
+		memcpy(rules[count].prefix, prefix, len + 1);
+		rules[count].length = len;
+		rules[count].bucket.configure(interval, burst);
+		rules[count].bucket.reset();
+		rule_count.store(count + 1, std::memory_order_release);
+		return NO_ERROR;
+	}
+
+	/**
+	 * Returns the token bucket for an event, or `nullptr` if the event is subject to the default
+	 * limits.
+	 */
+	TokenBucket* bucket_for(const char* event_name)
+	{
+		TokenBucket* bucket = nullptr;
+		size_t longest = 0;
+		const size_t count = rule_count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < count; i++)
+		{
+			const Rule& r = rules[i];
+			if (r.length > longest && !strncmp(event_name, r.prefix, r.length))
+			{
+				bucket = &rules[i].bucket;
+				longest = r.length;
+			}
+		}
+		if (!bucket && application_configured.load(std::memory_order_acquire) && !is_system(event_name))
+			bucket = &application;
+		return bucket;
+	}
+
+private:
+	struct Rule
+	{
+		char prefix[MAX_EVENT_RATE_LIMIT_PREFIX_LENGTH + 1];
+		size_t length;
+		TokenBucket bucket;
+	};
+
+	EventWindow<APPLICATION_BURST> application_window;
+	EventCounter<SYSTEM_BURST> system;
+	TokenBucket application;
+	std::atomic<bool> application_configured;
+	Rule rules[MAX_EVENT_RATE_LIMIT_RULES];
+	std::atomic<size_t> rule_count;
+};
+
+}}
@@ -453,7 +453,7 @@ ProtocolError Protocol::event_loop(CoAPMessageType::Enum& message_type)
 	return error;
 }
 
-void Protocol::build_describe_message(Appender& appender, int desc_flags)
+void Protocol::build_describe_message(Appender& appender, int desc_flags, const spark_protocol_describe_metrics* metrics)
 {
 	// diagnostics must be requested in isolation to be a binary packet
 	if (descriptor.append_metrics && (desc_flags == DESCRIBE_METRICS))
@@ -463,7 +463,7 @@ void Protocol::build_describe_message(Appender& appender, int desc_flags)
 		appender.append(char(0));	//
 		const int flags = 1;		// binary
 		const int page = 0;
-		descriptor.append_metrics(append_instance, &appender, flags, page, nullptr);
+		descriptor.append_metrics(append_instance, &appender, flags, page, (void*)metrics);
 	}
 	else {
 		appender.append("{");
@@ -532,12 +532,13 @@ void Protocol::build_describe_message(Appender& appender, int desc_flags)
 }
 
 ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, Message& message,
-                                                      size_t header_size, int desc_flags)
+                                                      size_t header_size, int desc_flags,
+                                                      const spark_protocol_describe_metrics* metrics)
 {
     ProtocolError error;
 
     BufferAppender appender((message.buf() + header_size), (message.capacity() - header_size));
-    build_describe_message(appender, desc_flags);
+    build_describe_message(appender, desc_flags, metrics);
 
     const size_t msglen = (appender.next() - (uint8_t*)message.buf());
     message.set_length(msglen);
@@ -586,14 +587,14 @@ ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, M
     return error;
 }
 
-ProtocolError Protocol::post_description(int desc_flags)
+ProtocolError Protocol::post_description(int desc_flags, const spark_protocol_describe_metrics* metrics)
 {
     Message message;
     channel.create(message);
     const size_t header_size =
         Messages::describe_post_header(message.buf(), message.capacity(), 0, (desc_flags & 0xFF));
 
-    return generate_and_send_description(channel, message, header_size, desc_flags);
+    return generate_and_send_description(channel, message, header_size, desc_flags, metrics);
 }
 
 /**
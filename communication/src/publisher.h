@@ -23,10 +23,15 @@
 #include "events.h"
 #include "message_channel.h"
 #include "messages.h"
+#include "event_rate_limiter.h"
 
 #include "completion_handler.h"
 #include "communication_diagnostic.h"
 
+#include <atomic>
+#include <new>
+#include <cstring>
+
 namespace particle
 {
 namespace protocol
@@ -38,66 +43,213 @@ class Publisher
 {
 public:
 	explicit Publisher(Protocol* protocol) :
-			protocol(protocol)
+			protocol(protocol),
+			deferred_head(nullptr),
+			deferred_tail(nullptr),
+			deferred_count(0),
+			max_wait(0)
 	{
 	}
 
+	~Publisher()
+	{
+		cancel_deferred();
+	}
+
 	inline bool is_system(const char* event_name)
 	{
-		return !strncmp(event_name, "spark", 5) || !strncmp(event_name, "particle", 8);
+		return EventRateLimiter::is_system(event_name);
 	}
 
 	bool is_rate_limited(bool is_system_event, system_tick_t millis)
 	{
-		if (is_system_event)
-		{
-			static uint16_t lastMinute = 0;
-			static uint8_t eventsThisMinute = 0;
-
-			uint16_t currentMinute = uint16_t(millis >> 16);
-			if (currentMinute == lastMinute)
-			{      // == handles millis() overflow
-				if (eventsThisMinute == 255)
-					return true;
-			}
-			else
-			{
-				lastMinute = currentMinute;
-				eventsThisMinute = 0;
-			}
-			eventsThisMinute++;
-		}
-		else
-		{
-			static system_tick_t recent_event_ticks[5] =
-			{ (system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000 };
-			static int evt_tick_idx = 0;
-
-			system_tick_t now = recent_event_ticks[evt_tick_idx] = millis;
-			evt_tick_idx++;
-			evt_tick_idx %= 5;
-			if (now - recent_event_ticks[evt_tick_idx] < 1000)
-			{
-				// exceeded allowable burst of 4 events per second
-				return true;
-			}
-		}
-		return false;
+		return limiter.is_rate_limited(is_system_event, millis);
+	}
+
+	/**
+	 * Takes a token for the given event, reserving a future token when none is available and
+	 * there is room for another deferred event.
+	 *
+	 * @return the time in milliseconds to wait before the event can be sent, or -1 if the event
+	 * is rate limited.
+	 */
+	int32_t take_token(const char* event_name, system_tick_t millis)
+	{
+		const system_tick_t wait = (deferred_count < MAX_DEFERRED_EVENTS) ? max_wait.load(std::memory_order_relaxed) : 0;
+		return limiter.take(event_name, millis, wait);
+	}
+
+	ProtocolError set_rate_limit(const char* prefix, system_tick_t interval, uint16_t burst)
+	{
+		return limiter.set_limit(prefix, interval, burst);
 	}
 
+	void set_max_wait(system_tick_t wait)
+	{
+		max_wait.store(wait < TokenBucket::MAX_WAIT ? wait : TokenBucket::MAX_WAIT, std::memory_order_relaxed);
+	}
+
+	system_tick_t get_max_wait() const
+	{
+		return max_wait.load(std::memory_order_relaxed);
+	}
+
+	EventRateLimiter& rate_limiter()
+	{
+		return limiter;
+	}
+
+	size_t deferred_events() const
+	{
+		return deferred_count;
+	}
+
+	/**
+	 * Sends an event, or defers it if it has to wait for a rate limit token. Deferred events
+	 * are sent by process_deferred().
+	 */
 	ProtocolError send_event(MessageChannel& channel, const char* event_name,
 			const char* data, int ttl, EventType::Enum event_type, int flags,
 			system_tick_t time, CompletionHandler handler)
 	{
-		bool is_system_event = is_system(event_name);
-		bool rate_limited = is_rate_limited(is_system_event, time);
-		if (rate_limited) {
+		const int32_t wait = take_token(event_name, time);
+		if (wait < 0) {
 			g_rateLimitedEventsCounter++;
 			return BANDWIDTH_EXCEEDED;
 		}
+		if (wait > 0) {
+			const ProtocolError error = defer_event(event_name, data, ttl, event_type, flags, time + wait, handler);
+			if (error == NO_ERROR) {
+				g_rateLimitWaitCounter++;
+			}
+			return error;
+		}
+		return send_event_now(channel, event_name, data, ttl, event_type, flags, handler);
+	}
 
+	/**
+	 * Sends the deferred events whose rate limit token has become available.
+	 */
+	void process_deferred(MessageChannel& channel, system_tick_t time)
+	{
+		DeferredEvent* prev = nullptr;
+		DeferredEvent* e = deferred_head;
+		while (e) {
+			DeferredEvent* const next = e->next;
+			if (int32_t(time - e->time) >= 0) {
+				if (prev) {
+					prev->next = next;
+				} else {
+					deferred_head = next;
+				}
+				if (deferred_tail == e) {
+					deferred_tail = prev;
+				}
+				--deferred_count;
+				const ProtocolError error = send_event_now(channel, e->name, e->data, e->ttl, e->type, e->flags,
+						e->handler);
+				if (error != NO_ERROR) {
+					e->handler.setError(toSystemError(error));
+				}
+				delete e;
+			} else {
+				prev = e;
+			}
+			e = next;
+		}
+	}
+
+	/**
+	 * Discards the deferred events.
+	 */
+	void cancel_deferred()
+	{
+		while (deferred_head) {
+			DeferredEvent* const e = deferred_head;
+			deferred_head = e->next;
+			e->handler.setError(SYSTEM_ERROR_CANCELLED);
+			delete e;
+		}
+		deferred_tail = nullptr;
+		deferred_count = 0;
+	}
+
+private:
+	// Event waiting for a rate limit token
+	struct DeferredEvent
+	{
+		DeferredEvent* next;
+		CompletionHandler handler;
+		system_tick_t time; // Time when the token becomes available
+		int ttl;
+		EventType::Enum type;
+		int flags;
+		char* data;
+		char name[MAX_EVENT_NAME_LENGTH + 1];
+
+		DeferredEvent() :
+				next(nullptr),
+				time(0),
+				ttl(0),
+				type(EventType::PUBLIC),
+				flags(0),
+				data(nullptr)
+		{
+			name[0] = '\0';
+		}
+
+		~DeferredEvent()
+		{
+			delete[] data;
+		}
+	};
+
+	Protocol* protocol;
+	EventRateLimiter limiter;
+	DeferredEvent* deferred_head;
+	DeferredEvent* deferred_tail;
+	size_t deferred_count;
+	std::atomic<system_tick_t> max_wait;
+
+	ProtocolError defer_event(const char* event_name, const char* data, int ttl, EventType::Enum event_type,
+			int flags, system_tick_t time, CompletionHandler& handler)
+	{
+		DeferredEvent* const e = new(std::nothrow) DeferredEvent();
+		if (!e) {
+			return NO_MEMORY;
+		}
+		if (data) {
+			const size_t size = strnlen(data, MAX_EVENT_DATA_LENGTH);
+			e->data = new(std::nothrow) char[size + 1];
+			if (!e->data) {
+				delete e;
+				return NO_MEMORY;
+			}
+			memcpy(e->data, data, size);
+			e->data[size] = '\0';
+		}
+		const size_t size = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+		memcpy(e->name, event_name, size);
+		e->name[size] = '\0';
+		e->time = time;
+		e->ttl = ttl;
+		e->type = event_type;
+		e->flags = flags;
+		e->handler = std::move(handler);
+		if (deferred_tail) {
+			deferred_tail->next = e;
+		} else {
+			deferred_head = e;
+		}
+		deferred_tail = e;
+		++deferred_count;
+		return NO_ERROR;
+	}
+
+	ProtocolError send_event_now(MessageChannel& channel, const char* event_name,
+			const char* data, int ttl, EventType::Enum event_type, int flags,
+			CompletionHandler& handler)
+	{
 		Message message;
 		channel.create(message);
 		bool confirmable = channel.is_unreliable();
@@ -121,9 +273,6 @@ public:
 		return result;
 	}
 
-private:
-	Protocol* protocol;
-
 	void add_ack_handler(message_id_t msg_id, CompletionHandler handler);
 };
 
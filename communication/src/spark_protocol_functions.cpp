@@ -123,8 +123,7 @@ int spark_protocol_presence_announcement(ProtocolFacade* protocol, uint8_t *buf,
 
 int spark_protocol_post_description(ProtocolFacade* protocol, int desc_flags, void* reserved) {
     ASSERT_ON_SYSTEM_THREAD();
-    (void)reserved;
-    return protocol->post_description(desc_flags);
+    return protocol->post_description(desc_flags, static_cast<const spark_protocol_describe_metrics*>(reserved));
 }
 
 bool spark_protocol_send_event(ProtocolFacade* protocol, const char *event_name, const char *data,
@@ -199,6 +198,23 @@ int spark_protocol_set_connection_property(ProtocolFacade* protocol, unsigned pr
     } else if (property_id == particle::protocol::Connection::FAST_OTA)
     {
         protocol->set_fast_ota(data);
+    } else if (property_id == particle::protocol::Connection::NSTART)
+    {
+        protocol->set_nstart(data);
+    } else if (property_id == particle::protocol::Connection::EVENT_RATE_LIMIT)
+    {
+        auto limit = static_cast<const particle::protocol::event_rate_limit_t*>(reserved);
+        if (!limit || !limit->prefix)
+        {
+            return SYSTEM_ERROR_INVALID_ARGUMENT;
+        }
+        return particle::protocol::toSystemError(protocol->set_event_rate_limit(limit->prefix, limit->interval, limit->burst));
+    } else if (property_id == particle::protocol::Connection::EVENT_RATE_LIMIT_WAIT)
+    {
+        protocol->set_event_rate_limit_wait(data);
+    } else if (property_id == particle::protocol::Connection::SUBSCRIPTION_LIMIT)
+    {
+        protocol->set_subscription_limit(data);
     }
     return 0;
 }
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <cstdlib>
+
 namespace particle
 {
 namespace protocol
@@ -34,8 +36,310 @@ class Subscriptions
 public:
 	typedef uint32_t (*calculate_crc_fn)(const unsigned char *buf, uint32_t buflen);
 
+	typedef void (*call_event_handler_fn)(uint16_t size, FilteringEventHandler* handler,
+			const char* event, const char* data, void* reserved);
+
 private:
+	static const size_t MAX_FILTER_LENGTH = sizeof(FilteringEventHandler::filter);
+
+	/**
+	 * Subscriptions beyond the first MAX_SUBSCRIPTIONS are allocated in blocks. Handlers are
+	 * never moved once added, since the system keeps pointers to them while events are
+	 * dispatched to the application thread. Empty blocks at the end of the list are freed
+	 * when handlers are removed.
+	 */
+	struct HandlerBlock
+	{
+		HandlerBlock* next;
+		FilteringEventHandler handlers[SUBSCRIPTION_BLOCK_SIZE];
+	};
+
 	FilteringEventHandler event_handlers[MAX_SUBSCRIPTIONS];
+	HandlerBlock* blocks;
+	size_t capacity;
+	size_t count;
+	size_t limit;
+
+	/**
+	 * Open addressing hash index of the handlers by filter. Matching handlers are found by
+	 * hashing each prefix of the event name that has the length of some filter, so dispatching
+	 * an event takes time proportional to the length of its name. If the index cannot be
+	 * allocated, events are matched against each handler instead.
+	 */
+	FilteringEventHandler** index;
+	size_t index_size;
+	uint32_t filter_lengths[MAX_FILTER_LENGTH / 32 + 1];
+	unsigned dispatching;
+	bool index_stale;
+
+	/**
+	 * The checksum is the sum of the checksums of the individual handlers, so that it
+	 * can be updated as handlers are added and removed. It is only valid once it
+	 * has been computed with `checksum_crc`.
+	 */
+	uint32_t checksum;
+	calculate_crc_fn checksum_crc;
+
+	static size_t filter_length(const FilteringEventHandler& handler)
+	{
+		return strnlen(handler.filter, MAX_FILTER_LENGTH);
+	}
+
+	static uint32_t hash_init()
+	{
+		// FNV-1a
+		return 2166136261u;
+	}
+
+	static uint32_t hash_next(uint32_t hash, char c)
+	{
+		return (hash ^ (uint8_t)c) * 16777619u;
+	}
+
+	static uint32_t hash(const char* filter, size_t length)
+	{
+		uint32_t h = hash_init();
+		for (size_t i = 0; i < length; i++)
+		{
+			h = hash_next(h, filter[i]);
+		}
+		return h;
+	}
+
+	static uint32_t handler_checksum(const FilteringEventHandler& handler, calculate_crc_fn calculate_crc)
+	{
+		uint32_t chk[3];
+		chk[0] = calculate_crc((const uint8_t*)handler.device_id, sizeof(handler.device_id));
+		chk[1] = calculate_crc((const uint8_t*)handler.filter, sizeof(handler.filter));
+		chk[2] = calculate_crc((const uint8_t*)&handler.scope, sizeof(handler.scope));
+		return calculate_crc((const uint8_t*)chk, sizeof(chk));
+	}
+
+	/**
+	 * Calls `fn` for each handler, used or not, until it returns true, and returns that handler.
+	 */
+	template<typename F> FilteringEventHandler* find_handler(F fn)
+	{
+		for (FilteringEventHandler& handler: event_handlers)
+		{
+			if (fn(handler))
+			{
+				return &handler;
+			}
+		}
+		for (HandlerBlock* block = blocks; block; block = block->next)
+		{
+			for (FilteringEventHandler& handler: block->handlers)
+			{
+				if (fn(handler))
+				{
+					return &handler;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Returns an unused handler, allocating a new block if all handlers are in use.
+	 */
+	FilteringEventHandler* allocate_handler()
+	{
+		if (count >= limit)
+		{
+			return nullptr;
+		}
+		if (count == capacity)
+		{
+			HandlerBlock* block = (HandlerBlock*)calloc(1, sizeof(HandlerBlock));
+			if (!block)
+			{
+				return nullptr;
+			}
+			HandlerBlock** last = &blocks;
+			while (*last)
+			{
+				last = &(*last)->next;
+			}
+			*last = block;
+			capacity += SUBSCRIPTION_BLOCK_SIZE;
+			return &block->handlers[0];
+		}
+		return find_handler([](FilteringEventHandler& handler) {
+			return !handler.handler;
+		});
+	}
+
+	/**
+	 * Frees the blocks at the end of the list that have no handlers.
+	 */
+	void free_empty_blocks()
+	{
+		HandlerBlock** end = &blocks;
+		size_t used = MAX_SUBSCRIPTIONS;
+		size_t size = MAX_SUBSCRIPTIONS;
+		for (HandlerBlock** block = &blocks; *block; block = &(*block)->next)
+		{
+			size += SUBSCRIPTION_BLOCK_SIZE;
+			for (const FilteringEventHandler& handler: (*block)->handlers)
+			{
+				if (handler.handler)
+				{
+					end = &(*block)->next;
+					used = size;
+					break;
+				}
+			}
+		}
+		HandlerBlock* block = *end;
+		*end = nullptr;
+		while (block)
+		{
+			HandlerBlock* next = block->next;
+			free(block);
+			block = next;
+		}
+		capacity = used;
+	}
+
+	void index_insert(FilteringEventHandler* handler)
+	{
+		const size_t length = filter_length(*handler);
+		filter_lengths[length / 32] |= (uint32_t)1 << (length % 32);
+		const size_t mask = index_size - 1;
+		for (size_t i = hash(handler->filter, length) & mask;; i = (i + 1) & mask)
+		{
+			if (!index[i])
+			{
+				index[i] = handler;
+				break;
+			}
+		}
+	}
+
+	void rebuild_index()
+	{
+		if (dispatching)
+		{
+			// The index is in use, rebuild it once the event has been dispatched
+			index_stale = true;
+			return;
+		}
+		index_stale = false;
+		free(index);
+		index = nullptr;
+		index_size = 0;
+		memset(filter_lengths, 0, sizeof(filter_lengths));
+		if (!count)
+		{
+			return;
+		}
+		// Keep the load factor at or below 1/2
+		size_t size = 8;
+		while (count * 2 > size)
+		{
+			size *= 2;
+		}
+		index = (FilteringEventHandler**)calloc(size, sizeof(FilteringEventHandler*));
+		if (!index)
+		{
+			return;
+		}
+		index_size = size;
+		for_each([this](FilteringEventHandler& handler) {
+			index_insert(&handler);
+			return NO_ERROR;
+		});
+	}
+
+	void added(FilteringEventHandler* handler)
+	{
+		++count;
+		if (checksum_crc)
+		{
+			checksum += handler_checksum(*handler, checksum_crc);
+		}
+		if (dispatching || !index || count * 2 > index_size)
+		{
+			rebuild_index();
+		}
+		else
+		{
+			index_insert(handler);
+		}
+	}
+
+	static void invoke(FilteringEventHandler& handler, const char* event_name, const char* data,
+			call_event_handler_fn call_event_handler)
+	{
+		// don't call the handler directly, use a callback for it.
+		if (!call_event_handler)
+		{
+			if (handler.handler_data)
+			{
+				EventHandlerWithData handler_with_data = (EventHandlerWithData)handler.handler;
+				handler_with_data(handler.handler_data, (char *)event_name, (char *)data);
+			}
+			else
+			{
+				handler.handler((char *)event_name, (char *)data);
+			}
+		}
+		else
+		{
+			call_event_handler(sizeof(FilteringEventHandler), &handler, event_name, data, NULL);
+		}
+	}
+
+	void dispatch(const char* event_name, size_t event_name_length, const char* data,
+			call_event_handler_fn call_event_handler)
+	{
+		++dispatching;
+		if (!index)
+		{
+			find_handler([=](FilteringEventHandler& handler) {
+				if (handler.handler)
+				{
+					const size_t length = filter_length(handler);
+					if (length <= event_name_length && !memcmp(handler.filter, event_name, length))
+					{
+						invoke(handler, event_name, data, call_event_handler);
+					}
+				}
+				return false;
+			});
+		}
+		else
+		{
+			const size_t mask = index_size - 1;
+			uint32_t h = hash_init();
+			for (size_t length = 0;; length++)
+			{
+				if (filter_lengths[length / 32] & ((uint32_t)1 << (length % 32)))
+				{
+					for (size_t i = h & mask; index[i]; i = (i + 1) & mask)
+					{
+						FilteringEventHandler& handler = *index[i];
+						// Handlers removed by an earlier handler are cleared but stay in the index until it is rebuilt
+						if (handler.handler && filter_length(handler) == length && !memcmp(handler.filter, event_name, length))
+						{
+							invoke(handler, event_name, data, call_event_handler);
+						}
+					}
+				}
+				if (length == event_name_length || length == MAX_FILTER_LENGTH)
+				{
+					break;
+				}
+				h = hash_next(h, event_name[length]);
+			}
+		}
+		if (!--dispatching && index_stale)
+		{
+			free_empty_blocks();
+			rebuild_index();
+		}
+	}
 
 protected:
 
@@ -60,31 +364,79 @@ protected:
 
 public:
 
-	Subscriptions()
+	Subscriptions() :
+			blocks(nullptr),
+			capacity(MAX_SUBSCRIPTIONS),
+			count(0),
+			limit(MAX_SUBSCRIPTIONS),
+			index(nullptr),
+			index_size(0),
+			dispatching(0),
+			index_stale(false),
+			checksum(0),
+			checksum_crc(nullptr)
 	{
 		memset(&event_handlers, 0, sizeof(event_handlers));
+		memset(filter_lengths, 0, sizeof(filter_lengths));
+	}
+
+	~Subscriptions()
+	{
+		free(index);
+		while (blocks)
+		{
+			HandlerBlock* next = blocks->next;
+			free(blocks);
+			blocks = next;
+		}
+	}
+
+	Subscriptions(const Subscriptions&) = delete;
+	Subscriptions& operator=(const Subscriptions&) = delete;
+
+	/**
+	 * Sets the maximum number of subscriptions. Existing subscriptions are kept when the
+	 * limit is lowered below their number.
+	 */
+	void set_limit(size_t limit)
+	{
+		this->limit = limit;
+	}
+
+	size_t get_limit() const
+	{
+		return limit;
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	/**
+	 * Returns the number of handlers that fit in the memory allocated for them.
+	 */
+	size_t get_capacity() const
+	{
+		return capacity;
 	}
 
 	uint32_t compute_subscriptions_checksum(calculate_crc_fn calculate_crc)
 	{
-		uint32_t checksum = 0;
-		for_each([&checksum, calculate_crc](FilteringEventHandler& handler){
-			uint32_t chk[4];
-			chk[0] = checksum;
-			chk[1] = calculate_crc((const uint8_t*)handler.device_id, sizeof(handler.device_id));
-			chk[2] = calculate_crc((const uint8_t*)handler.filter, sizeof(handler.filter));
-			chk[3] = calculate_crc((const uint8_t*)&handler.scope, sizeof(handler.scope));
-			checksum = calculate_crc((const uint8_t*)chk, sizeof(chk));
-			return NO_ERROR;
-		});
+		if (calculate_crc != checksum_crc)
+		{
+			checksum = 0;
+			for_each([this, calculate_crc](FilteringEventHandler& handler){
+				checksum += handler_checksum(handler, calculate_crc);
+				return NO_ERROR;
+			});
+			checksum_crc = calculate_crc;
+		}
 		return checksum;
 	}
 
-	ProtocolError handle_event(Message& message,
-			void (*call_event_handler)(uint16_t size,
-					FilteringEventHandler* handler, const char* event,
-					const char* data, void* reserved),
-					MessageChannel& channel)
+	ProtocolError handle_event(Message& message, call_event_handler_fn call_event_handler,
+			MessageChannel& channel)
 	{
 		const unsigned len = message.length();
 		uint8_t* queue = message.buf();
@@ -150,103 +502,43 @@ public:
 		// null terminate event name string
 		event_name[event_name_length] = 0;
 
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (NULL == event_handlers[i].handler)
-			{
-				break;
-			}
-			const size_t MAX_FILTER_LENGTH = sizeof(event_handlers[i].filter);
-			const size_t filter_length = strnlen(event_handlers[i].filter,
-					MAX_FILTER_LENGTH);
-
-			if (event_name_length < filter_length)
-			{
-				// does not match this filter, try the next event handler
-				continue;
-			}
-
-			const int cmp = memcmp(event_handlers[i].filter, event_name,
-					filter_length);
-			if (0 == cmp)
-			{
-				// don't call the handler directly, use a callback for it.
-				if (!call_event_handler)
-				{
-					if (event_handlers[i].handler_data)
-					{
-						EventHandlerWithData handler =
-								(EventHandlerWithData) event_handlers[i].handler;
-						handler(event_handlers[i].handler_data,
-								(char *) event_name, (char *) data);
-					}
-					else
-					{
-						event_handlers[i].handler((char *) event_name,
-								(char *) data);
-					}
-				}
-				else
-				{
-					call_event_handler(sizeof(FilteringEventHandler),
-							&event_handlers[i], (const char*) event_name,
-							(const char*) data, NULL);
-				}
-			}
-			// else continue the for loop to try the next handler
-		}
+		dispatch((const char*)event_name, event_name_length, (const char*)data, call_event_handler);
 		return NO_ERROR;
 	}
 
 	template<typename F> ProtocolError for_each(F callback)
 	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
 		ProtocolError error = NO_ERROR;
-		for (unsigned i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (nullptr != event_handlers[i].handler)
+		find_handler([&](FilteringEventHandler& handler) {
+			if (nullptr != handler.handler)
 			{
-				error = callback(event_handlers[i]);
-				if (error)
-					break;
+				error = callback(handler);
 			}
-		}
+			return error != NO_ERROR;
+		});
 		return error;
 	}
 
 	void remove_event_handlers(const char* event_name)
 	{
-		if (NULL == event_name)
-		{
-			memset(event_handlers, 0, sizeof(event_handlers));
-		}
-		else
-		{
-			const int NUM_HANDLERS = sizeof(event_handlers)
-					/ sizeof(FilteringEventHandler);
-			int dest = 0;
-			for (int i = 0; i < NUM_HANDLERS; i++)
+		find_handler([=](FilteringEventHandler& handler) {
+			if (handler.handler && (NULL == event_name || !strcmp(event_name, handler.filter)))
 			{
-				if (!strcmp(event_name, event_handlers[i].filter))
-				{
-					memset(&event_handlers[i], 0, sizeof(event_handlers[i]));
-				}
-				else
+				if (checksum_crc)
 				{
-					if (dest != i)
-					{
-						memcpy(event_handlers + dest, event_handlers + i,
-								sizeof(event_handlers[i]));
-						memset(event_handlers + i, 0,
-								sizeof(event_handlers[i]));
-					}
-					dest++;
+					checksum -= handler_checksum(handler, checksum_crc);
 				}
+				memset(&handler, 0, sizeof(handler));
+				--count;
 			}
+			return false;
+		});
+		if (!dispatching)
+		{
+			// The index may point to the removed handlers until the event has been dispatched
+			free_empty_blocks();
 		}
+		rebuild_index();
 	}
 
 	/**
@@ -255,29 +547,27 @@ public:
 	bool event_handler_exists(const char *event_name, EventHandler handler,
 			void *handler_data, SubscriptionScope::Enum scope, const char* id)
 	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (event_handlers[i].handler == handler
-					&& event_handlers[i].handler_data == handler_data
-					&& event_handlers[i].scope == scope)
+		bool exists = false;
+		find_handler([&](const FilteringEventHandler& h) {
+			if (h.handler == handler
+					&& h.handler_data == handler_data
+					&& h.scope == scope)
 			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
-				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				if (!strncmp(event_handlers[i].filter, event_name, FILTER_LEN))
+				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LENGTH);
+				if (!strncmp(h.filter, event_name, FILTER_LEN))
 				{
-					const size_t MAX_ID_LEN =
-							sizeof(event_handlers[i].device_id) - 1;
+					const size_t MAX_ID_LEN = sizeof(h.device_id) - 1;
 					const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
 					if (id_len)
-						return !strncmp(event_handlers[i].device_id, id, id_len);
+						exists = !strncmp(h.device_id, id, id_len);
 					else
-						return !event_handlers[i].device_id[0];
+						exists = !h.device_id[0];
+					return true;
 				}
 			}
-		}
-		return false;
+			return false;
+		});
+		return exists;
 	}
 
 	/**
@@ -289,27 +579,23 @@ public:
 		if (event_handler_exists(event_name, handler, handler_data, scope, id))
 			return NO_ERROR;
 
-		const int NUM_HANDLERS = sizeof(event_handlers) / sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
-		{
-			if (NULL == event_handlers[i].handler)
-			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
-				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				memcpy(event_handlers[i].filter, event_name, FILTER_LEN);
-				memset(event_handlers[i].filter + FILTER_LEN, 0, MAX_FILTER_LEN - FILTER_LEN);
-				event_handlers[i].handler = handler;
-				event_handlers[i].handler_data = handler_data;
-				event_handlers[i].device_id[0] = 0;
-				const size_t MAX_ID_LEN = sizeof(event_handlers[i].device_id) - 1;
-				const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
-				memcpy(event_handlers[i].device_id, id, id_len);
-				event_handlers[i].device_id[id_len] = 0;
-				event_handlers[i].scope = scope;
-				return NO_ERROR;
-			}
-		}
-		return INSUFFICIENT_STORAGE;
+		FilteringEventHandler* h = allocate_handler();
+		if (!h)
+			return INSUFFICIENT_STORAGE;
+
+		const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LENGTH);
+		memcpy(h->filter, event_name, FILTER_LEN);
+		memset(h->filter + FILTER_LEN, 0, MAX_FILTER_LENGTH - FILTER_LEN);
+		h->handler = handler;
+		h->handler_data = handler_data;
+		memset(h->device_id, 0, sizeof(h->device_id));
+		const size_t MAX_ID_LEN = sizeof(h->device_id) - 1;
+		const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
+		if (id_len)
+			memcpy(h->device_id, id, id_len);
+		h->scope = scope;
+		added(h);
+		return NO_ERROR;
 	}
 
 	inline ProtocolError send_subscriptions(MessageChannel& channel)
@@ -830,6 +830,9 @@ ssize_t hal_ble_gatt_server_set_characteristic_value(hal_ble_attr_handle_t value
 /**
  * Set Characteristic value and notify it to subscribers without acknowledgment.
  *
+ * The notification is queued for transmission. This function blocks only if the transmission
+ * queue is full.
+ *
  * @param[in]   value_handle    Characteristic value handle.
  * @param[in]   buf             Pointer to the buffer that contains the data to be set.
  * @param[in]   len             Length of the data to be set.
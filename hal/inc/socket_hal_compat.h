@@ -196,6 +196,12 @@ void HAL_NET_notify_socket_closed(sock_handle_t socket);
 
 #endif
 
+/**
+ * Notification that an open socket has become readable or writable, or has been closed by the peer.
+ * May be called from any thread.
+ */
+void HAL_NET_notify_socket_event(sock_handle_t socket);
+
 
 #ifdef  __cplusplus
 }
@@ -190,6 +190,10 @@ int PppNcpNetif::upImpl() {
         }
         return r;
     }, celMan_->ncpClient());
+    client_.setFlowControlCallback([](bool suspend, void* ctx) {
+        auto c = (CellularNcpClient*)ctx;
+        c->dataChannelFlowControl(!suspend);
+    }, celMan_->ncpClient());
     client_.connect();
     r = celMan_->connect();
     if (r) {
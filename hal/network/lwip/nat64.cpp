@@ -33,6 +33,7 @@ LOG_SOURCE_CATEGORY("net.nat64")
 #include <lwip/timeouts.h>
 #include "lwiplock.h"
 #include "random.h"
+#include "combine_hash.h"
 
 using namespace particle::net;
 using namespace particle::net::nat;
@@ -89,6 +90,49 @@ const size_t DEFAULT_SESSION_CLEANUP_TIMEOUT = 1000;
 
 static_assert(MEMP_NUM_SYS_TIMEOUT > LWIP_NUM_SYS_TIMEOUT_INTERNAL, "An extra timeout should be allocated for NAT64 service. Increase MEMP_NUM_SYS_TIMEOUT");
 
+/* Zones are ignored when comparing the addresses, so they are not hashed either */
+size_t bibHash(const ip6_addr_t& addr, uint16_t l4Id, L4Protocol proto) {
+    size_t h = proto;
+    for (unsigned i = 0; i < sizeof(addr.addr) / sizeof(addr.addr[0]); ++i) {
+        particle::combineHash(h, addr.addr[i]);
+    }
+    particle::combineHash(h, l4Id);
+    return h;
+}
+
+size_t bibHash(const ip4_addr_t& addr, uint16_t l4Id, L4Protocol proto) {
+    size_t h = proto;
+    particle::combineHash(h, addr.addr);
+    particle::combineHash(h, l4Id);
+    return h;
+}
+
+size_t bibHash6(const BibEntry* bib) {
+    return bibHash(bib->src6().address(), bib->src6().l4Id(), bib->proto());
+}
+
+size_t bibHash4(const BibEntry* bib) {
+    return bibHash(bib->dst4().address(), bib->dst4().l4Id(), bib->proto());
+}
+
+/* The remote IPv4 address is the same for the IPv6 and IPv4 side of a session: on the IPv6
+ * side it's embedded in the last 32 bits of the Pref64 address
+ */
+size_t sessionHash(const BibEntry* bib, uint32_t remoteAddr, uint16_t remoteL4Id) {
+    size_t h = (uintptr_t)bib;
+    particle::combineHash(h, remoteAddr);
+    particle::combineHash(h, remoteL4Id);
+    return h;
+}
+
+size_t sessionHash(const SessionEntry* session) {
+    return sessionHash(session->bib(), session->dst6().address().addr[3], session->dst6().l4Id());
+}
+
+uint32_t lifetimeToTicks(uint32_t lifetime) {
+    return (lifetime + DEFAULT_SESSION_CLEANUP_TIMEOUT - 1) / DEFAULT_SESSION_CLEANUP_TIMEOUT;
+}
+
 } /* anonymous */
 
 Nat64::Nat64() {
@@ -271,13 +315,13 @@ int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto
                   IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
                   IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
         /* Lookup session */
-        session = bib->lookupSession(srcAddr, dstAddr);
+        session = lookupSession(bib, srcAddr, dstAddr);
 
         /* FIXME: flag to enable full-cone NAT */
         if (!session && dstAddr.isV6()) {
             /* Attempt to create a new session */
             LOG_DEBUG(TRACE, "No matching session found, trying to create one");
-            session = bib->addSession(dstAddr, protoLifetime, *pool_);
+            session = addSession(bib, dstAddr, protoLifetime);
         } else if (!session && dstAddr.isV4()) {
             LOG_DEBUG(WARN, "Not creating a new session, full-cone NAT is not enabled");
         }
@@ -288,8 +332,11 @@ int Nat64::natInput(const ip_addr_t* src, const ip_addr_t* dst, L4Protocol proto
                       IP6ADDR_NTOA(&session->dst6().address()), session->dst6().l4Id(),
                       IP4ADDR_NTOA(&session->src4().address()), session->src4().l4Id(),
                       IP4ADDR_NTOA(&session->dst4().address()), session->dst4().l4Id(),
-                      session->lifetime());
-            session->setLifetime(protoLifetime);
+                      sessionLifetime(session));
+            refreshSession(session, protoLifetime);
+        } else if (bib->empty()) {
+            /* A BIB entry only exists while it has sessions */
+            removeBib(bib);
         }
     } else {
         LOG_DEBUG(TRACE, "No matching BIB");
@@ -412,19 +459,17 @@ bool Nat64::filter(const IpTransportAddress& src, const IpTransportAddress& dst,
 }
 
 BibEntry* Nat64::lookupBib(const IpTransportAddress& src, const IpTransportAddress& dst, L4Protocol proto) {
-    BibTable& tbl = proto == L4_PROTO_UDP ? udpBibTable_ : icmpBibTable_;
     const IpTransportAddress& addr = src.isV6() ? src : dst;
-    for (auto entry = tbl.front(); entry != nullptr; entry = entry->next) {
-        if (entry->matches(addr)) {
-            return entry;
-        }
+    auto match = [&addr, proto](const BibEntry* entry) {
+        return entry->proto() == proto && entry->matches(addr);
+    };
+    if (addr.isV6()) {
+        return bib6Table_.find(bibHash(*ip_2_ip6(&addr.address()), addr.l4Id(), proto), match);
     }
-    return nullptr;
+    return bib4Table_.find(bibHash(*ip_2_ip4(&addr.address()), addr.l4Id(), proto), match);
 }
 
 BibEntry* Nat64::addBib(const IpTransportAddress& src, const IpTransportAddress& dst, L4Protocol proto) {
-    BibTable& tbl = proto == L4_PROTO_UDP ? udpBibTable_ : icmpBibTable_;
-
     if (src.isV4()) {
         LOG_DEBUG(TRACE, "Not creating a new BIB for a connection initiated from IPv4 side");
         return nullptr;
@@ -447,8 +492,9 @@ BibEntry* Nat64::addBib(const IpTransportAddress& src, const IpTransportAddress&
                     if (pool_) {
                         BibEntry* bib = static_cast<BibEntry*>(pool_->alloc(NAT64_ENTRY_SIZE));
                         if (bib) {
-                            new (bib) BibEntry(src, src4);
-                            tbl.pushFront(bib);
+                            new (bib) BibEntry(src, src4, proto);
+                            bib6Table_.insert(bib, bibHash6(bib));
+                            bib4Table_.insert(bib, bibHash4(bib));
                             return bib;
                         }
                     }
@@ -463,6 +509,67 @@ BibEntry* Nat64::addBib(const IpTransportAddress& src, const IpTransportAddress&
     return nullptr;
 }
 
+void Nat64::removeBib(BibEntry* bib) {
+    bib6Table_.remove(bib, bibHash6(bib));
+    bib4Table_.remove(bib, bibHash4(bib));
+    pool_->free(bib);
+}
+
+SessionEntry* Nat64::lookupSession(BibEntry* bib, const IpTransportAddress& src, const IpTransportAddress& dst) {
+    size_t h = 0;
+    if (src.isV6()) {
+        h = sessionHash(bib, ip_2_ip6(&dst.address())->addr[3], dst.l4Id());
+    } else {
+        h = sessionHash(bib, ip_2_ip4(&src.address())->addr, src.l4Id());
+    }
+    return sessionTable_.find(h, [bib, &src, &dst](const SessionEntry* session) {
+        return session->bib() == bib && session->matches(src, dst);
+    });
+}
+
+SessionEntry* Nat64::addSession(BibEntry* bib, const Ip6TransportAddress& dst, uint32_t lifetime) {
+    auto session = static_cast<SessionEntry*>(pool_->alloc(NAT64_ENTRY_SIZE));
+    if (!session) {
+        LOG_DEBUG(TRACE, "Failed to allocate new session");
+        return nullptr;
+    }
+
+    new (session) SessionEntry(bib, dst);
+    bib->addSession();
+    sessionTable_.insert(session, sessionHash(session));
+    sessionTimers_.add(session, sessionTimers_.now() + lifetimeToTicks(lifetime));
+
+    return session;
+}
+
+void Nat64::refreshSession(SessionEntry* session, uint32_t lifetime) {
+    /* Lifetimes of a protocol are the same, so the session never expires earlier than scheduled */
+    sessionTimers_.postpone(session, sessionTimers_.now() + lifetimeToTicks(lifetime));
+}
+
+uint32_t Nat64::sessionLifetime(const SessionEntry* session) const {
+    return (session->expiry() - sessionTimers_.now()) * DEFAULT_SESSION_CLEANUP_TIMEOUT;
+}
+
+void Nat64::removeSession(SessionEntry* session) {
+    LOG_DEBUG(TRACE, "Session timed out %s#%u <-> %s#%u, %s#%u <-> %s#%u",
+              IP6ADDR_NTOA(&session->src6().address()), session->src6().l4Id(),
+              IP6ADDR_NTOA(&session->dst6().address()), session->dst6().l4Id(),
+              IP4ADDR_NTOA(&session->src4().address()), session->src4().l4Id(),
+              IP4ADDR_NTOA(&session->dst4().address()), session->dst4().l4Id());
+
+    BibEntry* bib = session->bib();
+    sessionTable_.remove(session, sessionHash(session));
+    pool_->free(session);
+
+    if (bib->removeSession()) {
+        LOG_DEBUG(TRACE, "%s BIB %s#%u <-> %s#%u timed out", bib->proto() == L4_PROTO_UDP ? "UDP" : "ICMP",
+                  IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
+                  IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
+        removeBib(bib);
+    }
+}
+
 bool Nat64::findNextL4Id(Ip4TransportAddress& src, L4Protocol proto) {
     if (proto == L4_PROTO_UDP) {
         return findNextUdpPort(src);
@@ -504,35 +611,10 @@ bool Nat64::findNextIcmpId(Ip4TransportAddress& src) {
 }
 
 void Nat64::timeout(uint32_t dt) {
-    for (auto bib = udpBibTable_.front(), p = static_cast<BibEntry*>(nullptr); bib != nullptr;) {
-        if (bib->timeout(dt, *pool_)) {
-            LOG_DEBUG(TRACE, "UDP BIB %s#%u <-> %s#%u timed out",
-                      IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
-                      IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
-
-            auto popped = udpBibTable_.pop(bib, p);
-            bib = popped->next;
-            pool_->free(popped);
-        } else {
-            p = bib;
-            bib = bib->next;
-        }
-    }
-
-    for (auto bib = icmpBibTable_.front(), p = static_cast<BibEntry*>(nullptr); bib != nullptr;) {
-        if (bib->timeout(dt, *pool_)) {
-            LOG_DEBUG(TRACE, "ICMP BIB %s#%u <-> %s#%u timed out",
-                      IP6ADDR_NTOA(&bib->src6().address()), bib->src6().l4Id(),
-                      IP4ADDR_NTOA(&bib->dst4().address()), bib->dst4().l4Id());
-
-            auto popped = udpBibTable_.pop(bib, p);
-            bib = popped->next;
-            pool_->free(popped);
-        } else {
-            p = bib;
-            bib = bib->next;
-        }
-    }
+    /* Only the sessions that are due are visited */
+    sessionTimers_.advance(dt / DEFAULT_SESSION_CLEANUP_TIMEOUT, [this](SessionEntry* session) {
+        removeSession(session);
+    });
 }
 
 void Nat64::enableSessionTimer() {
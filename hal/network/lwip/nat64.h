@@ -27,6 +27,8 @@
 #include <memory>
 #include <cstring>
 #include "intrusive_list.h"
+#include "intrusive_hash_table.h"
+#include "timer_wheel.h"
 #include "simple_pool_allocator.h"
 #include "logging.h"
 #include "ipaddr_util.h"
@@ -143,65 +145,65 @@ class BibEntry;
 class SessionEntry;
 class RuleEntry;
 
-using BibTable = particle::IntrusiveList<BibEntry>;
-using SessionTable = particle::IntrusiveList<SessionEntry>;
 using RuleTable = particle::IntrusiveList<RuleEntry>;
 
-template <typename DerivedT>
-class ListNode {
+class BibEntry {
 public:
-    DerivedT* next;
-};
-
-class BibEntry : public ListNode<BibEntry> {
-public:
-    BibEntry(const Ip6TransportAddress& src6, const Ip4TransportAddress& dst4);
+    BibEntry(const Ip6TransportAddress& src6, const Ip4TransportAddress& dst4, L4Protocol proto);
 
     const Ip6TransportAddress& src6() const;
     const Ip4TransportAddress& dst4() const;
+    L4Protocol proto() const;
 
     bool matches(const IpTransportAddress& addr) const;
     bool empty() const;
 
-    SessionEntry* lookupSession(const IpTransportAddress& src, const IpTransportAddress& dst);
-    SessionEntry* addSession(const Ip6TransportAddress& dst, uint32_t lifetime, particle::SimpleAllocator& allocator);
+    void addSession();
+    bool removeSession();
 
-    bool timeout(uint32_t dt, particle::SimpleAllocator& allocator);
+    /* Hash chains of the tables indexed by the IPv6 and the IPv4 transport address */
+    BibEntry* next6 = nullptr;
+    BibEntry* next4 = nullptr;
 
 private:
     Ip6TransportAddress src6_;
     Ip4TransportAddress dst4_;
+    L4Protocol proto_;
 
-    SessionTable sessions_;
+    unsigned sessions_;
 };
 
-class SessionEntry : public ListNode<SessionEntry> {
+/* Sessions are indexed by their BIB entry and the remote transport address, and expire on a timer wheel */
+class SessionEntry : public particle::TimerWheelNode<SessionEntry> {
 public:
     SessionEntry(BibEntry* bib, const Ip6TransportAddress& dst6);
 
-    BibEntry* bib();
+    BibEntry* bib() const;
 
     const Ip6TransportAddress& src6() const;
     const Ip6TransportAddress& dst6() const;
     const Ip4TransportAddress& src4() const;
     Ip4TransportAddress dst4() const;
 
-    bool matches(const IpTransportAddress& src, const IpTransportAddress& dst);
+    bool matches(const IpTransportAddress& src, const IpTransportAddress& dst) const;
 
-    uint32_t setLifetime(uint32_t lifetime);
-    uint32_t lifetime() const;
-
-    bool timeout(uint32_t dt);
+    /* Hash chain */
+    SessionEntry* next = nullptr;
 
 private:
     BibEntry* bib_;
     Ip6TransportAddress dst6_;
-
-    uint32_t lifetime_;
 };
 
 static const size_t NAT64_ENTRY_SIZE = std::max(sizeof(BibEntry), sizeof(SessionEntry));
 
+/* Both the UDP and ICMP entries are kept in the same tables */
+using Bib6Table = particle::IntrusiveHashTable<BibEntry, 32, &BibEntry::next6>;
+using Bib4Table = particle::IntrusiveHashTable<BibEntry, 32, &BibEntry::next4>;
+using SessionTable = particle::IntrusiveHashTable<SessionEntry, 32, &SessionEntry::next>;
+/* 32 slots of 1 tick and 32 slots of 32 ticks */
+using SessionTimers = particle::TimerWheel<SessionEntry, 5, 2>;
+
 class Nat64 {
 public:
     Nat64();
@@ -222,6 +224,13 @@ protected:
 
     BibEntry* lookupBib(const IpTransportAddress& src, const IpTransportAddress& dst, L4Protocol proto);
     BibEntry* addBib(const IpTransportAddress& src, const IpTransportAddress& dst, L4Protocol proto);
+    void removeBib(BibEntry* bib);
+
+    SessionEntry* lookupSession(BibEntry* bib, const IpTransportAddress& src, const IpTransportAddress& dst);
+    SessionEntry* addSession(BibEntry* bib, const Ip6TransportAddress& dst, uint32_t lifetime);
+    void refreshSession(SessionEntry* session, uint32_t lifetime);
+    uint32_t sessionLifetime(const SessionEntry* session) const;
+    void removeSession(SessionEntry* session);
 
     bool findNextL4Id(Ip4TransportAddress& src, L4Protocol proto);
     bool findNextUdpPort(Ip4TransportAddress& src);
@@ -243,9 +252,12 @@ private:
     /* Defaults to 64:ff9b::/96 */
     ip6_addr_t pref64_;
 
-    BibTable udpBibTable_;
+    Bib6Table bib6Table_;
+    Bib4Table bib4Table_;
+    SessionTable sessionTable_;
+    SessionTimers sessionTimers_;
+
     uint16_t udpNextPort_;
-    BibTable icmpBibTable_;
     uint16_t icmpNextId_;
 
     std::unique_ptr<SimpleAllocedPool> pool_;
@@ -408,9 +420,11 @@ inline netif* Rule::outside() const {
 }
 
 /* BibEntry */
-inline BibEntry::BibEntry(const Ip6TransportAddress& src6, const Ip4TransportAddress& dst4)
+inline BibEntry::BibEntry(const Ip6TransportAddress& src6, const Ip4TransportAddress& dst4, L4Protocol proto)
         : src6_(src6),
-          dst4_(dst4) {
+          dst4_(dst4),
+          proto_(proto),
+          sessions_(0) {
 }
 
 inline const Ip6TransportAddress& BibEntry::src6() const {
@@ -421,6 +435,10 @@ inline const Ip4TransportAddress& BibEntry::dst4() const {
     return dst4_;
 }
 
+inline L4Protocol BibEntry::proto() const {
+    return proto_;
+}
+
 inline bool BibEntry::matches(const IpTransportAddress& addr) const {
     if (addr.isV4()) {
         return dst4() == addr;
@@ -432,62 +450,25 @@ inline bool BibEntry::matches(const IpTransportAddress& addr) const {
 }
 
 inline bool BibEntry::empty() const {
-    return sessions_.front() == nullptr;
+    return sessions_ == 0;
 }
 
-inline SessionEntry* BibEntry::lookupSession(const IpTransportAddress& src, const IpTransportAddress& dst) {
-    for (auto* s = sessions_.front(); s != nullptr; s = s->next) {
-        if (s->matches(src, dst)) {
-            return s;
-        }
-    }
-
-    return nullptr;
+inline void BibEntry::addSession() {
+    ++sessions_;
 }
 
-inline SessionEntry* BibEntry::addSession(const Ip6TransportAddress& dst, uint32_t lifetime, particle::SimpleAllocator& allocator) {
-    auto sess = (SessionEntry*)allocator.alloc(NAT64_ENTRY_SIZE);
-    if (sess) {
-        new(sess) SessionEntry(this, dst);
-        sess->setLifetime(lifetime);
-        sessions_.pushFront(sess);
-        return sess;
-    }
-
-    LOG_DEBUG(TRACE, "Failed to allocate new session");
-
-    return nullptr;
-}
-
-inline bool BibEntry::timeout(uint32_t dt, particle::SimpleAllocator& allocator) {
-    using namespace particle::net;
-    for (auto s = sessions_.front(), p = static_cast<SessionEntry*>(nullptr); s != nullptr;) {
-        if (s->timeout(dt)) {
-            LOG_DEBUG(TRACE, "Session timed out %s#%u <-> %s#%u, %s#%u <-> %s#%u",
-                      IP6ADDR_NTOA(&s->src6().address()), s->src6().l4Id(),
-                      IP6ADDR_NTOA(&s->dst6().address()), s->dst6().l4Id(),
-                      IP4ADDR_NTOA(&s->src4().address()), s->src4().l4Id(),
-                      IP4ADDR_NTOA(&s->dst4().address()), s->dst4().l4Id());
-            auto popped = sessions_.pop(s, p);
-            s = popped->next;
-            allocator.free(popped);
-        } else {
-            p = s;
-            s = s->next;
-        }
-    }
-
+inline bool BibEntry::removeSession() {
+    --sessions_;
     return empty();
 }
 
 /* SessionEntry */
 inline SessionEntry::SessionEntry(BibEntry* bib, const Ip6TransportAddress& dst6)
         : bib_(bib),
-          dst6_(dst6),
-          lifetime_(0) {
+          dst6_(dst6) {
 }
 
-inline BibEntry* SessionEntry::bib() {
+inline BibEntry* SessionEntry::bib() const {
     return bib_;
 }
 
@@ -510,7 +491,7 @@ inline Ip4TransportAddress SessionEntry::dst4() const {
     return Ip4TransportAddress(addr, dst6().port());
 }
 
-inline bool SessionEntry::matches(const IpTransportAddress& src, const IpTransportAddress& dst) {
+inline bool SessionEntry::matches(const IpTransportAddress& src, const IpTransportAddress& dst) const {
     if (src.isV6()) {
         return src6() == src && dst6() == dst;
     } else if (src.isV4()) {
@@ -520,24 +501,6 @@ inline bool SessionEntry::matches(const IpTransportAddress& src, const IpTranspo
     return false;
 }
 
-inline uint32_t SessionEntry::setLifetime(uint32_t lifetime) {
-    std::swap(lifetime_, lifetime);
-    return lifetime;
-}
-
-inline uint32_t SessionEntry::lifetime() const {
-    return lifetime_;
-}
-
-inline bool SessionEntry::timeout(uint32_t dt) {
-    if (lifetime() <= dt) {
-        setLifetime(0);
-        return true;
-    }
-    setLifetime(lifetime() - dt);
-    return false;
-}
-
 } } } /* particle::net::nat */
 
 #endif /* HAL_NETWORK_LWIP_NAT64_H */
@@ -24,6 +24,7 @@ extern "C" {
 #include <netif/ppp/pppos.h>
 }
 #include <lwip/netifapi.h>
+#include <lwip/tcpip.h>
 #include <netif/ppp/pppapi.h>
 #include <mutex>
 #include "socket_hal.h"
@@ -175,8 +176,19 @@ int Client::input(const uint8_t* data, size_t size) {
       case STATE_DISCONNECTING:
       case STATE_CONNECTED: {
         LOG(TRACE, "RX: %lu", size);
-        err_t err = pppos_input_tcpip(pcb_, (u8_t*)data, size);
+        /* The chunk is copied once, into a pool pbuf that is then owned by the TCP/IP thread.
+         * Its credits are returned after it has been parsed, which is what throttles the
+         * lower layer instead of the pool or the TCP/IP mailbox running out */
+        pbuf* p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
+        if (!p) {
+          return SYSTEM_ERROR_NO_MEMORY;
+        }
+        pbuf_take(p, data, size);
+        rxFlow_.take(size);
+        err_t err = tcpip_inpkt(p, &if_, &Client::inputCb);
         if (err) {
+          pbuf_free(p);
+          rxFlow_.release(size);
           return SYSTEM_ERROR_INTERNAL;
         }
         return 0;
@@ -192,6 +204,22 @@ void Client::setNotifyCallback(NotifyCallback cb, void* ctx) {
   cbCtx_ = ctx;
 }
 
+err_t Client::inputCb(pbuf* p, netif* inp) {
+  auto self = static_cast<Client*>(netif_get_client_data(inp, netifClientDataIdx_));
+  const size_t size = p->tot_len;
+  for (pbuf* q = p; q; q = q->next) {
+    pppos_input(self->pcb_, (u8_t*)q->payload, q->len);
+  }
+  pbuf_free(p);
+  self->rxFlow_.release(size);
+  return ERR_OK;
+}
+
+void Client::setFlowControlCallback(FlowControlCallback cb, void* ctx) {
+  std::lock_guard<std::mutex> lk(mutex_);
+  rxFlow_.callback(cb, ctx);
+}
+
 void Client::setOutputCallback(OutputCallback cb, void* ctx) {
   std::lock_guard<std::mutex> lk(mutex_);
   oCb_ = cb;
@@ -32,6 +32,17 @@ extern "C" {
 #include <mutex>
 #include <atomic>
 #include "stream.h"
+#include "credit_flow_control.h"
+
+/* Number of received bytes queued to the TCP/IP thread before the lower layer is suspended */
+#ifndef PPP_CLIENT_RX_CREDITS_HIGH
+#define PPP_CLIENT_RX_CREDITS_HIGH (PBUF_POOL_SIZE * PBUF_POOL_BUFSIZE / 2)
+#endif /* PPP_CLIENT_RX_CREDITS_HIGH */
+
+/* Number of queued bytes at which the lower layer is resumed */
+#ifndef PPP_CLIENT_RX_CREDITS_LOW
+#define PPP_CLIENT_RX_CREDITS_LOW (PPP_CLIENT_RX_CREDITS_HIGH / 4)
+#endif /* PPP_CLIENT_RX_CREDITS_LOW */
 
 #ifdef __cplusplus
 
@@ -82,6 +93,10 @@ public:
   typedef int (*OutputCallback)(const uint8_t* data, size_t size, void* ctx);
   void setOutputCallback(OutputCallback cb, void* ctx);
 
+  /* Invoked to suspend or resume the lower layer when too much received data is queued */
+  typedef void (*FlowControlCallback)(bool suspend, void* ctx);
+  void setFlowControlCallback(FlowControlCallback cb, void* ctx);
+
   typedef void (*NotifyCallback)(Client* c, uint64_t ev, void* ctx);
 
   void setNotifyCallback(NotifyCallback cb, void* ctx);
@@ -131,6 +146,8 @@ private:
   static void notifyStatusCb(ppp_pcb* pcb, int err, void* ctx);
   void notifyStatus(int err);
 
+  static err_t inputCb(pbuf* p, netif* inp);
+
 #if defined(LWIP_NETIF_EXT_STATUS_CALLBACK) && LWIP_NETIF_EXT_STATUS_CALLBACK == 1
   static void notifyNetifCb(netif* netif, netif_nsc_reason_t reason, const netif_ext_callback_args_t* args);
   void notifyNetif(netif_nsc_reason_t reason, const netif_ext_callback_args_t* args);
@@ -164,6 +181,8 @@ private:
   OutputCallback oCb_ = nullptr;
   void* oCbCtx_ = nullptr;
 
+  CreditFlowControl rxFlow_{PPP_CLIENT_RX_CREDITS_HIGH, PPP_CLIENT_RX_CREDITS_LOW};
+
   bool inited_ = false;
   std::atomic_bool running_;
   std::atomic_bool exit_;
@@ -18,16 +18,40 @@
 #include "at_parser.h"
 
 #include "at_command.h"
+#include "at_response.h"
 #include "at_parser_impl.h"
 
+#include "c_string.h"
 #include "check.h"
 
 #include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
 
 namespace particle {
 
 using detail::AtParserImpl;
 
+namespace {
+
+CString formatCommand(const char* fmt, va_list args) {
+    va_list args2;
+    va_copy(args2, args);
+    const int n = vsnprintf(nullptr, 0, fmt, args2);
+    va_end(args2);
+    if (n < 0) {
+        return CString();
+    }
+    const auto buf = (char*)malloc(n + 1);
+    if (!buf) {
+        return CString();
+    }
+    vsnprintf(buf, n + 1, fmt, args);
+    return CString::wrap(buf);
+}
+
+} // unnamed
+
 AtParser::AtParser() {
 }
 
@@ -115,6 +139,53 @@ int AtParser::processUrc(unsigned timeout) {
     return p_->processUrc(timeout);
 }
 
+int AtParser::queueCommand(CommandHandler handler, void* data, const char* fmt, ...) {
+    CHECK_TRUE(p_, SYSTEM_ERROR_INVALID_STATE);
+    va_list args;
+    va_start(args, fmt);
+    auto cmd = formatCommand(fmt, args);
+    va_end(args);
+    CHECK_TRUE(cmd, SYSTEM_ERROR_NO_MEMORY);
+    return p_->queueCommand(std::move(cmd), p_->config().commandTimeout(), handler, data);
+}
+
+int AtParser::queueCommand(unsigned timeout, CommandHandler handler, void* data, const char* fmt, ...) {
+    CHECK_TRUE(p_, SYSTEM_ERROR_INVALID_STATE);
+    va_list args;
+    va_start(args, fmt);
+    auto cmd = formatCommand(fmt, args);
+    va_end(args);
+    CHECK_TRUE(cmd, SYSTEM_ERROR_NO_MEMORY);
+    return p_->queueCommand(std::move(cmd), timeout, handler, data);
+}
+
+int AtParser::processCommands() {
+    CHECK_TRUE(p_, SYSTEM_ERROR_INVALID_STATE);
+    CHECK_TRUE(p_->isReady(), SYSTEM_ERROR_BUSY);
+    int count = 0;
+    AtParserImpl::QueuedCommand qcmd = {};
+    while (p_->takeCommand(&qcmd)) {
+        AtResponse resp = command().timeout(qcmd.timeout).print(qcmd.cmd).send();
+        if (qcmd.handler) {
+            qcmd.handler(&resp, qcmd.data);
+        }
+        if (!p_->isReady()) {
+            // The handler didn't read the final result code. This also skips the remaining
+            // response lines so that they are not mistaken for the response of the next command
+            resp.readResult();
+        }
+        ++count;
+    }
+    return count;
+}
+
+size_t AtParser::queuedCommands() const {
+    if (!p_) {
+        return 0;
+    }
+    return p_->queuedCommands();
+}
+
 void AtParser::reset() {
     if (p_) {
         p_->reset();
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <memory>
+#include <cstddef>
 
 namespace particle {
 
@@ -203,6 +204,19 @@ public:
      * @see `addUrcHandler()`
      */
     typedef int(*UrcHandler)(AtResponseReader* reader, const char* prefix, void* data);
+    /**
+     * The signature of a function invoked by the parser when a queued AT command has been sent.
+     *
+     * The handler can read the response lines and the final result code of the command. If it
+     * doesn't read the final result code, the parser reads it after the handler returns.
+     *
+     * @param resp Response object. If the command couldn't be sent, the object is in an error
+     *        state and `AtResponseReader::error()` returns the error code.
+     * @param data User data.
+     *
+     * @see `queueCommand()`
+     */
+    typedef void(*CommandHandler)(AtResponse* resp, void* data);
 
     /**
      * Constructs a parser object.
@@ -350,6 +364,49 @@ public:
      * @return Number of URCs processed, or a negative result code in case of an error.
      */
     int processUrc(unsigned timeout = 0);
+    /**
+     * Formats an AT command and adds it to the command queue.
+     *
+     * Queued commands are sent by `processCommands()` in the order they were added. V.250 doesn't
+     * allow sending a command before the final result code of the previous command is received,
+     * so the commands are not sent at once, but each command is sent as soon as the previous one
+     * has completed, without returning to the calling code in between.
+     *
+     * @param handler Completion handler. Can be `nullptr`.
+     * @param data User data.
+     * @param fmt printf-style format string.
+     * @param ... Formatting arguments.
+     * @return `0` on success, or a negative result code in case of an error.
+     */
+    int queueCommand(CommandHandler handler, void* data, const char* fmt, ...) __attribute__((format(printf, 4, 5)));
+    /**
+     * Formats an AT command and adds it to the command queue.
+     *
+     * This method is similar to `queueCommand(CommandHandler handler, void* data, const char* fmt, ...)`,
+     * but it also overrides the default command timeout.
+     *
+     * @param timeout Timeout in milliseconds.
+     * @param handler Completion handler. Can be `nullptr`.
+     * @param data User data.
+     * @param fmt printf-style format string.
+     * @param ... Formatting arguments.
+     * @return `0` on success, or a negative result code in case of an error.
+     */
+    int queueCommand(unsigned timeout, CommandHandler handler, void* data, const char* fmt, ...) __attribute__((format(printf, 5, 6)));
+    /**
+     * Sends the queued AT commands.
+     *
+     * URCs received while the commands are running are passed to their handlers as usual. If a
+     * command can't be sent, its handler is invoked with an error, and the remaining commands
+     * are still sent.
+     *
+     * @return Number of commands processed, or a negative result code in case of an error.
+     */
+    int processCommands();
+    /**
+     * Returns the number of queued AT commands.
+     */
+    size_t queuedCommands() const;
     /**
      * Resets the parser state.
      */
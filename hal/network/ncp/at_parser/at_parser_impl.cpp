@@ -111,6 +111,8 @@ inline system_tick_t millis() {
 AtParserImpl::AtParserImpl(AtParserConfig conf) :
         cmdTerm_(cmdTermStr(conf.commandTerminator())),
         cmdTermSize_(strlen(cmdTerm_)),
+        buf_(initBuf_),
+        bufSize_(INPUT_BUF_SIZE),
         conf_(std::move(conf)) {
     reset();
 }
@@ -291,6 +293,12 @@ int AtParserImpl::addUrcHandler(const char* prefix, AtParser::UrcHandler handler
     if (!urcHandlers_.append(std::move(h))) {
         return SYSTEM_ERROR_NO_MEMORY;
     }
+    const int ret = buildUrcTrie();
+    if (ret < 0) {
+        urcHandlers_.takeLast();
+        buildUrcTrie(); // Can't fail as the tree doesn't grow
+        return ret;
+    }
     return 0;
 }
 
@@ -298,6 +306,7 @@ void AtParserImpl::removeUrcHandler(const char* prefix) {
     for (int i = 0; i < urcHandlers_.size(); ++i) {
         if (strcmp(urcHandlers_.at(i).prefix, prefix) == 0) {
             urcHandlers_.removeAt(i);
+            buildUrcTrie();
             break;
         }
     }
@@ -309,7 +318,9 @@ int AtParserImpl::processUrc(unsigned timeout) {
     }
     size_t urcCount = 0;
     for (;;) {
-        if (!checkStatus(StatusFlag::LINE_BEGIN)) {
+        // Both flags are set if the received data starts with a newline, e.g. an URC that is
+        // received before any command
+        if (!checkStatus(StatusFlag::LINE_BEGIN) || checkStatus(StatusFlag::LINE_END)) {
             PARSER_CHECK(nextLine(&timeout));
         }
         const int ret = PARSER_CHECK(parseLine(ParseFlag::PARSE_URC, &timeout));
@@ -322,6 +333,26 @@ int AtParserImpl::processUrc(unsigned timeout) {
     return urcCount;
 }
 
+int AtParserImpl::queueCommand(CString cmd, unsigned timeout, AtParser::CommandHandler handler, void* data) {
+    QueuedCommand c = {};
+    c.cmd = std::move(cmd);
+    c.timeout = timeout;
+    c.handler = handler;
+    c.data = data;
+    if (!cmdQueue_.append(std::move(c))) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    return 0;
+}
+
+bool AtParserImpl::takeCommand(QueuedCommand* cmd) {
+    if (cmdQueue_.isEmpty()) {
+        return false;
+    }
+    *cmd = cmdQueue_.takeFirst();
+    return true;
+}
+
 void AtParserImpl::reset() {
     bufPos_ = 0;
     cmdSize_ = 0;
@@ -492,23 +523,34 @@ int AtParserImpl::parseUrc(const UrcHandler** handler) {
     if (bufPos_ == 0) {
         return ParseResult::READ_MORE;
     }
-    // Look for an URC prefix that matches the buffer contents
+    if (urcTrie_.isEmpty()) {
+        return ParseResult::NO_MATCH;
+    }
+    // Find the longest URC prefix that matches the buffer contents
     const UrcHandler* h = nullptr;
-    size_t maxSize = 0;
-    for (size_t i = 0; i < (size_t)urcHandlers_.size(); ++i) {
-        const UrcHandler& h2 = urcHandlers_.at(i);
-        const size_t n = std::min(bufPos_, h2.prefixSize);
-        if (memcmp(buf_, h2.prefix, n) == 0 && n > maxSize) {
-            h = &h2;
-            maxSize = n;
+    int node = 0;
+    size_t i = 0;
+    for (; i < bufPos_; ++i) {
+        int child = urcTrie_.at(node).child;
+        while (child >= 0 && urcTrie_.at(child).c != buf_[i]) {
+            child = urcTrie_.at(child).next;
+        }
+        if (child < 0) {
+            break;
         }
+        node = child;
+        const int index = urcTrie_.at(node).handler;
+        if (index >= 0) {
+            h = &urcHandlers_.at(index);
+        }
+    }
+    if (i == bufPos_ && urcTrie_.at(node).child >= 0) {
+        // A longer prefix may still match
+        return ParseResult::READ_MORE;
     }
     if (!h) {
         return ParseResult::NO_MATCH;
     }
-    if (bufPos_ < h->prefixSize) {
-        return ParseResult::READ_MORE;
-    }
     *handler = h;
     return ParseResult::PARSED_URC;
 }
@@ -522,7 +564,7 @@ int AtParserImpl::parseEcho() {
     if (memcmp(buf_, cmdData_, n) != 0) {
         return ParseResult::NO_MATCH;
     }
-    n = std::min(cmdSize_, INPUT_BUF_SIZE);
+    n = std::min(cmdSize_, bufSize_);
     if (bufPos_ < n) {
         return ParseResult::READ_MORE;
     }
@@ -598,11 +640,11 @@ int AtParserImpl::nextLine(unsigned* timeout) {
 }
 
 int AtParserImpl::readMore(unsigned* timeout) {
-    assert(bufPos_ < INPUT_BUF_SIZE);
+    assert(bufPos_ < bufSize_);
     const auto strm = conf_.stream();
     size_t bytesRead = 0;
     for (;;) {
-        bytesRead = CHECK(strm->read(buf_ + bufPos_, INPUT_BUF_SIZE - bufPos_));
+        bytesRead = CHECK(strm->read(buf_ + bufPos_, bufSize_ - bufPos_));
         if (bytesRead > 0) {
             break;
         }
@@ -625,9 +667,60 @@ int AtParserImpl::readMore(unsigned* timeout) {
         }
     }
     bufPos_ += bytesRead;
+    if (bufPos_ == bufSize_) {
+        // More data is likely pending in the stream
+        growBuffer();
+    }
     return bytesRead;
 }
 
+void AtParserImpl::growBuffer() {
+    if (bufSize_ >= MAX_INPUT_BUF_SIZE) {
+        return;
+    }
+    const size_t size = std::min(bufSize_ * 2, MAX_INPUT_BUF_SIZE);
+    std::unique_ptr<char[]> data(new(std::nothrow) char[size]);
+    if (!data) {
+        return; // Keep using the current buffer
+    }
+    memcpy(data.get(), buf_, bufPos_);
+    bufData_ = std::move(data);
+    buf_ = bufData_.get();
+    bufSize_ = size;
+}
+
+int AtParserImpl::buildUrcTrie() {
+    urcTrie_.clear();
+    if (urcHandlers_.isEmpty()) {
+        return 0;
+    }
+    if (!urcTrie_.append(UrcNode{ -1, -1, -1, '\0' })) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    for (int i = 0; i < urcHandlers_.size(); ++i) {
+        const UrcHandler& h = urcHandlers_.at(i);
+        int node = 0;
+        for (size_t j = 0; j < h.prefixSize; ++j) {
+            const char c = h.prefix[j];
+            int child = urcTrie_.at(node).child;
+            while (child >= 0 && urcTrie_.at(child).c != c) {
+                child = urcTrie_.at(child).next;
+            }
+            if (child < 0) {
+                child = urcTrie_.size();
+                if (!urcTrie_.append(UrcNode{ -1, urcTrie_.at(node).child, -1, c })) {
+                    urcTrie_.clear();
+                    return SYSTEM_ERROR_NO_MEMORY;
+                }
+                urcTrie_.at(node).child = child;
+            }
+            node = child;
+        }
+        urcTrie_.at(node).handler = i;
+    }
+    return 0;
+}
+
 int AtParserImpl::flushCommand(unsigned* timeout) {
     if (!checkStatus(StatusFlag::FLUSH_CMD)) {
         return 0;
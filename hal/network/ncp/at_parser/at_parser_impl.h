@@ -23,6 +23,9 @@
 #include "timer_hal.h"
 
 #include "spark_wiring_vector.h"
+#include "c_string.h"
+
+#include <memory>
 
 #define PARSER_CHECK(_expr) \
         ({ \
@@ -39,9 +42,12 @@ namespace detail {
 
 using spark::Vector;
 
-// Size of the intermediate buffer for received data
+// Initial size of the intermediate buffer for received data
 const size_t INPUT_BUF_SIZE = 64;
 
+// Maximum size of the intermediate buffer for received data
+const size_t MAX_INPUT_BUF_SIZE = 512;
+
 // Maximum number of AT command characters stored by the parser
 const size_t CMD_BUF_SIZE = 128;
 
@@ -50,6 +56,13 @@ const size_t RESP_BUF_SIZE = 128;
 
 class AtParserImpl {
 public:
+    struct QueuedCommand {
+        CString cmd; // Command line
+        unsigned timeout; // Command timeout
+        AtParser::CommandHandler handler; // Completion handler
+        void* data; // User data
+    };
+
     explicit AtParserImpl(AtParserConfig conf);
     ~AtParserImpl();
 
@@ -69,6 +82,11 @@ public:
     void removeUrcHandler(const char* prefix);
     int processUrc(unsigned timeout);
 
+    int queueCommand(CString cmd, unsigned timeout, AtParser::CommandHandler handler, void* data);
+    bool takeCommand(QueuedCommand* cmd);
+    size_t queuedCommands() const;
+    bool isReady() const;
+
     void reset();
 
     void echoEnabled(bool enabled);
@@ -111,10 +129,20 @@ private:
         void* data; // User data
     };
 
+    struct UrcNode {
+        int child; // Index of the first child node, or -1
+        int next; // Index of the next sibling node, or -1
+        int handler; // Index of the handler whose prefix ends at this node, or -1
+        char c; // Prefix character
+    };
+
     const char* const cmdTerm_; // Command terminator string
     const size_t cmdTermSize_; // Size of the command terminator string
 
-    char buf_[INPUT_BUF_SIZE]; // Input buffer
+    char initBuf_[INPUT_BUF_SIZE]; // Initial input buffer
+    std::unique_ptr<char[]> bufData_; // Input buffer allocated when the initial one gets too small
+    char* buf_; // Input buffer
+    size_t bufSize_; // Size of the input buffer
     size_t bufPos_; // Number of bytes in the input buffer
 
     char cmdData_[CMD_BUF_SIZE]; // Command data
@@ -130,6 +158,8 @@ private:
     unsigned status_; // Status flags
 
     Vector<UrcHandler> urcHandlers_; // URC handlers
+    Vector<UrcNode> urcTrie_; // Prefix tree of the URC handlers, the first node is the root
+    Vector<QueuedCommand> cmdQueue_; // Queued commands
     AtParserConfig conf_; // Parser settings
 
     int readRespLine(char* data, size_t size);
@@ -143,6 +173,9 @@ private:
     int readLine(char* data, size_t size, unsigned* timeout);
     int nextLine(unsigned* timeout);
     int readMore(unsigned* timeout);
+    void growBuffer();
+
+    int buildUrcTrie();
 
     int flushCommand(unsigned* timeout);
     int write(const char* data, size_t* size, unsigned* timeout);
@@ -170,6 +203,14 @@ inline void AtParserImpl::logEnabled(bool enabled) {
     conf_.logEnabled(enabled);
 }
 
+inline size_t AtParserImpl::queuedCommands() const {
+    return cmdQueue_.size();
+}
+
+inline bool AtParserImpl::isReady() const {
+    return checkStatus(StatusFlag::READY);
+}
+
 inline const AtParserConfig& AtParserImpl::config() const {
     return conf_;
 }
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "at_profiler.h"
+
+#include "timer_hal.h"
+#include "logging.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstring>
+
+LOG_SOURCE_CATEGORY("ncp.prof");
+
+namespace particle {
+
+namespace {
+
+// Final result codes that consist of the entire line
+const char* const FINAL_RESULT_LINES[] = {
+    "OK",
+    "ERROR",
+    "NO CARRIER",
+    "NO DIALTONE",
+    "NO ANSWER",
+    "BUSY"
+};
+
+// Final result codes that are followed by additional information
+const char* const FINAL_RESULT_PREFIXES[] = {
+    "+CME ERROR",
+    "+CMS ERROR",
+    "CONNECT"
+};
+
+bool isFinalResult(const char* line, bool truncated) {
+    if (!truncated) {
+        for (auto s: FINAL_RESULT_LINES) {
+            if (strcmp(line, s) == 0) {
+                return true;
+            }
+        }
+    }
+    for (auto s: FINAL_RESULT_PREFIXES) {
+        if (strncmp(line, s, strlen(s)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // unnamed
+
+AtProfiler::AtProfiler(Stream* stream, size_t maxSteps) :
+        cmd_(),
+        line_(),
+        strm_(stream),
+        maxSteps_(maxSteps),
+        cmdLen_(0),
+        lineLen_(0),
+        lastTime_(0),
+        lineOverflow_(false) {
+}
+
+void AtProfiler::reset() {
+    steps_.clear();
+    cmdLen_ = 0;
+    lineLen_ = 0;
+    lineOverflow_ = false;
+}
+
+system_tick_t AtProfiler::totalTime() const {
+    if (steps_.isEmpty()) {
+        return 0;
+    }
+    const auto& last = steps_.last();
+    const auto end = last.done ? last.start + last.latency : lastTime_;
+    return end - steps_.first().start;
+}
+
+system_tick_t AtProfiler::commandTime() const {
+    system_tick_t t = 0;
+    for (const auto& s: steps_) {
+        t += s.latency;
+    }
+    return t;
+}
+
+system_tick_t AtProfiler::idleTime() const {
+    system_tick_t t = 0;
+    for (const auto& s: steps_) {
+        t += s.idle;
+    }
+    return t;
+}
+
+void AtProfiler::log() const {
+    LOG(TRACE, "%u steps, %u ms total, %u ms idle", (unsigned)steps_.size(), (unsigned)totalTime(),
+            (unsigned)idleTime());
+    for (const auto& s: steps_) {
+        if (s.done) {
+            LOG(TRACE, "%-31s %6u ms, idle %6u ms", s.command, (unsigned)s.latency, (unsigned)s.idle);
+        } else {
+            LOG(TRACE, "%-31s no result, idle %6u ms", s.command, (unsigned)s.idle);
+        }
+    }
+}
+
+int AtProfiler::read(char* data, size_t size) {
+    const int n = CHECK(strm_->read(data, size));
+    processInput(data, n);
+    return n;
+}
+
+int AtProfiler::peek(char* data, size_t size) {
+    return strm_->peek(data, size);
+}
+
+int AtProfiler::skip(size_t size) {
+    // The skipped data may contain a final result code as well
+    size_t n = 0;
+    while (n < size) {
+        char buf[64];
+        const int r = CHECK(strm_->peek(buf, std::min(size - n, sizeof(buf))));
+        if (r == 0) {
+            break;
+        }
+        const int m = CHECK(strm_->skip(r));
+        processInput(buf, m);
+        n += m;
+        if (m < r) {
+            break;
+        }
+    }
+    return n;
+}
+
+int AtProfiler::availForRead() {
+    return strm_->availForRead();
+}
+
+int AtProfiler::write(const char* data, size_t size) {
+    const int n = CHECK(strm_->write(data, size));
+    processOutput(data, n);
+    return n;
+}
+
+int AtProfiler::flush() {
+    return strm_->flush();
+}
+
+int AtProfiler::availForWrite() {
+    return strm_->availForWrite();
+}
+
+int AtProfiler::waitEvent(unsigned flags, unsigned timeout) {
+    return strm_->waitEvent(flags, timeout);
+}
+
+void AtProfiler::processInput(const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        const char c = data[i];
+        if (c == '\r' || c == '\n') {
+            if (lineLen_ > 0) {
+                endLine();
+            }
+            continue;
+        }
+        if (lineLen_ < sizeof(line_) - 1) {
+            line_[lineLen_++] = c;
+        } else {
+            lineOverflow_ = true;
+        }
+    }
+}
+
+void AtProfiler::processOutput(const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        const char c = data[i];
+        if (c != '\r' && c != '\n') {
+            if (cmdLen_ < MAX_COMMAND_LENGTH) {
+                cmd_[cmdLen_++] = c;
+            }
+            continue;
+        }
+        if (cmdLen_ == 0) {
+            continue; // Second character of a CRLF terminator
+        }
+        cmd_[cmdLen_] = '\0';
+        cmdLen_ = 0;
+        if (steps_.size() >= (int)maxSteps_) {
+            continue;
+        }
+        const auto now = HAL_Timer_Get_Milli_Seconds();
+        Step s = {};
+        memcpy(s.command, cmd_, sizeof(s.command));
+        s.start = now;
+        s.idle = steps_.isEmpty() ? 0 : now - lastTime_;
+        s.done = false;
+        if (steps_.append(s)) {
+            lastTime_ = now;
+        }
+    }
+}
+
+void AtProfiler::endLine() {
+    line_[lineLen_] = '\0';
+    const bool truncated = lineOverflow_;
+    lineLen_ = 0;
+    lineOverflow_ = false;
+    if (steps_.isEmpty() || steps_.last().done || !isFinalResult(line_, truncated)) {
+        return;
+    }
+    const auto now = HAL_Timer_Get_Milli_Seconds();
+    auto& s = steps_.last();
+    s.latency = now - s.start;
+    s.done = true;
+    lastTime_ = now;
+}
+
+} // particle
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "stream.h"
+
+#include "system_tick_hal.h"
+
+#include "spark_wiring_vector.h"
+
+namespace particle {
+
+/**
+ * Stream decorator that measures the latency of AT commands.
+ *
+ * The profiler is installed between the AT parser and the modem's stream and splits the AT
+ * transcript into steps. A step starts when a command line is written to the stream and ends
+ * when the final result code of that command is read from it. The time elapsed between the end
+ * of the previous step and the start of the current one, such as a fixed delay in the NCP client
+ * or a baudrate change, is recorded as the idle time of the step.
+ */
+class AtProfiler: public Stream {
+public:
+    /**
+     * Maximum length of the command line stored with a step.
+     */
+    static const size_t MAX_COMMAND_LENGTH = 31;
+    /**
+     * Default maximum number of recorded steps.
+     */
+    static const size_t DEFAULT_MAX_STEPS = 64;
+
+    /**
+     * Step of the AT transcript.
+     */
+    struct Step {
+        char command[MAX_COMMAND_LENGTH + 1]; ///< Command line, possibly truncated.
+        system_tick_t start; ///< Time when the command line was written.
+        system_tick_t latency; ///< Time until the final result code was received.
+        system_tick_t idle; ///< Time since the end of the previous step.
+        bool done; ///< Whether the final result code was received.
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param stream Underlying stream.
+     * @param maxSteps Maximum number of recorded steps.
+     */
+    explicit AtProfiler(Stream* stream = nullptr, size_t maxSteps = DEFAULT_MAX_STEPS);
+
+    /**
+     * Set the underlying stream.
+     *
+     * Recorded steps are preserved, so the profiler can follow the AT channel when the NCP client
+     * switches from the serial stream to a multiplexed one.
+     */
+    void stream(Stream* stream);
+    /**
+     * Get the underlying stream.
+     */
+    Stream* stream() const;
+
+    /**
+     * Discard all recorded steps.
+     */
+    void reset();
+
+    /**
+     * Get the number of recorded steps.
+     */
+    size_t stepCount() const;
+    /**
+     * Get a recorded step.
+     */
+    const Step& step(size_t index) const;
+
+    /**
+     * Get the time elapsed between the start of the first step and the end of the last one.
+     */
+    system_tick_t totalTime() const;
+    /**
+     * Get the total latency of all steps.
+     */
+    system_tick_t commandTime() const;
+    /**
+     * Get the total idle time of all steps.
+     */
+    system_tick_t idleTime() const;
+
+    /**
+     * Log the recorded steps.
+     */
+    void log() const;
+
+    // Reimplemented from `Stream`
+    int read(char* data, size_t size) override;
+    int peek(char* data, size_t size) override;
+    int skip(size_t size) override;
+    int availForRead() override;
+    int write(const char* data, size_t size) override;
+    int flush() override;
+    int availForWrite() override;
+    int waitEvent(unsigned flags, unsigned timeout) override;
+
+private:
+    spark::Vector<Step> steps_;
+    char cmd_[MAX_COMMAND_LENGTH + 1]; // Command line being written
+    char line_[16]; // Beginning of the response line being read
+    Stream* strm_;
+    size_t maxSteps_;
+    size_t cmdLen_;
+    size_t lineLen_;
+    system_tick_t lastTime_; // End of the last step
+    bool lineOverflow_;
+
+    void processInput(const char* data, size_t size);
+    void processOutput(const char* data, size_t size);
+    void endLine();
+};
+
+inline void AtProfiler::stream(Stream* stream) {
+    strm_ = stream;
+}
+
+inline Stream* AtProfiler::stream() const {
+    return strm_;
+}
+
+inline size_t AtProfiler::stepCount() const {
+    return steps_.size();
+}
+
+inline const AtProfiler::Step& AtProfiler::step(size_t index) const {
+    return steps_.at(index);
+}
+
+} // particle
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace particle {
+
+/**
+ * Modem state cached by a cellular NCP client across resets of the device.
+ *
+ * An instance of this structure is meant to be placed in retained memory, which is not initialized
+ * on boot. The cache is only used if it was written for the same modem and SIM card
+ * configuration, and its checksum is valid.
+ *
+ * The cached settings are persistent on the modem side, so a warm boot can skip the commands
+ * that query and apply them. The registration state tells the client that the modem, which stays
+ * powered across a reset of the device, may still be registered on the network.
+ */
+struct CellularNcpCache {
+    /**
+     * Cached state.
+     */
+    enum Flag {
+        SIM_SELECTED = 0x01, ///< The SIM card slot is configured.
+        RADIO_CONFIGURED = 0x02, ///< Radio access technology and power saving settings are applied.
+        FIRMWARE_VERSION = 0x04, ///< The firmware version of the modem is known.
+        REGISTERED = 0x08 ///< The modem was registered on the network.
+    };
+
+    uint32_t magic;
+    uint16_t size;
+    uint16_t flags;
+    int32_t ncpId;
+    int32_t simType;
+    uint32_t fwVersion;
+    uint32_t checksum;
+
+    /**
+     * Check if the cache is valid for the given modem and SIM card configuration.
+     */
+    bool isValid(int ncpId, int simType) const {
+        return magic == MAGIC && size == sizeof(CellularNcpCache) && this->ncpId == ncpId &&
+                this->simType == simType && checksum == computeChecksum();
+    }
+
+    /**
+     * Check if the cache is valid for the given configuration and has the given state cached.
+     */
+    bool has(Flag flag, int ncpId, int simType) const {
+        return isValid(ncpId, simType) && (flags & flag);
+    }
+
+    /**
+     * Initialize the cache for the given modem and SIM card configuration, unless it's already
+     * valid for them.
+     */
+    void init(int ncpId, int simType) {
+        if (isValid(ncpId, simType)) {
+            return;
+        }
+        magic = MAGIC;
+        size = sizeof(CellularNcpCache);
+        flags = 0;
+        this->ncpId = ncpId;
+        this->simType = simType;
+        fwVersion = 0;
+        update();
+    }
+
+    /**
+     * Set or clear a cached state.
+     *
+     * The cache needs to be initialized.
+     */
+    void set(Flag flag, bool state = true) {
+        if (state) {
+            flags |= flag;
+        } else {
+            flags &= ~flag;
+        }
+        update();
+    }
+
+    /**
+     * Cache the firmware version of the modem.
+     *
+     * The cache needs to be initialized.
+     */
+    void firmwareVersion(unsigned version) {
+        fwVersion = version;
+        set(FIRMWARE_VERSION);
+    }
+
+    /**
+     * Discard all cached state.
+     */
+    void invalidate() {
+        magic = 0;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x4e435063; // "NCPc"
+
+    void update() {
+        checksum = computeChecksum();
+    }
+
+    uint32_t computeChecksum() const {
+        // FNV-1a over all fields preceding the checksum
+        uint32_t h = 2166136261u;
+        const auto p = (const uint8_t*)this;
+        for (size_t i = 0; i < offsetof(CellularNcpCache, checksum); ++i) {
+            h = (h ^ p[i]) * 16777619u;
+        }
+        return h;
+    }
+};
+
+} // particle
@@ -127,6 +127,8 @@ public:
     virtual int getImei(char* buf, size_t size) = 0;
     virtual int getSignalQuality(CellularSignalQuality* qual) = 0;
     virtual int setRegistrationTimeout(unsigned timeout) = 0;
+    // Suspends (state = false) or resumes (state = true) the data received from the data channel
+    virtual int dataChannelFlowControl(bool state) = 0;
 };
 
 inline CellularNcpClientConfig::CellularNcpClientConfig() :
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cellular_ncp_init.h"
+
+#include "at_parser.h"
+#include "at_response.h"
+
+#include "delay_hal.h"
+#include "logging.h"
+#include "check.h"
+
+LOG_SOURCE_CATEGORY("ncp.client");
+
+namespace particle {
+
+namespace {
+
+const unsigned IMSI_RETRY_DELAY = 1000;
+
+} // unnamed
+
+int CellularNcpInit::queueInfoQueries(AtParser* parser) {
+    CHECK(parser->queueCommand([](AtResponse* resp, void* data) {
+        const int r = resp->readResult();
+        if (r != AtResponse::OK) {
+            LOG(WARN, "Unable to read ICCID: %d", r);
+        }
+    }, nullptr, "AT+CCID"));
+    return 0;
+}
+
+int CellularNcpInit::readImsi(AtParser* parser, char* buf, size_t size, unsigned attempts) {
+    int r = AtResponse::ERROR;
+    for (unsigned i = 0; i < attempts; ++i) {
+        if (i > 0) {
+            HAL_Delay_Milliseconds(IMSI_RETRY_DELAY);
+        }
+        auto resp = parser->sendCommand("AT+CIMI");
+        if (resp.hasNextLine()) {
+            CHECK(resp.readLine(buf, size));
+        }
+        r = CHECK(resp.readResult());
+        if (r == AtResponse::OK) {
+            break;
+        }
+    }
+    return r;
+}
+
+} // particle
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "cellular_ncp_cache.h"
+
+#include <cstddef>
+
+namespace particle {
+
+class AtParser;
+
+/**
+ * Bring-up steps shared by the cellular NCP clients.
+ *
+ * The steps use the modem state cached across resets of the device to decide which commands need
+ * to be sent. Settings that persist on the modem side are only applied if they are not cached,
+ * informational queries are deferred until the network registration is in progress, and the
+ * operator selection is skipped if the modem is still registered.
+ */
+class CellularNcpInit {
+public:
+    /**
+     * Construct the steps for the given cache, which is normally placed in retained memory.
+     */
+    explicit CellularNcpInit(CellularNcpCache* cache) :
+            cache_(cache),
+            ncpId_(-1),
+            simType_(-1) {
+    }
+
+    /**
+     * Start the initialization of the modem with the given SIM card configuration.
+     */
+    void begin(int ncpId, int simType) {
+        ncpId_ = ncpId;
+        simType_ = simType;
+        cache_->init(ncpId, simType);
+    }
+
+    /**
+     * Discard the cached state after the initialization has failed.
+     */
+    void failed() {
+        cache_->invalidate();
+    }
+
+    /**
+     * Check if the given state is cached for the current configuration.
+     */
+    bool isCached(CellularNcpCache::Flag flag) const {
+        return cache_->has(flag, ncpId_, simType_);
+    }
+
+    /**
+     * Apply a persistent setting unless it's cached.
+     *
+     * @param flag Cached state.
+     * @param fn Function applying the setting. Returns `0` on success, or a negative result code.
+     * @return `0` on success, or a negative result code in case of an error.
+     */
+    template<typename F>
+    int apply(CellularNcpCache::Flag flag, F fn) {
+        if (!isCached(flag)) {
+            const int r = fn();
+            if (r < 0) {
+                return r;
+            }
+            cache_->set(flag);
+        }
+        return 0;
+    }
+
+    /**
+     * Get the firmware version of the modem, querying it unless it's cached.
+     *
+     * @param query Function querying the version. Returns the version, or a negative result code.
+     * @return Firmware version, or a negative result code in case of an error.
+     */
+    template<typename F>
+    int firmwareVersion(F query) {
+        if (isCached(CellularNcpCache::FIRMWARE_VERSION)) {
+            return cache_->fwVersion;
+        }
+        const int version = query();
+        if (version > 0) {
+            cache_->firmwareVersion(version);
+        }
+        return version;
+    }
+
+    /**
+     * Start the network registration.
+     *
+     * @param queryState Function querying the registration state.
+     * @param isRegistered Function checking if the modem reported that it's registered.
+     * @param selectOperator Function starting the automatic operator selection.
+     * @return `0` on success, or a negative result code in case of an error.
+     */
+    template<typename QueryF, typename RegisteredF, typename SelectF>
+    int registerNet(QueryF queryState, RegisteredF isRegistered, SelectF selectOperator) {
+        // The modem may still be registered if it stayed powered on while the device was reset
+        if (isCached(CellularNcpCache::REGISTERED)) {
+            const int r = queryState();
+            if (r < 0) {
+                return r;
+            }
+        }
+        if (!isRegistered()) {
+            const int r = selectOperator();
+            if (r < 0) {
+                return r;
+            }
+            return queryState();
+        }
+        return 0;
+    }
+
+    /**
+     * Cache whether the modem is registered on the network.
+     */
+    void registered(bool state) {
+        cache_->set(CellularNcpCache::REGISTERED, state);
+    }
+
+    /**
+     * Queue the informational queries, so that they are sent while polling the registration state.
+     *
+     * @return `0` on success, or a negative result code in case of an error.
+     */
+    static int queueInfoQueries(AtParser* parser);
+
+    /**
+     * Read the IMSI of the SIM card.
+     *
+     * @param parser AT parser.
+     * @param buf Destination buffer.
+     * @param size Buffer size.
+     * @param attempts Number of attempts, the command may fail right after the SIM card becomes ready.
+     * @return Final result code of the last attempt, or a negative result code in case of an error.
+     */
+    static int readImsi(AtParser* parser, char* buf, size_t size, unsigned attempts);
+
+private:
+    CellularNcpCache* cache_;
+    int ncpId_;
+    int simType_;
+};
+
+} // particle
@@ -32,6 +32,7 @@
 #include "delay_hal.h"
 #include "core_hal.h"
 #include "deviceid_hal.h"
+#include "platform_headers.h"
 
 #include "stream_util.h"
 
@@ -44,6 +45,11 @@
 #undef LOG_COMPILE_TIME_LEVEL
 #define LOG_COMPILE_TIME_LEVEL LOG_LEVEL_ALL
 
+// Set to 1 to log the latency of each AT command sent while bringing up the modem
+#ifndef QUECTEL_NCP_PROFILE_INIT
+#define QUECTEL_NCP_PROFILE_INIT 0
+#endif
+
 #define CHECK_PARSER(_expr) \
         ({ \
             const auto _r = _expr; \
@@ -115,9 +121,14 @@ const auto ICCID_MAX_LENGTH = 20;
 using LacType = decltype(CellularGlobalIdentity::location_area_code);
 using CidType = decltype(CellularGlobalIdentity::cell_id);
 
+// Modem state that survives a reset of the device
+retained_system CellularNcpCache modemCache;
+
 } // namespace
 
-QuectelNcpClient::QuectelNcpClient() {}
+QuectelNcpClient::QuectelNcpClient() :
+        init_(&modemCache) {
+}
 
 QuectelNcpClient::~QuectelNcpClient() {
     destroy();
@@ -174,6 +185,10 @@ void QuectelNcpClient::destroy() {
 }
 
 int QuectelNcpClient::initParser(Stream* stream) {
+#if QUECTEL_NCP_PROFILE_INIT
+    profiler_.stream(stream);
+    stream = &profiler_;
+#endif
     // Initialize AT parser
     auto parserConf = AtParserConfig().stream(stream).commandTerminator(AtCommandTerminator::CRLF);
     parser_.destroy();
@@ -408,6 +423,13 @@ int QuectelNcpClient::dataChannelWrite(int id, const uint8_t* data, size_t size)
     return err;
 }
 
+int QuectelNcpClient::dataChannelFlowControl(bool state) {
+    // Called from the muxer thread and the TCP/IP thread, the muxer serializes access internally
+    int err = state ? muxer_.resumeChannel(QUECTEL_NCP_PPP_CHANNEL) : muxer_.suspendChannel(QUECTEL_NCP_PPP_CHANNEL);
+    CHECK_TRUE(err == 0, SYSTEM_ERROR_INTERNAL);
+    return 0;
+}
+
 void QuectelNcpClient::processEvents() {
     const NcpClientLock lock(this);
     processEventsImpl();
@@ -780,6 +802,9 @@ int QuectelNcpClient::waitReady() {
     if (ready_) {
         return SYSTEM_ERROR_NONE;
     }
+#if QUECTEL_NCP_PROFILE_INIT
+    profiler_.reset();
+#endif
     muxer_.stop();
     CHECK(serial_->setBaudRate(QUECTEL_NCP_DEFAULT_SERIAL_BAUDRATE));
     CHECK(initParser(serial_.get()));
@@ -797,7 +822,12 @@ int QuectelNcpClient::waitReady() {
         if (r != SYSTEM_ERROR_NONE) {
             LOG(ERROR, "Failed to perform early initialization");
             ready_ = false;
+            // Don't trust the cached modem state until the initialization succeeds again
+            init_.failed();
         }
+#if QUECTEL_NCP_PROFILE_INIT
+        profiler_.log();
+#endif
     } else {
         LOG(ERROR, "No response from NCP");
     }
@@ -841,6 +871,8 @@ int QuectelNcpClient::changeBaudRate(unsigned int baud) {
 }
 
 int QuectelNcpClient::initReady() {
+    init_.begin(ncpId(), (int)conf_.simType());
+
     // Enable flow control and change to runtime baudrate
     auto runtimeBaudrate = QUECTEL_NCP_DEFAULT_SERIAL_BAUDRATE;
 
@@ -867,26 +899,19 @@ int QuectelNcpClient::initReady() {
     int r = CHECK_PARSER(parser_.execCommand("AT+COPS=2"));
     // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
 
-    if (ncpId() == PLATFORM_NCP_QUECTEL_BG96) {
-        // FIXME: Force Cat M1-only mode, do we need to do it on Quectel NCP?
-        // Scan LTE only, take effect immediately
-        CHECK_PARSER(parser_.execCommand("AT+QCFG=\"nwscanmode\",3,1"));
-        // Configure Network Category to be Searched under LTE RAT
-        // Only use LTE Cat M1, take effect immediately
-        CHECK_PARSER(parser_.execCommand("AT+QCFG=\"iotopmode\",0,1"));
-
-        // Force eDRX mode to be disabled.
-        CHECK_PARSER(parser_.execCommand("AT+CEDRXS=0"));
-
-        // Disable Power Saving Mode
-        CHECK_PARSER(parser_.execCommand("AT+CPSMS=0"));
-    }
+    // These settings are persistent, skip them on a warm boot
+    CHECK(init_.apply(CellularNcpCache::RADIO_CONFIGURED, [this]() {
+        return configureRadio();
+    }));
 
     // Select (U)SIM card in slot 1, EG91 has two SIM card slots
-    if (ncpId() == PLATFORM_NCP_QUECTEL_EG91_E || \
+    if ((ncpId() == PLATFORM_NCP_QUECTEL_EG91_E || \
         ncpId() == PLATFORM_NCP_QUECTEL_EG91_NA || \
-        ncpId() == PLATFORM_NCP_QUECTEL_EG91_EX) {
-        CHECK_PARSER(parser_.execCommand("AT+QDSIM=0"));
+        ncpId() == PLATFORM_NCP_QUECTEL_EG91_EX)) {
+        CHECK(init_.apply(CellularNcpCache::SIM_SELECTED, [this]() {
+            CHECK_PARSER(parser_.execCommand("AT+QDSIM=0"));
+            return 0;
+        }));
     }
 
     // Send AT+CMUX and initialize multiplexer
@@ -944,6 +969,28 @@ int QuectelNcpClient::initReady() {
     // just in case
     CHECK_PARSER(parser_.execCommand("AT+QCFG=\"cmux/urcport\",1"));
 
+    // Informational queries don't need to hold up the registration, they are sent while
+    // polling the registration state
+    CHECK(CellularNcpInit::queueInfoQueries(&parser_));
+
+    return SYSTEM_ERROR_NONE;
+}
+
+int QuectelNcpClient::configureRadio() {
+    if (ncpId() == PLATFORM_NCP_QUECTEL_BG96) {
+        // FIXME: Force Cat M1-only mode, do we need to do it on Quectel NCP?
+        // Scan LTE only, take effect immediately
+        CHECK_PARSER(parser_.execCommand("AT+QCFG=\"nwscanmode\",3,1"));
+        // Configure Network Category to be Searched under LTE RAT
+        // Only use LTE Cat M1, take effect immediately
+        CHECK_PARSER(parser_.execCommand("AT+QCFG=\"iotopmode\",0,1"));
+
+        // Force eDRX mode to be disabled.
+        CHECK_PARSER(parser_.execCommand("AT+CEDRXS=0"));
+
+        // Disable Power Saving Mode
+        CHECK_PARSER(parser_.execCommand("AT+CPSMS=0"));
+    }
     return SYSTEM_ERROR_NONE;
 }
 
@@ -955,8 +1002,6 @@ int QuectelNcpClient::checkSimCard() {
     r = CHECK_PARSER(resp.readResult());
     CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
     if (!strcmp(code, "READY")) {
-        r = parser_.execCommand("AT+CCID");
-        CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
         return SYSTEM_ERROR_NONE;
     }
     return SYSTEM_ERROR_UNKNOWN;
@@ -965,13 +1010,10 @@ int QuectelNcpClient::checkSimCard() {
 int QuectelNcpClient::configureApn(const CellularNetworkConfig& conf) {
     netConf_ = conf;
     if (!netConf_.isValid()) {
-        // FIXME: CIMI may fail, need delay here
-        HAL_Delay_Milliseconds(1000);
         // Look for network settings based on IMSI
         char buf[32] = {};
-        auto resp = parser_.sendCommand("AT+CIMI");
-        CHECK_PARSER(resp.readLine(buf, sizeof(buf)));
-        const int r = CHECK_PARSER(resp.readResult());
+        // CIMI may fail right after the SIM card becomes ready, retry instead of always waiting
+        const int r = CHECK_PARSER(CellularNcpInit::readImsi(&parser_, buf, sizeof(buf), 3 /* attempts */));
         CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
         netConf_ = networkConfigForImsi(buf, strlen(buf));
     }
@@ -996,20 +1038,17 @@ int QuectelNcpClient::registerNet() {
 
     connectionState(NcpConnectionState::CONNECTING);
 
-    // NOTE: up to 3 mins
-    r = CHECK_PARSER(parser_.execCommand(3 * 60 * 1000, "AT+COPS=0"));
-    // Ignore response code here
-    // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
-
-    // if (conf_.ncpIdentifier() != MESH_NCP_SARA_R410) {
-    r = CHECK_PARSER(parser_.execCommand("AT+CREG?"));
-    CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
-    r = CHECK_PARSER(parser_.execCommand("AT+CGREG?"));
-    CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
-    // } else {
-    r = CHECK_PARSER(parser_.execCommand("AT+CEREG?"));
-    CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
-    // }
+    CHECK(init_.registerNet([this]() {
+        return queryRegistrationState();
+    }, [this]() {
+        return connState_ == NcpConnectionState::CONNECTED;
+    }, [this]() {
+        // NOTE: up to 3 mins
+        CHECK_PARSER(parser_.execCommand(3 * 60 * 1000, "AT+COPS=0"));
+        // Ignore response code here
+        // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_UNKNOWN);
+        return 0;
+    }));
 
     regStartTime_ = millis();
     regCheckTime_ = regStartTime_;
@@ -1066,7 +1105,12 @@ void QuectelNcpClient::connectionState(NcpConnectionState state) {
         if (r) {
             connState_ = NcpConnectionState::DISCONNECTED;
         }
+#if QUECTEL_NCP_PROFILE_INIT
+        profiler_.log();
+#endif
     }
+    // Remember whether the modem is registered in case the device gets reset
+    init_.registered(connState_ == NcpConnectionState::CONNECTED);
 
     const auto handler = conf_.eventHandler();
     if (handler) {
@@ -1136,19 +1180,25 @@ void QuectelNcpClient::checkRegistrationState() {
     }
 }
 
+int QuectelNcpClient::queryRegistrationState() {
+    // Check GPRS, LET, NB-IOT network registration status
+    CHECK_PARSER_OK(parser_.execCommand("AT+CREG?"));
+    CHECK_PARSER_OK(parser_.execCommand("AT+CGREG?"));
+    CHECK_PARSER_OK(parser_.execCommand("AT+CEREG?"));
+    return SYSTEM_ERROR_NONE;
+}
+
 int QuectelNcpClient::processEventsImpl() {
     CHECK_TRUE(ncpState_ == NcpState::ON, SYSTEM_ERROR_INVALID_STATE);
     parser_.processUrc(); // Ignore errors
+    parser_.processCommands(); // Ignore errors
     checkRegistrationState();
     if (connState_ != NcpConnectionState::CONNECTING || millis() - regCheckTime_ < REGISTRATION_CHECK_INTERVAL) {
         return SYSTEM_ERROR_NONE;
     }
     SCOPE_GUARD({ regCheckTime_ = millis(); });
 
-    // Check GPRS, LET, NB-IOT network registration status
-    CHECK_PARSER_OK(parser_.execCommand("AT+CREG?"));
-    CHECK_PARSER_OK(parser_.execCommand("AT+CGREG?"));
-    CHECK_PARSER_OK(parser_.execCommand("AT+CEREG?"));
+    CHECK(queryRegistrationState());
 
     if (connState_ == NcpConnectionState::CONNECTING && millis() - regStartTime_ >= registrationTimeout_) {
         LOG(WARN, "Resetting the modem due to the network registration timeout");
@@ -1199,6 +1249,8 @@ int QuectelNcpClient::modemPowerOn() const {
             }
             HAL_Delay_Milliseconds(150);
         }
+        // The modem needs to register on the network again
+        init_.registered(false);
         if (powerGood) {
             LOG(TRACE, "Modem powered on");
         } else {
@@ -31,6 +31,7 @@
 #include "timer_hal.h"
 #include "delay_hal.h"
 #include "core_hal.h"
+#include "platform_headers.h"
 
 #include "stream_util.h"
 
@@ -44,6 +45,11 @@
 #undef LOG_COMPILE_TIME_LEVEL
 #define LOG_COMPILE_TIME_LEVEL LOG_LEVEL_ALL
 
+// Set to 1 to log the latency of each AT command sent while bringing up the modem
+#ifndef UBLOX_NCP_PROFILE_INIT
+#define UBLOX_NCP_PROFILE_INIT 0
+#endif
+
 #define CHECK_PARSER(_expr) \
         ({ \
             const auto _r = _expr; \
@@ -113,10 +119,13 @@ using CidType = decltype(CellularGlobalIdentity::cell_id);
 const size_t UBLOX_NCP_R4_BYTES_PER_WINDOW_THRESHOLD = 512;
 const system_tick_t UBLOX_NCP_R4_WINDOW_SIZE_MS = 50;
 
+// Modem state that survives a reset of the device
+retained_system CellularNcpCache modemCache;
 
 } // anonymous
 
-SaraNcpClient::SaraNcpClient() {
+SaraNcpClient::SaraNcpClient() :
+        init_(&modemCache) {
 }
 
 SaraNcpClient::~SaraNcpClient() {
@@ -163,6 +172,10 @@ void SaraNcpClient::destroy() {
 }
 
 int SaraNcpClient::initParser(Stream* stream) {
+#if UBLOX_NCP_PROFILE_INIT
+    profiler_.stream(stream);
+    stream = &profiler_;
+#endif
     // Initialize AT parser
     auto parserConf = AtParserConfig()
             .stream(stream)
@@ -427,6 +440,13 @@ int SaraNcpClient::dataChannelWrite(int id, const uint8_t* data, size_t size) {
     return err;
 }
 
+int SaraNcpClient::dataChannelFlowControl(bool state) {
+    // Called from the muxer thread and the TCP/IP thread, the muxer serializes access internally
+    int err = state ? muxer_.resumeChannel(UBLOX_NCP_PPP_CHANNEL) : muxer_.suspendChannel(UBLOX_NCP_PPP_CHANNEL);
+    CHECK_TRUE(err == 0, SYSTEM_ERROR_INTERNAL);
+    return 0;
+}
+
 void SaraNcpClient::processEvents() {
     const NcpClientLock lock(this);
     processEventsImpl();
@@ -766,6 +786,9 @@ int SaraNcpClient::waitReady() {
     if (ready_) {
         return 0;
     }
+#if UBLOX_NCP_PROFILE_INIT
+    profiler_.reset();
+#endif
     muxer_.stop();
     CHECK(serial_->setBaudRate(UBLOX_NCP_DEFAULT_SERIAL_BAUDRATE));
     CHECK(initParser(serial_.get()));
@@ -798,7 +821,12 @@ int SaraNcpClient::waitReady() {
         if (r != SYSTEM_ERROR_NONE) {
             LOG(ERROR, "Failed to perform early initialization");
             ready_ = false;
+            // Don't trust the cached modem state until the initialization succeeds again
+            init_.failed();
         }
+#if UBLOX_NCP_PROFILE_INIT
+        profiler_.log();
+#endif
     } else {
         LOG(ERROR, "No response from NCP");
     }
@@ -817,6 +845,27 @@ int SaraNcpClient::waitReady() {
 }
 
 int SaraNcpClient::selectSimCard() {
+    // The SIM card slot configuration is persistent, skip it on a warm boot
+    CHECK(init_.apply(CellularNcpCache::SIM_SELECTED, [this]() {
+        return selectSimSlot();
+    }));
+
+    // Using numeric CME ERROR codes
+    // int r = CHECK_PARSER(parser_.execCommand("AT+CMEE=1"));
+    // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
+
+    int simState = 0;
+    for (unsigned i = 0; i < 10; ++i) {
+        simState = checkSimCard();
+        if (!simState) {
+            break;
+        }
+        HAL_Delay_Milliseconds(1000);
+    }
+    return simState;
+}
+
+int SaraNcpClient::selectSimSlot() {
     // Read current GPIO configuration
     int mode = -1;
     int value = -1;
@@ -903,20 +952,7 @@ int SaraNcpClient::selectSimCard() {
 
         CHECK(waitAtResponse(20000));
     }
-
-    // Using numeric CME ERROR codes
-    // int r = CHECK_PARSER(parser_.execCommand("AT+CMEE=1"));
-    // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-
-    int simState = 0;
-    for (unsigned i = 0; i < 10; ++i) {
-        simState = checkSimCard();
-        if (!simState) {
-            break;
-        }
-        HAL_Delay_Milliseconds(1000);
-    }
-    return simState;
+    return 0;
 }
 
 int SaraNcpClient::changeBaudRate(unsigned int baud) {
@@ -945,6 +981,8 @@ int SaraNcpClient::getAppFirmwareVersion() {
 }
 
 int SaraNcpClient::initReady() {
+    init_.begin(ncpId(), (int)conf_.simType());
+
     // Select either internal or external SIM card slot depending on the configuration
     CHECK(selectSimCard());
 
@@ -955,7 +993,10 @@ int SaraNcpClient::initReady() {
     if (conf_.ncpIdentifier() != PLATFORM_NCP_SARA_R410) {
         CHECK(changeBaudRate(UBLOX_NCP_RUNTIME_SERIAL_BAUDRATE_U2));
     } else {
-        fwVersion_ = getAppFirmwareVersion();
+        // The firmware version of the modem doesn't change, skip querying it on a warm boot
+        fwVersion_ = init_.firmwareVersion([this]() {
+            return getAppFirmwareVersion();
+        });
         if (fwVersion_ > 0) {
             // L0.0.00.00.05.06,A.02.00 has a memory issue
             memoryIssuePresent_ = (fwVersion_ == UBLOX_NCP_R4_APP_FW_VERSION_MEMORY_LEAK_ISSUE);
@@ -976,75 +1017,10 @@ int SaraNcpClient::initReady() {
     CHECK(waitAtResponse(10000));
 
     if (ncpId() == PLATFORM_NCP_SARA_R410) {
-        // Set UMNOPROF = SIM_SELECT
-        auto resp = parser_.sendCommand("AT+UMNOPROF?");
-        bool reset = false;
-        int umnoprof = static_cast<int>(UbloxSaraUmnoprof::NONE);
-        r = CHECK_PARSER(resp.scanf("+UMNOPROF: %d", &umnoprof));
-        CHECK_PARSER_OK(resp.readResult());
-        if (r == 1 && static_cast<UbloxSaraUmnoprof>(umnoprof) == UbloxSaraUmnoprof::SW_DEFAULT) {
-            // Disconnect before making changes to the UMNOPROF
-            r = CHECK_PARSER(parser_.execCommand("AT+COPS=2,2"));
-            if (r == AtResponse::OK) {
-                // This is a persistent setting
-                auto respUmno = parser_.sendCommand(1000, "AT+UMNOPROF=%d", static_cast<int>(UbloxSaraUmnoprof::SIM_SELECT));
-                respUmno.readResult();
-                // Not checking for error since we will reset either way
-                reset = true;
-            }
-        }
-        if (reset) {
-            const int respCfun = CHECK_PARSER(parser_.execCommand("AT+CFUN=15"));
-            CHECK_TRUE(respCfun == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-            HAL_Delay_Milliseconds(10000);
-            CHECK(waitAtResponse(20000));
-        }
-
-        // Force Cat M1-only mode
-        // We may encounter a CME ERROR response with u-blox firmware 05.08,A.02.04 and in that case Cat-M1 mode is
-        // already enforced properly based on the UMNOPROF setting.
-        resp = parser_.sendCommand("AT+URAT?");
-        unsigned selectAct = 0, preferAct1 = 0, preferAct2 = 0;
-        r = resp.scanf("+URAT: %u,%u,%u", &selectAct, &preferAct1, &preferAct2);
-        resp.readResult();
-        if (r > 0) {
-            if (selectAct != 7 || (r >= 2 && preferAct1 != 7) || (r >= 3 && preferAct2 != 7)) { // 7: LTE Cat M1
-                // Disconnect before making changes to URAT
-                r = CHECK_PARSER(parser_.execCommand("AT+COPS=2,2"));
-                if (r == AtResponse::OK) {
-                    // This is a persistent setting
-                    CHECK_PARSER_OK(parser_.execCommand("AT+URAT=7"));
-                }
-            }
-        }
-
-        // Force eDRX mode to be disabled. AT+CEDRXS=0 doesn't seem disable eDRX completely, so
-        // so we're disabling it for each reported RAT individually
-        Vector<unsigned> acts;
-        resp = parser_.sendCommand("AT+CEDRXS?");
-        while (resp.hasNextLine()) {
-            unsigned act = 0;
-            r = resp.scanf("+CEDRXS: %u", &act);
-            if (r == 1) { // Ignore scanf() errors
-                CHECK_TRUE(acts.append(act), SYSTEM_ERROR_NO_MEMORY);
-            }
-        }
-        CHECK_PARSER_OK(resp.readResult());
-        int lastError = AtResponse::OK;
-        for (unsigned act: acts) {
-            // This command may fail for unknown reason. eDRX mode is a persistent setting and, eventually,
-            // it will get applied for each RAT during subsequent re-initialization attempts
-            r = CHECK_PARSER(parser_.execCommand("AT+CEDRXS=3,%u", act)); // 3: Disable the use of eDRX
-            if (r != AtResponse::OK) {
-                lastError = r;
-            }
-        }
-        CHECK_PARSER_OK(lastError);
-        // Force Power Saving mode to be disabled
-        //
-        // TODO: if we enable this feature in the future add logic to CHECK_PARSER macro(s)
-        // to wait longer for device to become active (see MDMParser::_atOk)
-        CHECK_PARSER_OK(parser_.execCommand("AT+CPSMS=0"));
+        // These settings are persistent, skip them on a warm boot
+        CHECK(init_.apply(CellularNcpCache::RADIO_CONFIGURED, [this]() {
+            return configureRadio();
+        }));
     } else {
         // Force Power Saving mode to be disabled
         //
@@ -1106,6 +1082,83 @@ int SaraNcpClient::initReady() {
 
     muxerSg.dismiss();
 
+    // Informational queries don't need to hold up the registration, they are sent while
+    // polling the registration state
+    CHECK(CellularNcpInit::queueInfoQueries(&parser_));
+
+    return 0;
+}
+
+int SaraNcpClient::configureRadio() {
+    // Set UMNOPROF = SIM_SELECT
+    auto resp = parser_.sendCommand("AT+UMNOPROF?");
+    bool reset = false;
+    int umnoprof = static_cast<int>(UbloxSaraUmnoprof::NONE);
+    int r = CHECK_PARSER(resp.scanf("+UMNOPROF: %d", &umnoprof));
+    CHECK_PARSER_OK(resp.readResult());
+    if (r == 1 && static_cast<UbloxSaraUmnoprof>(umnoprof) == UbloxSaraUmnoprof::SW_DEFAULT) {
+        // Disconnect before making changes to the UMNOPROF
+        r = CHECK_PARSER(parser_.execCommand("AT+COPS=2,2"));
+        if (r == AtResponse::OK) {
+            // This is a persistent setting
+            auto respUmno = parser_.sendCommand(1000, "AT+UMNOPROF=%d", static_cast<int>(UbloxSaraUmnoprof::SIM_SELECT));
+            respUmno.readResult();
+            // Not checking for error since we will reset either way
+            reset = true;
+        }
+    }
+    if (reset) {
+        const int respCfun = CHECK_PARSER(parser_.execCommand("AT+CFUN=15"));
+        CHECK_TRUE(respCfun == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
+        HAL_Delay_Milliseconds(10000);
+        CHECK(waitAtResponse(20000));
+    }
+
+    // Force Cat M1-only mode
+    // We may encounter a CME ERROR response with u-blox firmware 05.08,A.02.04 and in that case Cat-M1 mode is
+    // already enforced properly based on the UMNOPROF setting.
+    resp = parser_.sendCommand("AT+URAT?");
+    unsigned selectAct = 0, preferAct1 = 0, preferAct2 = 0;
+    r = resp.scanf("+URAT: %u,%u,%u", &selectAct, &preferAct1, &preferAct2);
+    resp.readResult();
+    if (r > 0) {
+        if (selectAct != 7 || (r >= 2 && preferAct1 != 7) || (r >= 3 && preferAct2 != 7)) { // 7: LTE Cat M1
+            // Disconnect before making changes to URAT
+            r = CHECK_PARSER(parser_.execCommand("AT+COPS=2,2"));
+            if (r == AtResponse::OK) {
+                // This is a persistent setting
+                CHECK_PARSER_OK(parser_.execCommand("AT+URAT=7"));
+            }
+        }
+    }
+
+    // Force eDRX mode to be disabled. AT+CEDRXS=0 doesn't seem disable eDRX completely, so
+    // so we're disabling it for each reported RAT individually
+    Vector<unsigned> acts;
+    resp = parser_.sendCommand("AT+CEDRXS?");
+    while (resp.hasNextLine()) {
+        unsigned act = 0;
+        r = resp.scanf("+CEDRXS: %u", &act);
+        if (r == 1) { // Ignore scanf() errors
+            CHECK_TRUE(acts.append(act), SYSTEM_ERROR_NO_MEMORY);
+        }
+    }
+    CHECK_PARSER_OK(resp.readResult());
+    int lastError = AtResponse::OK;
+    for (unsigned act: acts) {
+        // This command may fail for unknown reason. eDRX mode is a persistent setting and, eventually,
+        // it will get applied for each RAT during subsequent re-initialization attempts
+        r = CHECK_PARSER(parser_.execCommand("AT+CEDRXS=3,%u", act)); // 3: Disable the use of eDRX
+        if (r != AtResponse::OK) {
+            lastError = r;
+        }
+    }
+    CHECK_PARSER_OK(lastError);
+    // Force Power Saving mode to be disabled
+    //
+    // TODO: if we enable this feature in the future add logic to CHECK_PARSER macro(s)
+    // to wait longer for device to become active (see MDMParser::_atOk)
+    CHECK_PARSER_OK(parser_.execCommand("AT+CPSMS=0"));
     return 0;
 }
 
@@ -1117,8 +1170,6 @@ int SaraNcpClient::checkSimCard() {
     r = CHECK_PARSER(resp.readResult());
     CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
     if (!strcmp(code, "READY")) {
-        r = parser_.execCommand("AT+CCID");
-        CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
         return 0;
     }
     return SYSTEM_ERROR_UNKNOWN;
@@ -1129,9 +1180,7 @@ int SaraNcpClient::configureApn(const CellularNetworkConfig& conf) {
     if (!netConf_.isValid()) {
         // Look for network settings based on IMSI
         char buf[32] = {};
-        auto resp = parser_.sendCommand("AT+CIMI");
-        CHECK_PARSER(resp.readLine(buf, sizeof(buf)));
-        const int r = CHECK_PARSER(resp.readResult());
+        const int r = CHECK_PARSER(CellularNcpInit::readImsi(&parser_, buf, sizeof(buf), 1 /* attempts */));
         CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
         netConf_ = networkConfigForImsi(buf, strlen(buf));
     }
@@ -1164,21 +1213,18 @@ int SaraNcpClient::registerNet() {
     connectionState(NcpConnectionState::CONNECTING);
     registeredTime_ = 0;
 
-    // NOTE: up to 3 mins (FIXME: there seems to be a bug where this timeout of 3 minutes
-    //       is not being respected by u-blox modems.  Setting to 5 for now.)
-    r = CHECK_PARSER(parser_.execCommand(5 * 60 * 1000, "AT+COPS=0,2"));
-    // Ignore response code here
-    // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-
-    if (conf_.ncpIdentifier() != PLATFORM_NCP_SARA_R410) {
-        r = CHECK_PARSER(parser_.execCommand("AT+CREG?"));
-        CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-        r = CHECK_PARSER(parser_.execCommand("AT+CGREG?"));
-        CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-    } else {
-        r = CHECK_PARSER(parser_.execCommand("AT+CEREG?"));
-        CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
-    }
+    CHECK(init_.registerNet([this]() {
+        return queryRegistrationState();
+    }, [this]() {
+        return connState_ == NcpConnectionState::CONNECTED;
+    }, [this]() {
+        // NOTE: up to 3 mins (FIXME: there seems to be a bug where this timeout of 3 minutes
+        //       is not being respected by u-blox modems.  Setting to 5 for now.)
+        CHECK_PARSER(parser_.execCommand(5 * 60 * 1000, "AT+COPS=0,2"));
+        // Ignore response code here
+        // CHECK_TRUE(r == AtResponse::OK, SYSTEM_ERROR_AT_NOT_OK);
+        return 0;
+    }));
 
     regStartTime_ = millis();
     regCheckTime_ = regStartTime_;
@@ -1233,7 +1279,12 @@ void SaraNcpClient::connectionState(NcpConnectionState state) {
         if (r) {
             connState_ = NcpConnectionState::DISCONNECTED;
         }
+#if UBLOX_NCP_PROFILE_INIT
+        profiler_.log();
+#endif
     }
+    // Remember whether the modem is registered in case the device gets reset
+    init_.registered(connState_ == NcpConnectionState::CONNECTED);
 
     const auto handler = conf_.eventHandler();
     if (handler) {
@@ -1310,9 +1361,20 @@ void SaraNcpClient::checkRegistrationState() {
     }
 }
 
+int SaraNcpClient::queryRegistrationState() {
+    if (conf_.ncpIdentifier() != PLATFORM_NCP_SARA_R410) {
+        CHECK_PARSER_OK(parser_.execCommand("AT+CREG?"));
+        CHECK_PARSER_OK(parser_.execCommand("AT+CGREG?"));
+    } else {
+        CHECK_PARSER_OK(parser_.execCommand("AT+CEREG?"));
+    }
+    return 0;
+}
+
 int SaraNcpClient::processEventsImpl() {
     CHECK_TRUE(ncpState_ == NcpState::ON, SYSTEM_ERROR_INVALID_STATE);
     parser_.processUrc(); // Ignore errors
+    parser_.processCommands(); // Ignore errors
     checkRegistrationState();
     if (connState_ != NcpConnectionState::CONNECTING ||
             millis() - regCheckTime_ < REGISTRATION_CHECK_INTERVAL) {
@@ -1321,12 +1383,7 @@ int SaraNcpClient::processEventsImpl() {
     SCOPE_GUARD({
         regCheckTime_ = millis();
     });
-    if (conf_.ncpIdentifier() != PLATFORM_NCP_SARA_R410) {
-        CHECK_PARSER_OK(parser_.execCommand("AT+CREG?"));
-        CHECK_PARSER_OK(parser_.execCommand("AT+CGREG?"));
-    } else {
-        CHECK_PARSER_OK(parser_.execCommand("AT+CEREG?"));
-    }
+    CHECK(queryRegistrationState());
     if (connState_ == NcpConnectionState::CONNECTING &&
             millis() - regStartTime_ >= registrationTimeout_) {
         LOG(WARN, "Resetting the modem due to the network registration timeout");
@@ -1395,6 +1452,8 @@ int SaraNcpClient::modemPowerOn() const {
             }
             HAL_Delay_Milliseconds(100);
         }
+        // The modem needs to register on the network again
+        init_.registered(false);
         if (powerGood) {
             LOG(TRACE, "Modem powered on");
         } else {
@@ -20,9 +20,11 @@
 #include <cstdlib>
 
 #include "network/ncp/cellular/cellular_ncp_client.h"
+#include "network/ncp/cellular/cellular_ncp_init.h"
 #include "platform_ncp.h"
 
 #include "at_parser.h"
+#include "at_profiler.h"
 
 #include "spark_wiring_thread.h"
 #include "gsm0710muxer/channel_stream.h"
@@ -64,9 +66,12 @@ public:
     virtual int getImei(char* buf, size_t size) override;
     virtual int getSignalQuality(CellularSignalQuality* qual) override;
     virtual int setRegistrationTimeout(unsigned timeout) override;
+    virtual int dataChannelFlowControl(bool state) override;
 
 private:
     AtParser parser_;
+    AtProfiler profiler_;
+    CellularNcpInit init_;
     std::unique_ptr<SerialStream> serial_;
     RecursiveMutex mutex_;
     CellularNcpClientConfig conf_;
@@ -107,9 +112,12 @@ private:
     int initReady();
     int waitAtResponse(unsigned int timeout, unsigned int period = 1000);
     int selectSimCard();
+    int selectSimSlot();
     int checkSimCard();
+    int configureRadio();
     int configureApn(const CellularNetworkConfig& conf);
     int registerNet();
+    int queryRegistrationState();
     int changeBaudRate(unsigned int baud);
     static int muxChannelStateCb(uint8_t channel, decltype(muxer_)::ChannelState oldState,
             decltype(muxer_)::ChannelState newState, void* ctx);
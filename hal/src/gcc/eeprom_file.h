@@ -5,4 +5,16 @@ void GCC_EEPROM_Load(const char* filename);
 
 void GCC_EEPROM_Save(const char* filename);
 
+/**
+ * Write the modified eeprom data to the loaded file. Unless `force` is set,
+ * the data is written back at most once per MappedFile::SYNC_INTERVAL_MS.
+ */
+void GCC_EEPROM_Flush(bool force = true);
+
+/**
+ * Detach the eeprom from the loaded file. The eeprom keeps its current contents
+ * as a transient storage.
+ */
+void GCC_EEPROM_Unload();
+
 
@@ -22,25 +22,36 @@
 #include "filesystem.h"
 #include <string.h>
 #include <string>
+#include <stdexcept>
 
 /*
  * Implements eeprom either as a transient storage,
  * or as a persisted storage, depending upon if the file exists.
  *
+ * The persisted storage is the eeprom file mapped into memory,
+ * so that a write only modifies the affected bytes of the file.
  */
 
-static uint8_t eeprom[2048];
+static uint8_t eeprom_data[2048];
+static uint8_t* eeprom = eeprom_data;
 
-std::string eeprom_file;
+static MappedFile eeprom_file;
 
 /**
- * Write the eeprom state to the file.
- * This currently writes the entire file.
+ * Write the modified eeprom data to the file.
  */
-void GCC_EEPROM_Flush()
+void GCC_EEPROM_Flush(bool force)
 {
-	if (eeprom_file.length()) {
-		GCC_EEPROM_Save(eeprom_file.c_str());
+	if (eeprom_file.isOpen()) {
+		eeprom_file.sync(force);
+	}
+}
+
+static void eeprom_modified(uint32_t index, size_t length)
+{
+	if (eeprom_file.isOpen()) {
+		eeprom_file.markDirty(index, length);
+		eeprom_file.sync();
 	}
 }
 
@@ -51,7 +62,7 @@ void GCC_EEPROM_Flush()
  */
 void HAL_EEPROM_Init()
 {
-	if (!eeprom_file.length())
+	if (!eeprom_file.isOpen())
 		HAL_EEPROM_Clear();
 }
 
@@ -75,18 +86,18 @@ void HAL_EEPROM_Get(uint32_t index, void *data, size_t length)
 void HAL_EEPROM_Put(uint32_t index, const void *data, size_t length)
 {
 	memcpy(eeprom+index, data, length);
-	GCC_EEPROM_Flush();
+	eeprom_modified(index, length);
 }
 
 size_t HAL_EEPROM_Length()
 {
-	return sizeof(eeprom);
+	return sizeof(eeprom_data);
 }
 
 void HAL_EEPROM_Clear()
 {
-	memset(eeprom, 0xFF, sizeof(eeprom));
-	GCC_EEPROM_Flush();
+	memset(eeprom, 0xFF, sizeof(eeprom_data));
+	eeprom_modified(0, sizeof(eeprom_data));
 }
 
 bool HAL_EEPROM_Has_Pending_Erase()
@@ -100,13 +111,28 @@ void HAL_EEPROM_Perform_Pending_Erase()
 
 void GCC_EEPROM_Load(const char* filename)
 {
-	read_file(filename, eeprom, sizeof(eeprom));
-	eeprom_file = filename;
+	if (!eeprom_file.open(filename, sizeof(eeprom_data))) {
+		throw std::invalid_argument(std::string("unable to map file '") + filename + "'");
+	}
+	// Bytes that are missing in the file keep their current value
+	const size_t size = eeprom_file.fileSize();
+	if (size < sizeof(eeprom_data)) {
+		memcpy(eeprom_file.data() + size, eeprom_data + size, sizeof(eeprom_data) - size);
+		eeprom_file.markDirty(size, sizeof(eeprom_data) - size);
+	}
+	eeprom = eeprom_file.data();
 }
 
 void GCC_EEPROM_Save(const char* filename)
 {
-	write_file(filename, eeprom, sizeof(eeprom));
+	write_file(filename, eeprom, sizeof(eeprom_data));
 }
 
-
+void GCC_EEPROM_Unload()
+{
+	if (eeprom_file.isOpen()) {
+		memcpy(eeprom_data, eeprom, sizeof(eeprom_data));
+		eeprom = eeprom_data;
+		eeprom_file.close();
+	}
+}
@@ -3,6 +3,12 @@
 #include <stddef.h>
 #include <cstdio>
 #include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "service_debug.h"
 #include "filesystem.h"
 
@@ -10,6 +16,26 @@ const char* rootDir = NULL;
 
 using namespace std;
 
+namespace {
+
+string file_path(const char* filename)
+{
+    string path;
+    if (rootDir) {
+        path = rootDir;
+        path += '/';
+    }
+    path += filename;
+    return path;
+}
+
+uint64_t millis()
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
 void set_root_dir(const char* dir) {
     rootDir = dir;
 }
@@ -33,26 +59,17 @@ bool exists_file(const char* filename)
 
 void read_file(const char* filename, void* data, size_t length)
 {
-    char buf[256];
-    buf[0] = 0;
-    if (rootDir) {
-        strcpy(buf, rootDir);
-        strcat(buf, "/");
+    MappedFile file;
+    if (!file.open(filename, length, MappedFile::READ_ONLY)) {
+        throw invalid_argument(string("unable to read file '") + file_path(filename) + "'");
     }
-    strcat(buf, filename);
-    FILE *f = fopen(buf, "rb");
-    if (f!=NULL) {
-        length = fread(data, 1, length, f);
-        INFO("read file %s length %d", buf, length);
-        fclose(f);
-    }
-    else
-    {
-        throw invalid_argument(string("unable to read file '") + buf + "'");
+    length = file.size();
+    if (length > 0) {
+        memcpy(data, file.data(), length);
     }
+    INFO("read file %s length %d", file_path(filename).c_str(), length);
 }
 
-
 void write_file(const char* filename, const void* data, size_t length)
 {
     char buf[256];
@@ -74,3 +91,115 @@ void write_file(const char* filename, const void* data, size_t length)
     }
 }
 
+MappedFile::MappedFile() :
+        data_(nullptr),
+        size_(0),
+        fileSize_(0),
+        dirtyBegin_(0),
+        dirtyEnd_(0),
+        lastSync_(0),
+        fd_(-1)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char* filename, size_t size, unsigned flags)
+{
+    close();
+    const bool readOnly = flags & READ_ONLY;
+    int oflags = readOnly ? O_RDONLY : (O_RDWR | O_CREAT);
+    if (flags & TRUNCATE) {
+        oflags |= O_TRUNC;
+    }
+    const int fd = ::open(file_path(filename).c_str(), oflags, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        return false;
+    }
+    fileSize_ = st.st_size;
+    if (readOnly) {
+        size = std::min(size, fileSize_);
+    } else if (fileSize_ < size && ftruncate(fd, size) < 0) {
+        ::close(fd);
+        return false;
+    }
+    if (size > 0) {
+        const auto data = mmap(nullptr, size, readOnly ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        data_ = (uint8_t*)data;
+    }
+    size_ = size;
+    dirtyBegin_ = dirtyEnd_ = 0;
+    lastSync_ = millis();
+    fd_ = fd;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (fd_ < 0) {
+        return;
+    }
+    sync(true /* force */);
+    if (data_) {
+        munmap(data_, size_);
+        data_ = nullptr;
+    }
+    ::close(fd_);
+    fd_ = -1;
+    size_ = 0;
+    fileSize_ = 0;
+}
+
+void MappedFile::close(size_t fileSize)
+{
+    if (fd_ >= 0 && ftruncate(fd_, fileSize) < 0) {
+        WARN("unable to truncate file");
+    }
+    close();
+}
+
+void MappedFile::markDirty(size_t offset, size_t size)
+{
+    if (offset >= size_ || size == 0) {
+        return;
+    }
+    const size_t end = std::min(offset + size, size_);
+    if (dirtyBegin_ == dirtyEnd_) {
+        dirtyBegin_ = offset;
+        dirtyEnd_ = end;
+    } else {
+        dirtyBegin_ = std::min(dirtyBegin_, offset);
+        dirtyEnd_ = std::max(dirtyEnd_, end);
+    }
+}
+
+void MappedFile::sync(bool force)
+{
+    if (dirtyBegin_ == dirtyEnd_) {
+        return;
+    }
+    const auto now = millis();
+    if (!force && now - lastSync_ < SYNC_INTERVAL_MS) {
+        return;
+    }
+    // msync() requires a page-aligned address
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t begin = dirtyBegin_ / pageSize * pageSize;
+    if (msync(data_ + begin, dirtyEnd_ - begin, force ? MS_SYNC : MS_ASYNC) < 0) {
+        WARN("msync() failed");
+    }
+    dirtyBegin_ = dirtyEnd_ = 0;
+    lastSync_ = now;
+}
@@ -9,6 +9,7 @@
 #define	FILESYSTEM_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 void read_file(const char* filename, void* data, size_t length);
 void write_file(const char* filename, const void* data, size_t length);
@@ -17,6 +18,97 @@ bool exists_file(const char* filename);
 
 void set_root_dir(const char* dir);
 
+/**
+ * A file mapped into memory.
+ *
+ * Changes made to the mapped data are written to the file by the OS. Modified ranges are
+ * tracked with markDirty() and written back in batches by sync(), so frequent small writes
+ * don't cause a file operation each.
+ */
+class MappedFile
+{
+public:
+    enum Flags {
+        READ_ONLY = 0x01, ///< Map the file for reading. The file is not extended.
+        TRUNCATE = 0x02 ///< Discard the current contents of the file.
+    };
+
+    /**
+     * Minimum interval between two sync() calls that write the dirty range back to the file.
+     */
+    static const unsigned SYNC_INTERVAL_MS = 1000;
+
+    MappedFile();
+    ~MappedFile();
+
+    /**
+     * Map a file, creating it if necessary.
+     *
+     * Unless the file is opened for reading only, it is extended to the given size.
+     *
+     * @param filename File name, relative to the root directory.
+     * @param size Number of bytes to map.
+     * @param flags A combination of `Flags`.
+     * @return `true` on success.
+     */
+    bool open(const char* filename, size_t size, unsigned flags = 0);
+    /**
+     * Write the dirty range back and unmap the file.
+     */
+    void close();
+    /**
+     * Write the dirty range back, unmap the file and truncate it to the given size.
+     */
+    void close(size_t fileSize);
+
+    /**
+     * Mark a range of the mapped data as modified.
+     */
+    void markDirty(size_t offset, size_t size);
+    /**
+     * Write the dirty range back to the file.
+     *
+     * Unless `force` is set, this does nothing if the previous write-back occurred less than
+     * `SYNC_INTERVAL_MS` milliseconds ago.
+     */
+    void sync(bool force = false);
+
+    uint8_t* data() const {
+        return data_;
+    }
+
+    /**
+     * Get the number of mapped bytes.
+     */
+    size_t size() const {
+        return size_;
+    }
+
+    /**
+     * Get the size of the file before it was extended.
+     */
+    size_t fileSize() const {
+        return fileSize_;
+    }
+
+    bool isOpen() const {
+        return fd_ >= 0;
+    }
+
+private:
+    uint8_t* data_;
+    size_t size_;
+    size_t fileSize_;
+    size_t dirtyBegin_;
+    size_t dirtyEnd_;
+    uint64_t lastSync_;
+    int fd_;
+
+    // Non-copyable
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
 
 #endif	/* FILESYSTEM_H */
 
@@ -2,6 +2,7 @@
 #include "device_config.h"
 #include <string.h>
 #include <cstdio>
+#include <algorithm>
 #include "service_debug.h"
 #include "core_hal.h"
 #include "filesystem.h"
@@ -29,21 +30,31 @@ uint16_t HAL_OTA_ChunkSize()
     return 512;
 }
 
-FILE* output_file;
+static MappedFile output_file;
+static size_t output_size = 0; // Number of bytes written to the output file
 
 bool HAL_FLASH_Begin(uint32_t sFLASH_Address, uint32_t fileSize, void* reserved)
 {
-    output_file = fopen("output.bin", "wb");
+    output_size = 0;
+    const size_t size = std::max(fileSize, HAL_OTA_FlashLength());
+    if (!output_file.open("output.bin", size, MappedFile::TRUNCATE)) {
+        return false;
+    }
     DEBUG("flash started");
-    return output_file;
+    return true;
 }
 
 int HAL_FLASH_Update(const uint8_t *pBuffer, uint32_t address, uint32_t length, void* reserved)
 {
 	DEBUG("flash write %d %d", address, length);
-	fseek(output_file, address, SEEK_SET);
-    fwrite(pBuffer, length, 1, output_file);
-    return 0;
+	if (!output_file.isOpen() || address > output_file.size() || length > output_file.size() - address) {
+		return -1;
+	}
+	memcpy(output_file.data() + address, pBuffer, length);
+	output_file.markDirty(address, length);
+	output_file.sync();
+	output_size = std::max<size_t>(output_size, address + length);
+	return 0;
 }
 
 int HAL_FLASH_OTA_Validate(hal_module_t* mod, bool userDepsOptional, module_validation_flags_t flags, void* reserved)
@@ -53,8 +64,8 @@ int HAL_FLASH_OTA_Validate(hal_module_t* mod, bool userDepsOptional, module_vali
 
  hal_update_complete_t HAL_FLASH_End(hal_module_t* mod)
 {
-	 fclose(output_file);
-	 output_file = NULL;
+	 // The file only contains the data written during the update
+	 output_file.close(output_size);
      return HAL_UPDATE_APPLIED;
 }
 
@@ -23,248 +23,415 @@
  ******************************************************************************
  */
 
+/*
+ * Sockets of the virtual device are non-blocking POSIX sockets. On Linux, a single event loop
+ * thread waits for readiness events of all sockets in the process using edge-triggered epoll,
+ * and records them in the socket table. socket_receive() and socket_send() use the recorded
+ * state to avoid system calls that would fail with EAGAIN, and threads that need to wait for
+ * a socket sleep until the event loop wakes them up. Every virtual device runs in its own
+ * process, so each device has one event loop thread for all of its sockets. This keeps the
+ * per-device overhead low when many virtual devices are run on the same host.
+ *
+ * On other hosts there is no event loop, and waiting threads poll() the socket instead.
+ */
+
 // FIXME: Avoid defining sockaddr twice. We should probably update gcc platform to use POSIX sockets
 #define HAL_SOCKET_HAL_COMPAT_NO_SOCKADDR (1)
 #include "device_globals.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define SOCKET_HAL_USE_EPOLL 1
+#else
+#define SOCKET_HAL_USE_EPOLL 0
+#endif
+
+#ifndef SOCK_CLOEXEC
+#define SOCK_CLOEXEC 0
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #include "socket_hal.h"
 #include "inet_hal.h"
 #include "core_msg.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
-#pragma GCC diagnostic ignored "-Wunused-variable"
-#pragma GCC diagnostic ignored "-Wmissing-braces"
-#include <boost/array.hpp>
+// Used by the resolver in inet_hal.cpp
+boost::asio::io_service device_io_service;
 
-// conflict of types
-#define socklen_t boost_socklen_t
-#include <boost/asio.hpp>
-#undef socklen_t
+namespace {
 
-#include <boost/system/system_error.hpp>
+const sock_handle_t SOCKET_INVALID = (sock_handle_t)-1;
 
-namespace ip = boost::asio::ip;
+// Maximum number of events processed by the event loop in a single iteration
+const int EVENT_LOOP_MAX_EVENTS = 64;
 
-const sock_handle_t SOCKET_COUNT = sock_handle_t(8);
-const sock_handle_t SOCKET_MAX =  SOCKET_COUNT*2;
-const sock_handle_t SOCKET_INVALID = (sock_handle_t)-1;
+enum class SocketType
+{
+    TCP,
+    UDP,
+    TCP_SERVER
+};
 
-boost::asio::io_service device_io_service;
-boost::system::error_code ec;
-
-boost::array<ip::tcp::socket, SOCKET_COUNT> tcp_handles = {
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service),
-    ip::tcp::socket(device_io_service)
+struct Socket
+{
+    int fd;
+    SocketType type;
+    uint64_t id; // Unique socket ID used to match events to sockets
+    std::atomic<bool> readable;
+    std::atomic<bool> writable;
+    std::atomic<bool> error; // Set if the connection was closed or reset
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned waiters; // Number of threads waiting for this socket, protected by the mutex
+
+    Socket(int fd, SocketType type, uint64_t id) :
+        fd(fd),
+        type(type),
+        id(id),
+        // Without the event loop the socket state is unknown and all calls go to the kernel
+        readable(!SOCKET_HAL_USE_EPOLL),
+        writable(!SOCKET_HAL_USE_EPOLL),
+        error(false),
+        waiters(0)
+    {
+    }
+
+    ~Socket()
+    {
+        ::close(fd);
+    }
 };
 
-boost::array<ip::udp::socket, SOCKET_COUNT> udp_handles = {
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service),
-    ip::udp::socket(device_io_service)
+typedef std::shared_ptr<Socket> SocketPtr;
+
+/**
+ * Table of open sockets. Socket handles are indices in the table, and free entries are reused.
+ */
+class SocketTable
+{
+    std::vector<SocketPtr> sockets;
+    std::mutex mutex;
+    uint64_t last_id = 0;
+
+public:
+    sock_handle_t add(int fd, SocketType type, SocketPtr* result);
+    SocketPtr get(sock_handle_t handle);
+    SocketPtr remove(sock_handle_t handle);
+    SocketPtr find(uint64_t data);
+
+    static uint64_t event_data(sock_handle_t handle, uint64_t id)
+    {
+        return (id << 32) | handle;
+    }
 };
 
+#if SOCKET_HAL_USE_EPOLL
 
-ip::tcp::socket invalid_tcp_(device_io_service);
-ip::udp::socket invalid_udp_(device_io_service);
+/**
+ * Event loop shared by all sockets of the process.
+ */
+class SocketEventLoop
+{
+    int epoll_fd = -1;
+    std::once_flag started;
 
-ip::tcp::socket& invalid_tcp() {
-    return invalid_tcp_;
-}
+    void run();
 
-ip::udp::socket& invalid_udp() {
-    return invalid_udp_;
-}
+public:
+    bool add(sock_handle_t handle, const Socket& socket);
+    void remove(const Socket& socket);
 
-bool is_tcp_socket(sock_handle_t sd)
+    static SocketEventLoop& instance()
+    {
+        static SocketEventLoop loop;
+        return loop;
+    }
+};
+
+#endif // SOCKET_HAL_USE_EPOLL
+
+SocketTable sockets;
+
+sock_handle_t SocketTable::add(int fd, SocketType type, SocketPtr* result)
 {
-	return sd<SOCKET_COUNT;
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t handle = 0;
+    while (handle < sockets.size() && sockets[handle]) {
+        ++handle;
+    }
+    if (handle == sockets.size()) {
+        sockets.push_back(nullptr);
+    }
+    sockets[handle] = std::make_shared<Socket>(fd, type, ++last_id);
+    *result = sockets[handle];
+    return handle;
 }
 
-bool is_udp_socket(sock_handle_t sd)
+SocketPtr SocketTable::get(sock_handle_t handle)
 {
-	return sd>=SOCKET_COUNT && sd<SOCKET_MAX;
+    std::lock_guard<std::mutex> lock(mutex);
+    return handle < sockets.size() ? sockets[handle] : nullptr;
 }
 
-
-ip::tcp::socket& tcp_from(sock_handle_t sd)
+SocketPtr SocketTable::remove(sock_handle_t handle)
 {
-    if (sd>=SOCKET_COUNT)
-        return invalid_tcp();
-    return tcp_handles[sd];
+    std::lock_guard<std::mutex> lock(mutex);
+    if (handle >= sockets.size()) {
+        return nullptr;
+    }
+    SocketPtr socket;
+    socket.swap(sockets[handle]);
+    return socket;
 }
 
-ip::udp::socket& udp_from(sock_handle_t sd)
+SocketPtr SocketTable::find(uint64_t data)
 {
-    if (sd<SOCKET_COUNT || sd>=SOCKET_MAX)
-        return invalid_udp();
-    return udp_handles[sd-SOCKET_COUNT];
+    const sock_handle_t handle = data & 0xffffffff;
+    const SocketPtr socket = get(handle);
+    return (socket && socket->id == (data >> 32)) ? socket : nullptr;
 }
 
-
-sock_handle_t next_unused_tcp()
+void notify(Socket& socket)
 {
-    for (sock_handle_t i=0; i<SOCKET_COUNT; i++) {
-        if (!tcp_from(i).is_open())
-            return i;
+    std::lock_guard<std::mutex> lock(socket.mutex);
+    if (socket.waiters) {
+        socket.cond.notify_all();
     }
-    return -1;
 }
 
-sock_handle_t next_unused_udp()
+#if SOCKET_HAL_USE_EPOLL
+
+bool SocketEventLoop::add(sock_handle_t handle, const Socket& socket)
 {
-    for (sock_handle_t i=SOCKET_COUNT; i<SOCKET_MAX; i++) {
-        if (!udp_from(i).is_open())
-            return i;
+    std::call_once(started, [this]() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd >= 0) {
+            std::thread(&SocketEventLoop::run, this).detach();
+        }
+    });
+    if (epoll_fd < 0) {
+        return false;
     }
-    return -1;
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = SocketTable::event_data(handle, socket.id);
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket.fd, &ev) == 0;
 }
 
-
-
-bool is_valid(ip::tcp::socket& handle) {
-    return &handle!=&invalid_tcp();
+void SocketEventLoop::remove(const Socket& socket)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket.fd, nullptr);
 }
 
-bool is_valid(ip::udp::socket& handle) {
-    return &handle!=&invalid_udp();
+void SocketEventLoop::run()
+{
+    epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    for (;;) {
+        const int count = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+        for (int i = 0; i < count; ++i) {
+            const SocketPtr socket = sockets.find(events[i].data.u64);
+            if (!socket) {
+                continue; // The socket was closed
+            }
+            const uint32_t flags = events[i].events;
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                socket->readable = true;
+            }
+            if (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                socket->writable = true;
+            }
+            if (flags & (EPOLLHUP | EPOLLERR)) {
+                socket->error = true;
+            }
+            notify(*socket);
+            HAL_NET_notify_socket_event(events[i].data.u64 & 0xffffffff);
+        }
+    }
 }
 
+#endif // SOCKET_HAL_USE_EPOLL
 
-
-class TCPServer
+/**
+ * Waits until the socket is readable or writable. Returns false on timeout.
+ */
+bool wait_ready(Socket& socket, bool write, system_tick_t timeout)
 {
-	ip::tcp::acceptor acceptor;
-
-	void accept_handler(const boost::system::error_code& error)
-	{
-		if (!error)
-		{
-			start_accept();
-		}
-	}
-
-	sock_handle_t start_accept()
-	{
-		sock_handle_t handle = next_unused_tcp();
-		if (!socket_handle_valid(handle))
-			return handle;
-
-		ip::tcp::socket& sock = tcp_from(handle);
-		acceptor.accept(sock);
-		return handle;
-	}
-
-
-public:
-	TCPServer(uint16_t port)
-		: acceptor(device_io_service, ip::tcp::endpoint(ip::tcp::v4(), port))
-	{
-		acceptor.non_blocking(true);
-	}
-
-	~TCPServer()
-	{
-		acceptor.cancel();
-	}
-
-	sock_handle_t accept()
-	{
-		sock_handle_t handle = next_unused_tcp();
-		if (!socket_handle_valid(handle))
-			return handle;
-
-		ip::tcp::socket& sock = tcp_from(handle);
+    std::atomic<bool>& ready = write ? socket.writable : socket.readable;
+#if SOCKET_HAL_USE_EPOLL
+    std::unique_lock<std::mutex> lock(socket.mutex);
+    ++socket.waiters;
+    const auto pred = [&]() { return ready.load() || socket.error.load(); };
+    bool result = true;
+    if (timeout == SOCKET_WAIT_FOREVER) {
+        socket.cond.wait(lock, pred);
+    } else {
+        result = socket.cond.wait_for(lock, std::chrono::milliseconds(timeout), pred);
+    }
+    --socket.waiters;
+    return result;
+#else
+    pollfd p = {};
+    p.fd = socket.fd;
+    p.events = write ? POLLOUT : POLLIN;
+    const int r = poll(&p, 1, (timeout == SOCKET_WAIT_FOREVER) ? -1 : (int)timeout);
+    ready = true;
+    return r > 0;
+#endif
+}
 
-		acceptor.accept(sock, ec);
-		return !ec ? handle : socket_handle_invalid();
-	}
+bool register_socket(sock_handle_t handle, const Socket& socket)
+{
+#if SOCKET_HAL_USE_EPOLL
+    return SocketEventLoop::instance().add(handle, socket);
+#else
+    return true;
+#endif
+}
 
+// Adds a socket to the table. Sockets that are not connected yet are registered with the event loop
+// by socket_connect(), as an unconnected stream socket would be reported as hung up
+sock_handle_t add_socket(int fd, SocketType type, bool connected = true)
+{
+    if (fd < 0) {
+        return SOCKET_INVALID;
+    }
+    const int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    SocketPtr socket;
+    const sock_handle_t handle = sockets.add(fd, type, &socket);
+    if (connected && !register_socket(handle, *socket)) {
+        DEBUG("Unable to register socket: %d", errno);
+        sockets.remove(handle);
+        return SOCKET_INVALID;
+    }
+    return handle;
+}
 
-};
+SocketPtr socket_from(sock_handle_t sd, SocketType type)
+{
+    SocketPtr socket = sockets.get(sd);
+    return (socket && socket->type == type) ? socket : nullptr;
+}
 
-class TCPServers
+// Clears the readiness flag before a call that can fail with EAGAIN, so that an event received
+// during the call is not lost
+inline void begin_io(std::atomic<bool>& ready)
 {
-	std::vector<TCPServer*> servers;
-public:
+#if SOCKET_HAL_USE_EPOLL
+    ready = false;
+#endif
+}
 
-	bool is_valid(sock_handle_t handle) {
-		return handle>=SOCKET_MAX && handle<SOCKET_MAX+servers.size();
-	}
-
-	TCPServer* from(sock_handle_t handle)
-	{
-		if (!is_valid(handle))
-			return nullptr;
-
-		return servers[handle-SOCKET_MAX];
-	}
-
-	sock_handle_t add(TCPServer* server)
-	{
-		if (!server)
-			return SOCKET_INVALID;
-		size_t handle = servers.size();
-		servers.push_back(server);
-		return SOCKET_MAX + handle;
-	}
-
-	void dispose(sock_handle_t handle)
-	{
-		if (is_valid(handle)) {
-			size_t index = handle-SOCKET_MAX;
-			TCPServer* server = servers[index];
-			servers[index] = nullptr;
-			delete server;
-		}
-	}
-};
+inline void end_io(std::atomic<bool>& ready, ssize_t result)
+{
+    if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        ready = true; // There may be more data or space available
+    }
+}
 
+void to_sockaddr(const sockaddr_t* addr, sockaddr_in* in)
+{
+    memset(in, 0, sizeof(sockaddr_in));
+    in->sin_family = AF_INET;
+    // 0-1 are the port and 2-5 are the IP address in network byte order
+    memcpy(&in->sin_port, addr->sa_data, 2);
+    memcpy(&in->sin_addr.s_addr, addr->sa_data + 2, 4);
+}
 
+void from_sockaddr(const sockaddr_in& in, sockaddr_t* addr)
+{
+    memcpy(addr->sa_data, &in.sin_port, 2);
+    memcpy(addr->sa_data + 2, &in.sin_addr.s_addr, 4);
+}
 
-TCPServers servers;
+} // namespace
 
 sock_result_t socket_create_tcp_server(uint16_t port, network_interface_t nif)
 {
-	DEBUG("Creating TCP Server on port %d", port);
-	TCPServer* server = new TCPServer(port);
-	return servers.add(server);
+    DEBUG("Creating TCP Server on port %d", port);
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return SOCKET_INVALID;
+    }
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (::bind(fd, (const ::sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        DEBUG("Unable to listen on port %d: %d", port, errno);
+        ::close(fd);
+        return SOCKET_INVALID;
+    }
+    return add_socket(fd, SocketType::TCP_SERVER);
 }
 
 sock_result_t socket_accept(sock_handle_t handle)
 {
-	TCPServer* server = servers.from(handle);
-	if (!server)
-		return socket_handle_invalid();
-	return server->accept();
+    const SocketPtr server = socket_from(handle, SocketType::TCP_SERVER);
+    if (!server) {
+        return socket_handle_invalid();
+    }
+    begin_io(server->readable);
+    const int fd = ::accept(server->fd, nullptr, nullptr);
+    end_io(server->readable, fd);
+    if (fd < 0) {
+        return socket_handle_invalid();
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return add_socket(fd, SocketType::TCP);
 }
 
-
 int32_t socket_connect(sock_handle_t sd, const sockaddr_t *addr, long addrlen)
 {
-    auto& handle = tcp_from(sd);
-    if (!is_valid(handle))
+    const SocketPtr socket = socket_from(sd, SocketType::TCP);
+    if (!socket) {
         return -1;
-
-    unsigned port = addr->sa_data[0] << 8 | addr->sa_data[1];
-    // 2-5 are IP address in network byte order
-    const uint8_t* dest = addr->sa_data+2;
-
-    ip::address_v4::bytes_type address = {{ dest[0], dest[1], dest[2], dest[3] }};
-    ip::tcp::endpoint endpoint(boost::asio::ip::address_v4(address),port);
-
-    handle.connect(endpoint, ec);
-    bool open = handle.is_open();
-    return ec.value();
+    }
+    sockaddr_in in;
+    to_sockaddr(addr, &in);
+    const int r = ::connect(socket->fd, (const ::sockaddr*)&in, sizeof(in));
+    if (r != 0 && errno != EINPROGRESS) {
+        return errno;
+    }
+    if (!register_socket(sd, *socket)) {
+        return -1;
+    }
+    if (r == 0) {
+        return 0;
+    }
+    // The connection is established when the socket becomes writable
+    wait_ready(*socket, true /* write */, SOCKET_WAIT_FOREVER);
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(socket->fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+        error = errno;
+    }
+    return error;
 }
 
 sock_result_t socket_reset_blocking_call()
@@ -274,48 +441,74 @@ sock_result_t socket_reset_blocking_call()
 
 sock_result_t socket_receive(sock_handle_t sd, void* buffer, socklen_t len, system_tick_t _timeout)
 {
-    auto& handle = tcp_from(sd);
-    if (!is_valid(handle))
+    const SocketPtr socket = socket_from(sd, SocketType::TCP);
+    if (!socket) {
         return -1;
-    boost::asio::socket_base::bytes_readable command(true);
-    handle.io_control(command);
-    std::size_t available = command.get();
-    sock_result_t result = 0;
-    if (_timeout || available) {
-        available = handle.read_some(boost::asio::buffer(buffer, len), ec);
-        result = ec.value() ? -abs(ec.value()) : available;
-        if (ec.value()) {
-            if (ec.value() == boost::system::errc::resource_deadlock_would_occur || // EDEADLK (35)
-                ec.value() == boost::system::errc::resource_unavailable_try_again) { // EAGAIN (11)
-                result = 0; // No data available
-            } else {
-                DEBUG("socket receive error: %d %s, read=%d", ec.value(), ec.message().c_str(), available);
-            }
+    }
+    if (!socket->readable && !socket->error) {
+        // Don't call into the kernel if no data has arrived since the last call
+        if (!_timeout || !wait_ready(*socket, false /* write */, _timeout)) {
+            return 0;
         }
     }
-    return result;
+    begin_io(socket->readable);
+    const ssize_t n = ::recv(socket->fd, buffer, len, 0);
+    end_io(socket->readable, n);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0; // No data available
+        }
+        DEBUG("socket receive error: %d %s", errno, strerror(errno));
+        return -errno;
+    }
+    if (n == 0 && len) {
+        // The peer has closed the connection
+        socket->error = true;
+        return -ECONNRESET;
+    }
+    return n;
 }
 
-sock_result_t socket_send(sock_handle_t sd, const void* buffer, socklen_t len)
+sock_result_t socket_send_ex(sock_handle_t sd, const void* buffer, socklen_t len, uint32_t flags, system_tick_t timeout, void* reserved)
 {
-    auto& socket = tcp_from(sd);
-    if (!is_valid(socket))
+    const SocketPtr socket = socket_from(sd, SocketType::TCP);
+    if (!socket) {
         return -1;
-    try
-    {
-        sock_result_t result = write(socket, boost::asio::buffer(buffer, len));
-        return result;
     }
-    catch (const boost::system::system_error& e)
-    {
-        return -1;
+    const auto start = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    while (sent < len) {
+        if (!socket->writable && !socket->error) {
+            system_tick_t wait = timeout;
+            if (timeout != SOCKET_WAIT_FOREVER) {
+                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                if (elapsed.count() >= timeout) {
+                    break;
+                }
+                wait = timeout - elapsed.count();
+            }
+            if (!wait_ready(*socket, true /* write */, wait)) {
+                break;
+            }
+        }
+        begin_io(socket->writable);
+        const ssize_t n = ::send(socket->fd, (const char*)buffer + sent, len - sent, MSG_NOSIGNAL);
+        end_io(socket->writable, n);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            DEBUG("socket send error: %d %s", errno, strerror(errno));
+            return -1;
+        }
+        sent += n;
     }
+    return sent;
 }
 
-sock_result_t socket_send_ex(sock_handle_t sd, const void* buffer, socklen_t len, uint32_t flags, system_tick_t timeout, void* reserved)
+sock_result_t socket_send(sock_handle_t sd, const void* buffer, socklen_t len)
 {
-    /* NOTE: non-blocking mode and timeouts are not supported */
-    return socket_send(sd, buffer, len);
+    return socket_send_ex(sd, buffer, len, 0, SOCKET_WAIT_FOREVER, nullptr);
 }
 
 sock_result_t socket_create_nonblocking_server(sock_handle_t sock, uint16_t port)
@@ -326,55 +519,50 @@ sock_result_t socket_create_nonblocking_server(sock_handle_t sock, uint16_t port
 
 sock_result_t socket_receivefrom(sock_handle_t sock, void* buffer, socklen_t bufLen, uint32_t flags, sockaddr_t* addr, socklen_t* addrsize)
 {
-	ip::udp::endpoint endpoint;
-	auto& socket = udp_from(sock);
-
-	int count = socket.receive_from(boost::asio::buffer(buffer, bufLen), endpoint, 0, ec);
-	if (addr && addrsize && *addrsize>=6u) {
-		uint16_t port = endpoint.port();
-		addr->sa_data[0] = port >> 8;
-		addr->sa_data[1] = port & 0xFF;
-		uint32_t ip = endpoint.address().to_v4().to_ulong();
-		addr->sa_data[2] = (ip >> 24) & 0xFF;
-		addr->sa_data[3] = (ip >> 16) & 0xFF;
-		addr->sa_data[4] = (ip >> 8) & 0xFF;
-		addr->sa_data[5] = (ip >> 0) & 0xFF;
-	}
-
-	sock_handle_t result = ec.value();
-
-    if (result == boost::asio::error::would_block)
+    const SocketPtr socket = socket_from(sock, SocketType::UDP);
+    if (!socket) {
+        return -1;
+    }
+    if (!socket->readable) {
         return 0;
-    if (result==boost::asio::error::try_again)
-	   return 0;
-	if (!result)
-		DEBUG("count: %d", count);
-	else
-		DEBUG("result: %d %s", ec.value(), ec.message().c_str());
-
-	return result ? result : count;
+    }
+    sockaddr_in from = {};
+    socklen_t from_len = sizeof(from);
+    begin_io(socket->readable);
+    const ssize_t count = ::recvfrom(socket->fd, buffer, bufLen, 0, (::sockaddr*)&from, &from_len);
+    end_io(socket->readable, count);
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        DEBUG("result: %d %s", errno, strerror(errno));
+        return errno;
+    }
+    if (addr && addrsize && *addrsize >= 6u) {
+        from_sockaddr(from, addr);
+    }
+    DEBUG("count: %d", (int)count);
+    return count;
 }
 
 sock_result_t socket_sendto(sock_handle_t sd, const void* buffer, socklen_t len, uint32_t flags, sockaddr_t* addr, socklen_t addr_size)
 {
-    unsigned port = addr->sa_data[0] << 8 | addr->sa_data[1];
-    // 2-5 are IP address in network byte order
-    const uint8_t* dest = addr->sa_data+2;
-
-    ip::address_v4::bytes_type address = {{ dest[0], dest[1], dest[2], dest[3] }};
-    ip::udp::endpoint endpoint(boost::asio::ip::address_v4(address),port);
-
-	auto& socket = udp_from(sd);
-	int count = socket.send_to(boost::asio::buffer(buffer, len), endpoint, 0, ec);
-
-	sock_handle_t result = ec.value();
-    if (result == boost::asio::error::would_block)
-        return 0;
-
-    return result ? result : count;
+    const SocketPtr socket = socket_from(sd, SocketType::UDP);
+    if (!socket) {
+        return -1;
+    }
+    sockaddr_in to;
+    to_sockaddr(addr, &to);
+    const ssize_t count = ::sendto(socket->fd, buffer, len, 0, (const ::sockaddr*)&to, sizeof(to));
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return errno;
+    }
+    return count;
 }
 
-
 sock_result_t socket_bind(sock_handle_t sock, uint16_t port)
 {
     NOT_IMPLEMENTED("socket_bind");
@@ -383,109 +571,73 @@ sock_result_t socket_bind(sock_handle_t sock, uint16_t port)
 
 uint8_t socket_active_status(sock_handle_t socket)
 {
-    bool open;
-    if (socket>=SOCKET_COUNT)
-    		open = udp_from(socket).is_open();
-    else
-    		open = tcp_from(socket).is_open();
-    return open ? SOCKET_STATUS_ACTIVE : SOCKET_STATUS_INACTIVE;
+    const SocketPtr s = sockets.get(socket);
+    return (s && !s->error) ? SOCKET_STATUS_ACTIVE : SOCKET_STATUS_INACTIVE;
 }
 
 sock_result_t socket_close(sock_handle_t socket)
 {
-	if (servers.is_valid(socket))
-	{
-		servers.dispose(socket);
-	}
-	else if (socket>=SOCKET_COUNT)
-    {
-    		auto& s = udp_from(socket);
-    		s.shutdown(boost::asio::ip::udp::socket::shutdown_both, ec);
-    		udp_from(socket).close();
-    }
-    else
-    {
-    		auto& s = tcp_from(socket);
-		s.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
-    		s.close();
+    const SocketPtr s = sockets.remove(socket);
+    if (s) {
+#if SOCKET_HAL_USE_EPOLL
+        SocketEventLoop::instance().remove(*s);
+#endif
+        if (s->type != SocketType::TCP_SERVER) {
+            ::shutdown(s->fd, SHUT_RDWR);
+        }
+        // Wake up threads waiting for this socket. The descriptor is closed when the last reference is released
+        s->error = true;
+        notify(*s);
     }
     return 0;
 }
 
 sock_result_t socket_shutdown(sock_handle_t socket, int how)
 {
-    if (servers.is_valid(socket) || socket >= SOCKET_COUNT) {
+    const SocketPtr s = socket_from(socket, SocketType::TCP);
+    if (!s) {
         return -1;
     }
-    else
-    {
-        auto& s = tcp_from(socket);
-        auto shflags = boost::asio::ip::tcp::socket::shutdown_both;
-        if (how == SHUT_WR) {
-            shflags = boost::asio::ip::tcp::socket::shutdown_send;
-        } else if (how == SHUT_RD) {
-            shflags = boost::asio::ip::tcp::socket::shutdown_receive;
-        }
-        s.shutdown(shflags, ec);
-        return (sock_result_t)ec.value();
+    int shflags = SHUT_RDWR;
+    if (how == SHUT_WR) {
+        shflags = SHUT_WR;
+    } else if (how == SHUT_RD) {
+        shflags = SHUT_RD;
     }
-
-    return -1;
+    return (::shutdown(s->fd, shflags) == 0) ? 0 : errno;
 }
 
-
-
 sock_handle_t socket_create(uint8_t family, uint8_t type, uint8_t protocol, uint16_t port, network_interface_t nif)
 {
-	bool udp = protocol==IPPROTO_UDP;
-    sock_handle_t handle = udp ? next_unused_udp() : next_unused_tcp();
-    if (handle==SOCKET_INVALID)
-        return -1;
-
+    const bool udp = protocol == IPPROTO_UDP;
+    const int fd = ::socket(AF_INET, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return SOCKET_INVALID;
+    }
     if (udp) {
-        auto& socket = udp_from(handle);
-        socket.open(ip::udp::v4(), ec);
-        sock_handle_t result = ec.value();
-        if (result)				// error
-            return result;
-
-        boost::asio::ip::udp::endpoint listen_endpoint(ip::udp::v4(), port);
-        socket.open(listen_endpoint.protocol(), ec);
-
-        socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
-
-        socket.bind(listen_endpoint, ec);
-        result = ec.value();
-        if (result) {
-            DEBUG("%d %s", port, ec.message().c_str());
-            return result;
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (::bind(fd, (const ::sockaddr*)&addr, sizeof(addr)) != 0) {
+            DEBUG("%d %s", port, strerror(errno));
+            ::close(fd);
+            return SOCKET_INVALID;
         }
-
-        socket.non_blocking(true, ec);
-    }
-    else {
-        auto& socket = tcp_from(handle);
-        socket.open(ip::tcp::v4(), ec);
-        sock_handle_t result = ec.value();
-        if (result)
-            return result;
-
-        socket.non_blocking(true, ec);
+    } else {
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
     }
-
-    sock_handle_t result = ec.value();
-    return result ? result : handle;
+    return add_socket(fd, udp ? SocketType::UDP : SocketType::TCP, udp /* connected */);
 }
 
-uint8_t socket_handle_valid(sock_handle_t handle) {
-    if (handle==SOCKET_INVALID)
-    		return false;
-	if (handle>=SOCKET_MAX)
-    		return servers.is_valid(handle);
-    return handle<SOCKET_COUNT ? is_valid(tcp_from(handle)) : is_valid(udp_from(handle));
+uint8_t socket_handle_valid(sock_handle_t handle)
+{
+    return handle != SOCKET_INVALID && sockets.get(handle);
 }
 
-
 sock_handle_t socket_handle_invalid()
 {
     return SOCKET_INVALID;
@@ -493,25 +645,26 @@ sock_handle_t socket_handle_invalid()
 
 sock_result_t socket_join_multicast(const HAL_IPAddress* addr, network_interface_t nif, socket_multicast_info_t* info)
 {
-	if (info) {
-		sock_handle_t socket = info->sock_handle;
-		if (socket>=SOCKET_COUNT)
-		{
-			auto& s = udp_from(socket);
-			ip::address_v4 address(addr->ipv4);
-			DEBUG("join multicast %s", address.to_string().c_str());
-			s.set_option(ip::multicast::enable_loopback(true));
-			boost::asio::ip::multicast::join_group option(address);
-			s.set_option(option);
-			return 0;
-		}
-	}
+    if (info) {
+        const SocketPtr s = socket_from(info->sock_handle, SocketType::UDP);
+        if (s) {
+            DEBUG("join multicast %s", boost::asio::ip::address_v4(addr->ipv4).to_string().c_str());
+            const unsigned char loop = 1;
+            setsockopt(s->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+            ip_mreq mreq = {};
+            mreq.imr_multiaddr.s_addr = htonl(addr->ipv4);
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(s->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == 0) {
+                return 0;
+            }
+        }
+    }
     return -1;
 }
 
 sock_result_t socket_leave_multicast(const HAL_IPAddress* addr, network_interface_t nif, socket_multicast_info_t* reserved)
 {
-	return -1;
+    return -1;
 }
 
 sock_result_t socket_peer(sock_handle_t sd, sock_peer_t* peer, void* reserved)
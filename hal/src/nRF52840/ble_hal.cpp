@@ -2434,6 +2434,33 @@ ssize_t BleObject::GattServer::notifyValue(hal_ble_attr_handle_t attrHandle, con
         hvxParams.offset = 0;
         hvxParams.p_data = buf;
         hvxParams.p_len = &hvxLen;
+        if (hvxParams.type == BLE_GATT_HVX_NOTIFICATION) {
+            // The SoftDevice copies the notification data to its TX queue, so there's no need to wait
+            // until the notification is sent, unless the queue is full
+            const uint16_t len = hvxLen;
+            int ret = NRF_SUCCESS;
+            for (;;) {
+                isHvxing_ = true;
+                currHvxConnHandle_ = subscriber.connHandle;
+                ret = sd_ble_gatts_hvx(subscriber.connHandle, &hvxParams);
+                if (ret != NRF_ERROR_RESOURCES) {
+                    break;
+                }
+                if (os_semaphore_take(hvxSemaphore_, BLE_OPERATION_TIMEOUT_MS, false)) {
+                    ret = NRF_ERROR_TIMEOUT;
+                    break;
+                }
+                hvxLen = len;
+            }
+            isHvxing_ = false;
+            currHvxConnHandle_ = BLE_INVALID_CONN_HANDLE;
+            // Discard the semaphore token given for a notification that completed in the meantime
+            os_semaphore_take(hvxSemaphore_, 0, false);
+            if (ret != NRF_SUCCESS) {
+                LOG(ERROR, "sd_ble_gatts_hvx() failed: %u", (unsigned)ret);
+            }
+            continue;
+        }
         int ret = sd_ble_gatts_hvx(subscriber.connHandle, &hvxParams);
         if (ret != NRF_SUCCESS) {
             LOG(ERROR, "sd_ble_gatts_hvx() failed: %u", (unsigned)ret);
@@ -3293,6 +3320,14 @@ int BleObject::init() {
     int ret = nrf_sdh_ble_default_cfg_set(BLE_CONN_CFG_TAG, &appRamStart);
     CHECK_NRF_RETURN(ret, nrf_system_error(ret));
     LOG_DEBUG(TRACE, "APP RAM start: 0x%08x", (unsigned)appRamStart);
+    // Allow multiple notifications to be queued for transmission in a single connection event
+    ble_cfg_t bleCfg = {};
+    bleCfg.conn_cfg.conn_cfg_tag = BLE_CONN_CFG_TAG;
+    bleCfg.conn_cfg.params.gatts_conn_cfg.hvn_tx_queue_size = BLE_HVN_TX_QUEUE_SIZE;
+    ret = sd_ble_cfg_set(BLE_CONN_CFG_GATTS, &bleCfg, appRamStart);
+    if (ret != NRF_SUCCESS) {
+        LOG(WARN, "sd_ble_cfg_set() failed: %u", (unsigned)ret); // Use the default queue size
+    }
     // Enable the stack
     uint32_t sdRamEnd = appRamStart;
     ret = nrf_sdh_ble_enable(&sdRamEnd);
@@ -111,6 +111,9 @@
 #define BLE_MAX_ATTR_VALUE_PACKET_SIZE              (BLE_MAX_ATT_MTU_SIZE - BLE_ATT_OPCODE_SIZE - BLE_ATT_HANDLE_SIZE)
 #define BLE_ATTR_VALUE_PACKET_SIZE(ATT_MTU)         (ATT_MTU - BLE_ATT_OPCODE_SIZE - BLE_ATT_HANDLE_SIZE)
 
+// Number of notifications that can be queued for transmission per connection
+#define BLE_HVN_TX_QUEUE_SIZE                       4
+
 #define BLE_MAX_SVC_COUNT                           21
 #define BLE_MAX_CHAR_COUNT                          23
 #define BLE_MAX_DESC_COUNT                          10
@@ -44,11 +44,13 @@ void otPlatSettingsInit(otInstance* aInstance)
 }
 
 otError otPlatSettingsBeginChange(otInstance* aInstance) {
-    return OT_ERROR_NONE;
+    int r = s_settingsFile.beginBatch();
+    return r == 0 ? OT_ERROR_NONE : OT_ERROR_FAILED;
 }
 
 otError otPlatSettingsCommitChange(otInstance* aInstance) {
-    return OT_ERROR_NONE;
+    int r = s_settingsFile.commitBatch();
+    return r == 0 ? OT_ERROR_NONE : OT_ERROR_FAILED;
 }
 
 otError otPlatSettingsAbandonChange(otInstance* aInstance) {
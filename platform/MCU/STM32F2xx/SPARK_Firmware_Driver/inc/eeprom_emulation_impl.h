@@ -28,4 +28,10 @@ constexpr uintptr_t EEPROM_SectorBase2 = 0x08010000;
 constexpr size_t EEPROM_SectorSize1 = 16*1024;
 constexpr size_t EEPROM_SectorSize2 = 64*1024;
 
-using FlashEEPROM = EEPROMEmulation<InternalFlashStore, EEPROM_SectorBase1, EEPROM_SectorSize1, EEPROM_SectorBase2, EEPROM_SectorSize2>;
+// Keep the latest value of each EEPROM byte in RAM (uses EEPROM capacity bytes of RAM)
+#ifndef EEPROM_EMULATION_RAM_INDEX
+#define EEPROM_EMULATION_RAM_INDEX 0
+#endif
+
+using FlashEEPROM = EEPROMEmulation<InternalFlashStore, EEPROM_SectorBase1, EEPROM_SectorSize1, EEPROM_SectorBase2, EEPROM_SectorSize2,
+        (EEPROM_EMULATION_RAM_INDEX != 0)>;
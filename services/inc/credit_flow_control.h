@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace particle {
+
+/**
+ * Credit-based flow control for a receive path.
+ *
+ * The producer takes credits for every chunk it hands over to the consumer, and the consumer
+ * returns them once the chunk has been processed. The producer is suspended when the amount of
+ * outstanding data reaches the high watermark, and is resumed once it drops to the low watermark.
+ *
+ * `take()` and `release()` may be called from different threads. The flow control callback is
+ * invoked by one thread at a time, in the order of the state changes, and never while holding a
+ * lock, so it can call into a component that invokes `take()` under its own lock.
+ */
+class CreditFlowControl {
+public:
+    typedef void (*Callback)(bool suspend, void* ctx);
+
+    CreditFlowControl(size_t high, size_t low, Callback cb = nullptr, void* ctx = nullptr) :
+            high_(high),
+            low_(low),
+            cb_(cb),
+            ctx_(ctx),
+            outstanding_(0),
+            suspended_(false),
+            busy_(false),
+            dirty_(false) {
+    }
+
+    void callback(Callback cb, void* ctx) {
+        cb_ = cb;
+        ctx_ = ctx;
+    }
+
+    void take(size_t size) {
+        const auto n = outstanding_.fetch_add(size, std::memory_order_relaxed) + size;
+        if (n >= high_) {
+            update();
+        }
+    }
+
+    void release(size_t size) {
+        const auto n = outstanding_.fetch_sub(size, std::memory_order_relaxed) - size;
+        if (n <= low_) {
+            update();
+        }
+    }
+
+    size_t outstanding() const {
+        return outstanding_.load(std::memory_order_relaxed);
+    }
+
+    bool suspended() const {
+        return suspended_.load(std::memory_order_relaxed);
+    }
+
+private:
+    const size_t high_;
+    const size_t low_;
+    Callback cb_;
+    void* ctx_;
+    std::atomic<size_t> outstanding_;
+    std::atomic<bool> suspended_;
+    std::atomic<bool> busy_;
+    std::atomic<bool> dirty_;
+
+    void update() {
+        dirty_.store(true, std::memory_order_seq_cst);
+        // Whichever thread gets here first applies the state changes on behalf of the others
+        while (!busy_.exchange(true, std::memory_order_acquire)) {
+            while (dirty_.exchange(false, std::memory_order_seq_cst)) {
+                const auto n = outstanding_.load(std::memory_order_relaxed);
+                const bool suspended = suspended_.load(std::memory_order_relaxed);
+                if (!suspended && n >= high_) {
+                    suspended_.store(true, std::memory_order_relaxed);
+                    notify(true);
+                } else if (suspended && n <= low_) {
+                    suspended_.store(false, std::memory_order_relaxed);
+                    notify(false);
+                }
+            }
+            busy_.store(false, std::memory_order_release);
+            if (!dirty_.load(std::memory_order_seq_cst)) {
+                break;
+            }
+        }
+    }
+
+    void notify(bool suspend) {
+        if (cb_) {
+            cb_(suspend, ctx_);
+        }
+    }
+};
+
+} // particle
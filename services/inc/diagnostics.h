@@ -58,8 +58,17 @@
 #define DIAG_NAME_CLOUD_TRANSMITTED_MESSAGES "coap:transmit"
 #define DIAG_NAME_CLOUD_COAP_ROUND_TRIP "coap:roundtrip"
 #define DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS "pub:limit"
+#define DIAG_NAME_CLOUD_RATE_LIMIT_WAITS "pub:wait"
 #define DIAG_NAME_SYSTEM_TOTAL_RAM "sys:tram"
 #define DIAG_NAME_SYSTEM_USED_RAM "sys:uram"
+#define DIAG_NAME_SYSTEM_WAKEUPS_NETWORK "sys:wake:net"
+#define DIAG_NAME_SYSTEM_WAKEUPS_CLOUD "sys:wake:cloud"
+#define DIAG_NAME_SYSTEM_WAKEUPS_SOCKET "sys:wake:sock"
+#define DIAG_NAME_SYSTEM_WAKEUPS_ISR_TASK "sys:wake:isr"
+#define DIAG_NAME_SYSTEM_WAKEUPS_TIMEOUT "sys:wake:tmo"
+#define DIAG_NAME_SYSTEM_LOOP_TIME "sys:loop:time"
+#define DIAG_NAME_CLOUD_COAP_ROUND_TRIP_TIME "coap:rtt"
+#define DIAG_NAME_CLOUD_PUBLISH_TIME "pub:time"
 
 #ifdef __cplusplus
 extern "C" {
@@ -104,18 +113,34 @@ typedef enum diag_id {
     DIAG_ID_CLOUD_UNACKNOWLEDGED_MESSAGES = 22, // coap:unack
     DIAG_ID_CLOUD_TRANSMITTED_MESSAGES = 23, // coap:transmit
     DIAG_ID_CLOUD_RATE_LIMITED_EVENTS = 20, // pub:throttle
+    DIAG_ID_CLOUD_RATE_LIMIT_WAITS = 44, // pub:wait
     DIAG_ID_SYSTEM_TOTAL_RAM = 25, // sys:tram
     DIAG_ID_SYSTEM_USED_RAM = 26, // sys:uram
+    DIAG_ID_SYSTEM_WAKEUPS_NETWORK = 45, // sys:wake:net
+    DIAG_ID_SYSTEM_WAKEUPS_CLOUD = 46, // sys:wake:cloud
+    DIAG_ID_SYSTEM_WAKEUPS_SOCKET = 47, // sys:wake:sock
+    DIAG_ID_SYSTEM_WAKEUPS_ISR_TASK = 48, // sys:wake:isr
+    DIAG_ID_SYSTEM_WAKEUPS_TIMEOUT = 49, // sys:wake:tmo
     DIAG_ID_CLOUD_COAP_ROUND_TRIP = 31, // coap:roundtrip
+    DIAG_ID_SYSTEM_LOOP_TIME = 50, // sys:loop:time
+    DIAG_ID_CLOUD_COAP_ROUND_TRIP_TIME = 51, // coap:rtt
+    DIAG_ID_CLOUD_PUBLISH_TIME = 52, // pub:time
     DIAG_ID_USER = 32768 // Base value for application-specific source IDs
 } diag_id;
 
 // Data types
 typedef enum diag_type {
     DIAG_TYPE_INT = 1, // 32-bit signed integer
-    DIAG_TYPE_UINT = 2 // 32-bit unsigned integer
+    DIAG_TYPE_UINT = 2, // 32-bit unsigned integer
+    DIAG_TYPE_HISTOGRAM = 3 // Histogram (see below)
 } diag_type;
 
+// Histogram data is a sequence of unsigned base-128 varints: format version, number of sub-buckets
+// per power of two (log2), number of buckets, total count, minimum and maximum value, followed by
+// an index delta and a count for each non-empty bucket. The index delta of the first non-empty
+// bucket is its index; the delta of a subsequent bucket is relative to the previous non-empty bucket
+#define DIAG_HISTOGRAM_FORMAT_VERSION 1
+
 // Data source commands
 typedef enum diag_source_cmd {
     DIAG_SOURCE_CMD_GET = 1 // Get current data
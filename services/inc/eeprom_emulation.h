@@ -20,6 +20,8 @@
  ******************************************************************************
  */
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 #include <memory>
 #include <vector>
@@ -89,9 +91,25 @@
  * not call performPendingErase() before the next page swap, the
  * alternate page will be erased just before the page swap.
  *
+ * Optionally (RamIndex = true), the latest value of every byte and the
+ * address where the next record will be written are kept in RAM. The
+ * index is rebuilt from the active page at init and after each page swap,
+ * so reads are a copy from RAM and writes don't scan the page. It uses
+ * capacity() bytes of RAM.
+ *
+ * With the index, the page swap is also done incrementally: once the
+ * active page is nearly full and the alternate page is erased, each write
+ * copies a batch of values from the index to the alternate page (in the
+ * COPY state) and values that change after being copied are appended to
+ * both pages. When the active page is full, only the remaining values are
+ * copied before the alternate page is marked active. A reset during the
+ * copy leaves the alternate page in the COPY state, which is erased
+ * before the next page swap like any other non-active page.
+ *
  */
 
-template <typename Store, uintptr_t PageBase1, size_t PageSize1, uintptr_t PageBase2, size_t PageSize2>
+template <typename Store, uintptr_t PageBase1, size_t PageSize1, uintptr_t PageBase2, size_t PageSize2,
+        bool RamIndex = false>
 class EEPROMEmulation
 {
 public:
@@ -101,6 +119,9 @@ public:
 
     static constexpr size_t SmallestPageSize = (PageSize1 < PageSize2) ? PageSize1 : PageSize2;
 
+    // Number of values copied to the alternate page by each write during an incremental page swap
+    static const Index IncrementalCopyBatchSize = 32;
+
     enum class LogicalPage
     {
         NoPage,
@@ -181,6 +202,17 @@ public:
         }
     }
 
+    EEPROMEmulation()
+        : activePage(LogicalPage::NoPage),
+          alternatePage(LogicalPage::NoPage),
+          nextRecordAddress(0),
+          nextRecordWritable(false),
+          copying(false),
+          copyIndex(0),
+          copyAddress(0)
+    {
+    }
+
     // Read the latest value of a byte of EEPROM in data or 0xFF if the
     // value was not programmed
     void get(Index index, Data &data)
@@ -306,6 +338,53 @@ public:
             activePage = LogicalPage::NoPage;
             alternatePage = LogicalPage::NoPage;
         }
+
+        if(RamIndex)
+        {
+            rebuildIndex();
+        }
+    }
+
+    // Read the latest value of each byte and find the address where to
+    // write new records in a single pass through the active page
+    void rebuildIndex()
+    {
+        std::memset(values.data(), FLASH_ERASED, values.size());
+        copying = false;
+        nextRecordWritable = false;
+        nextRecordAddress = getPageEnd(getActivePage());
+
+        if(getActivePage() == LogicalPage::NoPage)
+        {
+            return;
+        }
+
+        bool hasInvalidRecords = false;
+        forEachRecord(getActivePage(), [&](Address address, const Record &record) -> bool
+        {
+            if(record.empty())
+            {
+                nextRecordAddress = address;
+                return true;
+            }
+            else if(record.valid() && !hasInvalidRecords)
+            {
+                if(record.index < values.size())
+                {
+                    values[record.index] = record.data;
+                }
+                return false;
+            }
+            else
+            {
+                // Records after an invalid one are not read, but the
+                // first empty record is still needed for the write address
+                hasInvalidRecords = true;
+                return false;
+            }
+        });
+
+        nextRecordWritable = !hasInvalidRecords;
     }
 
     // Which page should currently be read from/written to
@@ -339,6 +418,15 @@ public:
     {
         std::memset(data, FLASH_ERASED, length);
 
+        if(RamIndex)
+        {
+            if(indexBegin < values.size())
+            {
+                std::memcpy(data, &values[indexBegin], std::min<size_t>(length, values.size() - indexBegin));
+            }
+            return;
+        }
+
         Index indexEnd = indexBegin + length;
         forEachValidRecord(getActivePage(), [=](Address address, const Record &record)
         {
@@ -359,6 +447,12 @@ public:
             return;
         }
 
+        if(RamIndex)
+        {
+            writeRangeIndexed(indexBegin, data, length);
+            return;
+        }
+
         // Read existing values for range
         std::unique_ptr<Data[]> existingData(new Data[length]);
         // don't write anything if memory is full
@@ -386,6 +480,164 @@ public:
         }
     }
 
+    // Same as writeRange, but the existing values and the address where to
+    // write new records come from the RAM index
+    void writeRangeIndexed(Index indexBegin, const Data *data, uint16_t length)
+    {
+        const Data *existingData = &values[indexBegin];
+
+        uint16_t changedCount = 0;
+        for(uint16_t i = 0; i < length; i++)
+        {
+            if(existingData[i] != data[i])
+            {
+                changedCount++;
+            }
+        }
+
+        if(changedCount == 0)
+        {
+            return;
+        }
+
+        bool success = nextRecordWritable && writeRangeChanged(nextRecordAddress, indexBegin, data, existingData, length);
+
+        if(!success)
+        {
+            swapPagesAndWrite(indexBegin, data, length);
+            return;
+        }
+
+        nextRecordAddress += changedCount * sizeof(Record);
+
+        // Values that were already copied to the alternate page are
+        // appended there too, so that the copy stays up to date
+        if(copying)
+        {
+            const Address endAddress = getPageEnd(getAlternatePage());
+            for(uint16_t i = 0; i < length && copying; i++)
+            {
+                const Index recordIndex = indexBegin + i;
+                if(existingData[i] != data[i] && recordIndex < copyIndex)
+                {
+                    copying = writeRecord(copyAddress, endAddress, Record(recordIndex, data[i]));
+                    copyAddress += sizeof(Record);
+                }
+            }
+        }
+
+        std::memcpy(&values[indexBegin], data, length);
+
+        continueIncrementalCopy();
+    }
+
+    // Start copying values to the alternate page once the active page is
+    // nearly full, then copy a batch of values on each call
+    void continueIncrementalCopy()
+    {
+        const LogicalPage destinationPage = getAlternatePage();
+
+        if(!copying)
+        {
+            // Leave enough room in the alternate page for a copy of all
+            // values plus every record that can still be appended to the
+            // active page
+            const size_t freeRecords = (getPageEnd(getActivePage()) - nextRecordAddress) / sizeof(Record);
+            const size_t destinationRecords = (getPageSize(destinationPage) - sizeof(PageHeader)) / sizeof(Record);
+            if(freeRecords > (destinationRecords - capacity()) / 2)
+            {
+                return;
+            }
+
+            // Erasing the alternate page here would block like a full
+            // page swap, so an incremental copy only starts once the
+            // pending erase has been performed
+            if(readPageStatus(destinationPage) != PageHeader::ERASED || !verifyPage(destinationPage) ||
+                    !writePageStatus(destinationPage, PageHeader::COPY))
+            {
+                return;
+            }
+
+            copying = true;
+            copyIndex = 0;
+            copyAddress = getPageBegin(destinationPage) + sizeof(PageHeader);
+        }
+
+        copying = copyValues(copyIndex, capacity(), copyAddress, getPageEnd(destinationPage), IncrementalCopyBatchSize);
+    }
+
+    // Copy non-erased values from the index to a page, starting at
+    // indexBegin, until maxCount records have been written
+    bool copyValues(Index &indexBegin, Index indexEnd, Address &address, Address endAddress, size_t maxCount)
+    {
+        bool success = true;
+        for(size_t count = 0; indexBegin < indexEnd && count < maxCount && success; indexBegin++)
+        {
+            if(values[indexBegin] != FLASH_ERASED)
+            {
+                success = writeRecord(address, endAddress, Record(indexBegin, values[indexBegin]));
+                address += sizeof(Record);
+                count++;
+            }
+        }
+        return success;
+    }
+
+    // Complete an incremental page swap: copy the remaining values, write
+    // the new values and mark the alternate page active
+    //
+    // Returns false if there is no copy in progress or the copy failed, in
+    // which case a full page swap should be done
+    bool finishIncrementalCopy(Index indexBegin, const Data *data, uint16_t length)
+    {
+        if(!RamIndex || !copying)
+        {
+            return false;
+        }
+        copying = false;
+
+        const LogicalPage sourcePage = getActivePage();
+        const LogicalPage destinationPage = getAlternatePage();
+        const Address endAddress = getPageEnd(destinationPage);
+        const Index indexEnd = indexBegin + length;
+        const Index copiedEnd = copyIndex;
+        bool success = true;
+
+        // Copy values that were not copied yet, except the ones being replaced
+        Index nextIndex = copyIndex;
+        if(nextIndex < indexBegin)
+        {
+            success = copyValues(nextIndex, indexBegin, copyAddress, endAddress, capacity());
+        }
+        if(nextIndex < indexEnd)
+        {
+            nextIndex = indexEnd;
+        }
+        success = success && copyValues(nextIndex, capacity(), copyAddress, endAddress, capacity());
+
+        // Write the new values. Values that were already copied only need
+        // a record if they have changed
+        for(uint16_t i = 0; i < length && success; i++)
+        {
+            const Index recordIndex = indexBegin + i;
+            const Data previous = (recordIndex < copiedEnd) ? values[recordIndex] : FLASH_ERASED;
+            if(data[i] != previous)
+            {
+                success = writeRecord(copyAddress, endAddress, Record(recordIndex, data[i]));
+                copyAddress += sizeof(Record);
+            }
+        }
+
+        success = success && writePageStatus(destinationPage, PageHeader::ACTIVE);
+        success = success && writePageStatus(sourcePage, PageHeader::INACTIVE);
+
+        if(success)
+        {
+            updateActivePage();
+        }
+        return success;
+    }
+
     // Read values and find the address where to write new records
     //
     // Return false if there are invalid records, true if page can be
@@ -640,6 +892,11 @@ public:
     // Then erase the old active page
     bool swapPagesAndWrite(Index indexBegin, const Data *data, uint16_t length)
     {
+        if(finishIncrementalCopy(indexBegin, data, length))
+        {
+            return true;
+        }
+
         LogicalPage sourcePage = getActivePage();
         LogicalPage destinationPage = getAlternatePage();
 
@@ -698,6 +955,16 @@ public:
     {
         bool success = true;
         Address endAddress = getPageEnd(destinationPage);
+
+        // The index holds the latest value of each byte of the source page
+        if(RamIndex)
+        {
+            Index nextIndex = 0;
+            success = copyValues(nextIndex, exceptIndexBegin, writeAddress, endAddress, capacity());
+            nextIndex = exceptIndexEnd;
+            return success && copyValues(nextIndex, capacity(), writeAddress, endAddress, capacity());
+        }
+
         forEachUniqueValidRecord(sourcePage, [&](Address address, const Record &record)
         {
             // Don't copy the records that are being replaced or records that are 0xFF
@@ -740,6 +1007,11 @@ public:
     // Which page needs to be erased after a page swap.
     LogicalPage getPendingErasePage()
     {
+        // The alternate page is not erasable while values are being copied to it
+        if(RamIndex && copying)
+        {
+            return LogicalPage::NoPage;
+        }
         if(readPageStatus(getAlternatePage()) != PageHeader::ERASED)
         {
             return getAlternatePage();
@@ -756,4 +1028,16 @@ public:
 protected:
     LogicalPage activePage;
     LogicalPage alternatePage;
+
+    // RAM index: latest value of each byte in the active page
+    std::array<Data, RamIndex ? capacity() : 0> values;
+    // Address of the first empty record in the active page
+    Address nextRecordAddress;
+    // Whether new records can be appended at nextRecordAddress
+    bool nextRecordWritable;
+    // Incremental page swap state: values below copyIndex have been copied
+    // to the alternate page, and copyAddress is where the next record goes
+    bool copying;
+    Index copyIndex;
+    Address copyAddress;
 };
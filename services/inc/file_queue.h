@@ -193,6 +193,33 @@ public:
     	return lfs_remove(lfs(), path_);
     }
 
+    /**
+     * Count the active entries in the queue.
+     *
+     * @return the number of entries, 0 when the queue file does not exist.
+     */
+    int count() {
+        FsLock lk(fs_);
+        _open();
+        int ret = lfs_file_open(lfs(), &read_file_, path_, LFS_O_RDONLY);
+        if (ret) {
+            return (ret==LFS_ERR_NOENT) ? 0 : ret;
+        }
+        int count = 0;
+        QueueEntry entry;
+        while ((ret = lfs_file_read(lfs(), &read_file_, &entry, sizeof(entry)))==sizeof(entry)) {
+            if (entry.flags & QueueEntry::ACTIVE) {
+                count++;
+            }
+            ret = lfs_file_seek(lfs(), &read_file_, entry.size-sizeof(entry), LFS_SEEK_CUR);
+            if (ret<0) {
+                break;
+            }
+        }
+        ret = preserve_error(lfs_file_close(lfs(), &read_file_), ret);
+        return ret<0 ? ret : count;
+    }
+
 private:
 
     int file_write(lfs_file* file, void* data, uint16_t size) {
@@ -128,6 +128,12 @@ public:
         write_count = count;
     }
 
+    // Number of bytes that can still be written before writes start failing
+    int getWriteCount()
+    {
+        return write_count;
+    }
+
     int getEraseCount()
     {
         return erase_count;
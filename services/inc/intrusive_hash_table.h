@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace particle {
+
+/**
+ * A hash table of items chained through a pointer member of the item.
+ *
+ * The table doesn't own its items and doesn't compute hashes: the caller passes the hash of an
+ * item's key to every operation. An item can be in several tables at once if each table uses
+ * its own `NextM` member.
+ */
+template<typename ItemT, size_t BucketCount, ItemT* ItemT::*NextM>
+class IntrusiveHashTable {
+public:
+    static_assert(BucketCount > 0 && (BucketCount & (BucketCount - 1)) == 0, "Bucket count should be a power of 2");
+
+    typedef ItemT ItemType;
+
+    IntrusiveHashTable() :
+            buckets_(),
+            size_(0) {
+    }
+
+    void insert(ItemT* item, size_t hash) {
+        ItemT*& bucket = buckets_[hash & (BucketCount - 1)];
+        item->*NextM = bucket;
+        bucket = item;
+        ++size_;
+    }
+
+    /**
+     * Returns the first item with the given hash for which `match(item)` returns `true`.
+     */
+    template<typename MatchF>
+    ItemT* find(size_t hash, MatchF match) const {
+        for (ItemT* item = buckets_[hash & (BucketCount - 1)]; item != nullptr; item = item->*NextM) {
+            if (match(item)) {
+                return item;
+            }
+        }
+        return nullptr;
+    }
+
+    bool remove(ItemT* item, size_t hash) {
+        for (ItemT** p = &buckets_[hash & (BucketCount - 1)]; *p != nullptr; p = &((*p)->*NextM)) {
+            if (*p == item) {
+                *p = item->*NextM;
+                item->*NextM = nullptr;
+                --size_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    ItemT* buckets_[BucketCount];
+    size_t size_;
+};
+
+} // namespace particle
@@ -193,6 +193,14 @@ typedef void (*log_write_callback_type)(const char *data, size_t size, int level
 // Callback invoked to check whether logging is enabled for particular level and category (used by log_enabled())
 typedef int (*log_enabled_callback_type)(int level, const char *category, void *reserved);
 
+// Callback for message-based logging taking the format string and arguments instead of a formatted message
+// (used by log_message()). Returns 0 if the message should be formatted and passed to the message callback instead
+typedef int (*log_message_v_callback_type)(int level, const char *category, const LogAttributes *attr, const char *fmt,
+        va_list args, void *reserved);
+
+// Callback invoked to write out any buffered logging output (used by log_flush())
+typedef void (*log_flush_callback_type)(void *reserved);
+
 // Generates log message
 void log_message(int level, const char *category, LogAttributes *attr, void *reserved, const char *fmt, ...);
 
@@ -222,6 +230,12 @@ const char* log_level_name(int level, void *reserved);
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
         log_enabled_callback_type log_enabled, void *reserved);
 
+// Sets callbacks used by a logger that buffers logging output
+void log_set_async_callbacks(log_message_v_callback_type log_msg_v, log_flush_callback_type log_flush, void *reserved);
+
+// Writes out any buffered logging output. This function is called on panic
+void log_flush(void *reserved);
+
 extern void HAL_Delay_Microseconds(uint32_t delay);
 
 #ifdef __cplusplus
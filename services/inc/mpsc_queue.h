@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace particle {
+
+/**
+ * A bounded lock-free queue for multiple producers and a single consumer.
+ *
+ * Every cell of the ring carries a sequence number that tells whether it is free for the
+ * producer that claimed its position or holds an item for the consumer. Producers claim
+ * positions with a compare-and-swap on the tail, so a producer is never blocked by another
+ * producer or by the consumer. Items can be pushed from an ISR.
+ *
+ * `ItemT` should be cheap to copy, typically a pointer.
+ */
+template<typename ItemT>
+class MpscQueue {
+public:
+    typedef ItemT ItemType;
+
+    MpscQueue() :
+            cells_(nullptr),
+            mask_(0),
+            head_(0),
+            tail_(0) {
+    }
+
+    ~MpscQueue() {
+        delete[] cells_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /**
+     * Allocates the queue storage. The capacity is rounded up to a power of two.
+     */
+    bool init(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        delete[] cells_;
+        cells_ = new(std::nothrow) Cell[size];
+        if (!cells_) {
+            mask_ = 0;
+            return false;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        mask_ = size - 1;
+        head_ = 0;
+        tail_.store(0, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const {
+        return cells_ ? mask_ + 1 : 0;
+    }
+
+    /**
+     * Adds an item to the queue. May be called from any thread.
+     *
+     * @return `false` if the queue is full.
+     */
+    bool push(const ItemT& item) {
+        if (!cells_) {
+            return false;
+        }
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->seq.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The consumer has not taken the item pushed one round before
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = item;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Takes the oldest item from the queue. Must only be called from the consumer thread.
+     *
+     * @return `false` if the queue is empty, or if the producer of the oldest item has not
+     *         finished pushing it yet.
+     */
+    bool pop(ItemT& item) {
+        if (!cells_) {
+            return false;
+        }
+        Cell& cell = cells_[head_ & mask_];
+        if (cell.seq.load(std::memory_order_acquire) != head_ + 1) {
+            return false;
+        }
+        item = cell.item;
+        cell.seq.store(head_ + mask_ + 1, std::memory_order_release);
+        ++head_;
+        return true;
+    }
+
+    /**
+     * Returns `true` if there is no item for the consumer. Must only be called from the consumer thread.
+     */
+    bool empty() const {
+        return !cells_ || cells_[head_ & mask_].seq.load(std::memory_order_acquire) != head_ + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        ItemT item;
+    };
+
+    Cell* cells_;
+    size_t mask_;
+    size_t head_; // Accessed by the consumer only
+    std::atomic<size_t> tail_;
+};
+
+} // particle
@@ -110,6 +110,9 @@ DYNALIB_FN(55, services, pb_encode_varint, bool(pb_ostream_t*, pb_uint64_t))
 # define BASE_IDX 40
 #endif
 
+DYNALIB_FN(BASE_IDX + 0, services, log_set_async_callbacks, void(log_message_v_callback_type, log_flush_callback_type, void*))
+DYNALIB_FN(BASE_IDX + 1, services, log_flush, void(void*))
+
 DYNALIB_END(services)
 
 #undef BASE_IDX
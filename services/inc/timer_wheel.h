@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace particle {
+
+/**
+ * Base class for items scheduled in a `TimerWheel`.
+ */
+template<typename DerivedT>
+class TimerWheelNode {
+public:
+    /**
+     * Returns the tick at which the item expires.
+     */
+    uint32_t expiry() const {
+        return expiry_;
+    }
+
+private:
+    DerivedT* wheelNext_ = nullptr;
+    uint32_t expiry_ = 0;
+
+    template<typename ItemT, unsigned SlotBits, unsigned Levels>
+    friend class TimerWheel;
+};
+
+/**
+ * A hierarchical timer wheel.
+ *
+ * Level 0 has a slot per tick, every following level has a slot per full turn of the previous
+ * level. Items far in the future are kept in the higher levels and are moved down when the
+ * previous level completes a turn, so that advancing the wheel only touches the items that are
+ * due and the contents of a single higher level slot.
+ *
+ * Postponing an item only updates its expiry time: the item is moved when its original slot is
+ * reached. This keeps postponing an item, which is much more frequent than expiring it, O(1)
+ * without a doubly linked list.
+ *
+ * Ticks are unsigned and may wrap around. `ItemT` should be derived from `TimerWheelNode<ItemT>`.
+ */
+template<typename ItemT, unsigned SlotBits = 6, unsigned Levels = 2>
+class TimerWheel {
+public:
+    static_assert(SlotBits * Levels < 32, "Timer wheel is too large");
+
+    static const unsigned SLOT_COUNT = 1 << SlotBits;
+    static const uint32_t MAX_DELAY = ((uint32_t)1 << (SlotBits * Levels)) - 1;
+
+    explicit TimerWheel(uint32_t now = 0) :
+            slots_(),
+            now_(now),
+            size_(0) {
+    }
+
+    /**
+     * Schedules an item to expire at the given tick.
+     */
+    void add(ItemT* item, uint32_t expiry) {
+        item->expiry_ = expiry;
+        insert(item, 1);
+        ++size_;
+    }
+
+    /**
+     * Moves the expiry time of a scheduled item. The new expiry time should not be earlier than
+     * the current one.
+     */
+    void postpone(ItemT* item, uint32_t expiry) {
+        item->expiry_ = expiry;
+    }
+
+    /**
+     * Advances the wheel by the given number of ticks and calls `expired(item)` for every item
+     * that has expired. The item is no longer in the wheel when the function is called and may
+     * be destroyed or added to the wheel again.
+     */
+    template<typename ExpiredF>
+    void advance(uint32_t ticks, ExpiredF expired) {
+        while (ticks-- > 0) {
+            ++now_;
+            // Move the items of the next higher level slot down once a level completes a turn
+            for (unsigned level = 1; level < Levels && index(now_, level - 1) == 0; ++level) {
+                ItemT* item = take(level, index(now_, level));
+                while (item) {
+                    ItemT* next = item->wheelNext_;
+                    // Items that expire at this tick go to the slot that is processed below
+                    insert(item, 0);
+                    item = next;
+                }
+            }
+            ItemT* item = take(0, index(now_, 0));
+            while (item) {
+                ItemT* next = item->wheelNext_;
+                if ((int32_t)(item->expiry_ - now_) > 0) {
+                    // Postponed or too far in the future for the highest level
+                    insert(item, 1);
+                } else {
+                    --size_;
+                    expired(item);
+                }
+                item = next;
+            }
+        }
+    }
+
+    uint32_t now() const {
+        return now_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    ItemT* slots_[Levels][SLOT_COUNT];
+    uint32_t now_;
+    size_t size_;
+
+    static unsigned index(uint32_t tick, unsigned level) {
+        return (tick >> (SlotBits * level)) & (SLOT_COUNT - 1);
+    }
+
+    void insert(ItemT* item, uint32_t minDelay) {
+        uint32_t delay = item->expiry_ - now_;
+        if ((int32_t)delay < (int32_t)minDelay) {
+            // Already expired, handle as soon as possible
+            delay = minDelay;
+        } else if (delay > MAX_DELAY) {
+            delay = MAX_DELAY;
+        }
+        const uint32_t tick = now_ + delay;
+        unsigned level = 0;
+        while (level < Levels - 1 && (delay >> (SlotBits * (level + 1))) != 0) {
+            ++level;
+        }
+        ItemT*& slot = slots_[level][index(tick, level)];
+        item->wheelNext_ = slot;
+        slot = item;
+    }
+
+    ItemT* take(unsigned level, unsigned index) {
+        ItemT* item = slots_[level][index];
+        slots_[level][index] = nullptr;
+        return item;
+    }
+};
+
+} // namespace particle
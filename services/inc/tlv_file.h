@@ -19,13 +19,30 @@
 #define SERVICES_TLV_FILE_H
 
 #include "filesystem.h"
+#include "spark_wiring_vector.h"
 #include <stdio.h>
 
 namespace particle { namespace services { namespace settings {
 
 static constexpr uint32_t TLV_FILE_MAGICK = 0x714f11e5;
+/* Files containing deleted entries use a different magic number, so that older firmware, which
+ * doesn't know the deleted entry marker, discards such a file instead of misreading it */
+static constexpr uint32_t TLV_FILE_DELETED_MAGICK = 0x714f11e6;
+static constexpr uint16_t TLV_FILE_DELETED_VERSION = 1;
 static constexpr uint32_t TLV_HEADER_MAGICK = 0x4ead;
+static constexpr uint32_t TLV_HEADER_DELETED_MAGICK = 0xdead;
 
+/**
+ * Key-value storage in a single LittleFS file.
+ *
+ * Entries are appended to the file and deleted entries are marked in place, so that a change
+ * doesn't move any other entry. Offsets of all entries are kept in a directory in RAM, which is
+ * built when the file is opened. The space taken by deleted entries is reclaimed by compact(),
+ * which is also called after a change once deleted entries take up a significant part of the file.
+ * A compacted file uses the original format.
+ *
+ * Changes made between beginBatch() and commitBatch() are synced to the filesystem together.
+ */
 class TlvFile {
 public:
     TlvFile(const char* path);
@@ -47,6 +64,21 @@ public:
     int add(uint16_t key, const uint8_t* value, uint16_t length);
     int del(uint16_t key, int index = -1);
 
+    /**
+     * Starts a batch of changes. Batches can be nested, the changes are committed when the
+     * outermost batch is committed.
+     */
+    int beginBatch();
+    int commitBatch();
+
+    /**
+     * Rewrites the file without deleted entries.
+     */
+    int compact();
+
+    // Deleted entries are compacted when they take more than this many bytes and at least half of the file
+    static constexpr size_t COMPACTION_THRESHOLD = 1024;
+
 private:
     struct FileFooter {
         uint32_t reserved;  /* CRC32? */
@@ -65,6 +97,12 @@ private:
     } __attribute__((__packed__));
     static_assert(sizeof(TlvHeader) == sizeof(uint32_t) * 2, "sizeof(TlvHeader) != 8");
 
+    struct Entry {
+        uint16_t key;
+        uint16_t length;
+        uint32_t offset;
+    };
+
 private:
     lfs_t* lfs();
 
@@ -74,8 +112,11 @@ private:
 
     int mkdir(char* dir);
 
-    ssize_t find(uint16_t key, int index, uint16_t* dataSize);
+    int buildIndex();
+    int find(uint16_t key, int index);
+    int commit();
     int readFooter(FileFooter& footer);
+    int writeFooter();
 
     ssize_t seek(ssize_t offset, int whence = SEEK_SET);
     ssize_t read(uint8_t* buf, size_t length);
@@ -87,6 +128,14 @@ private:
     bool open_ = false;
     filesystem_t* fs_ = nullptr;
     lfs_file_t file_ = {};
+
+    /* Entries sorted by key, entries with the same key are sorted by offset */
+    spark::Vector<Entry> entries_;
+    uint32_t dataSize_ = 0;
+    uint32_t deletedSize_ = 0;
+    int batch_ = 0;
+    bool footerChanged_ = false;
+    bool changed_ = false;
 };
 
 } } } /* namespace particle::services::settings */
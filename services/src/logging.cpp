@@ -67,6 +67,8 @@ namespace {
 volatile log_message_callback_type log_msg_callback = 0;
 volatile log_write_callback_type log_write_callback = 0;
 volatile log_enabled_callback_type log_enabled_callback = 0;
+volatile log_message_v_callback_type log_msg_v_callback = 0;
+volatile log_flush_callback_type log_flush_callback = 0;
 
 } // namespace
 
@@ -77,6 +79,18 @@ void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_typ
     log_enabled_callback = log_enabled;
 }
 
+void log_set_async_callbacks(log_message_v_callback_type log_msg_v, log_flush_callback_type log_flush, void *reserved) {
+    log_msg_v_callback = log_msg_v;
+    log_flush_callback = log_flush;
+}
+
+void log_flush(void *reserved) {
+    const log_flush_callback_type flush_callback = log_flush_callback;
+    if (flush_callback) {
+        flush_callback(0);
+    }
+}
+
 void log_message_v(int level, const char *category, LogAttributes *attr, void *reserved, const char *fmt, va_list args) {
     const log_message_callback_type msg_callback = log_msg_callback;
     if (!msg_callback && (!log_compat_callback || level < log_compat_level)) {
@@ -86,6 +100,16 @@ void log_message_v(int level, const char *category, LogAttributes *attr, void *r
     if (!attr->has_time) {
         LOG_ATTR_SET(*attr, time, HAL_Timer_Get_Milli_Seconds());
     }
+    const log_message_v_callback_type msg_v_callback = log_msg_v_callback;
+    if (msg_v_callback && msg_callback) {
+        va_list args_copy;
+        va_copy(args_copy, args);
+        const int ok = msg_v_callback(level, category, attr, fmt, args_copy, 0);
+        va_end(args_copy);
+        if (ok) {
+            return;
+        }
+    }
     char buf[LOG_MAX_STRING_LENGTH];
     if (msg_callback) {
         const int n = vsnprintf(buf, sizeof(buf), fmt, args);
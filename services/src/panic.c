@@ -54,6 +54,8 @@ void panic_(ePanicCode code, void* extraInfo, void (*HAL_Delay_Microseconds)(uin
         LED_Signaling_Stop();
         uint16_t c;
         int loops = 2;
+        // Write out messages buffered by an asynchronous logger
+        log_flush(NULL);
         LOG_PRINT(TRACE, "!");
         LED_Off(LED_RGB);
         while(loops) {
@@ -119,14 +119,14 @@ ssize_t TlvFile::get(uint16_t key, uint8_t* value, uint16_t length, int index) {
         return SYSTEM_ERROR_INVALID_ARGUMENT;
     }
 
-    uint16_t dataSize;
     ssize_t ret = SYSTEM_ERROR_NOT_FOUND;
-    ssize_t pos = find(key, index, &dataSize);
-    if (pos >= 0) {
+    const int i = find(key, index);
+    if (i >= 0) {
         /* Found it */
-        const size_t toRead = std::min(length, dataSize);
+        const Entry& entry = entries_[i];
+        const size_t toRead = std::min(length, entry.length);
         if (toRead) {
-            ret = seek(pos + sizeof(TlvHeader));
+            ret = seek(entry.offset + sizeof(TlvHeader));
             if (ret >= 0) {
                 ret = read(value, toRead);
             }
@@ -143,13 +143,16 @@ int TlvFile::set(uint16_t key, const uint8_t* value, uint16_t length, int index)
         return SYSTEM_ERROR_INVALID_STATE;
     }
 
-    /* Delete previous entry */
+    /* Delete previous entry and add the new one in a single commit */
+    beginBatch();
+
     int ret = del(key, index);
-    if (!(ret == 0 || ret == SYSTEM_ERROR_NOT_FOUND)) {
-        return ret;
+    if (ret == 0 || ret == SYSTEM_ERROR_NOT_FOUND) {
+        ret = add(key, value, length);
     }
 
-    return add(key, value, length);
+    const int r = commitBatch();
+    return ret ? ret : r;
 }
 
 int TlvFile::add(uint16_t key, const uint8_t* value, uint16_t length) {
@@ -159,19 +162,26 @@ int TlvFile::add(uint16_t key, const uint8_t* value, uint16_t length) {
         return SYSTEM_ERROR_INVALID_STATE;
     }
 
-    FileFooter footer;
-    int ret = readFooter(footer);
-    if (ret < 0) {
-        return ret;
+    if (value == nullptr && length != 0) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
     }
-    ssize_t pos = footer.size;
 
-    if (pos < 0) {
-        return pos;
+    Entry entry = {};
+    entry.key = key;
+    entry.length = length;
+    entry.offset = dataSize_;
+
+    /* Reserve the directory entry first, so that running out of memory leaves the file intact */
+    auto it = std::upper_bound(entries_.begin(), entries_.end(), key, [](uint16_t key, const Entry& e) {
+        return key < e.key;
+    });
+    if (!entries_.insert(it - entries_.begin(), entry)) {
+        return SYSTEM_ERROR_NO_MEMORY;
     }
 
-    ret = seek(pos);
+    int ret = seek(entry.offset);
     if (ret < 0) {
+        buildIndex();
         return ret;
     }
 
@@ -180,25 +190,22 @@ int TlvFile::add(uint16_t key, const uint8_t* value, uint16_t length) {
     header.key = key;
     header.length = length;
 
-    /* Write entry header */
+    /* Write entry header. The file footer is written when the change is committed */
     ret = write((const uint8_t*)&header, sizeof(header));
-    if (ret < 0) {
-        return ret;
-    }
-    /* Write data */
-    ret = write((const uint8_t*)value, length);
-    if (ret < 0) {
-        return ret;
+    if (ret >= 0) {
+        /* Write data */
+        ret = write((const uint8_t*)value, length);
     }
-    /* Write file footer */
-    footer.magick = TLV_FILE_MAGICK;
-    footer.size += sizeof(header) + length;
-    ret = write((const uint8_t*)&footer, sizeof(footer));
     if (ret < 0) {
+        buildIndex();
         return ret;
     }
 
-    return sync();
+    dataSize_ += sizeof(header) + length;
+    footerChanged_ = true;
+    changed_ = true;
+
+    return commit();
 }
 
 int TlvFile::del(uint16_t key, int index) {
@@ -208,86 +215,195 @@ int TlvFile::del(uint16_t key, int index) {
         return SYSTEM_ERROR_INVALID_STATE;
     }
 
-    int ret = 0;
+    const int i = find(key, index);
+    if (i < 0) {
+        return i;
+    }
 
-    for (;;) {
-        uint16_t dataSize = 0;
-        ssize_t pos = find(key, index, &dataSize);
-        if (pos < 0) {
-            return pos;
+    /* Entries with the same key are adjacent in the directory */
+    int first = i;
+    int last = i + 1;
+    if (index < 0) {
+        while (first > 0 && entries_[first - 1].key == key) {
+            --first;
         }
+    }
 
-        /* FIXME: this will only work on LittleFS. Provide a different implementation later
-         * when filesystem API is finalized and TlvFile implementation is refactored not to use
-         * LittleFS API.
-         */
-        const ssize_t fileSize = size();
+    for (int j = first; j < last; ++j) {
+        const Entry& entry = entries_[j];
 
-        FileFooter footer;
-        ret = readFooter(footer);
+        /* Mark the entry deleted, preserving its length so that the following entries can be found */
+        TlvHeader header = {};
+        header.magick = TLV_HEADER_DELETED_MAGICK;
+        header.key = entry.key;
+        header.length = entry.length;
 
-        while (ret == 0) {
-            lfs_file_t f;
-            ret = lfs_file_open(lfs(), &f, path_, LFS_O_RDONLY);
-            if (ret) {
-                break;
-            }
+        int ret = seek(entry.offset);
+        if (ret >= 0) {
+            ret = write((const uint8_t*)&header, sizeof(header));
+        }
+        if (ret < 0) {
+            buildIndex();
+            return ret;
+        }
 
-            size_t wpos = pos;
-            size_t rpos = wpos + sizeof(TlvHeader) + dataSize;
+        deletedSize_ += sizeof(TlvHeader) + entry.length;
+        /* The footer changes its magic number once the file contains deleted entries */
+        footerChanged_ = true;
+        changed_ = true;
+    }
 
-            ret = seek(wpos);
-            if (ret < 0) {
-                break;
-            }
+    entries_.removeAt(first, last - first);
 
-            ret = lfs_file_seek(lfs(), &f, rpos, LFS_SEEK_SET);
-            if (ret < 0) {
-                break;
-            }
+    return commit();
+}
 
-            for (; rpos < footer.size && ret > 0; ++wpos, ++rpos) {
-                uint8_t tmp;
-                ret = lfs_file_read(lfs(), &f, &tmp, sizeof(tmp));
-                if (ret < 0) {
-                    break;
-                }
-
-                ret = write(&tmp, sizeof(tmp));
-                if (ret < 0) {
-                    break;
-                }
-            }
+int TlvFile::beginBatch() {
+    FsLock lk(fs_);
 
-            if (ret > 0) {
-                /* Write footer */
-                footer.size -= sizeof(TlvHeader) + dataSize;
-                ret = write((const uint8_t*)&footer, sizeof(footer));
-                if (ret < 0) {
-                    break;
-                }
-                /* Truncate */
-                ret = lfs_file_truncate(lfs(), &file_, fileSize - (sizeof(TlvHeader) + dataSize));
-                if (ret < 0) {
-                    break;
-                }
-                ret = sync();
-            }
+    if (!open_) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+
+    ++batch_;
+
+    return 0;
+}
+
+int TlvFile::commitBatch() {
+    FsLock lk(fs_);
+
+    if (batch_ <= 0) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+
+    --batch_;
+
+    if (!open_) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+
+    return commit();
+}
+
+int TlvFile::compact() {
+    FsLock lk(fs_);
+
+    if (!open_) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+
+    if (batch_ > 0) {
+        return SYSTEM_ERROR_BUSY;
+    }
 
-            lfs_file_close(lfs(), &f);
+    if (!deletedSize_) {
+        return 0;
+    }
+
+    /* Copy the remaining entries to a temporary file and replace the original file with it */
+    const size_t pathLen = strlen(path_);
+    char* tmpPath = (char*)malloc(pathLen + sizeof(".tmp"));
+    if (tmpPath == nullptr) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    memcpy(tmpPath, path_, pathLen);
+    memcpy(tmpPath + pathLen, ".tmp", sizeof(".tmp"));
+
+    lfs_file_t f;
+    int ret = lfs_file_open(lfs(), &f, tmpPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+    if (ret) {
+        free(tmpPath);
+        return ret;
+    }
 
+    uint32_t pos = 0;
+    for (const Entry& entry: entries_) {
+        ret = seek(entry.offset);
+        for (size_t offs = 0, size = sizeof(TlvHeader) + entry.length; offs < size && ret >= 0;) {
+            uint8_t buf[64];
+            const size_t n = std::min(size - offs, sizeof(buf));
+            ret = read(buf, n);
+            if (ret == (int)n) {
+                ret = lfs_file_write(lfs(), &f, buf, n);
+            } else if (ret >= 0) {
+                ret = SYSTEM_ERROR_BAD_DATA;
+            }
+            offs += n;
+        }
+        if (ret < 0) {
             break;
         }
+        pos += sizeof(TlvHeader) + entry.length;
+    }
 
+    if (ret >= 0) {
+        FileFooter footer = {};
+        footer.magick = TLV_FILE_MAGICK;
+        footer.size = pos;
+        ret = lfs_file_write(lfs(), &f, &footer, sizeof(footer));
+    }
 
-        if (ret || index >= 0) {
-            break;
+    /* Closing the file commits it */
+    const int r = lfs_file_close(lfs(), &f);
+    if (ret >= 0) {
+        ret = r;
+    }
+
+    if (ret >= 0) {
+        close();
+        ret = lfs_rename(lfs(), tmpPath, path_);
+        /* Reopening the file rebuilds the directory. If it fails, the file stays closed and
+         * further calls fail with SYSTEM_ERROR_INVALID_STATE */
+        int r = open();
+        if (r) {
+            /* Retry once in case the failure was transient */
+            r = open();
         }
+        if (ret >= 0 || r) {
+            ret = r;
+        }
+    } else {
+        lfs_remove(lfs(), tmpPath);
     }
 
+    free(tmpPath);
+
     return ret;
 }
 
+int TlvFile::commit() {
+    if (batch_ > 0 || !changed_) {
+        return 0;
+    }
+
+    int ret = 0;
+    if (footerChanged_) {
+        ret = writeFooter();
+    }
+    if (!ret) {
+        ret = sync();
+    }
+    if (ret) {
+        buildIndex();
+        return ret;
+    }
+
+    footerChanged_ = false;
+    changed_ = false;
+
+    if (deletedSize_ > COMPACTION_THRESHOLD && deletedSize_ >= dataSize_ / 2) {
+        /* Failing to compact the file doesn't affect the change that has been committed, unless
+         * the file couldn't be reopened afterwards */
+        const int r = compact();
+        if (r < 0 && !open_) {
+            return r;
+        }
+    }
+
+    return 0;
+}
+
 lfs_t* TlvFile::lfs() {
     SPARK_ASSERT(fs_);
     return &fs_->instance;
@@ -335,6 +451,9 @@ int TlvFile::open() {
     r = sync();
 
 open_done:
+    if (!r) {
+        r = buildIndex();
+    }
     if (r) {
         lfs_file_close(lfs(), &file_);
         open_ = false;
@@ -346,7 +465,7 @@ int TlvFile::validate() {
     FileFooter footer = {};
     int ret = readFooter(footer);
     if (!ret) {
-        if (footer.magick != TLV_FILE_MAGICK) {
+        if (footer.magick != TLV_FILE_MAGICK && footer.magick != TLV_FILE_DELETED_MAGICK) {
             ret = SYSTEM_ERROR_BAD_DATA;
         }
     }
@@ -364,6 +483,10 @@ int TlvFile::close() {
     /* Close */
 
     open_ = false;
+    entries_.clear();
+    batch_ = 0;
+    footerChanged_ = false;
+    changed_ = false;
 
     return lfs_file_close(lfs(), &file_);
 }
@@ -441,19 +564,39 @@ int TlvFile::readFooter(FileFooter& footer) {
     return SYSTEM_ERROR_BAD_DATA;
 }
 
-ssize_t TlvFile::find(uint16_t key, int index, uint16_t* dataSize) {
+int TlvFile::writeFooter() {
+    FileFooter footer = {};
+    if (deletedSize_) {
+        footer.magick = TLV_FILE_DELETED_MAGICK;
+        footer.version = TLV_FILE_DELETED_VERSION;
+    } else {
+        footer.magick = TLV_FILE_MAGICK;
+    }
+    footer.size = dataSize_;
+
+    ssize_t r = seek(dataSize_);
+    if (r >= 0) {
+        r = write((const uint8_t*)&footer, sizeof(footer));
+    }
+
+    return r < 0 ? r : 0;
+}
+
+int TlvFile::buildIndex() {
+    entries_.clear();
+    dataSize_ = 0;
+    deletedSize_ = 0;
+    footerChanged_ = false;
+    changed_ = false;
+
     FileFooter footer;
     int r = readFooter(footer);
     if (r) {
         return r;
     }
 
-    ssize_t candidatePos = -1;
-    int candidateIdx = -1;
-    uint16_t candidateSize = 0;
-
     TlvHeader header;
-    for (ssize_t pos = 0; pos >= 0 && (pos + sizeof(TlvHeader)) <= footer.size;) {
+    for (size_t pos = 0; (pos + sizeof(TlvHeader)) <= footer.size;) {
         r = seek(pos);
         if (r < 0) {
             return r;
@@ -464,29 +607,49 @@ ssize_t TlvFile::find(uint16_t key, int index, uint16_t* dataSize) {
             return SYSTEM_ERROR_BAD_DATA;
         }
 
-        if (header.magick != TLV_HEADER_MAGICK) {
+        if (header.magick == TLV_HEADER_MAGICK) {
+            /* Entries with the same key are appended in the order they are found */
+            auto it = std::upper_bound(entries_.begin(), entries_.end(), header.key, [](uint16_t key, const Entry& e) {
+                return key < e.key;
+            });
+            Entry entry = {};
+            entry.key = header.key;
+            entry.length = header.length;
+            entry.offset = pos;
+            if (!entries_.insert(it - entries_.begin(), entry)) {
+                return SYSTEM_ERROR_NO_MEMORY;
+            }
+        } else if (header.magick == TLV_HEADER_DELETED_MAGICK) {
+            deletedSize_ += sizeof(TlvHeader) + header.length;
+        } else {
             /* Attempt to recover */
             pos += sizeof(uint16_t);
+            deletedSize_ += sizeof(uint16_t);
             continue;
         }
 
-        if (header.key == key) {
-            candidatePos = pos;
-            ++candidateIdx;
-            candidateSize = header.length;
-            if (index >= 0 && candidateIdx >= index) {
-                break;
-            }
-        }
-
         pos += sizeof(TlvHeader) + header.length;
     }
 
-    if ((index >= 0 && candidateIdx == index) || (index < 0 && candidateIdx >= 0)) {
-        if (dataSize) {
-            *dataSize = candidateSize;
-        }
-        return candidatePos;
+    dataSize_ = footer.size;
+
+    return 0;
+}
+
+int TlvFile::find(uint16_t key, int index) {
+    auto first = std::lower_bound(entries_.begin(), entries_.end(), key, [](const Entry& e, uint16_t key) {
+        return e.key < key;
+    });
+    auto last = std::upper_bound(first, entries_.end(), key, [](uint16_t key, const Entry& e) {
+        return key < e.key;
+    });
+
+    if (index < 0 && first != last) {
+        /* The most recently added entry */
+        return (last - entries_.begin()) - 1;
+    }
+    if (index >= 0 && index < last - first) {
+        return (first - entries_.begin()) + index;
     }
 
     return SYSTEM_ERROR_NOT_FOUND;
@@ -23,13 +23,34 @@
 
 #if PLATFORM_THREADING
 
+#include <atomic>
 #include <functional>
 #include <mutex>
+#include <new>
 #include <thread>
 #include <future>
+#include <type_traits>
+#include <utility>
 
 #include "channel.h"
 #include "concurrent_hal.h"
+#include "mpsc_queue.h"
+
+/**
+ * The number of task objects that can be allocated from the static pool before falling back
+ * to the heap.
+ */
+#ifndef ACTIVE_OBJECT_TASK_POOL_SIZE
+#define ACTIVE_OBJECT_TASK_POOL_SIZE (8)
+#endif
+
+/**
+ * The maximum size of a task object that can be allocated from the static pool, including
+ * the captured state of the task closure.
+ */
+#ifndef ACTIVE_OBJECT_TASK_SIZE
+#define ACTIVE_OBJECT_TASK_SIZE (48)
+#endif
 
 /**
  * Configuratino data for an active object.
@@ -94,6 +115,14 @@ public:
     Message() {}
     virtual void operator()()=0;
     virtual ~Message() {}
+
+    /**
+     * Messages are allocated from a small static pool when they fit into a pool slot, so
+     * that posting a message to an active object doesn't usually touch the heap.
+     */
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, const std::nothrow_t&) noexcept;
+    static void operator delete(void* ptr);
 };
 
 /**
@@ -142,6 +171,26 @@ public:
 
 };
 
+/**
+ * An asynchronous task that stores the function object inline, rather than in a
+ * std::function. Disposes itself when complete.
+ */
+template <typename F>
+class AsyncCallTask : public Message
+{
+    F work;
+
+public:
+    template <typename FnT>
+    inline explicit AsyncCallTask(FnT&& fn_) : work(std::forward<FnT>(fn_)) {}
+
+    void operator()() override
+    {
+        work();
+        delete this;
+    }
+};
+
 /**
  * Promises. these are used for synchronous tasks.
  */
@@ -272,7 +321,7 @@ protected:
 protected:
 
 
-    // todo - concurrent queue should be a strategy so it's pluggable without requiring inheritance
+    // The concurrent queue is provided by a strategy, see BasicActiveObjectQueue
     virtual bool take(Item& item)=0;
     virtual bool put(Item& item)=0;
 
@@ -294,6 +343,13 @@ public:
 
     bool process();
 
+    /**
+     * Wakes the thread running this active object if it is waiting for a message, so that
+     * it runs its background task without waiting for the take timeout. May be called from an ISR.
+     */
+    virtual void wakeup() {
+    }
+
     bool isCurrentThread() {
         return os_thread_is_current(_thread);
     }
@@ -306,9 +362,9 @@ public:
         return started;
     }
 
-    template<typename R> void invoke_async(const std::function<R(void)>& work)
+    template<typename F> void invoke_async(F&& work)
     {
-        auto task = new AsyncTask<R>(work);
+        auto task = new(std::nothrow) AsyncCallTask<typename std::decay<F>::type>(std::forward<F>(work));
         if (task)
         {
 			Item message = task;
@@ -369,30 +425,97 @@ public:
 
 };
 
-class ActiveObjectQueue : public ActiveObjectBase
+/**
+ * Queue strategy that passes messages through an RTOS queue.
+ */
+class OsQueueStrategy
 {
-    os_queue_t  queue;
+    os_queue_t queue;
+
+public:
+    OsQueueStrategy() : queue(nullptr) {}
+
+    bool create(size_t size)
+    {
+        return !os_queue_create(&queue, sizeof(Message*), size, nullptr);
+    }
+
+    bool take(Message*& item, system_tick_t wait)
+    {
+        return !os_queue_take(queue, &item, wait, nullptr);
+    }
+
+    bool put(Message* item, system_tick_t wait)
+    {
+        return !os_queue_put(queue, &item, wait, nullptr);
+    }
+
+    void wakeup()
+    {
+        // An RTOS queue can't be woken up without posting a message, so the consumer returns at the take timeout
+    }
+};
+
+/**
+ * Queue strategy that passes messages through a lock-free ring, so that producers
+ * don't contend on the queue lock or enter the scheduler when the consumer is busy.
+ * The consumer thread sleeps on a semaphore that is only signalled when it is waiting
+ * for a message, and producers that find the ring full sleep on another semaphore that
+ * is only signalled when some producer is blocked.
+ */
+class MpscQueueStrategy
+{
+    particle::MpscQueue<Message*> queue;
+    os_semaphore_t signal;
+    os_semaphore_t space;
+    std::atomic<bool> waiting;
+    std::atomic<unsigned> blocked;
+
+public:
+    MpscQueueStrategy() : signal(nullptr), space(nullptr), waiting(false), blocked(0) {}
+
+    bool create(size_t size);
+    bool take(Message*& item, system_tick_t wait);
+    bool put(Message* item, system_tick_t wait);
+    void wakeup();
+};
+
+/**
+ * An active object that receives messages via a queue.
+ *
+ * @tparam QueueT The queue strategy. Must provide `create()`, `take()`, `put()` and `wakeup()`
+ *         with the same signatures as `OsQueueStrategy`.
+ */
+template<typename QueueT>
+class BasicActiveObjectQueue : public ActiveObjectBase
+{
+    QueueT queue;
 
 protected:
 
     virtual bool take(Item& result)
     {
-        return !os_queue_take(queue, &result, configuration.take_wait, nullptr);
+        return queue.take(result, configuration.take_wait);
     }
 
     virtual bool put(Item& item)
     {
-    		return !os_queue_put(queue, &item, configuration.put_wait, nullptr);
+        return queue.put(item, configuration.put_wait);
     }
 
     void createQueue()
     {
-        os_queue_create(&queue, sizeof(Item), configuration.queue_size, nullptr);
+        queue.create(configuration.queue_size);
     }
 
 public:
 
-    ActiveObjectQueue(const ActiveObjectConfiguration& config) : ActiveObjectBase(config), queue(NULL) {}
+    BasicActiveObjectQueue(const ActiveObjectConfiguration& config) : ActiveObjectBase(config) {}
+
+    virtual void wakeup() override
+    {
+        queue.wakeup();
+    }
 
     void start()
     {
@@ -404,24 +527,27 @@ public:
 /**
  * An active object that runs the message pump on the calling thread.
  */
-class ActiveObjectCurrentThreadQueue : public ActiveObjectQueue
+template<typename QueueT>
+class BasicActiveObjectCurrentThreadQueue : public BasicActiveObjectQueue<QueueT>
 {
+    using super = BasicActiveObjectQueue<QueueT>;
+
 public:
-    ActiveObjectCurrentThreadQueue(const ActiveObjectConfiguration& config) : ActiveObjectQueue(config) {}
+    BasicActiveObjectCurrentThreadQueue(const ActiveObjectConfiguration& config) : super(config) {}
 
     /**
      * Start the message pump on this thread. This method does not return.
      */
     void start()
     {
-        createQueue();
-        setCurrentThread();
-        run();
+        this->createQueue();
+        this->setCurrentThread();
+        this->run();
     }
 
     void process()
     {
-        ActiveObjectQueue::process();
+        super::process();
     }
 };
 
@@ -430,22 +556,26 @@ public:
  * An active object that runs the message pump on a new thread using a queue
  * for the message store.
  */
-class ActiveObjectThreadQueue : public ActiveObjectQueue
+template<typename QueueT>
+class BasicActiveObjectThreadQueue : public BasicActiveObjectQueue<QueueT>
 {
+    using super = BasicActiveObjectQueue<QueueT>;
 
 public:
 
-    ActiveObjectThreadQueue(const ActiveObjectConfiguration& config) : ActiveObjectQueue(config) {}
+    BasicActiveObjectThreadQueue(const ActiveObjectConfiguration& config) : super(config) {}
 
     void start()
     {
-        createQueue();
-        start_thread();
+        this->createQueue();
+        this->start_thread();
     }
 
 };
 
-
+typedef BasicActiveObjectQueue<MpscQueueStrategy> ActiveObjectQueue;
+typedef BasicActiveObjectCurrentThreadQueue<MpscQueueStrategy> ActiveObjectCurrentThreadQueue;
+typedef BasicActiveObjectThreadQueue<MpscQueueStrategy> ActiveObjectThreadQueue;
 
 #endif // PLATFORM_THREADING
 
@@ -457,15 +587,21 @@ class ISRTaskQueue {
 public:
     struct Task;
     typedef void(*TaskFunc)(Task*);
+    typedef void(*WakeupFunc)();
 
     struct Task {
         TaskFunc func;
         Task* next; // Next element in the queue
     };
 
-    ISRTaskQueue() :
+    /**
+     * @param wakeup Function that is called after a task has been enqueued to wake up the event loop.
+     *        It is called in the context of `enqueue()` and thus must be ISR-safe.
+     */
+    explicit ISRTaskQueue(WakeupFunc wakeup = nullptr) :
             firstTask_(nullptr),
-            lastTask_(nullptr) {
+            lastTask_(nullptr),
+            wakeup_(wakeup) {
     }
 
     void enqueue(Task* task);
@@ -474,4 +610,5 @@ public:
 private:
     Task* volatile firstTask_;
     Task* lastTask_;
+    WakeupFunc wakeup_;
 };
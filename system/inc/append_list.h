@@ -64,7 +64,7 @@ public:
     bool removeAt(unsigned int i) {
     	if (i<count) {
 			T* const p = store + i;
-			memmove(p, p + 1, count - i - 1);
+			memmove(p, p + 1, (count - i - 1) * sizeof(T));
 			count--;
     	}
         return true;
@@ -0,0 +1,140 @@
+/**
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+  ******************************************************************************
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "append_list.h"
+
+/**
+ * An append_list of named items with an open addressing hash index over the item names,
+ * so that items can be looked up by name in constant time.
+ *
+ * The index stores list positions rather than pointers, and is rebuilt when it grows. If the
+ * index cannot be allocated, lookups fall back to a linear scan of the list.
+ *
+ * @tparam T The item type
+ * @tparam KeyLength The number of significant characters in a name
+ * @tparam Key Returns the name of an item
+ */
+template <typename T, size_t KeyLength, const char* (*Key)(const T&)>
+class indexed_append_list
+{
+    // Slots hold the list position of an item plus one, 0 marks an empty slot
+    typedef uint16_t slot_t;
+
+    append_list<T> list;
+    slot_t* table;
+    unsigned table_size;
+
+    static uint32_t hash(const char* key)
+    {
+        // FNV-1a
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < KeyLength && key[i]; i++) {
+            h = (h ^ (uint8_t)key[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    void insert(unsigned index)
+    {
+        const unsigned mask = table_size - 1;
+        for (unsigned i = hash(Key(list[index])) & mask;; i = (i + 1) & mask) {
+            if (!table[i]) {
+                table[i] = index + 1;
+                break;
+            }
+        }
+    }
+
+    bool rebuild(unsigned size)
+    {
+        slot_t* new_table = (slot_t*)calloc(size, sizeof(slot_t));
+        free(table);
+        table = new_table;
+        table_size = new_table ? size : 0;
+        if (!table) {
+            return false;
+        }
+        for (unsigned i = 0; i < list.size(); i++) {
+            insert(i);
+        }
+        return true;
+    }
+
+public:
+
+    indexed_append_list(unsigned block=5) : list(block), table(nullptr), table_size(0) {}
+
+    ~indexed_append_list()
+    {
+        free(table);
+    }
+
+    T* add(const T& item) {
+        T* result = list.add(item);
+        if (result) {
+            // Keep the load factor at or below 1/2
+            if (list.size() * 2 > table_size) {
+                unsigned size = table_size ? table_size : 8;
+                while (list.size() * 2 > size) {
+                    size *= 2;
+                }
+                rebuild(size);
+            }
+            else {
+                insert(list.size() - 1);
+            }
+        }
+        return result;
+    }
+
+    T* find(const char* key) {
+        if (table) {
+            const unsigned mask = table_size - 1;
+            for (unsigned i = hash(key) & mask; table[i]; i = (i + 1) & mask) {
+                T& item = list[table[i] - 1];
+                if (0 == strncmp(Key(item), key, KeyLength)) {
+                    return &item;
+                }
+            }
+            return nullptr;
+        }
+        for (int i = list.size(); i-->0; ) {
+            if (0 == strncmp(Key(list[i]), key, KeyLength)) {
+                return &list[i];
+            }
+        }
+        return nullptr;
+    }
+
+    bool removeAt(unsigned int i) {
+        const bool result = list.removeAt(i);
+        if (table) {
+            rebuild(table_size);
+        }
+        return result;
+    }
+
+    T& operator[](unsigned index) { return list[index]; }
+    unsigned size() { return list.size(); }
+};
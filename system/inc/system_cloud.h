@@ -158,6 +158,11 @@ const uint32_t PUBLISH_EVENT_FLAG_WITH_ACK = 0x8;
  * This is a stop-gap solution until all synchronous APIs return futures, allowing asynchronous operation.
  */
 const uint32_t PUBLISH_EVENT_FLAG_ASYNC = EventType::ASYNC;
+/**
+ * Queue the event in persistent storage when it cannot be sent immediately, and send it once the
+ * device is connected to the cloud. Only supported on platforms with a filesystem.
+ */
+const uint32_t PUBLISH_EVENT_FLAG_STORE = 0x80;
 
 
 PARTICLE_STATIC_ASSERT(publish_no_ack_flag_matches, PUBLISH_EVENT_FLAG_NO_ACK==EventType::NO_ACK);
@@ -75,15 +75,13 @@ FFL(F const &func)
 
 #define _THREAD_CONTEXT_ASYNC_RESULT(thread, fn, result) \
     if (thread.isStarted() && !thread.isCurrentThread()) { \
-        auto lambda = [=]() { (fn); }; \
-        thread.invoke_async(FFL(lambda)); \
+        thread.invoke_async([=]() { (fn); }); \
         return result; \
     }
 
 #define _THREAD_CONTEXT_ASYNC(thread, fn) \
     if (thread.isStarted() && !thread.isCurrentThread()) { \
-        auto lambda = [=]() { (fn); }; \
-        thread.invoke_async(FFL(lambda)); \
+        thread.invoke_async([=]() { (fn); }); \
         return; \
     }
 
@@ -25,10 +25,165 @@
 #if PLATFORM_THREADING
 
 #include <string.h>
+#include <stdlib.h>
 #include "concurrent_hal.h"
 #include "timer_hal.h"
+#include "interrupts_hal.h"
 #include "rng_hal.h"
 
+namespace {
+
+/**
+ * A fixed pool of task objects. Slots are claimed and released with atomic operations on
+ * a bitmap, so tasks can be allocated from any thread or ISR without a lock.
+ */
+class TaskPool {
+public:
+    static_assert(ACTIVE_OBJECT_TASK_POOL_SIZE <= 32, "ACTIVE_OBJECT_TASK_POOL_SIZE is too large");
+
+    TaskPool() :
+            used_(0) {
+    }
+
+    void* alloc(size_t size) {
+        if (size > SLOT_SIZE) {
+            return nullptr;
+        }
+        uint32_t used = used_.load(std::memory_order_relaxed);
+        for (;;) {
+            const uint32_t free = ~used & FULL_MASK;
+            if (!free) {
+                return nullptr;
+            }
+            const unsigned slot = __builtin_ctz(free);
+            if (used_.compare_exchange_weak(used, used | (1u << slot), std::memory_order_acquire,
+                    std::memory_order_relaxed)) {
+                return slots_[slot].data;
+            }
+        }
+    }
+
+    bool free(void* ptr) {
+        const uintptr_t offs = (uintptr_t)ptr - (uintptr_t)slots_;
+        if (offs >= sizeof(slots_)) {
+            return false;
+        }
+        used_.fetch_and(~(1u << (offs / sizeof(Slot))), std::memory_order_release);
+        return true;
+    }
+
+private:
+    // Rounded up so that every slot is suitably aligned for any task object
+    static const size_t SLOT_SIZE = (ACTIVE_OBJECT_TASK_SIZE + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) *
+            alignof(std::max_align_t);
+    static const uint32_t FULL_MASK = (uint32_t)((1ull << ACTIVE_OBJECT_TASK_POOL_SIZE) - 1);
+
+    struct Slot {
+        alignas(max_align_t) char data[SLOT_SIZE];
+    };
+
+    Slot slots_[ACTIVE_OBJECT_TASK_POOL_SIZE];
+    std::atomic<uint32_t> used_;
+};
+
+TaskPool taskPool;
+
+} // namespace
+
+void* Message::operator new(size_t size) {
+    void* ptr = taskPool.alloc(size);
+    if (!ptr) {
+        ptr = ::operator new(size);
+    }
+    return ptr;
+}
+
+void* Message::operator new(size_t size, const std::nothrow_t&) noexcept {
+    void* ptr = taskPool.alloc(size);
+    if (!ptr) {
+        ptr = ::operator new(size, std::nothrow);
+    }
+    return ptr;
+}
+
+void Message::operator delete(void* ptr) {
+    if (!taskPool.free(ptr)) {
+        ::operator delete(ptr);
+    }
+}
+
+bool MpscQueueStrategy::create(size_t size) {
+    if (!queue.init(size)) {
+        return false;
+    }
+    return !os_semaphore_create(&signal, 1, 0) && !os_semaphore_create(&space, 1, 0);
+}
+
+bool MpscQueueStrategy::take(Message*& item, system_tick_t wait) {
+    if (!queue.pop(item)) {
+        if (!wait) {
+            return false;
+        }
+        waiting.store(true, std::memory_order_relaxed);
+        // Pairs with the fence in put(): either the producer sees the waiting flag, or the consumer sees the item
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!queue.pop(item)) {
+            // A signal left over from an earlier wait only results in an early return, which the
+            // caller handles like a timeout
+            os_semaphore_take(signal, wait, false);
+            waiting.store(false, std::memory_order_relaxed);
+            if (!queue.pop(item)) {
+                return false;
+            }
+        } else {
+            waiting.store(false, std::memory_order_relaxed);
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (blocked.load(std::memory_order_relaxed)) {
+        os_semaphore_give(space, false);
+    }
+    return true;
+}
+
+bool MpscQueueStrategy::put(Message* item, system_tick_t wait) {
+    if (!queue.push(item)) {
+        if (HAL_IsISR()) {
+            return false;
+        }
+        const system_tick_t start = HAL_Timer_Get_Milli_Seconds();
+        for (;;) {
+            blocked.fetch_add(1, std::memory_order_relaxed);
+            // Pairs with the fence in take(): either the consumer sees the blocked producer, or the producer sees the free cell
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (queue.push(item)) {
+                blocked.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            const system_tick_t elapsed = HAL_Timer_Get_Milli_Seconds() - start;
+            if (elapsed >= wait) {
+                blocked.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            os_semaphore_take(space, wait - elapsed, false);
+            blocked.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false, std::memory_order_relaxed)) {
+        os_semaphore_give(signal, false);
+    }
+    return true;
+}
+
+void MpscQueueStrategy::wakeup() {
+    // Same as the notification in put(): take() returns false when it is woken up without an item
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false, std::memory_order_relaxed)) {
+        os_semaphore_give(signal, false);
+    }
+}
+
 void ActiveObjectBase::start_thread()
 {
     const auto r = os_thread_create(&_thread, "active_object", configuration.priority, run_active_object, this,
@@ -100,6 +255,9 @@ void ISRTaskQueue::enqueue(Task* task) {
         task->next = nullptr;
         lastTask_ = task;
     }
+    if (wakeup_) {
+        wakeup_();
+    }
 }
 
 bool ISRTaskQueue::process() {
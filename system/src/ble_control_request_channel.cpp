@@ -23,8 +23,6 @@ LOG_SOURCE_CATEGORY("system.ctrl.ble")
 
 #if SYSTEM_CONTROL_ENABLED && HAL_PLATFORM_BLE
 
-#include "device_code.h"
-
 #include "timer_hal.h"
 #include "deviceid_hal.h"
 
@@ -32,11 +30,13 @@ LOG_SOURCE_CATEGORY("system.ctrl.ble")
 #include "endian_util.h"
 #include "debug.h"
 
+#if BLE_CHANNEL_SECURITY_ENABLED
 #include "mbedtls/ecjpake.h"
 #include "mbedtls/ccm.h"
 #include "mbedtls/md.h"
 
 #include "mbedtls_util.h"
+#endif
 
 #define CHECK(_expr) \
         do { \
@@ -122,6 +122,10 @@ const uint8_t RECV_CHAR_UUID[] = { 0xfc, 0x36, 0x6f, 0x54, 0x30, 0x80, 0xf4, 0x9
 // Size of the buffer pool
 const size_t BUFFER_POOL_SIZE = 1024;
 
+// Maximum number of notification packets sent per run() pass. The HAL queues notifications for
+// transmission and only blocks when it runs out of TX buffers
+const unsigned MAX_PACKETS_PER_RUN = 8;
+
 // Size of the message header
 const size_t MESSAGE_HEADER_SIZE = sizeof(MessageHeader);
 
@@ -180,6 +184,8 @@ const size_t MESSAGE_FOOTER_SIZE = AES_CCM_TAG_SIZE;
 const size_t MESSAGE_FOOTER_SIZE = 0;
 #endif
 
+#if BLE_CHANNEL_SECURITY_ENABLED
+
 int mbedtlsError(int ret) {
     switch (ret) {
     case 0:
@@ -298,8 +304,12 @@ private:
     mbedtls_md_context_t ctx_;
 };
 
+#endif // BLE_CHANNEL_SECURITY_ENABLED
+
 } // particle::system::
 
+#if BLE_CHANNEL_SECURITY_ENABLED
+
 class BleControlRequestChannel::HandshakeHandler {
 public:
     enum Result {
@@ -668,6 +678,8 @@ private:
     }
 };
 
+#endif // BLE_CHANNEL_SECURITY_ENABLED
+
 BleControlRequestChannel::BleControlRequestChannel(ControlRequestHandler* handler) :
         ControlRequestChannel(handler),
 #if BLE_CHANNEL_DEBUG_ENABLED
@@ -679,7 +691,7 @@ BleControlRequestChannel::BleControlRequestChannel(ControlRequestHandler* handle
         curReq_(nullptr),
         reqBufSize_(0),
         reqBufOffs_(0),
-        packetSize_(0),
+        stats_(),
         connHandle_(BLE_INVALID_CONN_HANDLE),
         curConnHandle_(BLE_INVALID_CONN_HANDLE),
         connId_(0),
@@ -737,6 +749,12 @@ void BleControlRequestChannel::run() {
             }
         } else if (prevConnHandle != BLE_INVALID_CONN_HANDLE) {
             LOG(TRACE, "Disconnected");
+            LOG(TRACE, "Sent %u bytes in %u packets, received %u bytes in %u packets", (unsigned)stats_.bytesSent,
+                    (unsigned)stats_.packetsSent, (unsigned)stats_.bytesReceived, (unsigned)stats_.packetsReceived);
+            if (stats_.repliesSent > 0) {
+                LOG(TRACE, "Reply latency: %u ms average, %u ms maximum", (unsigned)(stats_.totalReplyLatency / stats_.repliesSent),
+                        (unsigned)stats_.maxReplyLatency);
+            }
         }
     }
     if (connHandle_ != BLE_INVALID_CONN_HANDLE) {
@@ -822,6 +840,7 @@ int BleControlRequestChannel::initChannel() {
     if (!packetBuf_) {
         return SYSTEM_ERROR_NO_MEMORY;
     }
+    stats_ = Stats();
 #if BLE_CHANNEL_SECURITY_ENABLED
     CHECK(initJpake());
 #endif
@@ -853,7 +872,6 @@ void BleControlRequestChannel::resetChannel() {
     reqBufSize_ = 0;
     reqBufOffs_ = 0;
     inBufSize_ = 0;
-    packetSize_ = 0;
 }
 
 int BleControlRequestChannel::receiveRequest() {
@@ -885,6 +903,7 @@ int BleControlRequestChannel::receiveRequest() {
     // Parse request header
     RequestHeader rh = {};
     memcpy(&rh, p + MESSAGE_HEADER_SIZE, REQUEST_HEADER_SIZE);
+    curReq_->time = HAL_Timer_Get_Milli_Seconds();
     curReq_->id = littleEndianToNative(rh.id); // Request ID
     curReq_->type = littleEndianToNative(rh.type); // Request type
     LOG(TRACE, "Received a request message; type: %u, ID: %u", (unsigned)curReq_->type, (unsigned)curReq_->id);
@@ -932,6 +951,8 @@ int BleControlRequestChannel::sendReply() {
     CHECK(aesCcm_->encryptReplyData(p, req->reply_size));
 #endif
     // Enqueue the reply buffer for sending
+    req->repBuf->reqTime = req->time;
+    req->repBuf->isReply = true;
     outBufs_.pushBack(req->repBuf);
     req->repBuf = nullptr;
     LOG(TRACE, "Enqueued a reply message for sending; ID: %u", (unsigned)req->id);
@@ -946,59 +967,113 @@ int BleControlRequestChannel::sendPacket() {
     if (!writable_) {
         return 0; // Can't send now
     }
-    // Prepare a BLE packet
-    SPARK_ASSERT(packetBuf_);
+    // Keep handing packets to the HAL, so that multiple notifications can be sent in a single
+    // connection event
     const size_t maxSize = maxPacketSize_;
-    Buffer* buf = nullptr;
-    while (packetSize_ < maxSize && (buf = outBufs_.front())) {
-        const size_t n = std::min(maxSize - packetSize_, buf->size);
-        memcpy(packetBuf_.get() + packetSize_, buf->data, n);
+    unsigned count = 0;
+    while (count < MAX_PACKETS_PER_RUN && outBufs_.front()) {
+        const char* data = nullptr;
+        const size_t size = preparePacket(&data, maxSize);
+        const int ret = hal_ble_gatt_server_notify_characteristic_value(sendCharHandle_, (const uint8_t*)data, size, nullptr);
+        if (ret != (int)size) {
+            LOG(ERROR, "hal_ble_gatt_server_notify_characteristic_value() failed: %d", ret);
+            return ret;
+        }
+        DEBUG("Sent BLE packet");
+        DEBUG_DUMP(data, size);
+        consumePacket(size);
+        ++count;
+    }
+    if (!outBufs_.front() && packetCount_ == 0) {
+        // Invoke completion handlers
+        while (Request* req = pendingReps_.popFront()) {
+            req->handler(SYSTEM_ERROR_NONE, req->handlerData);
+            req->handler = nullptr;
+            freeRequest(req);
+        }
+    }
+    return 0;
+}
+
+size_t BleControlRequestChannel::preparePacket(const char** data, size_t maxSize) {
+    Buffer* buf = outBufs_.front();
+    if (buf->size >= maxSize || !buf->next) {
+        // The packet can be sent directly from the output buffer
+        *data = buf->data;
+        return std::min(buf->size, maxSize);
+    }
+    // Combine the remaining data of this buffer with the data of the following buffers
+    SPARK_ASSERT(packetBuf_);
+    size_t size = 0;
+    while (size < maxSize && buf) {
+        const size_t n = std::min(maxSize - size, buf->size);
+        memcpy(packetBuf_.get() + size, buf->data, n);
+        size += n;
+        buf = static_cast<Buffer*>(buf->next);
+    }
+    *data = packetBuf_.get();
+    return size;
+}
+
+void BleControlRequestChannel::consumePacket(size_t size) {
+    ++stats_.packetsSent;
+    stats_.bytesSent += size;
+    while (size > 0) {
+        Buffer* buf = outBufs_.front();
+        SPARK_ASSERT(buf);
+        const size_t n = std::min(size, buf->size);
         buf->data += n;
         buf->size -= n;
+        size -= n;
         if (buf->size == 0) {
+            if (buf->isReply) {
+                const system_tick_t latency = HAL_Timer_Get_Milli_Seconds() - buf->reqTime;
+                stats_.totalReplyLatency += latency;
+                if (latency > stats_.maxReplyLatency) {
+                    stats_.maxReplyLatency = latency;
+                }
+                ++stats_.repliesSent;
+            }
             outBufs_.popFront();
             freeBuffer(buf);
         }
-        packetSize_ += n;
-    }
-    if (packetSize_ == 0) {
-        if (packetCount_ == 0) {
-            // Invoke completion handlers
-            while (Request* req = pendingReps_.popFront()) {
-                req->handler(SYSTEM_ERROR_NONE, req->handlerData);
-                req->handler = nullptr;
-                freeRequest(req);
-            }
-        }
-        return 0; // Nothing to send
-    }
-    // Send packet
-    const int ret = hal_ble_gatt_server_notify_characteristic_value(sendCharHandle_, (const uint8_t*)packetBuf_.get(), packetSize_, nullptr);
-    if (ret != (int)packetSize_) {
-        LOG(ERROR, "hal_ble_gatt_server_notify_characteristic_value() failed: %d", ret);
-        return ret;
     }
-    DEBUG("Sent BLE packet");
-    DEBUG_DUMP(packetBuf_.get(), packetSize_);
-    packetSize_ = 0;
-    return 0;
 }
 
 bool BleControlRequestChannel::readAll(char* data, size_t size) {
+    if (fetchInput(size) < size) {
+        return false; // Wait for more data
+    }
+    copyInput(data, size);
+    return true;
+}
+
+size_t BleControlRequestChannel::readSome(char* data, size_t size) {
+    size = std::min(size, fetchInput(size));
+    copyInput(data, size);
+    return size;
+}
+
+size_t BleControlRequestChannel::fetchInput(size_t size) {
     // Keep taking input buffers from the queue until there's enough data
     Buffer* buf = nullptr;
     while (inBufSize_ < size && (buf = inBufs_.popFront())) {
         readInBufs_.pushBack(buf);
         inBufSize_ += buf->size;
+        ++stats_.packetsReceived;
+        stats_.bytesReceived += buf->size;
     }
-    if (inBufSize_ < size) {
-        return false; // Wait for more data
+    return inBufSize_;
+}
+
+void BleControlRequestChannel::copyInput(char* data, size_t size) {
+    if (size == 0) {
+        return;
     }
-    // Copy data to the destination buffer
     DEBUG("Reading %u bytes", (unsigned)size);
     size_t offs = 0;
     while (offs < size) {
-        buf = readInBufs_.front();
+        Buffer* buf = readInBufs_.front();
         SPARK_ASSERT(buf);
         const size_t n = std::min(size - offs, buf->size);
         memcpy(data + offs, buf->data, n);
@@ -1014,23 +1089,6 @@ bool BleControlRequestChannel::readAll(char* data, size_t size) {
     }
     inBufSize_ -= size;
     DEBUG_DUMP(data, size);
-    return true;
-}
-
-size_t BleControlRequestChannel::readSome(char* data, size_t size) {
-    Buffer* buf = nullptr;
-    while (inBufSize_ < size && (buf = inBufs_.popFront())) {
-        readInBufs_.pushBack(buf);
-        inBufSize_ += buf->size;
-    }
-    if (inBufSize_ < size) {
-        size = inBufSize_;
-    }
-    if (size > 0) {
-        const bool ok = readAll(data, size);
-        SPARK_ASSERT(ok);
-    }
-    return size;
 }
 
 int BleControlRequestChannel::connected(const hal_ble_link_evt_t& event) {
@@ -28,6 +28,7 @@
 #include "linked_buffer.h"
 
 #include "ble_hal.h"
+#include "system_tick_hal.h"
 
 #include "spark_wiring_thread.h"
 
@@ -52,6 +53,17 @@ namespace system {
 // Class implementing a BLE control request channel
 class BleControlRequestChannel: public ControlRequestChannel {
 public:
+    // Statistics of the current connection
+    struct Stats {
+        size_t bytesSent; // Number of bytes sent to the client
+        size_t packetsSent; // Number of notification packets sent to the client
+        size_t bytesReceived; // Number of bytes received from the client
+        size_t packetsReceived; // Number of packets received from the client
+        size_t repliesSent; // Number of reply messages sent to the client
+        system_tick_t totalReplyLatency; // Total time between receiving requests and sending their replies
+        system_tick_t maxReplyLatency; // Maximum time between receiving a request and sending its reply
+    };
+
     explicit BleControlRequestChannel(ControlRequestHandler* handler);
     ~BleControlRequestChannel();
 
@@ -60,6 +72,8 @@ public:
 
     void run();
 
+    const Stats& stats() const;
+
     // Reimplemented from `ControlRequestChannel`
     virtual int allocReplyData(ctrl_request* ctrlReq, size_t size) override;
     virtual void freeRequestData(ctrl_request* ctrlReq) override;
@@ -73,6 +87,8 @@ private:
     struct Buffer: LinkedBuffer<> {
         char* data;
         size_t size;
+        system_tick_t reqTime; // Time when the request was received (reply buffers only)
+        bool isReply; // Set to `true` if this is a reply buffer
     };
 
     // Request data
@@ -84,6 +100,7 @@ private:
         void* handlerData; // Completion handler data
         int result; // Result code
         unsigned connId; // Connection ID
+        system_tick_t time; // Time when the request was received
         uint16_t id; // Request ID
     };
 
@@ -105,8 +122,8 @@ private:
     size_t reqBufSize_; // Size of the request buffer
     size_t reqBufOffs_; // Offset in the request buffer
 
-    std::unique_ptr<char[]> packetBuf_; // Intermediate buffer for BLE packet data
-    size_t packetSize_; // Size of the pending BLE packet
+    std::unique_ptr<char[]> packetBuf_; // Intermediate buffer for BLE packets spanning multiple output buffers
+    Stats stats_; // Connection statistics
 #if BLE_CHANNEL_SECURITY_ENABLED
     std::unique_ptr<AesCcmCipher> aesCcm_; // AES cipher
     std::unique_ptr<JpakeHandler> jpake_; // J-PAKE handshake handler
@@ -134,9 +151,13 @@ private:
     int receiveRequest();
     int sendReply();
     int sendPacket();
+    size_t preparePacket(const char** data, size_t maxSize);
+    void consumePacket(size_t size);
 
     bool readAll(char* data, size_t size);
     size_t readSome(char* data, size_t size);
+    size_t fetchInput(size_t size);
+    void copyInput(char* data, size_t size);
     void sendBuffer(Buffer* buf);
 
     int connected(const hal_ble_link_evt_t& event);
@@ -163,6 +184,10 @@ private:
     static void onBleLinkEvents(const hal_ble_link_evt_t* event, void* context);
 };
 
+inline const BleControlRequestChannel::Stats& BleControlRequestChannel::stats() const {
+    return stats_;
+}
+
 inline void BleControlRequestChannel::sendBuffer(Buffer* buf) {
     outBufs_.pushBack(buf);
 }
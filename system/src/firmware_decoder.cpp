@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("system.ota")
+
+#include "firmware_decoder.h"
+
+#include "ota_flash_hal.h"
+#include "core_hal.h"
+
+#include "system_error.h"
+#include "check.h"
+
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+#include "miniz.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace particle {
+
+namespace system {
+
+namespace {
+
+// Decoded data is written to the OTA section in blocks of this size
+const size_t BUFFER_SIZE = 512;
+
+// Maximum number of bytes in a varint
+const size_t MAX_VARINT_SIZE = 5;
+
+} // namespace
+
+FirmwareDecoder::FirmwareDecoder() :
+        deltaHeader_(),
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+        dictOffs_(0),
+#endif
+        src_(nullptr),
+        findModule_(nullptr),
+        address_(0),
+        maxSize_(0),
+        inSize_(0),
+        inOffs_(0),
+        outOffs_(0),
+        bufSize_(0),
+        deltaState_(HEADER),
+        deltaOffs_(0),
+        srcOffs_(0),
+        opSize_(0),
+        varint_(0),
+        op_(0),
+        format_(0),
+        error_(0),
+        done_(false) {
+}
+
+FirmwareDecoder::~FirmwareDecoder() {
+}
+
+int FirmwareDecoder::init(unsigned format, size_t size, uint32_t address, size_t maxSize, FindModuleFn findModule) {
+    CHECK_TRUE(isSupported(format), SYSTEM_ERROR_NOT_SUPPORTED);
+    if (!buf_) {
+        buf_.reset(new(std::nothrow) uint8_t[BUFFER_SIZE]);
+        CHECK_TRUE(buf_, SYSTEM_ERROR_NO_MEMORY);
+    }
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+    if (format & FileTransfer::Format::COMPRESSED) {
+        if (!decomp_) {
+            decomp_.reset(new(std::nothrow) tinfl_decompressor);
+            CHECK_TRUE(decomp_, SYSTEM_ERROR_NO_MEMORY);
+            dictBuf_.reset(new(std::nothrow) uint8_t[TINFL_LZ_DICT_SIZE]);
+            CHECK_TRUE(dictBuf_, SYSTEM_ERROR_NO_MEMORY);
+        }
+        tinfl_init(decomp_.get());
+    } else {
+        decomp_.reset();
+        dictBuf_.reset();
+    }
+    dictOffs_ = 0;
+#endif
+    memset(&deltaHeader_, 0, sizeof(deltaHeader_));
+    src_ = nullptr;
+    findModule_ = findModule;
+    address_ = address;
+    maxSize_ = maxSize;
+    inSize_ = size;
+    inOffs_ = 0;
+    outOffs_ = 0;
+    bufSize_ = 0;
+    deltaState_ = HEADER;
+    deltaOffs_ = 0;
+    srcOffs_ = 0;
+    opSize_ = 0;
+    varint_ = 0;
+    op_ = 0;
+    format_ = format;
+    error_ = 0;
+    done_ = false;
+    return 0;
+}
+
+int FirmwareDecoder::write(size_t offset, const uint8_t* data, size_t size) {
+    if (error_ < 0) {
+        return SYSTEM_ERROR_ABORTED;
+    }
+    if (offset > inOffs_) {
+        // The data doesn't continue the stream, the caller may provide it again later
+        return SYSTEM_ERROR_OUT_OF_RANGE;
+    }
+    const size_t skip = inOffs_ - offset;
+    if (skip >= size) {
+        return 0; // Already decoded
+    }
+    data += skip;
+    size -= skip;
+    if (size > inSize_ - inOffs_) {
+        error_ = SYSTEM_ERROR_TOO_LARGE;
+        return error_;
+    }
+    int ret = decode(data, size);
+    if (ret >= 0) {
+        inOffs_ += size;
+        if (inOffs_ == inSize_ && !done_) {
+            LOG(ERROR, "Unexpected end of encoded data");
+            ret = SYSTEM_ERROR_BAD_DATA;
+        }
+    }
+    if (ret < 0) {
+        error_ = ret;
+        return ret;
+    }
+    return 0;
+}
+
+bool FirmwareDecoder::isSupported(unsigned format) {
+    unsigned supported = FileTransfer::Format::DELTA;
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+    supported |= FileTransfer::Format::COMPRESSED;
+#endif
+    return !(format & ~supported);
+}
+
+int FirmwareDecoder::decode(const uint8_t* data, size_t size) {
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+    if (decomp_) {
+        const bool hasMore = (inOffs_ + size < inSize_);
+        for (;;) {
+            size_t srcBytes = size;
+            size_t destBytes = TINFL_LZ_DICT_SIZE - dictOffs_;
+            const auto stat = tinfl_decompress(decomp_.get(), data, &srcBytes, dictBuf_.get(), dictBuf_.get() + dictOffs_,
+                    &destBytes, hasMore ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+            if (stat < 0) {
+                LOG(ERROR, "Decompression error: %d", (int)stat);
+                return SYSTEM_ERROR_BAD_DATA;
+            }
+            data += srcBytes;
+            size -= srcBytes;
+            if (destBytes > 0) {
+                CHECK(patch(dictBuf_.get() + dictOffs_, destBytes));
+                dictOffs_ = (dictOffs_ + destBytes) % TINFL_LZ_DICT_SIZE;
+            }
+            if (stat == TINFL_STATUS_DONE) {
+                CHECK_TRUE(size == 0, SYSTEM_ERROR_BAD_DATA);
+                if (!(format_ & FileTransfer::Format::DELTA)) {
+                    CHECK(finish());
+                }
+                break;
+            }
+            if (stat != TINFL_STATUS_HAS_MORE_OUTPUT) {
+                break;
+            }
+        }
+        return 0;
+    }
+#endif // HAL_PLATFORM_COMPRESSED_BINARIES
+    return patch(data, size);
+}
+
+int FirmwareDecoder::patch(const uint8_t* data, size_t size) {
+    if (!(format_ & FileTransfer::Format::DELTA)) {
+        return output(data, size);
+    }
+    while (size > 0) {
+        switch (deltaState_) {
+        case HEADER: {
+            const size_t n = std::min(sizeof(deltaHeader_) - deltaOffs_, size);
+            memcpy((uint8_t*)&deltaHeader_ + deltaOffs_, data, n);
+            data += n;
+            size -= n;
+            deltaOffs_ += n;
+            if (deltaOffs_ == sizeof(deltaHeader_)) {
+                CHECK(beginPatch());
+            }
+            break;
+        }
+        case OP:
+        case OP_OFFSET: {
+            CHECK_TRUE(deltaOffs_ < MAX_VARINT_SIZE, SYSTEM_ERROR_BAD_DATA);
+            const uint8_t b = *data++;
+            --size;
+            varint_ |= (uint32_t)(b & 0x7f) << (deltaOffs_ * 7);
+            ++deltaOffs_;
+            if (!(b & 0x80)) {
+                CHECK(nextOp());
+            }
+            break;
+        }
+        case OP_DATA: {
+            const size_t n = std::min(opSize_, size);
+            if (op_ == FirmwareDeltaHeader::ADD) {
+                // Add the delta bytes to the source bytes directly in the output buffer
+                size_t offs = 0;
+                while (offs < n) {
+                    const size_t m = std::min(BUFFER_SIZE - bufSize_, n - offs);
+                    const auto src = src_ + srcOffs_ + offs;
+                    const auto dest = buf_.get() + bufSize_;
+                    for (size_t i = 0; i < m; ++i) {
+                        dest[i] = src[i] + data[offs + i];
+                    }
+                    bufSize_ += m;
+                    offs += m;
+                    if (bufSize_ == BUFFER_SIZE) {
+                        CHECK(flush());
+                    }
+                }
+                srcOffs_ += n;
+            } else {
+                CHECK(output(data, n));
+            }
+            data += n;
+            size -= n;
+            opSize_ -= n;
+            if (opSize_ == 0) {
+                CHECK(endOp());
+            }
+            break;
+        }
+        case END:
+        default:
+            LOG(ERROR, "Unexpected data after the end of the delta");
+            return SYSTEM_ERROR_BAD_DATA;
+        }
+    }
+    return 0;
+}
+
+int FirmwareDecoder::beginPatch() {
+    const auto& h = deltaHeader_;
+    if (h.magic != FirmwareDeltaHeader::MAGIC) {
+        LOG(ERROR, "Invalid delta header");
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    CHECK_TRUE(h.version == FirmwareDeltaHeader::VERSION, SYSTEM_ERROR_NOT_SUPPORTED);
+    CHECK_TRUE(h.targetSize <= maxSize_, SYSTEM_ERROR_TOO_LARGE);
+    CHECK_TRUE(findModule_, SYSTEM_ERROR_NOT_SUPPORTED);
+    const uint8_t* src = nullptr;
+    size_t srcSize = 0;
+    const int ret = findModule_(h.moduleFunction, h.moduleIndex, &src, &srcSize);
+    if (ret < 0) {
+        LOG(ERROR, "Module not found; function: %u, index: %u", (unsigned)h.moduleFunction, (unsigned)h.moduleIndex);
+        return ret;
+    }
+    if (h.sourceSize > srcSize || HAL_Core_Compute_CRC32(src, h.sourceSize) != h.sourceCrc) {
+        LOG(ERROR, "Delta is not based on the installed module");
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    LOG(TRACE, "Applying delta; source size: %u, target size: %u", (unsigned)h.sourceSize, (unsigned)h.targetSize);
+    src_ = src;
+    deltaOffs_ = 0;
+    return endOp();
+}
+
+int FirmwareDecoder::nextOp() {
+    const auto& h = deltaHeader_;
+    const uint32_t v = varint_;
+    varint_ = 0;
+    deltaOffs_ = 0;
+    if (deltaState_ == OP) {
+        op_ = v & 0x03;
+        opSize_ = v >> 2;
+        CHECK_TRUE(opSize_ <= h.targetSize - (outOffs_ + bufSize_), SYSTEM_ERROR_BAD_DATA);
+        switch (op_) {
+        case FirmwareDeltaHeader::COPY:
+            deltaState_ = OP_OFFSET;
+            return 0;
+        case FirmwareDeltaHeader::ADD:
+            CHECK_TRUE(opSize_ <= h.sourceSize - srcOffs_, SYSTEM_ERROR_BAD_DATA);
+            break;
+        case FirmwareDeltaHeader::INSERT:
+            break;
+        default:
+            LOG(ERROR, "Unknown delta operation: %u", op_);
+            return SYSTEM_ERROR_BAD_DATA;
+        }
+        if (opSize_ == 0) {
+            return endOp();
+        }
+        deltaState_ = OP_DATA;
+        return 0;
+    }
+    // Zigzag-decode the offset in the source binary
+    const int32_t offs = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    const int64_t pos = (int64_t)srcOffs_ + offs;
+    CHECK_TRUE(pos >= 0 && pos <= (int64_t)h.sourceSize, SYSTEM_ERROR_BAD_DATA);
+    const size_t p = (size_t)pos;
+    CHECK_TRUE(opSize_ <= h.sourceSize - p, SYSTEM_ERROR_BAD_DATA);
+    srcOffs_ = p;
+    CHECK(output(src_ + srcOffs_, opSize_));
+    srcOffs_ += opSize_;
+    return endOp();
+}
+
+int FirmwareDecoder::endOp() {
+    if (outOffs_ + bufSize_ == deltaHeader_.targetSize) {
+        deltaState_ = END;
+        return finish();
+    }
+    deltaState_ = OP;
+    return 0;
+}
+
+int FirmwareDecoder::output(const uint8_t* data, size_t size) {
+    CHECK_TRUE(size <= maxSize_ - (outOffs_ + bufSize_), SYSTEM_ERROR_TOO_LARGE);
+    while (size > 0) {
+        const size_t n = std::min(BUFFER_SIZE - bufSize_, size);
+        memcpy(buf_.get() + bufSize_, data, n);
+        bufSize_ += n;
+        data += n;
+        size -= n;
+        if (bufSize_ == BUFFER_SIZE) {
+            CHECK(flush());
+        }
+    }
+    return 0;
+}
+
+int FirmwareDecoder::flush() {
+    if (bufSize_ == 0) {
+        return 0;
+    }
+    const int ret = HAL_FLASH_Update(buf_.get(), address_ + outOffs_, bufSize_, nullptr);
+    if (ret != 0) {
+        LOG(ERROR, "HAL_FLASH_Update() failed: %d", ret);
+        return SYSTEM_ERROR_IO;
+    }
+    outOffs_ += bufSize_;
+    bufSize_ = 0;
+    return 0;
+}
+
+int FirmwareDecoder::finish() {
+    CHECK(flush());
+    done_ = true;
+    LOG(TRACE, "Decoded %u bytes", (unsigned)outOffs_);
+    return 0;
+}
+
+} // particle::system
+
+} // particle
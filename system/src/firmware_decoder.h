@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "file_transfer.h"
+#include "hal_platform.h"
+
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+struct tinfl_decompressor_tag;
+#endif
+
+namespace particle {
+
+namespace system {
+
+/**
+ * Header of a delta-encoded firmware binary.
+ *
+ * All fields are little-endian. The header is followed by a sequence of operations, each of which
+ * starts with a control word encoded as a base-128 varint: the lower 2 bits of the word specify
+ * the operation, and the remaining bits specify the number of bytes it produces.
+ *
+ * - `COPY`: Followed by a signed (zigzag-encoded) varint that is added to the current position in
+ *   the source binary. Copies the bytes at that position to the target binary.
+ * - `ADD`: Followed by the bytes to add to the bytes at the current position in the source binary.
+ * - `INSERT`: Followed by the bytes to insert to the target binary.
+ *
+ * Both `COPY` and `ADD` advance the position in the source binary. The delta ends when all bytes
+ * of the target binary are produced.
+ */
+struct __attribute__((packed)) FirmwareDeltaHeader {
+    enum Op {
+        COPY = 0,
+        ADD = 1,
+        INSERT = 2
+    };
+
+    static const uint32_t MAGIC = 0x544c4450; // "PDLT"
+    static const uint8_t VERSION = 1;
+
+    uint32_t magic; ///< Magic number.
+    uint8_t version; ///< Format version.
+    uint8_t moduleFunction; ///< Function of the installed module the delta is based on.
+    uint8_t moduleIndex; ///< Index of the installed module the delta is based on.
+    uint8_t reserved;
+    uint32_t sourceSize; ///< Size of the source binary.
+    uint32_t sourceCrc; ///< CRC-32 of the source binary.
+    uint32_t targetSize; ///< Size of the target binary.
+};
+
+/**
+ * Decoder for compressed and delta-encoded firmware binaries.
+ *
+ * The encoded data needs to be written in order, but can be split at arbitrary boundaries. The
+ * decoded data is written to the OTA section with `HAL_FLASH_Update()`. The RAM usage doesn't
+ * depend on the size of the binary.
+ */
+class FirmwareDecoder {
+public:
+    /**
+     * Function looking up an installed module.
+     *
+     * The module data needs to be readable via the returned pointer.
+     */
+    typedef int (*FindModuleFn)(unsigned moduleFunction, unsigned moduleIndex, const uint8_t** data, size_t* size);
+
+    FirmwareDecoder();
+    ~FirmwareDecoder();
+
+    /**
+     * Initialize the decoder.
+     *
+     * @param format A combination of `FileTransfer::Format` flags.
+     * @param size Size of the encoded data.
+     * @param address Address of the OTA section.
+     * @param maxSize Maximum size of the decoded data.
+     * @param findModule Function looking up the installed module a delta is based on.
+     * @return 0 on success, otherwise an error code defined by `system_error_t`.
+     */
+    int init(unsigned format, size_t size, uint32_t address, size_t maxSize, FindModuleFn findModule);
+
+    /**
+     * Decode a portion of the encoded data.
+     *
+     * Data preceding the current position is skipped, so a portion can be written more than once.
+     *
+     * Any error other than `SYSTEM_ERROR_OUT_OF_RANGE` is fatal: the decoder can't continue and
+     * all subsequent calls fail with `SYSTEM_ERROR_ABORTED`.
+     *
+     * @param offset Offset of the data in the encoded stream.
+     * @param data Data.
+     * @param size Data size.
+     * @return 0 on success, `SYSTEM_ERROR_OUT_OF_RANGE` if the data doesn't continue the stream,
+     *         otherwise an error code defined by `system_error_t`.
+     */
+    int write(size_t offset, const uint8_t* data, size_t size);
+
+    /**
+     * Get the error that stopped the decoder, or 0 if no such error has occurred.
+     */
+    int error() const {
+        return error_;
+    }
+
+    /**
+     * Get the number of encoded bytes decoded so far.
+     */
+    size_t bytesRead() const {
+        return inOffs_;
+    }
+
+    /**
+     * Get the number of decoded bytes written to the OTA section.
+     */
+    size_t bytesWritten() const {
+        return outOffs_;
+    }
+
+    /**
+     * Check if the entire binary has been decoded.
+     */
+    bool isDone() const {
+        return done_;
+    }
+
+    /**
+     * Check if the given combination of `FileTransfer::Format` flags is supported.
+     */
+    static bool isSupported(unsigned format);
+
+private:
+    enum DeltaState {
+        HEADER,
+        OP,
+        OP_OFFSET,
+        OP_DATA,
+        END
+    };
+
+    FirmwareDeltaHeader deltaHeader_; // Delta header
+    std::unique_ptr<uint8_t[]> buf_; // Buffer for decoded data
+#if HAL_PLATFORM_COMPRESSED_BINARIES
+    std::unique_ptr<tinfl_decompressor_tag> decomp_; // Decompressor context
+    std::unique_ptr<uint8_t[]> dictBuf_; // Dictionary buffer
+    size_t dictOffs_; // Offset in the dictionary buffer
+#endif
+    const uint8_t* src_; // Source binary
+    FindModuleFn findModule_; // Module lookup function
+    uint32_t address_; // Address of the OTA section
+    size_t maxSize_; // Maximum size of the decoded data
+    size_t inSize_; // Size of the encoded data
+    size_t inOffs_; // Offset in the encoded data
+    size_t outOffs_; // Number of bytes written to the OTA section
+    size_t bufSize_; // Number of bytes in the buffer for decoded data
+    DeltaState deltaState_; // State of the delta decoder
+    size_t deltaOffs_; // Offset in the current header or varint
+    size_t srcOffs_; // Offset in the source binary
+    size_t opSize_; // Number of bytes remaining in the current operation
+    uint32_t varint_; // Varint being decoded
+    unsigned op_; // Current operation
+    unsigned format_; // Format flags
+    int error_; // Sticky error
+    bool done_; // Set to `true` when the entire binary has been decoded
+
+    int decode(const uint8_t* data, size_t size);
+    int patch(const uint8_t* data, size_t size);
+    int beginPatch();
+    int nextOp();
+    int endOp();
+    int output(const uint8_t* data, size_t size);
+    int flush();
+    int finish();
+};
+
+} // particle::system
+
+} // particle
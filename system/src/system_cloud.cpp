@@ -29,10 +29,12 @@
 
 #include "logging.h"
 #include "protocol_defs.h"
+#include "spark_wiring_diagnostics.h"
 #include "spark_wiring_string.h"
 #include "spark_wiring_timer.h"
 #include "system_cloud.h"
 #include "system_cloud_internal.h"
+#include "system_publish_queue.h"
 #include "system_publish_vitals.h"
 #include "system_task.h"
 #include "system_threading.h"
@@ -61,6 +63,9 @@ VitalsPublisher<Timer> _vitals;
 VitalsPublisher<particle::NullTimer> _vitals;
 #endif // PLATFORM_THREADING
 
+// Time spent sending an event, in milliseconds
+particle::HistogramDiagnosticData<> g_publishTime(DIAG_ID_CLOUD_PUBLISH_TIME, DIAG_NAME_CLOUD_PUBLISH_TIME);
+
 } // namespace
 
 SubscriptionScope::Enum convert(Spark_Subscription_Scope_TypeDef subscription_type)
@@ -150,7 +155,7 @@ system_tick_t spark_sync_time_last(time_t* tm, void* reserved)
  */
 inline uint32_t convert(uint32_t flags) {
 	bool priv = flags & PUBLISH_EVENT_FLAG_PRIVATE;
-	flags &= ~PUBLISH_EVENT_FLAG_PRIVATE;
+	flags &= ~(PUBLISH_EVENT_FLAG_PRIVATE | PUBLISH_EVENT_FLAG_STORE);
 	flags |= !priv ? EventType::PUBLIC : EventType::PRIVATE;
 	return flags;
 }
@@ -164,6 +169,8 @@ bool spark_send_event(const char* name, const char* data, int ttl, uint32_t flag
     SYSTEM_THREAD_CONTEXT_SYNC(spark_send_event(name, data, ttl, flags, reserved));
     }
 
+    const particle::ScopedDiagnosticTimer<decltype(g_publishTime)> publishTimer(g_publishTime);
+
     spark_protocol_send_event_data d = { sizeof(spark_protocol_send_event_data) };
     if (reserved) {
         // Forward completion callback to the protocol implementation
@@ -172,6 +179,13 @@ bool spark_send_event(const char* name, const char* data, int ttl, uint32_t flag
         d.handler_data = r->handler_data;
     }
 
+#if HAL_PLATFORM_FILESYSTEM
+    if (flags & PUBLISH_EVENT_FLAG_STORE) {
+        return particle::system::publishQueued(name, data, ttl, convert(flags),
+                particle::CompletionHandler(d.handler_callback, d.handler_data)) == 0;
+    }
+#endif // HAL_PLATFORM_FILESYSTEM
+
     return spark_protocol_send_event(sp, name, data, ttl, convert(flags), &d);
 }
 
@@ -32,6 +32,7 @@
 #include "delay_hal.h"
 #include "system_string_interpolate.h"
 #include "endian_util.h"
+#include "system_wakeup.h"
 
 namespace {
 
@@ -353,4 +354,11 @@ void HAL_NET_notify_socket_closed(sock_handle_t socket)
     }
 }
 
+void HAL_NET_notify_socket_event(sock_handle_t socket)
+{
+    // Incoming cloud messages are handled on the next pass of the system loop. Events of
+    // application sockets end a delay() in progress when the system thread is disabled
+    particle::system::system_wakeup(particle::system::WAKEUP_REASON_SOCKET);
+}
+
 #endif /* !HAL_USE_SOCKET_HAL_POSIX && HAL_USE_SOCKET_HAL_COMPAT */
@@ -30,7 +30,6 @@
 #include "system_user.h"
 #include "spark_wiring_string.h"
 #include "spark_protocol_functions.h"
-#include "append_list.h"
 #include "core_hal.h"
 #include "deviceid_hal.h"
 #include "ota_flash_hal.h"
@@ -92,96 +91,6 @@ ProtocolFacade* system_cloud_protocol_instance(void)
     return sp;
 }
 
-static append_list<User_Var_Lookup_Table_t> vars(5);
-static append_list<User_Func_Lookup_Table_t> funcs(5);
-
-User_Var_Lookup_Table_t* find_var_by_key(const char* varKey)
-{
-    for (int i = vars.size(); i-->0; )
-    {
-        if (0 == strncmp(vars[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
-        {
-            return &vars[i];
-        }
-    }
-    return NULL;
-}
-
-template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const char* name, const char* itemType, const T& value) {
-	T* result = list.add(value);
-	if (result) {
-		spark_protocol_describe_data data;
-		data.size = sizeof(data);
-		data.flags = particle::protocol::DESCRIBE_APPLICATION;
-		if (!spark_protocol_get_describe_data(spark_protocol_instance(), &data, nullptr)) {
-			if (data.maximum_size<data.current_size) {
-				list.removeAt(list.size()-1);
-				result = nullptr;
-			}
-		}
-		else {
-			INFO("get describe data unsupported");
-		}
-	}
-	if (!result) {
-		ERROR("Cannot add %s named %d: insufficient storage", itemType, name);
-	}
-	return result;
-}
-
-User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void* userVar, Spark_Data_TypeDef userVarType, spark_variable_t* extra)
-{
-	User_Var_Lookup_Table_t item = {};
-	item.userVar = userVar;
-	item.userVarType = userVarType;
-	if (extra) {
-		item.update = extra->update;
-		if (offsetof(spark_variable_t, copy) + sizeof(spark_variable_t::copy) <= extra->size) {
-			item.copy = extra->copy;
-		}
-	}
-	memcpy(item.userVarKey, varKey, USER_VAR_KEY_LENGTH);
-
-    User_Var_Lookup_Table_t* result = find_var_by_key(varKey);
-
-    if (!result) {
-    	result = add_if_sufficient_describe(vars, varKey, "variable", item);
-    }
-    else {
-    	*result = item;
-    }
-    return result;
-}
-
-User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey)
-{
-    for (int i = funcs.size(); i-->0; )
-    {
-        if (0 == strncmp(funcs[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH))
-        {
-            return &funcs[i];
-        }
-    }
-    return NULL;
-}
-
-User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const cloud_function_descriptor* desc)
-{
-	User_Func_Lookup_Table_t item = {0};
-	item.pUserFunc = desc->fn;
-	item.pUserFuncData = desc->data;
-    memcpy(item.userFuncKey, desc->funcKey, USER_FUNC_KEY_LENGTH);
-
-    User_Func_Lookup_Table_t* result = find_func_by_key(funcKey);
-    if (result) {
-    	*result = item;
-    }
-    else {
-    	result = add_if_sufficient_describe(funcs, funcKey, "function", item);
-    }
-    return result;
-}
-
 int call_raw_user_function(void* data, const char* param, void* reserved)
 {
     user_function_int_str_t* fn = (user_function_int_str_t*)(data);
@@ -189,51 +98,6 @@ int call_raw_user_function(void* data, const char* param, void* reserved)
     return (*fn)(p);
 }
 
-inline uint32_t crc(const void* data, size_t len)
-{
-	return HAL_Core_Compute_CRC32((const uint8_t*)data, len);
-}
-
-template <typename T>
-uint32_t crc(const T& t)
-{
-	return crc(&t, sizeof(t));
-}
-
-uint32_t string_crc(const char* s)
-{
-	return crc(s, strlen(s));
-}
-
-/**
- * Computes the checksum of the registered functions.
- * The function name is used to compute the checksum.
- */
-uint32_t compute_functions_checksum()
-{
-	uint32_t checksum = 0;
-	for (int i = funcs.size(); i-->0; )
-    {
-		checksum += string_crc(funcs[i].userFuncKey);
-    }
-	return checksum;
-}
-
-/**
- * Computes the checksum of the registered variables.
- * The checksum is derived from the variable name and type.
- */
-uint32_t compute_variables_checksum()
-{
-	uint32_t checksum = 0;
-	for (int i = vars.size(); i-->0; )
-	{
-		checksum += string_crc(vars[i].userVarKey);
-		checksum += crc(vars[i].userVarType);
-	}
-	return checksum;
-}
-
 /**
  * Computes the checksum of all functions and variables.
  */
@@ -321,26 +185,6 @@ void invokeEventHandler(uint16_t handlerInfoSize, FilteringEventHandler* handler
     }
 }
 
-int numUserFunctions(void)
-{
-    return funcs.size();
-}
-
-const char* getUserFunctionKey(int function_index)
-{
-    return funcs[function_index].userFuncKey;
-}
-
-int numUserVariables(void)
-{
-    return vars.size();
-}
-
-const char* getUserVariableKey(int variable_index)
-{
-    return vars[variable_index].userVarKey;
-}
-
 SparkReturnType::Enum wrapVarTypeInEnum(const char *varKey)
 {
     switch (userVarType(varKey))
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_cloud_registry.h"
+
+#include "indexed_append_list.h"
+#include "spark_protocol_functions.h"
+#include "service_debug.h"
+
+static const char* var_key(const User_Var_Lookup_Table_t& item)
+{
+    return item.userVarKey;
+}
+
+static const char* func_key(const User_Func_Lookup_Table_t& item)
+{
+    return item.userFuncKey;
+}
+
+static indexed_append_list<User_Var_Lookup_Table_t, USER_VAR_KEY_LENGTH, var_key> vars(5);
+static indexed_append_list<User_Func_Lookup_Table_t, USER_FUNC_KEY_LENGTH, func_key> funcs(5);
+
+// Checksums of the registered variables and functions, updated as items are registered
+static uint32_t vars_checksum = 0;
+static uint32_t funcs_checksum = 0;
+
+/**
+ * The contribution of a variable to the variables checksum.
+ * The checksum is derived from the variable name and type.
+ */
+inline uint32_t var_checksum(const User_Var_Lookup_Table_t& item)
+{
+	return string_crc(item.userVarKey) + crc(item.userVarType);
+}
+
+/**
+ * The contribution of a function to the functions checksum.
+ * The function name is used to compute the checksum.
+ */
+inline uint32_t func_checksum(const User_Func_Lookup_Table_t& item)
+{
+	return string_crc(item.userFuncKey);
+}
+
+User_Var_Lookup_Table_t* find_var_by_key(const char* varKey)
+{
+    return vars.find(varKey);
+}
+
+template<typename ListT, typename T> T* add_if_sufficient_describe(ListT& list, const char* name, const char* itemType, const T& value) {
+	T* result = list.add(value);
+	if (result) {
+		spark_protocol_describe_data data;
+		data.size = sizeof(data);
+		data.flags = particle::protocol::DESCRIBE_APPLICATION;
+		if (!spark_protocol_get_describe_data(spark_protocol_instance(), &data, nullptr)) {
+			if (data.maximum_size<data.current_size) {
+				list.removeAt(list.size()-1);
+				result = nullptr;
+			}
+		}
+		else {
+			INFO("get describe data unsupported");
+		}
+	}
+	if (!result) {
+		ERROR("Cannot add %s named %d: insufficient storage", itemType, name);
+	}
+	return result;
+}
+
+User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void* userVar, Spark_Data_TypeDef userVarType, spark_variable_t* extra)
+{
+	User_Var_Lookup_Table_t item = {};
+	item.userVar = userVar;
+	item.userVarType = userVarType;
+	if (extra) {
+		item.update = extra->update;
+		if (offsetof(spark_variable_t, copy) + sizeof(spark_variable_t::copy) <= extra->size) {
+			item.copy = extra->copy;
+		}
+	}
+	memcpy(item.userVarKey, varKey, USER_VAR_KEY_LENGTH);
+
+    User_Var_Lookup_Table_t* result = find_var_by_key(varKey);
+
+    if (!result) {
+    	result = add_if_sufficient_describe(vars, varKey, "variable", item);
+    	if (result) {
+    		vars_checksum += var_checksum(*result);
+    	}
+    }
+    else {
+    	vars_checksum -= var_checksum(*result);
+    	*result = item;
+    	vars_checksum += var_checksum(*result);
+    }
+    return result;
+}
+
+User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey)
+{
+    return funcs.find(funcKey);
+}
+
+User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const cloud_function_descriptor* desc)
+{
+	User_Func_Lookup_Table_t item = {0};
+	item.pUserFunc = desc->fn;
+	item.pUserFuncData = desc->data;
+    memcpy(item.userFuncKey, desc->funcKey, USER_FUNC_KEY_LENGTH);
+
+    User_Func_Lookup_Table_t* result = find_func_by_key(funcKey);
+    if (result) {
+    	*result = item;
+    }
+    else {
+    	result = add_if_sufficient_describe(funcs, funcKey, "function", item);
+    	if (result) {
+    		funcs_checksum += func_checksum(*result);
+    	}
+    }
+    return result;
+}
+
+/**
+ * Computes the checksum of the registered functions.
+ */
+uint32_t compute_functions_checksum()
+{
+	return funcs_checksum;
+}
+
+/**
+ * Computes the checksum of the registered variables.
+ */
+uint32_t compute_variables_checksum()
+{
+	return vars_checksum;
+}
+
+int numUserFunctions(void)
+{
+    return funcs.size();
+}
+
+const char* getUserFunctionKey(int function_index)
+{
+    return funcs[function_index].userFuncKey;
+}
+
+int numUserVariables(void)
+{
+    return vars.size();
+}
+
+const char* getUserVariableKey(int variable_index)
+{
+    return vars[variable_index].userVarKey;
+}
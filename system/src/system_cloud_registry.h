@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "system_cloud.h"
+#include "core_hal.h"
+
+struct User_Var_Lookup_Table_t
+{
+    const void *userVar;
+    Spark_Data_TypeDef userVarType;
+    char userVarKey[USER_VAR_KEY_LENGTH+1];
+
+    const void* (*update)(const char* name, Spark_Data_TypeDef varType, const void* var, void* reserved);
+    int (*copy)(const void* var, void** data, size_t* size);
+};
+
+
+struct User_Func_Lookup_Table_t
+{
+    void* pUserFuncData;
+    cloud_function_t pUserFunc;
+    char userFuncKey[USER_FUNC_KEY_LENGTH+1];
+};
+
+
+User_Var_Lookup_Table_t* find_var_by_key(const char* varKey);
+User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void* userVarData, Spark_Data_TypeDef userVarType, spark_variable_t* extra);
+User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey);
+User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const cloud_function_descriptor* desc);
+
+int numUserFunctions(void);
+const char* getUserFunctionKey(int function_index);
+int numUserVariables(void);
+const char* getUserVariableKey(int variable_index);
+
+uint32_t compute_functions_checksum();
+uint32_t compute_variables_checksum();
+
+inline uint32_t crc(const void* data, size_t len)
+{
+	return HAL_Core_Compute_CRC32((const uint8_t*)data, len);
+}
+
+template <typename T>
+uint32_t crc(const T& t)
+{
+	return crc(&t, sizeof(t));
+}
+
+inline uint32_t string_crc(const char* s)
+{
+	return crc(s, strlen(s));
+}
@@ -19,6 +19,10 @@
 
 #include "system_mode.h"
 #include "system_task.h"
+#include "system_wakeup.h"
+
+using particle::system::system_wakeup;
+using particle::system::WAKEUP_REASON_CLOUD;
 static System_Mode_TypeDef current_mode = DEFAULT;
 
 volatile uint8_t SPARK_CLOUD_AUTO_CONNECT = 1; //default is AUTOMATIC mode
@@ -28,11 +32,13 @@ void spark_cloud_flag_connect(void)
     //Schedule cloud connection and handshake
     SPARK_CLOUD_AUTO_CONNECT = 1;
     SPARK_WLAN_SLEEP = 0;
+    system_wakeup(WAKEUP_REASON_CLOUD);
 }
 
 void spark_cloud_flag_disconnect(void)
 {
     SPARK_CLOUD_AUTO_CONNECT = 0;
+    system_wakeup(WAKEUP_REASON_CLOUD);
 }
 
 bool spark_cloud_flag_auto_connect()
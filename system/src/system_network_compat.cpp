@@ -29,6 +29,7 @@
 #include "system_cloud.h"
 #include "system_event.h"
 #include "system_threading.h"
+#include "system_wakeup.h"
 #include "watchdog_hal.h"
 #include "wlan_hal.h"
 #include "delay_hal.h"
@@ -82,11 +83,13 @@ void HAL_WLAN_notify_simple_config_done()
 void HAL_NET_notify_connected()
 {
     network.notify_connected();
+    particle::system::system_wakeup(particle::system::WAKEUP_REASON_NETWORK);
 }
 
 void HAL_NET_notify_disconnected()
 {
     network.notify_disconnected();
+    particle::system::system_wakeup(particle::system::WAKEUP_REASON_NETWORK);
 }
 
 void HAL_NET_notify_can_shutdown()
@@ -97,6 +100,7 @@ void HAL_NET_notify_can_shutdown()
 void HAL_NET_notify_dhcp(bool dhcp)
 {
     network.notify_dhcp(dhcp);
+    particle::system::system_wakeup(particle::system::WAKEUP_REASON_NETWORK);
 }
 
 const void* network_config(network_handle_t network, uint32_t param, void* reserved)
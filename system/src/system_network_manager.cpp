@@ -43,6 +43,7 @@ LOG_SOURCE_CATEGORY("system.nm")
 #include "system_cloud.h"
 #include "system_threading.h"
 #include "system_event.h"
+#include "system_wakeup.h"
 
 #define CHECKV(_expr) \
         ({ \
@@ -568,6 +569,7 @@ void NetworkManager::transition(State state) {
 void NetworkManager::ifEventHandlerCb(void* arg, if_t iface, const struct if_event* ev) {
     auto self = static_cast<NetworkManager*>(arg);
     self->ifEventHandler(iface, ev);
+    system_wakeup(WAKEUP_REASON_NETWORK);
 }
 
 void NetworkManager::ifEventHandler(if_t iface, const struct if_event* ev) {
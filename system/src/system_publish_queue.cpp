@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_publish_queue.h"
+
+#include <cstring>
+#include <utility>
+
+#include "rtc_hal.h"
+#include "spark_protocol_functions.h"
+#include "system_cloud.h"
+#include "system_error.h"
+
+using namespace particle::system;
+using particle::CompletionHandler;
+using particle::protocol::MAX_EVENT_NAME_LENGTH;
+using particle::protocol::MAX_EVENT_DATA_LENGTH;
+
+template <class Queue>
+const size_t PublishQueue<Queue>::MAX_EVENT_SIZE = sizeof(EventHeader) + MAX_EVENT_NAME_LENGTH + 1 + MAX_EVENT_DATA_LENGTH + 1;
+
+template <class Queue>
+PublishQueue<Queue>::PublishQueue(Queue* queue)
+    : queue_(queue),
+      records_(-1),
+      staleRecords_(0),
+      writtenRecords_(0),
+      readRecords_(0),
+      stageStart_(0),
+      stageEnd_(0),
+      stageCount_(0),
+      stageTime_(0),
+      stageTimerStarted_(false),
+      frontPos_(0),
+      frontSize_(0),
+      frontLoaded_(false),
+      nextHandlerId_(1),
+      sending_(nullptr)
+{
+    static_assert(PUBLISH_QUEUE_BUFFER_SIZE >= sizeof(EventHeader) + MAX_EVENT_NAME_LENGTH + 1 + MAX_EVENT_DATA_LENGTH + 1,
+            "PUBLISH_QUEUE_BUFFER_SIZE is too small to hold an event");
+    for (Handler& h: handlers_)
+    {
+        h.queue = this;
+        h.record = 0;
+        h.id = 0;
+        h.sent = false;
+    }
+}
+
+template <class Queue>
+PublishQueue<Queue>::~PublishQueue()
+{
+    for (Handler& h: handlers_)
+    {
+        if (h.id && !h.sent)
+        {
+            completeHandler(&h, SYSTEM_ERROR_ABORTED);
+        }
+    }
+}
+
+template <class Queue>
+int PublishQueue<Queue>::publish(const char* name, const char* data, int ttl, uint32_t flags, CompletionHandler handler)
+{
+    const size_t nameLength = name ? strlen(name) : 0;
+    const size_t dataLength = data ? strlen(data) : 0;
+    if (!nameLength || nameLength > MAX_EVENT_NAME_LENGTH || dataLength > MAX_EVENT_DATA_LENGTH)
+    {
+        handler.setError(SYSTEM_ERROR_TOO_LARGE);
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    Handler* h = nullptr;
+    if (handler)
+    {
+        h = allocHandler(std::move(handler));
+        if (!h)
+        {
+            handler.setError(SYSTEM_ERROR_LIMIT_EXCEEDED);
+            return SYSTEM_ERROR_LIMIT_EXCEEDED;
+        }
+    }
+    // Events are only sent directly when doing so does not overtake queued events
+    if (isEmpty() && spark_cloud_flag_connected() && sendEvent(name, data, ttl, flags, h))
+    {
+        return SYSTEM_ERROR_NONE;
+    }
+    EventHeader header = {};
+    header.time = HAL_RTC_Time_Is_Valid(nullptr) ? HAL_RTC_Get_UnixTime() : 0;
+    header.ttl = ttl;
+    header.handlerId = h ? h->id : 0;
+    header.flags = flags;
+    header.nameLength = nameLength;
+    header.dataLength = dataLength;
+    const int error = stage(header, name, data ? data : "");
+    if (error < 0 && h)
+    {
+        completeHandler(h, error);
+    }
+    return error;
+}
+
+template <class Queue>
+int PublishQueue<Queue>::process(system_tick_t now, unsigned maxEvents)
+{
+    if (!stageCount_)
+    {
+        stageTimerStarted_ = false;
+    }
+    else if (!stageTimerStarted_)
+    {
+        stageTime_ = now;
+        stageTimerStarted_ = true;
+    }
+    else if (now - stageTime_ >= PUBLISH_QUEUE_FLUSH_INTERVAL && !spark_cloud_flag_connected())
+    {
+        // Keep staged events in RAM while they can still be drained, flash writes are costly
+        flush();
+    }
+    if (!spark_cloud_flag_connected())
+    {
+        return 0;
+    }
+    int sent = 0;
+    while (unsigned(sent) < maxEvents)
+    {
+        if (storedRecords())
+        {
+            int error = loadFront();
+            if (error < 0)
+            {
+                // Discard the unreadable record so that the queue does not stall. Its events are
+                // lost, complete their handlers as they would never be invoked otherwise
+                if (!staleRecords_)
+                {
+                    for (Handler& h: handlers_)
+                    {
+                        if (h.id && !h.sent && h.record == readRecords_ + 1)
+                        {
+                            completeHandler(&h, error);
+                        }
+                    }
+                }
+                popFront();
+                return error;
+            }
+            if (frontPos_ < frontSize_)
+            {
+                const uint8_t* event = front_ + frontPos_;
+                error = sendStored(event, staleRecords_ > 0);
+                if (error < 0)
+                {
+                    break;
+                }
+                sent += error;
+                frontPos_ += eventSize(event);
+            }
+            if (frontPos_ >= frontSize_)
+            {
+                popFront();
+            }
+        }
+        else if (stageCount_)
+        {
+            const uint8_t* event = stage_ + stageStart_;
+            const int error = sendStored(event, false);
+            if (error < 0)
+            {
+                break;
+            }
+            sent += error;
+            stageStart_ += eventSize(event);
+            if (!--stageCount_)
+            {
+                stageStart_ = stageEnd_ = 0;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+    return sent;
+}
+
+template <class Queue>
+int PublishQueue<Queue>::flush()
+{
+    if (!stageCount_)
+    {
+        return SYSTEM_ERROR_NONE;
+    }
+    if (storedRecords() >= PUBLISH_QUEUE_MAX_RECORDS)
+    {
+        return SYSTEM_ERROR_LIMIT_EXCEEDED;
+    }
+    if (queue_->pushBack(stage_ + stageStart_, stageEnd_ - stageStart_) < 0)
+    {
+        return SYSTEM_ERROR_FILE;
+    }
+    records_++;
+    writtenRecords_++;
+    for (size_t pos = stageStart_; pos < stageEnd_; pos += eventSize(stage_ + pos))
+    {
+        EventHeader header;
+        memcpy(&header, stage_ + pos, sizeof(EventHeader));
+        Handler* h = findHandler(header.handlerId);
+        if (h)
+        {
+            h->record = writtenRecords_;
+        }
+    }
+    stageStart_ = stageEnd_ = stageCount_ = 0;
+    stageTimerStarted_ = false;
+    return SYSTEM_ERROR_NONE;
+}
+
+template <class Queue>
+int PublishQueue<Queue>::clear()
+{
+    queue_->clear(); // Fails if the queue file does not exist
+    records_ = 0;
+    staleRecords_ = 0;
+    writtenRecords_ = readRecords_ = 0;
+    frontLoaded_ = false;
+    stageStart_ = stageEnd_ = stageCount_ = 0;
+    stageTimerStarted_ = false;
+    for (Handler& h: handlers_)
+    {
+        if (h.id && !h.sent)
+        {
+            completeHandler(&h, SYSTEM_ERROR_ABORTED);
+        }
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+template <class Queue>
+size_t PublishQueue<Queue>::stagedEvents() const
+{
+    return stageCount_;
+}
+
+template <class Queue>
+size_t PublishQueue<Queue>::storedRecords()
+{
+    load();
+    return records_;
+}
+
+template <class Queue>
+bool PublishQueue<Queue>::isEmpty()
+{
+    return !stageCount_ && !storedRecords();
+}
+
+template <class Queue>
+int PublishQueue<Queue>::load()
+{
+    if (records_ < 0)
+    {
+        const int count = queue_->count();
+        records_ = (count > 0) ? count : 0;
+        staleRecords_ = records_;
+    }
+    return records_;
+}
+
+template <class Queue>
+int PublishQueue<Queue>::loadFront()
+{
+    if (frontLoaded_)
+    {
+        return SYSTEM_ERROR_NONE;
+    }
+    typename Queue::QueueEntry entry;
+    if (queue_->front(entry, front_, sizeof(front_)) < 0)
+    {
+        return SYSTEM_ERROR_FILE;
+    }
+    frontSize_ = entry.size - sizeof(entry);
+    frontPos_ = 0;
+    // Validate the record so that a corrupted entry is not sent
+    for (size_t pos = 0; pos < frontSize_; pos += eventSize(front_ + pos))
+    {
+        if (frontSize_ - pos < sizeof(EventHeader) || frontSize_ - pos < eventSize(front_ + pos))
+        {
+            return SYSTEM_ERROR_BAD_DATA;
+        }
+    }
+    frontLoaded_ = true;
+    return SYSTEM_ERROR_NONE;
+}
+
+template <class Queue>
+void PublishQueue<Queue>::popFront()
+{
+    queue_->popFront();
+    records_--;
+    if (staleRecords_ > 0)
+    {
+        staleRecords_--;
+    }
+    else
+    {
+        readRecords_++;
+    }
+    frontLoaded_ = false;
+}
+
+template <class Queue>
+int PublishQueue<Queue>::stage(const EventHeader& header, const char* name, const char* data)
+{
+    const size_t size = sizeof(EventHeader) + header.nameLength + 1 + header.dataLength + 1;
+    if (stageEnd_ + size > sizeof(stage_) && stageStart_)
+    {
+        memmove(stage_, stage_ + stageStart_, stageEnd_ - stageStart_);
+        stageEnd_ -= stageStart_;
+        stageStart_ = 0;
+    }
+    if (stageEnd_ + size > sizeof(stage_))
+    {
+        const int error = flush();
+        if (error < 0)
+        {
+            return error;
+        }
+    }
+    uint8_t* p = stage_ + stageEnd_;
+    memcpy(p, &header, sizeof(EventHeader));
+    p += sizeof(EventHeader);
+    memcpy(p, name, header.nameLength + 1);
+    p += header.nameLength + 1;
+    memcpy(p, data, header.dataLength + 1);
+    stageEnd_ += size;
+    stageCount_++;
+    return SYSTEM_ERROR_NONE;
+}
+
+template <class Queue>
+int PublishQueue<Queue>::sendStored(const uint8_t* event, bool stale)
+{
+    EventHeader header;
+    memcpy(&header, event, sizeof(EventHeader));
+    const char* name = (const char*)event + sizeof(EventHeader);
+    const char* data = name + header.nameLength + 1;
+    // Completion handlers do not survive a reset, identifiers from a previous session are meaningless
+    Handler* h = stale ? nullptr : findHandler(header.handlerId);
+    int ttl = header.ttl;
+    if (header.time && HAL_RTC_Time_Is_Valid(nullptr))
+    {
+        const uint32_t now = HAL_RTC_Get_UnixTime();
+        const uint32_t elapsed = (now > header.time) ? now - header.time : 0;
+        if (ttl >= 0 && elapsed >= uint32_t(ttl))
+        {
+            if (h)
+            {
+                completeHandler(h, SYSTEM_ERROR_TIMEOUT);
+            }
+            return 0;
+        }
+        ttl -= elapsed;
+    }
+    if (!sendEvent(name, data, ttl, header.flags, h))
+    {
+        return SYSTEM_ERROR_BUSY;
+    }
+    return 1;
+}
+
+template <class Queue>
+bool PublishQueue<Queue>::sendEvent(const char* name, const char* data, int ttl, uint8_t flags, Handler* h)
+{
+    spark_protocol_send_event_data d = { sizeof(spark_protocol_send_event_data) };
+    if (h)
+    {
+        d.handler_callback = handlerCallback;
+        d.handler_data = h;
+    }
+    // The protocol layer reports a failure to send through the completion handler as well,
+    // such errors are ignored by handlerCallback() while the event is kept in the queue
+    sending_ = h;
+    const bool ok = spark_protocol_send_event(spark_protocol_instance(), name, data, ttl, flags, &d);
+    sending_ = nullptr;
+    if (ok && h && h->id)
+    {
+        h->sent = true;
+    }
+    return ok;
+}
+
+template <class Queue>
+typename PublishQueue<Queue>::Handler* PublishQueue<Queue>::allocHandler(CompletionHandler&& handler)
+{
+    for (Handler& h: handlers_)
+    {
+        if (!h.id)
+        {
+            h.handler = std::move(handler);
+            h.record = 0;
+            h.id = nextHandlerId_++;
+            if (!nextHandlerId_)
+            {
+                nextHandlerId_ = 1;
+            }
+            h.sent = false;
+            return &h;
+        }
+    }
+    return nullptr;
+}
+
+template <class Queue>
+typename PublishQueue<Queue>::Handler* PublishQueue<Queue>::findHandler(uint16_t id)
+{
+    if (id)
+    {
+        for (Handler& h: handlers_)
+        {
+            if (h.id == id)
+            {
+                return &h;
+            }
+        }
+    }
+    return nullptr;
+}
+
+template <class Queue>
+void PublishQueue<Queue>::completeHandler(Handler* h, int error)
+{
+    if (error < 0)
+    {
+        h->handler.setError(error);
+    }
+    else
+    {
+        h->handler.setResult();
+    }
+    h->id = 0;
+    h->sent = false;
+}
+
+template <class Queue>
+size_t PublishQueue<Queue>::eventSize(const uint8_t* event)
+{
+    EventHeader header;
+    memcpy(&header, event, sizeof(EventHeader));
+    return sizeof(EventHeader) + header.nameLength + 1 + header.dataLength + 1;
+}
+
+template <class Queue>
+void PublishQueue<Queue>::handlerCallback(int error, const void* data, void* callbackData, void* reserved)
+{
+    Handler* h = static_cast<Handler*>(callbackData);
+    if (error < 0 && h->queue->sending_ == h)
+    {
+        return;
+    }
+    h->queue->completeHandler(h, error);
+}
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "file_queue.h"
+
+namespace
+{
+
+PublishQueue<particle::fs::FileQueue>& publishQueue()
+{
+    static particle::fs::FileQueue file("events.bin");
+    static PublishQueue<particle::fs::FileQueue> queue(&file);
+    return queue;
+}
+
+} // namespace
+
+void particle::system::processPublishQueue(system_tick_t now)
+{
+    publishQueue().process(now);
+}
+
+int particle::system::publishQueued(const char* name, const char* data, int ttl, uint32_t flags, CompletionHandler handler)
+{
+    return publishQueue().publish(name, data, ttl, flags, std::move(handler));
+}
+
+template class particle::system::PublishQueue<particle::fs::FileQueue>;
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM_PUBLISH_QUEUE_H
+#define SYSTEM_PUBLISH_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "completion_handler.h"
+#include "protocol_defs.h"
+#include "system_tick_hal.h"
+#include "hal_platform.h"
+
+/**
+ * Size of each of the two RAM buffers used by the publish queue. Events are batched in the
+ * staging buffer before being written to flash as a single queue record, so a larger buffer
+ * means fewer flash writes per event.
+ */
+#ifndef PUBLISH_QUEUE_BUFFER_SIZE
+#define PUBLISH_QUEUE_BUFFER_SIZE 1024
+#endif
+
+/**
+ * Maximum number of records (batches of events) kept in flash.
+ */
+#ifndef PUBLISH_QUEUE_MAX_RECORDS
+#define PUBLISH_QUEUE_MAX_RECORDS 32
+#endif
+
+/**
+ * Maximum number of queued events with a pending completion handler.
+ */
+#ifndef PUBLISH_QUEUE_MAX_HANDLERS
+#define PUBLISH_QUEUE_MAX_HANDLERS 8
+#endif
+
+/**
+ * Time in milliseconds after which staged events are written to flash even if the staging
+ * buffer is not full.
+ */
+#ifndef PUBLISH_QUEUE_FLUSH_INTERVAL
+#define PUBLISH_QUEUE_FLUSH_INTERVAL 10000
+#endif
+
+/**
+ * Maximum number of events sent per call to PublishQueue::process().
+ */
+#ifndef PUBLISH_QUEUE_BATCH_SIZE
+#define PUBLISH_QUEUE_BATCH_SIZE 4
+#endif
+
+namespace particle
+{
+namespace system
+{
+
+/**
+ * @class PublishQueue system_publish_queue.h
+ * @brief Store-and-forward queue for cloud events
+ *
+ * Events that cannot be sent right away, because the device is offline or the publish rate
+ * limit is exceeded, are batched in a RAM staging buffer and written to a persistent queue
+ * as a single record. Queued events are sent in order by process() once the cloud connection
+ * is available. An event whose TTL has passed before it could be sent is discarded and its
+ * completion handler is invoked with \p SYSTEM_ERROR_TIMEOUT.
+ *
+ * Events that were staged but not yet written to the persistent queue are lost on reset.
+ * Completion handlers are not persisted, so events restored from a previous session are
+ * delivered without notification.
+ *
+ * @tparam Queue An API compatible queue class with \p file_queue.h:FileQueue
+ */
+template <class Queue>
+class PublishQueue
+{
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] queue The persistent queue storing batches of events
+     */
+    explicit PublishQueue(Queue* queue);
+
+    /**
+     * @brief Destructor
+     *
+     * Pending completion handlers are invoked with \p SYSTEM_ERROR_ABORTED.
+     */
+    ~PublishQueue();
+
+    /**
+     * @brief Publish an event, queueing it if it cannot be sent immediately
+     *
+     * The event is sent right away when the cloud is connected and no other events are queued.
+     * The completion handler is invoked once the event has been sent, or acknowledged
+     * when \p EventType::WITH_ACK is set, or when the event is discarded.
+     *
+     * @param[in] name The event name
+     * @param[in] data The event data. Can be \p nullptr
+     * @param[in] ttl The event TTL in seconds
+     * @param[in] flags Protocol event type and flags
+     * @param[in] handler The completion handler
+     *
+     * @returns \p system_error_t result code
+     * @retval \p system_error_t::SYSTEM_ERROR_NONE
+     * @retval \p system_error_t::SYSTEM_ERROR_TOO_LARGE
+     * @retval \p system_error_t::SYSTEM_ERROR_LIMIT_EXCEEDED
+     */
+    int publish(const char* name, const char* data, int ttl, uint32_t flags, CompletionHandler handler);
+
+    /**
+     * @brief Send queued events and flush the staging buffer when it is due
+     *
+     * @param[in] now The current system tick count
+     * @param[in] maxEvents The maximum number of events to send
+     *
+     * @returns The number of events sent, or a negative \p system_error_t result code
+     */
+    int process(system_tick_t now, unsigned maxEvents = PUBLISH_QUEUE_BATCH_SIZE);
+
+    /**
+     * @brief Write staged events to the persistent queue
+     *
+     * @returns \p system_error_t result code
+     */
+    int flush();
+
+    /**
+     * @brief Discard all queued events
+     *
+     * Completion handlers of the discarded events are invoked with \p SYSTEM_ERROR_ABORTED.
+     */
+    int clear();
+
+    /**
+     * @brief Fetch the number of events waiting in RAM
+     */
+    size_t stagedEvents() const;
+
+    /**
+     * @brief Fetch the number of records in the persistent queue
+     */
+    size_t storedRecords();
+
+    /**
+     * @brief Check whether there are no queued events
+     */
+    bool isEmpty();
+
+    /**
+     * @brief Maximum size of a serialized event
+     */
+    static const size_t MAX_EVENT_SIZE;
+
+private:
+    struct __attribute__((packed)) EventHeader
+    {
+        uint32_t time; // RTC time when the event was published, 0 if the time was not known
+        int32_t ttl;
+        uint16_t handlerId;
+        uint8_t flags;
+        uint8_t nameLength;
+        uint16_t dataLength;
+    };
+
+    struct Handler
+    {
+        CompletionHandler handler;
+        PublishQueue* queue;
+        unsigned record; // Persistent record holding the event, 0 while the event is staged
+        uint16_t id;
+        bool sent;
+    };
+
+    Queue* const queue_;
+    int records_; // Number of records in the persistent queue, < 0 if not known yet
+    int staleRecords_; // Number of records written in a previous session
+    unsigned writtenRecords_; // Number of records written in this session
+    unsigned readRecords_; // Number of records written in this session and removed from the queue
+    uint8_t stage_[PUBLISH_QUEUE_BUFFER_SIZE];
+    size_t stageStart_;
+    size_t stageEnd_;
+    size_t stageCount_;
+    system_tick_t stageTime_;
+    bool stageTimerStarted_;
+    uint8_t front_[PUBLISH_QUEUE_BUFFER_SIZE];
+    size_t frontPos_;
+    size_t frontSize_;
+    bool frontLoaded_;
+    Handler handlers_[PUBLISH_QUEUE_MAX_HANDLERS];
+    uint16_t nextHandlerId_;
+    Handler* sending_;
+
+    int load();
+    int loadFront();
+    void popFront();
+    int stage(const EventHeader& header, const char* name, const char* data);
+    int sendStored(const uint8_t* event, bool stale);
+    bool sendEvent(const char* name, const char* data, int ttl, uint8_t flags, Handler* h);
+    Handler* allocHandler(CompletionHandler&& handler);
+    Handler* findHandler(uint16_t id);
+    void completeHandler(Handler* h, int error);
+
+    static size_t eventSize(const uint8_t* event);
+    static void handlerCallback(int error, const void* data, void* callbackData, void* reserved);
+};
+
+#if HAL_PLATFORM_FILESYSTEM
+
+/**
+ * @brief Process the system publish queue
+ *
+ * Called periodically on the system thread.
+ */
+void processPublishQueue(system_tick_t now);
+
+/**
+ * @brief Publish an event through the system publish queue
+ *
+ * @sa PublishQueue::publish
+ */
+int publishQueued(const char* name, const char* data, int ttl, uint32_t flags, CompletionHandler handler);
+
+#endif // HAL_PLATFORM_FILESYSTEM
+
+} // namespace system
+} // namespace particle
+
+#endif
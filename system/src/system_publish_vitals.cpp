@@ -1,11 +1,14 @@
 
 #include "system_publish_vitals.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "logging.h"
 #include "system_cloud.h"
+#include "system_error.h"
 #include "system_threading.h"
+#include "timer_hal.h"
 
 namespace
 {
@@ -20,8 +23,10 @@ using namespace particle::system;
  *
  * @sa template <class Timer> particle::cloud::VitalsPublisher<Timer>::publish
  * @sa template <class Timer> particle::cloud::VitalsPublisher<Timer>::publishFromTimer
+ *
+ * @param[in] metrics The diagnostic sources to include, or \p nullptr to include all sources
  */
-inline int postDescription()
+inline int postDescription(const spark_protocol_describe_metrics* metrics = nullptr)
 {
     int error;
 
@@ -29,7 +34,8 @@ inline int postDescription()
     {
         // Transmit CoAP message via communication layer
         error = spark_protocol_post_description(spark_protocol_instance(),
-                                                particle::protocol::DESCRIBE_METRICS, nullptr);
+                                                particle::protocol::DESCRIBE_METRICS,
+                                                const_cast<spark_protocol_describe_metrics*>(metrics));
 
         // Convert `protocol` error to `system` error
         error = spark_protocol_to_system_error(error);
@@ -47,9 +53,13 @@ inline int postDescription()
 template <class Timer>
 VitalsPublisher<Timer>::VitalsPublisher(Timer* timer_)
     : _period_s(std::numeric_limits<system_tick_t>::max()),
+      _sample_s(0),
+      _last_publish_ms(0),
       _timer(timer_ ? timer_
                     : new Timer(_period_s, &VitalsPublisher::publishFromTimer, *this, false)),
-      _timer_owner(!timer_)
+      _timer_owner(!timer_),
+      _delta(false),
+      _triggered(false)
 {
 }
 
@@ -63,12 +73,38 @@ VitalsPublisher<Timer>::~VitalsPublisher(void)
     }
 }
 
+template <class Timer>
+void VitalsPublisher<Timer>::disableDeltaPublish(void)
+{
+    _delta = false;
+
+    // The snapshot becomes stale while every message includes all sources
+    for (SourceState& state : _sources)
+    {
+        state.published = false;
+    }
+    if (!updateTimer(_period_s))
+    {
+        LOG(ERROR, "Unable to update vitals timer period!");
+    }
+}
+
 template <class Timer>
 void VitalsPublisher<Timer>::disablePeriodicPublish(void)
 {
     _timer->stop();
 }
 
+template <class Timer>
+void VitalsPublisher<Timer>::enableDeltaPublish(void)
+{
+    _delta = true;
+    if (!updateTimer(_period_s))
+    {
+        LOG(ERROR, "Unable to update vitals timer period!");
+    }
+}
+
 template <class Timer>
 void VitalsPublisher<Timer>::enablePeriodicPublish(void)
 {
@@ -84,33 +120,231 @@ system_tick_t VitalsPublisher<Timer>::period(void) const
 template <class Timer>
 void VitalsPublisher<Timer>::period(system_tick_t period_s_)
 {
-    const system_tick_t period_ms = period_s_ * 1000;
-    const bool was_active = _timer->isActive();
-
-    if (!_timer->changePeriod(period_ms))
+    if (!updateTimer(period_s_))
     {
         LOG(ERROR, "Unable to update vitals timer period!");
     }
     else
     {
         _period_s = period_s_;
+    }
+}
+
+template <class Timer>
+int VitalsPublisher<Timer>::publish(void)
+{
+    if (!_delta)
+    {
+        return postDescription();
+    }
+
+    // The full message becomes the new snapshot known to the cloud
+    int error = sample();
+    if (!error)
+    {
+        error = postDescription();
+    }
+    if (!error)
+    {
+        commit(true);
+        _last_publish_ms = HAL_Timer_Get_Milli_Seconds();
+    }
+
+    return error;
+}
+
+template <class Timer>
+int VitalsPublisher<Timer>::publishChanges(void)
+{
+    if (!_delta)
+    {
+        return postDescription();
+    }
+
+    int error = sample();
+    if (error)
+    {
+        return error;
+    }
+
+    const system_tick_t now_ms = HAL_Timer_Get_Milli_Seconds();
+    const bool period_elapsed
+        = (uint64_t)(system_tick_t)(now_ms - _last_publish_ms) >= (uint64_t)_period_s * 1000;
+    if (_changed.isEmpty() || (!period_elapsed && !_triggered))
+    {
+        return SYSTEM_ERROR_NONE;
+    }
+
+    const spark_protocol_describe_metrics metrics = {sizeof(spark_protocol_describe_metrics),
+                                                     (uint16_t)_changed.size(), _changed.data()};
+    error = postDescription(&metrics);
+    if (!error)
+    {
+        commit(false);
+        _last_publish_ms = now_ms;
+    }
+
+    return error;
+}
+
+template <class Timer>
+system_tick_t VitalsPublisher<Timer>::samplePeriod(void) const
+{
+    return _sample_s;
+}
+
+template <class Timer>
+void VitalsPublisher<Timer>::samplePeriod(system_tick_t sample_s_)
+{
+    const system_tick_t prev_sample_s = _sample_s;
+
+    _sample_s = sample_s_;
+    if (!updateTimer(_period_s))
+    {
+        LOG(ERROR, "Unable to update vitals timer period!");
+        _sample_s = prev_sample_s;
+    }
+}
 
-        // Maintain pre-existing state
-        if (was_active)
+template <class Timer>
+int VitalsPublisher<Timer>::threshold(uint16_t id_, uint32_t threshold_, bool trigger_)
+{
+    SourceState* const state = sourceState(id_);
+    if (!state)
+    {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    state->threshold = threshold_;
+    state->trigger = trigger_;
+
+    return SYSTEM_ERROR_NONE;
+}
+
+template <class Timer>
+typename VitalsPublisher<Timer>::SourceState* VitalsPublisher<Timer>::sourceState(uint16_t id_)
+{
+    // Sources are sorted by ID
+    const auto it = std::lower_bound(_sources.begin(), _sources.end(), id_,
+                                     [](const SourceState& state, uint16_t id) { return state.id < id; });
+    const int index = it - _sources.begin();
+    if (it == _sources.end() || it->id != id_)
+    {
+        SourceState state = {};
+        state.id = id_;
+        if (!_sources.insert(index, state))
         {
-            _timer->reset();
+            return nullptr;
         }
-        else
+    }
+
+    return &_sources.at(index);
+}
+
+template <class Timer>
+int VitalsPublisher<Timer>::sample(void)
+{
+    _changed.clear();
+    _triggered = false;
+
+    return diag_enum_sources(&VitalsPublisher::sampleSource, nullptr, this, nullptr);
+}
+
+template <class Timer>
+int VitalsPublisher<Timer>::sampleSource(const diag_source* src_, void* data_)
+{
+    // Only single values are included in the metrics
+    if (src_->type != DIAG_TYPE_INT && src_->type != DIAG_TYPE_UINT)
+    {
+        return SYSTEM_ERROR_NONE;
+    }
+
+    const auto self = static_cast<VitalsPublisher*>(data_);
+    SourceState* const state = self->sourceState(src_->id);
+    if (!state)
+    {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+
+    // Both supported data types are 32-bit integers
+    uint32_t value = 0;
+    diag_source_get_cmd_data cmd = {sizeof(diag_source_get_cmd_data), 0, &value, sizeof(value)};
+    const int error = src_->callback(src_, DIAG_SOURCE_CMD_GET, &cmd);
+    state->sample_value = error ? 0 : value;
+    state->sample_error = error;
+
+    bool changed;
+    if (!state->published || state->error != error)
+    {
+        changed = true;
+    }
+    else if (error)
+    {
+        changed = false;
+    }
+    else
+    {
+        const int64_t prev = (src_->type == DIAG_TYPE_INT) ? (int64_t)(int32_t)state->value
+                                                           : (int64_t)state->value;
+        const int64_t next = (src_->type == DIAG_TYPE_INT) ? (int64_t)(int32_t)value
+                                                           : (int64_t)value;
+        const uint64_t delta = (next > prev) ? next - prev : prev - next;
+        changed = delta > state->threshold;
+    }
+
+    if (changed)
+    {
+        if (!self->_changed.append(src_->id))
+        {
+            return SYSTEM_ERROR_NO_MEMORY;
+        }
+        if (state->trigger || !state->published)
         {
-            _timer->stop();
+            self->_triggered = true;
         }
     }
+
+    return SYSTEM_ERROR_NONE;
 }
 
 template <class Timer>
-int VitalsPublisher<Timer>::publish(void)
+void VitalsPublisher<Timer>::commit(bool all_)
+{
+    for (SourceState& state : _sources)
+    {
+        if (all_ || _changed.contains(state.id))
+        {
+            state.value = state.sample_value;
+            state.error = state.sample_error;
+            state.published = true;
+        }
+    }
+    _changed.clear();
+    _triggered = false;
+}
+
+template <class Timer>
+bool VitalsPublisher<Timer>::updateTimer(system_tick_t period_s_)
 {
-    return postDescription();
+    const system_tick_t timer_s = (_delta && _sample_s) ? std::min(_sample_s, period_s_) : period_s_;
+    const system_tick_t period_ms = timer_s * 1000;
+    const bool was_active = _timer->isActive();
+
+    if (!_timer->changePeriod(period_ms))
+    {
+        return false;
+    }
+
+    // Maintain pre-existing state
+    if (was_active)
+    {
+        _timer->reset();
+    }
+    else
+    {
+        _timer->stop();
+    }
+
+    return true;
 }
 
 // Functionality covered by E2E tests
@@ -122,15 +356,22 @@ int VitalsPublisher<Timer>::publish(void)
 template <class Timer>
 void VitalsPublisher<Timer>::publishFromTimer(void)
 {
-    const auto task = new (std::nothrow) ISRTaskQueue::Task;
+    struct PublishTask : ISRTaskQueue::Task
+    {
+        VitalsPublisher* publisher;
+    };
+
+    const auto task = new (std::nothrow) PublishTask;
     if (!task)
     {
         return;
     }
     task->func = [](ISRTaskQueue::Task* task) {
-        delete task;
-        postDescription();
+        const auto publisher = static_cast<PublishTask*>(task)->publisher;
+        delete static_cast<PublishTask*>(task);
+        publisher->publishChanges();
     };
+    task->publisher = this;
     SystemISRTaskQueue.enqueue(task);
 }
 #define LCOV_EXCL_STOP
@@ -5,7 +5,9 @@
 #include <cstddef>
 #include <functional>
 
+#include "diagnostics.h"
 #include "spark_protocol_functions.h"
+#include "spark_wiring_vector.h"
 #include "system_tick_hal.h"
 
 namespace particle
@@ -21,6 +23,11 @@ namespace system
  * publish vitals information to the cloud. This information is then consumed
  * by the fleet health metrics dashboard in the console.
  *
+ * In delta mode, the publisher keeps a snapshot of the values last sent to
+ * the cloud and the timer-based messages only include the diagnostic sources
+ * whose values changed beyond their thresholds. A message can also be sent
+ * ahead of the period when a change in a trigger source exceeds its threshold.
+ *
  * @tparam Timer An API compatible timer class with \p spark_wiring_timer.h:Timer
  *
  * @sa Timer
@@ -46,11 +53,26 @@ public:
      */
     virtual ~VitalsPublisher(void);
 
+    /**
+     * @brief Disable delta publishing
+     *
+     * Every message includes all diagnostic sources.
+     */
+    void disableDeltaPublish(void);
+
     /**
      * @brief Disable periodic publishing
      */
     void disablePeriodicPublish(void);
 
+    /**
+     * @brief Enable delta publishing
+     *
+     * The timer-based messages only include the diagnostic sources that changed
+     * beyond their thresholds since they were last sent to the cloud.
+     */
+    void enableDeltaPublish(void);
+
     /**
      * @brief Enable periodic publishing
      */
@@ -73,6 +95,9 @@ public:
     /**
      * @brief Publish vitals information to the cloud (immediately)
      *
+     * The message includes all diagnostic sources. In delta mode, it also
+     * replaces the snapshot of the values known to the cloud.
+     *
      * @returns \p system_error_t result code
      * @retval \p system_error_t::SYSTEM_ERROR_NONE
      * @retval \p system_error_t::SYSTEM_ERROR_INVALID_STATE
@@ -80,10 +105,119 @@ public:
      */
     int publish(void);
 
+    /**
+     * @brief Publish the changed vitals information to the cloud
+     *
+     * Invoked on the system thread every time the timer expires. In delta
+     * mode, a message is sent if the period has elapsed since the last
+     * message, or a change in a trigger source exceeds its threshold. The
+     * message only includes the diagnostic sources that changed beyond their
+     * thresholds. Otherwise, this method is equivalent to \p publish.
+     *
+     * @returns \p system_error_t result code
+     * @retval \p system_error_t::SYSTEM_ERROR_NONE
+     * @retval \p system_error_t::SYSTEM_ERROR_INVALID_STATE
+     * @retval \p system_error_t::SYSTEM_ERROR_IO
+     * @retval \p system_error_t::SYSTEM_ERROR_NO_MEMORY
+     */
+    int publishChanges(void);
+
+    /**
+     * @brief Fetch the sample period value
+     *
+     * @return The sample period value in seconds
+     */
+    system_tick_t samplePeriod(void) const;
+
+    /**
+     * @brief Update the sample period value
+     *
+     * In delta mode, the diagnostic sources are checked for changes at this
+     * period instead of the publishing period. A value of \p 0 checks the
+     * sources once per publishing period.
+     *
+     * @param[in] sample_s The sample period value in seconds
+     */
+    void samplePeriod(system_tick_t sample_s);
+
+    /**
+     * @brief Update the change threshold of a diagnostic source
+     *
+     * In delta mode, a source is included in a message if its value differs
+     * from the value last sent to the cloud by more than the threshold. The
+     * default threshold of every source is \p 0.
+     *
+     * @param[in] id The diagnostic source ID
+     * @param[in] threshold The change threshold
+     * @param[in] trigger Publish a message as soon as the change exceeds the threshold
+     *
+     * @returns \p system_error_t result code
+     * @retval \p system_error_t::SYSTEM_ERROR_NONE
+     * @retval \p system_error_t::SYSTEM_ERROR_NO_MEMORY
+     */
+    int threshold(uint16_t id, uint32_t threshold, bool trigger = false);
+
 private:
+    /**
+     * @brief Diagnostic source state
+     */
+    struct SourceState
+    {
+        uint16_t id;
+        bool published; ///< The source value is known to the cloud
+        bool trigger; ///< A change publishes a message ahead of the period
+        uint32_t threshold; ///< Change threshold
+        uint32_t value; ///< Value last sent to the cloud
+        int error; ///< Error last sent to the cloud
+        uint32_t sample_value; ///< Most recently sampled value
+        int sample_error; ///< Most recently sampled error
+    };
+
     system_tick_t _period_s;
+    system_tick_t _sample_s;
+    system_tick_t _last_publish_ms;
     Timer* const _timer;
     const bool _timer_owner;
+    bool _delta;
+    bool _triggered;
+    Vector<SourceState> _sources;
+    Vector<uint16_t> _changed;
+
+    /**
+     * @brief Find or add the state of a diagnostic source
+     *
+     * @param[in] id The diagnostic source ID
+     *
+     * @returns The source state, or \p nullptr if memory allocation failed
+     */
+    SourceState* sourceState(uint16_t id);
+
+    /**
+     * @brief Sample all diagnostic sources
+     *
+     * Collects the IDs of the sources that changed beyond their thresholds.
+     *
+     * @returns \p system_error_t result code
+     */
+    int sample(void);
+
+    /**
+     * @brief Record the sampled values as known to the cloud
+     *
+     * @param[in] all Record all sources, not only the changed ones
+     */
+    void commit(bool all);
+
+    /**
+     * @brief Apply the timer period for the current mode
+     *
+     * @param[in] period_s The publishing period value in seconds
+     *
+     * @returns \p true on success, otherwise \p false
+     */
+    bool updateTimer(system_tick_t period_s);
+
+    static int sampleSource(const diag_source* src, void* data);
 
     /**
      * @brief Publish vitals from Timer callback
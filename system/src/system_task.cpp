@@ -48,6 +48,9 @@
 #include "spark_wiring_interrupts.h"
 #include "spark_wiring_led.h"
 #include "system_commands.h"
+#include "system_publish_queue.h"
+#include "system_wakeup.h"
+#include "spark_wiring_diagnostics.h"
 
 #if HAL_PLATFORM_BLE
 #include "ble_hal.h"
@@ -81,7 +84,21 @@ static struct SetThreadCurrentFunctionPointers {
     }
 } s_SetThreadCurrentFunctionPointersInitializer;
 
-ISRTaskQueue SystemISRTaskQueue;
+using particle::system::SystemWakeup;
+
+namespace {
+
+void wakeup_on_isr_task()
+{
+    particle::system::system_wakeup(particle::system::WAKEUP_REASON_ISR_TASK);
+}
+
+// Time spent in a pass of the system loop, in microseconds
+particle::HistogramDiagnosticData<64> g_loopTime(DIAG_ID_SYSTEM_LOOP_TIME, DIAG_NAME_SYSTEM_LOOP_TIME);
+
+} // namespace
+
+ISRTaskQueue SystemISRTaskQueue(wakeup_on_isr_task);
 
 void Network_Setup(bool threaded)
 {
@@ -433,11 +450,17 @@ extern void system_handle_button_clicks(bool isIsr);
 
 void Spark_Idle_Events(bool force_events/*=false*/)
 {
+    const particle::ScopedDiagnosticMicrosTimer<decltype(g_loopTime)> loopTimer(g_loopTime);
+
     HAL_Notify_WDT();
 
     ON_EVENT_DELTA();
     spark_loop_total_millis = 0;
 
+    // Consume the wakeups posted since the previous pass. The managers below still run on every
+    // pass, since their connection and backoff timers have no deadline that the loop could wait for
+    SystemWakeup::instance()->loopIteration();
+
     process_isr_task_queue();
 
     if (!SYSTEM_POWEROFF) {
@@ -458,6 +481,7 @@ void Spark_Idle_Events(bool force_events/*=false*/)
 // FIXME: there should be a separate feature macro
 #if HAL_PLATFORM_FILESYSTEM
         particle::system::fetchAndExecuteCommand(millis());
+        particle::system::processPublishQueue(millis());
 #endif // HAL_PLATFORM_FILESYSTEM
     }
     else
@@ -471,6 +495,10 @@ void Spark_Idle_Events(bool force_events/*=false*/)
     system_shutdown_if_needed();
 }
 
+// Maximum time system_delay_pump() sleeps without kicking the watchdog. HAL_Delay_Milliseconds()
+// doesn't kick the watchdog on all platforms
+const system_tick_t DELAY_WATCHDOG_SLICE_MILLIS = 10;
+
 /*
  * @brief This should block for a certain number of milliseconds and also execute spark_wlan_loop
  */
@@ -483,6 +511,7 @@ void system_delay_pump(unsigned long ms, bool force_no_background_loop=false)
 
     system_tick_t start_millis = HAL_Timer_Get_Milli_Seconds();
     system_tick_t end_micros = HAL_Timer_Get_Micro_Seconds() + (1000*ms);
+    bool wakeup = false;
 
     while (1)
     {
@@ -508,16 +537,40 @@ void system_delay_pump(unsigned long ms, bool force_no_background_loop=false)
         }
         else
         {
-            HAL_Delay_Milliseconds(1);
+            // Sleep until the last millisecond of the delay or until the background loop is due,
+            // whichever comes first. Without the system thread, the background loop runs on this
+            // thread, so the wait also ends early when an event source posts a wakeup
+            const bool background = !SPARK_WLAN_SLEEP && !force_no_background_loop;
+            system_tick_t timeout = ms - 1 - elapsed_millis;
+            if (background && spark_loop_total_millis < SPARK_LOOP_DELAY_MILLIS && spark_loop_elapsed_millis > elapsed_millis)
+            {
+                timeout = min(timeout, spark_loop_elapsed_millis - elapsed_millis);
+            }
+            else if (background)
+            {
+                timeout = 0;
+            }
+            // Sleep in short slices, so that the watchdog is kicked at the start of each iteration
+            timeout = min(timeout, DELAY_WATCHDOG_SLICE_MILLIS);
+            if (!background || system_thread_get_state(nullptr))
+            {
+                HAL_Delay_Milliseconds(max(timeout, (system_tick_t)1));
+            }
+            else
+            {
+                wakeup = SystemWakeup::instance()->wait(timeout);
+            }
+            elapsed_millis = HAL_Timer_Get_Milli_Seconds() - start_millis;
         }
 
         if (SPARK_WLAN_SLEEP || force_no_background_loop)
         {
             //Do not yield for Spark_Idle()
         }
-        else if ((elapsed_millis >= spark_loop_elapsed_millis) || (spark_loop_total_millis >= SPARK_LOOP_DELAY_MILLIS))
+        else if (wakeup || (elapsed_millis >= spark_loop_elapsed_millis) || (spark_loop_total_millis >= SPARK_LOOP_DELAY_MILLIS))
         {
         		bool threading = system_thread_get_state(nullptr);
+            wakeup = false;
             spark_loop_elapsed_millis = elapsed_millis + SPARK_LOOP_DELAY_MILLIS;
             //spark_loop_total_millis is reset to 0 in Spark_Idle()
             do
@@ -43,7 +43,10 @@
 #include "system_network_internal.h"
 #include "bytes2hexbuf.h"
 #include "system_threading.h"
+#include "firmware_decoder.h"
+#include "scope_guard.h"
 #include <cstdio>
+#include <memory>
 #if HAL_PLATFORM_DCT
 #include "dct.h"
 #endif // HAL_PLATFORM_DCT
@@ -289,10 +292,37 @@ void set_flag(void* flag)
 namespace {
 // FIXME: Dirty hack
 bool ledIsOverridden = false;
+
+// Decoder of the compressed or delta-encoded binary being received
+std::unique_ptr<particle::system::FirmwareDecoder> firmwareDecoder;
+
+int findInstalledModule(unsigned moduleFunction, unsigned moduleIndex, const uint8_t** data, size_t* size)
+{
+    hal_system_info_t info = {};
+    info.size = sizeof(info);
+    HAL_System_Info(&info, true, nullptr);
+    SCOPE_GUARD({
+        HAL_System_Info(&info, false, nullptr);
+    });
+    for (size_t i = 0; i < info.module_count; ++i) {
+        const hal_module_t& module = info.modules[i];
+        if (!module.info || module.bounds.store != MODULE_STORE_MAIN || module.info->module_function != moduleFunction ||
+                module.info->module_index != moduleIndex) {
+            continue;
+        }
+        // Modules in the main store are located in the internal flash, which is memory-mapped.
+        // The binary is followed by its CRC
+        *data = (const uint8_t*)module.info->module_start_address;
+        *size = (uintptr_t)module.info->module_end_address - (uintptr_t)module.info->module_start_address + 4;
+        return 0;
+    }
+    return SYSTEM_ERROR_NOT_FOUND;
+}
 } // namespace
 
 int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags, void* reserved)
 {
+    using namespace particle::protocol;
     if (file.store==FileTransfer::Store::FIRMWARE)
     {
         // address is relative to the OTA region. Normally will be 0.
@@ -304,9 +334,13 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
             file.file_length = HAL_OTA_FlashLength();
         }
     }
+    if (file.format != FileTransfer::Format::BINARY && (file.store != FileTransfer::Store::FIRMWARE ||
+            !particle::system::FirmwareDecoder::isSupported(file.format))) {
+        return 1;
+    }
     int result = 0;
     if (System.updatesEnabled() || System.updatesForced()) {		// application event is handled asynchronously
-        if (flags & 1) {
+        if (flags & PrepareFlag::DRY_RUN) {
             // only check address
 		}
 		else {
@@ -324,7 +358,19 @@ int Spark_Prepare_For_Firmware_Update(FileTransfer::Descriptor& file, uint32_t f
             SPARK_FLASH_UPDATE = 1;
             TimingFlashUpdateTimeout = 0;
             system_notify_event(firmware_update, firmware_update_begin, &file);
-            HAL_FLASH_Begin(file.file_address, file.file_length, NULL);
+            firmwareDecoder.reset();
+            if (file.format != FileTransfer::Format::BINARY) {
+                // The size of the decoded binary is unknown, so the entire OTA section is erased
+                HAL_FLASH_Begin(file.file_address, HAL_OTA_FlashLength(), NULL);
+                firmwareDecoder.reset(new(std::nothrow) particle::system::FirmwareDecoder());
+                result = firmwareDecoder ? firmwareDecoder->init(file.format, file.file_length, file.file_address,
+                        HAL_OTA_FlashLength(), findInstalledModule) : SYSTEM_ERROR_NO_MEMORY;
+                if (result != 0) {
+                    firmwareDecoder.reset();
+                }
+            } else {
+                HAL_FLASH_Begin(file.file_address, file.file_length, NULL);
+            }
         }
     }
     else {
@@ -401,6 +447,13 @@ int Spark_Finish_Firmware_Update(FileTransfer::Descriptor& file, uint32_t flags,
         return res;
     }
 
+    if ((flags & UpdateFlag::SUCCESS) && file.format != FileTransfer::Format::BINARY &&
+            !(firmwareDecoder && firmwareDecoder->isDone())) {
+        // the encoded data is incomplete
+        flags &= ~UpdateFlag::SUCCESS;
+    }
+    firmwareDecoder.reset();
+
     if (flags & UpdateFlag::SUCCESS) {    // update successful
         if (file.store==FileTransfer::Store::FIRMWARE)
         {
@@ -437,7 +490,17 @@ int Spark_Save_Firmware_Chunk(FileTransfer::Descriptor& file, const uint8_t* chu
     system_notify_event(firmware_update, firmware_update_progress, &file);
     if (file.store==FileTransfer::Store::FIRMWARE)
     {
-        result = HAL_FLASH_Update(chunk, file.chunk_address, file.chunk_size, NULL);
+        if (file.format != FileTransfer::Format::BINARY) {
+            // the decoder writes the decoded data to the OTA section
+            result = firmwareDecoder ? firmwareDecoder->write(file.chunk_address - file.file_address, chunk, file.chunk_size) :
+                    SYSTEM_ERROR_INVALID_STATE;
+            if (result < 0 && firmwareDecoder && firmwareDecoder->error() < 0) {
+                // the decoder can't continue, requesting the data again won't help
+                result = SYSTEM_ERROR_ABORTED;
+            }
+        } else {
+            result = HAL_FLASH_Update(chunk, file.chunk_address, file.chunk_size, NULL);
+        }
         // FIXME: use APIs in system_led_signal.h instead
         if (!ledIsOverridden) {
             LED_Toggle(LED_RGB);
@@ -790,6 +853,14 @@ protected:
 			}
 			break;
 		}
+		case DIAG_TYPE_HISTOGRAM: {
+			HistogramDiagnosticSummary val = {};
+			const int ret = AbstractHistogramDiagnosticData::get(src, val);
+			if ((ret == 0 && !fmt.formatSourceHistogram(src, val)) || (ret != 0 && !fmt.formatSourceError(src, ret))) {
+				return SYSTEM_ERROR_TOO_LARGE;
+			}
+			break;
+		}
 		default:
 			return SYSTEM_ERROR_NOT_SUPPORTED;
 		}
@@ -869,6 +940,19 @@ public:
 	inline bool formatSourceUnsignedInt(const diag_source* src, AbstractUnsignedIntegerDiagnosticData::IntType val) {
 		return json.write_value(src->name, val);
 	}
+
+	bool formatSourceHistogram(const diag_source* src, const HistogramDiagnosticSummary& val) {
+		return json.write_attribute(src->name) &&
+				json.write('{') &&
+				json.write_attribute("n") && json.write((unsigned)val.count) && json.write(',') &&
+				json.write_attribute("min") && json.write((unsigned)val.min) && json.write(',') &&
+				json.write_attribute("max") && json.write((unsigned)val.max) && json.write(',') &&
+				json.write_attribute("p50") && json.write((unsigned)val.p50) && json.write(',') &&
+				json.write_attribute("p90") && json.write((unsigned)val.p90) && json.write(',') &&
+				json.write_attribute("p99") && json.write((unsigned)val.p99) &&
+				json.write('}') &&
+				json.next();
+	}
 };
 
 
@@ -912,6 +996,11 @@ public:
 		return data.write(src->id) && data.write(val);
 	}
 
+	inline bool formatSourceHistogram(const diag_source* src, const HistogramDiagnosticSummary& val) {
+		// Only single values are supported by the binary format
+		return true;
+	}
+
 };
 
 
@@ -934,6 +1023,9 @@ int system_format_diag_data(const uint16_t* id, size_t count, unsigned flags, ap
 }
 
 bool system_metrics(appender_fn appender, void* append_data, uint32_t flags, uint32_t page, void* reserved) {
-    const int ret = system_format_diag_data(nullptr, 0, flags, appender, append_data, nullptr);
+    const auto metrics = static_cast<const spark_protocol_describe_metrics*>(reserved);
+    const uint16_t* id = metrics ? metrics->ids : nullptr;
+    const size_t count = id ? metrics->count : 0;
+    const int ret = system_format_diag_data(id, count, flags, appender, append_data, nullptr);
     return ret == 0;
 };
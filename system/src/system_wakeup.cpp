@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_wakeup.h"
+
+#include "system_threading.h"
+#include "spark_wiring_diagnostics.h"
+#include "delay_hal.h"
+#include "platforms.h"
+
+#if PLATFORM_THREADING
+#include "concurrent_hal.h"
+#elif PLATFORM_ID == PLATFORM_GCC
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace particle
+{
+namespace system
+{
+
+namespace
+{
+
+// Counters are only updated by the thread running the system loop
+SimpleUnsignedIntegerDiagnosticData g_loops(DIAG_ID_SYSTEM_SYSTEM_LOOPS, DIAG_NAME_SYSTEM_SYSTEM_LOOPS);
+SimpleUnsignedIntegerDiagnosticData g_networkWakeups(DIAG_ID_SYSTEM_WAKEUPS_NETWORK, DIAG_NAME_SYSTEM_WAKEUPS_NETWORK);
+SimpleUnsignedIntegerDiagnosticData g_cloudWakeups(DIAG_ID_SYSTEM_WAKEUPS_CLOUD, DIAG_NAME_SYSTEM_WAKEUPS_CLOUD);
+SimpleUnsignedIntegerDiagnosticData g_socketWakeups(DIAG_ID_SYSTEM_WAKEUPS_SOCKET, DIAG_NAME_SYSTEM_WAKEUPS_SOCKET);
+SimpleUnsignedIntegerDiagnosticData g_isrTaskWakeups(DIAG_ID_SYSTEM_WAKEUPS_ISR_TASK, DIAG_NAME_SYSTEM_WAKEUPS_ISR_TASK);
+SimpleUnsignedIntegerDiagnosticData g_timeoutWakeups(DIAG_ID_SYSTEM_WAKEUPS_TIMEOUT, DIAG_NAME_SYSTEM_WAKEUPS_TIMEOUT);
+
+#if PLATFORM_THREADING
+
+// Created by the first waiting thread, since the RTOS may not be running yet during the static initialization
+os_semaphore_t g_signal = nullptr;
+
+#elif PLATFORM_ID == PLATFORM_GCC
+
+// Socket events are posted by the event loop thread of the socket HAL
+std::mutex g_mutex;
+std::condition_variable g_cond;
+bool g_signalled = false;
+
+#endif // PLATFORM_ID == PLATFORM_GCC
+
+SystemWakeup g_wakeup;
+
+} // namespace
+
+SystemWakeup::SystemWakeup() :
+        pending_(0),
+        waiting_(false)
+{
+}
+
+void SystemWakeup::post(unsigned reasons)
+{
+    pending_.fetch_or(reasons, std::memory_order_relaxed);
+    // Pairs with the fence in wait(): either the waiting thread sees the reasons, or this thread sees the waiting flag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_relaxed) && waiting_.exchange(false, std::memory_order_relaxed)) {
+        signal();
+    }
+#if PLATFORM_THREADING
+    // The system thread sleeps in its message queue rather than in wait()
+    SystemThread.wakeup();
+#endif
+}
+
+bool SystemWakeup::wait(system_tick_t timeout)
+{
+    if (pending() || !timeout) {
+        return pending();
+    }
+#if PLATFORM_THREADING
+    if (!g_signal && os_semaphore_create(&g_signal, 1, 0) != 0) {
+        g_signal = nullptr;
+        HAL_Delay_Milliseconds(timeout);
+        return pending();
+    }
+#endif
+    waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!pending()) {
+        // A signal left over from an earlier wait only results in an early return, which the
+        // caller handles like a timeout
+        block(timeout);
+    }
+    waiting_.store(false, std::memory_order_relaxed);
+    return pending();
+}
+
+unsigned SystemWakeup::loopIteration()
+{
+    unsigned reasons = pending_.exchange(0, std::memory_order_relaxed);
+    ++g_loops;
+    if (!reasons) {
+        reasons = WAKEUP_REASON_TIMEOUT;
+        ++g_timeoutWakeups;
+        return reasons;
+    }
+    if (reasons & WAKEUP_REASON_NETWORK) {
+        ++g_networkWakeups;
+    }
+    if (reasons & WAKEUP_REASON_CLOUD) {
+        ++g_cloudWakeups;
+    }
+    if (reasons & WAKEUP_REASON_SOCKET) {
+        ++g_socketWakeups;
+    }
+    if (reasons & WAKEUP_REASON_ISR_TASK) {
+        ++g_isrTaskWakeups;
+    }
+    return reasons;
+}
+
+#if PLATFORM_THREADING
+
+void SystemWakeup::signal()
+{
+    os_semaphore_give(g_signal, false);
+}
+
+void SystemWakeup::block(system_tick_t timeout)
+{
+    os_semaphore_take(g_signal, timeout, false);
+}
+
+#elif PLATFORM_ID == PLATFORM_GCC
+
+void SystemWakeup::signal()
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_signalled = true;
+    g_cond.notify_one();
+}
+
+void SystemWakeup::block(system_tick_t timeout)
+{
+    std::unique_lock<std::mutex> lock(g_mutex);
+    g_cond.wait_for(lock, std::chrono::milliseconds(timeout), []() { return g_signalled; });
+    g_signalled = false;
+}
+
+#else
+
+void SystemWakeup::signal()
+{
+}
+
+void SystemWakeup::block(system_tick_t timeout)
+{
+    // Without a blocking primitive, the wait is split into 1ms steps that end early once a wakeup is posted
+    for (system_tick_t t = 0; t < timeout && !pending(); ++t) {
+        HAL_Delay_Milliseconds(1);
+    }
+}
+
+#endif // !PLATFORM_THREADING && PLATFORM_ID != PLATFORM_GCC
+
+SystemWakeup* SystemWakeup::instance()
+{
+    return &g_wakeup;
+}
+
+} // namespace system
+} // namespace particle
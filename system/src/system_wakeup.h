@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM_WAKEUP_H
+#define SYSTEM_WAKEUP_H
+
+#include <atomic>
+
+#include "system_tick_hal.h"
+
+namespace particle
+{
+namespace system
+{
+
+/**
+ * Reasons for waking up the system loop.
+ */
+enum WakeupReason
+{
+    WAKEUP_REASON_NONE = 0x00,
+    WAKEUP_REASON_NETWORK = 0x01, ///< Network interface state has changed
+    WAKEUP_REASON_CLOUD = 0x02, ///< Cloud connection has been requested or cancelled
+    WAKEUP_REASON_SOCKET = 0x04, ///< A socket has become readable or writable, or has been closed
+    WAKEUP_REASON_ISR_TASK = 0x08, ///< A task has been added to the system ISR task queue
+    WAKEUP_REASON_TIMEOUT = 0x10 ///< The loop ran without a posted wakeup. Never posted
+};
+
+/**
+ * @class SystemWakeup system_wakeup.h
+ * @brief Wakeup signal for the system loop
+ *
+ * Event sources post wakeups instead of waiting for the system loop to poll them. The loop
+ * blocks in wait() between its passes, or in the system thread's queue when threading is
+ * enabled, until a wakeup is posted or its next deadline has passed.
+ *
+ * Each pass of the loop is counted together with the reasons that woke it up, and the
+ * counters are exposed as diagnostic data sources.
+ */
+class SystemWakeup
+{
+public:
+    SystemWakeup();
+
+    /**
+     * Posts a wakeup. May be called from any thread or from an ISR.
+     *
+     * @param reasons Bitwise combination of \p WakeupReason flags.
+     */
+    void post(unsigned reasons);
+
+    /**
+     * Blocks until a wakeup is posted or the timeout expires. Posted reasons are not consumed.
+     *
+     * @return `true` if a wakeup is pending.
+     */
+    bool wait(system_tick_t timeout);
+
+    /**
+     * Consumes the posted reasons and counts a pass of the system loop.
+     *
+     * @return Reasons that were posted since the previous pass, or \p WAKEUP_REASON_TIMEOUT.
+     */
+    unsigned loopIteration();
+
+    bool pending() const
+    {
+        return pending_.load(std::memory_order_relaxed) != 0;
+    }
+
+    static SystemWakeup* instance();
+
+private:
+    std::atomic<unsigned> pending_;
+    std::atomic<bool> waiting_;
+
+    void signal();
+    void block(system_tick_t timeout);
+};
+
+/**
+ * Posts a wakeup to the system loop. May be called from an ISR.
+ */
+inline void system_wakeup(unsigned reasons)
+{
+    SystemWakeup::instance()->post(reasons);
+}
+
+} // namespace system
+} // namespace particle
+
+#endif // SYSTEM_WAKEUP_H
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include "indexed_append_list.h"
+#include "system_cloud_registry.h"
+#include "spark_protocol_functions.h"
+
+// Describe message size reported to the registry, and the maximum size allowed
+uint16_t describe_current_size;
+uint16_t describe_maximum_size = 0xffff;
+
+extern "C"
+{
+    int spark_protocol_get_describe_data(ProtocolFacade*, spark_protocol_describe_data* data, void*)
+    {
+        data->current_size = describe_current_size;
+        data->maximum_size = describe_maximum_size;
+        return 0;
+    }
+
+    uint32_t HAL_Core_Compute_CRC32(const uint8_t* data, uint32_t size)
+    {
+        uint32_t crc = 0xffffffff;
+        while (size--)
+        {
+            crc ^= *data++;
+            for (int i = 0; i < 8; i++)
+            {
+                crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+            }
+        }
+        return ~crc;
+    }
+}
+
+namespace
+{
+
+const size_t KEY_LENGTH = 64;
+
+struct Item
+{
+    int value;
+    char key[KEY_LENGTH + 1];
+};
+
+const char* itemKey(const Item& item)
+{
+    return item.key;
+}
+
+typedef indexed_append_list<Item, KEY_LENGTH, itemKey> ItemList;
+
+Item makeItem(const std::string& key, int value)
+{
+    Item item = {};
+    item.value = value;
+    strncpy(item.key, key.c_str(), KEY_LENGTH);
+    return item;
+}
+
+std::string keyFor(unsigned i)
+{
+    // Registered names typically share long prefixes
+    return "sensor_reading_" + std::to_string(i);
+}
+
+// The lookup that was used before the index was added
+Item* linearFind(ItemList& list, const char* key)
+{
+    for (int i = list.size(); i-->0; )
+    {
+        if (0 == strncmp(list[i].key, key, KEY_LENGTH))
+        {
+            return &list[i];
+        }
+    }
+    return nullptr;
+}
+
+template <typename F>
+double lookupTimeNs(ItemList& list, unsigned count, F find)
+{
+    const unsigned rounds = 20000 / count + 10;
+    std::vector<std::string> keys;
+    for (unsigned i = 0; i < count; i++)
+    {
+        keys.push_back(keyFor(i));
+    }
+    unsigned found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; r++)
+    {
+        for (const std::string& key: keys)
+        {
+            found += (find(list, key.c_str()) != nullptr);
+        }
+    }
+    const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(found == count * rounds);
+    return double(elapsed.count()) / (double(count) * rounds);
+}
+
+// Checksum of the registered variables computed from scratch
+uint32_t recomputeVariablesChecksum()
+{
+    uint32_t checksum = 0;
+    for (int i = 0; i < numUserVariables(); i++)
+    {
+        const User_Var_Lookup_Table_t* item = find_var_by_key(getUserVariableKey(i));
+        checksum += string_crc(item->userVarKey) + crc(item->userVarType);
+    }
+    return checksum;
+}
+
+// Checksum of the registered functions computed from scratch
+uint32_t recomputeFunctionsChecksum()
+{
+    uint32_t checksum = 0;
+    for (int i = 0; i < numUserFunctions(); i++)
+    {
+        checksum += string_crc(getUserFunctionKey(i));
+    }
+    return checksum;
+}
+
+int testFunction(void*, const char*, void*)
+{
+    return 0;
+}
+
+User_Func_Lookup_Table_t* addFunction(const char* name)
+{
+    cloud_function_descriptor desc;
+    desc.funcKey = name;
+    desc.fn = testFunction;
+    return find_func_by_key_or_add(name, &desc);
+}
+
+} // namespace
+
+SCENARIO("Items are found by name", "[indexed_append_list]")
+{
+    GIVEN("a list with 200 items")
+    {
+        ItemList list;
+        for (unsigned i = 0; i < 200; i++)
+        {
+            REQUIRE(list.add(makeItem(keyFor(i), i)) != nullptr);
+        }
+        REQUIRE(list.size() == 200);
+
+        THEN("every item can be found")
+        {
+            for (unsigned i = 0; i < 200; i++)
+            {
+                Item* item = list.find(keyFor(i).c_str());
+                REQUIRE(item != nullptr);
+                REQUIRE(item->value == int(i));
+            }
+        }
+
+        THEN("names that were not added are not found")
+        {
+            REQUIRE(list.find("sensor_reading_200") == nullptr);
+            REQUIRE(list.find("sensor_reading_") == nullptr);
+            REQUIRE(list.find("") == nullptr);
+        }
+
+        WHEN("the last item is removed")
+        {
+            list.removeAt(list.size() - 1);
+            THEN("it is no longer found")
+            {
+                REQUIRE(list.find(keyFor(199).c_str()) == nullptr);
+                REQUIRE(list.find(keyFor(198).c_str())->value == 198);
+            }
+        }
+    }
+
+    GIVEN("names longer than the key length")
+    {
+        ItemList list;
+        const std::string longKey(KEY_LENGTH + 10, 'x');
+        REQUIRE(list.add(makeItem(longKey, 1)) != nullptr);
+        THEN("only the significant characters are compared")
+        {
+            REQUIRE(list.find(longKey.c_str())->value == 1);
+            REQUIRE(list.find(longKey.substr(0, KEY_LENGTH).c_str())->value == 1);
+        }
+    }
+}
+
+// The registry is global, so each scenario registers its own names
+SCENARIO("The describe checksums match a full recomputation", "[cloud_registry]")
+{
+    int value = 0;
+    REQUIRE(find_var_by_key_or_add("checksum_var_1", &value, CLOUD_VAR_INT, nullptr) != nullptr);
+    REQUIRE(find_var_by_key_or_add("checksum_var_2", &value, CLOUD_VAR_INT, nullptr) != nullptr);
+    REQUIRE(addFunction("checksum_fn_1") != nullptr);
+    REQUIRE(addFunction("checksum_fn_2") != nullptr);
+    REQUIRE(compute_variables_checksum() == recomputeVariablesChecksum());
+    REQUIRE(compute_functions_checksum() == recomputeFunctionsChecksum());
+
+    WHEN("a variable is registered again with a different type")
+    {
+        const uint32_t before = compute_variables_checksum();
+        const int count = numUserVariables();
+        REQUIRE(find_var_by_key_or_add("checksum_var_1", &value, CLOUD_VAR_DOUBLE, nullptr) != nullptr);
+        THEN("the variables checksum is updated")
+        {
+            REQUIRE(numUserVariables() == count);
+            REQUIRE(find_var_by_key("checksum_var_1")->userVarType == CLOUD_VAR_DOUBLE);
+            REQUIRE(compute_variables_checksum() != before);
+            REQUIRE(compute_variables_checksum() == recomputeVariablesChecksum());
+        }
+    }
+
+    WHEN("a function is registered again")
+    {
+        const uint32_t before = compute_functions_checksum();
+        const int count = numUserFunctions();
+        REQUIRE(addFunction("checksum_fn_1") != nullptr);
+        THEN("the functions checksum is unchanged")
+        {
+            REQUIRE(numUserFunctions() == count);
+            REQUIRE(compute_functions_checksum() == before);
+            REQUIRE(compute_functions_checksum() == recomputeFunctionsChecksum());
+        }
+    }
+
+    WHEN("registrations are rejected because the describe message is too large")
+    {
+        const uint32_t varsBefore = compute_variables_checksum();
+        const uint32_t funcsBefore = compute_functions_checksum();
+        const int varCount = numUserVariables();
+        const int funcCount = numUserFunctions();
+        describe_current_size = 2;
+        describe_maximum_size = 1;
+        User_Var_Lookup_Table_t* var = find_var_by_key_or_add("checksum_rejected_var", &value, CLOUD_VAR_INT, nullptr);
+        User_Func_Lookup_Table_t* func = addFunction("checksum_rejected_fn");
+        describe_current_size = 0;
+        describe_maximum_size = 0xffff;
+        THEN("the rejected items do not contribute to the checksums")
+        {
+            REQUIRE(var == nullptr);
+            REQUIRE(func == nullptr);
+            REQUIRE(numUserVariables() == varCount);
+            REQUIRE(numUserFunctions() == funcCount);
+            REQUIRE(find_var_by_key("checksum_rejected_var") == nullptr);
+            REQUIRE(find_func_by_key("checksum_rejected_fn") == nullptr);
+            REQUIRE(compute_variables_checksum() == varsBefore);
+            REQUIRE(compute_functions_checksum() == funcsBefore);
+            REQUIRE(compute_variables_checksum() == recomputeVariablesChecksum());
+            REQUIRE(compute_functions_checksum() == recomputeFunctionsChecksum());
+        }
+    }
+}
+
+SCENARIO("Lookup time with a growing number of registered items", "[indexed_append_list][.benchmark]")
+{
+    double indexed[3], linear[3];
+    const unsigned counts[3] = { 10, 50, 200 };
+    for (int i = 0; i < 3; i++)
+    {
+        ItemList list;
+        for (unsigned j = 0; j < counts[i]; j++)
+        {
+            list.add(makeItem(keyFor(j), j));
+        }
+        indexed[i] = lookupTimeNs(list, counts[i], [](ItemList& l, const char* key) { return l.find(key); });
+        linear[i] = lookupTimeNs(list, counts[i], linearFind);
+    }
+    WARN("indexed: " << indexed[0] << "ns @10, " << indexed[1] << "ns @50, " << indexed[2] << "ns @200; "
+            << "linear: " << linear[0] << "ns @10, " << linear[1] << "ns @50, " << linear[2] << "ns @200");
+}
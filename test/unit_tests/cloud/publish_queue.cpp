@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+
+#include "protocol_selector.h"
+#include "spark_protocol_functions.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include "mock/mock_types.h"
+#include "system_publish_queue.h"
+
+using particle::CompletionHandler;
+using PublishQueue = particle::system::PublishQueue<particle::mock_type::FileQueue>;
+
+// Defined in publish_vitals.cpp
+extern int spark_cloud_flag_connected_result;
+
+namespace
+{
+
+// Simulated protocol layer that accepts a limited number of events per second, like `Publisher`
+struct CloudStub
+{
+    system_tick_t now = 0;
+    unsigned rateLimit = 4;
+    std::vector<std::string> sent;
+    std::vector<int> ttls;
+    system_tick_t windowStart = 0;
+    unsigned windowCount = 0;
+
+    void reset()
+    {
+        *this = CloudStub();
+    }
+} cloud;
+
+time_t rtcTime = 0;
+
+struct Result
+{
+    int calls = 0;
+    int error = 0;
+};
+
+void resultCallback(int error, const void*, void* data, void*)
+{
+    auto r = static_cast<Result*>(data);
+    r->calls++;
+    r->error = error;
+}
+
+CompletionHandler handlerFor(Result& r)
+{
+    return CompletionHandler(resultCallback, &r);
+}
+
+void setConnected(bool connected)
+{
+    spark_cloud_flag_connected_result = connected;
+}
+
+} // namespace
+
+extern "C"
+{
+    bool spark_protocol_send_event(ProtocolFacade*, const char* name, const char* data, int ttl, uint32_t flags, void* reserved)
+    {
+        CompletionHandler handler;
+        if (reserved)
+        {
+            auto d = static_cast<const spark_protocol_send_event_data*>(reserved);
+            handler = CompletionHandler(d->handler_callback, d->handler_data);
+        }
+        if (cloud.now - cloud.windowStart >= 1000)
+        {
+            cloud.windowStart = cloud.now;
+            cloud.windowCount = 0;
+        }
+        if (cloud.windowCount >= cloud.rateLimit)
+        {
+            return false; // the handler is completed with an internal error when it goes out of scope
+        }
+        cloud.windowCount++;
+        cloud.sent.push_back(name);
+        cloud.ttls.push_back(ttl);
+        handler.setResult();
+        return true;
+    }
+
+    time_t HAL_RTC_Get_UnixTime(void)
+    {
+        return rtcTime;
+    }
+
+    uint8_t HAL_RTC_Time_Is_Valid(void*)
+    {
+        return rtcTime != 0;
+    }
+}
+
+SCENARIO("Events are sent immediately while connected and not throttled", "[PublishQueue]")
+{
+    cloud.reset();
+    rtcTime = 1000000;
+    setConnected(true);
+    particle::mock_type::FileQueue file;
+    PublishQueue queue(&file);
+
+    Result r;
+    REQUIRE(queue.publish("a", "data", 60, 'e', handlerFor(r)) == SYSTEM_ERROR_NONE);
+    REQUIRE(cloud.sent == std::vector<std::string>{ "a" });
+    REQUIRE(r.calls == 1);
+    REQUIRE(r.error == SYSTEM_ERROR_NONE);
+    REQUIRE(queue.isEmpty());
+    REQUIRE(file.writes == 0);
+}
+
+SCENARIO("Events published while offline are stored and sent in order when connected", "[PublishQueue]")
+{
+    cloud.reset();
+    rtcTime = 1000000;
+    setConnected(false);
+    particle::mock_type::FileQueue file;
+    PublishQueue queue(&file);
+
+    GIVEN("events published while disconnected")
+    {
+        Result first, last;
+        REQUIRE(queue.publish("e0", "x", 600, 'e', handlerFor(first)) == SYSTEM_ERROR_NONE);
+        for (int i = 1; i < 30; i++)
+        {
+            const std::string name = "e" + std::to_string(i);
+            REQUIRE(queue.publish(name.c_str(), "some event data", 600, 'e', (i == 29) ? handlerFor(last) : CompletionHandler()) == SYSTEM_ERROR_NONE);
+        }
+        REQUIRE(cloud.sent.empty());
+        REQUIRE(first.calls == 0);
+
+        WHEN("the flush interval passes")
+        {
+            queue.process(cloud.now);
+            cloud.now += PUBLISH_QUEUE_FLUSH_INTERVAL;
+            queue.process(cloud.now);
+
+            THEN("the events are written to flash in batches")
+            {
+                REQUIRE(queue.stagedEvents() == 0);
+                REQUIRE(queue.storedRecords() > 0);
+                REQUIRE(file.writes == queue.storedRecords());
+                REQUIRE(file.writes < 30 / 8);
+            }
+
+            AND_WHEN("the device connects")
+            {
+                setConnected(true);
+                while (!queue.isEmpty() && cloud.now < 60000)
+                {
+                    cloud.now += 100;
+                    queue.process(cloud.now);
+                }
+                THEN("all events are sent in order and their handlers are completed")
+                {
+                    REQUIRE(cloud.sent.size() == 30);
+                    for (int i = 0; i < 30; i++)
+                    {
+                        REQUIRE(cloud.sent[i] == "e" + std::to_string(i));
+                    }
+                    REQUIRE(first.calls == 1);
+                    REQUIRE(first.error == SYSTEM_ERROR_NONE);
+                    REQUIRE(last.calls == 1);
+                    REQUIRE(last.error == SYSTEM_ERROR_NONE);
+                    REQUIRE(file.count() == 0);
+                }
+            }
+        }
+
+        WHEN("the device connects before the staged events are flushed")
+        {
+            setConnected(true);
+            Result next;
+            REQUIRE(queue.publish("next", nullptr, 600, 'e', handlerFor(next)) == SYSTEM_ERROR_NONE);
+            THEN("new events do not overtake queued events")
+            {
+                REQUIRE(cloud.sent.empty());
+                REQUIRE(next.calls == 0);
+            }
+            AND_WHEN("the queue is drained")
+            {
+                while (!queue.isEmpty() && cloud.now < 60000)
+                {
+                    cloud.now += 100;
+                    queue.process(cloud.now);
+                }
+                THEN("no flash writes were made")
+                {
+                    REQUIRE(cloud.sent.size() == 31);
+                    REQUIRE(cloud.sent.back() == "next");
+                    REQUIRE(next.calls == 1);
+                    REQUIRE(file.writes == 0);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Throttled events are queued instead of being rejected", "[PublishQueue]")
+{
+    cloud.reset();
+    rtcTime = 1000000;
+    setConnected(true);
+    particle::mock_type::FileQueue file;
+    PublishQueue queue(&file);
+
+    Result results[6];
+    for (int i = 0; i < 6; i++)
+    {
+        REQUIRE(queue.publish("t", nullptr, 60, 'e', handlerFor(results[i])) == SYSTEM_ERROR_NONE);
+    }
+    REQUIRE(cloud.sent.size() == 4);
+    // The synchronous failure reported by the protocol layer is not forwarded to the caller
+    REQUIRE(results[4].calls == 0);
+    REQUIRE(queue.stagedEvents() == 2);
+
+    cloud.now += 1000;
+    REQUIRE(queue.process(cloud.now) == 2);
+    for (const Result& r: results)
+    {
+        REQUIRE(r.calls == 1);
+        REQUIRE(r.error == SYSTEM_ERROR_NONE);
+    }
+}
+
+SCENARIO("Queued events expire after their TTL", "[PublishQueue]")
+{
+    cloud.reset();
+    rtcTime = 1000000;
+    setConnected(false);
+    particle::mock_type::FileQueue file;
+    PublishQueue queue(&file);
+
+    Result expired, alive;
+    REQUIRE(queue.publish("short", nullptr, 10, 'e', handlerFor(expired)) == SYSTEM_ERROR_NONE);
+    REQUIRE(queue.publish("long", nullptr, 100, 'e', handlerFor(alive)) == SYSTEM_ERROR_NONE);
+    rtcTime += 30;
+    setConnected(true);
+    REQUIRE(queue.process(cloud.now) == 1);
+    REQUIRE(cloud.sent == std::vector<std::string>{ "long" });
+    REQUIRE(cloud.ttls == std::vector<int>{ 70 });
+    REQUIRE(expired.calls == 1);
+    REQUIRE(expired.error == SYSTEM_ERROR_TIMEOUT);
+    REQUIRE(alive.calls == 1);
+    REQUIRE(alive.error == SYSTEM_ERROR_NONE);
+}
+
+SCENARIO("The number of pending completion handlers is bounded", "[PublishQueue]")
+{
+    cloud.reset();
+    setConnected(false);
+    particle::mock_type::FileQueue file;
+    PublishQueue queue(&file);
+
+    Result results[PUBLISH_QUEUE_MAX_HANDLERS + 1];
+    for (int i = 0; i < PUBLISH_QUEUE_MAX_HANDLERS; i++)
+    {
+        REQUIRE(queue.publish("h", nullptr, 60, 'e', handlerFor(results[i])) == SYSTEM_ERROR_NONE);
+    }
+    REQUIRE(queue.publish("h", nullptr, 60, 'e', handlerFor(results[PUBLISH_QUEUE_MAX_HANDLERS])) == SYSTEM_ERROR_LIMIT_EXCEEDED);
+    REQUIRE(results[PUBLISH_QUEUE_MAX_HANDLERS].calls == 1);
+    REQUIRE(results[PUBLISH_QUEUE_MAX_HANDLERS].error == SYSTEM_ERROR_LIMIT_EXCEEDED);
+    // Events without a handler can still be queued
+    REQUIRE(queue.publish("h", nullptr, 60, 'e', CompletionHandler()) == SYSTEM_ERROR_NONE);
+
+    queue.clear();
+    for (int i = 0; i < PUBLISH_QUEUE_MAX_HANDLERS; i++)
+    {
+        REQUIRE(results[i].calls == 1);
+        REQUIRE(results[i].error == SYSTEM_ERROR_ABORTED);
+    }
+    REQUIRE(queue.isEmpty());
+}
+
+SCENARIO("Events stored in a previous session are sent after a reset", "[PublishQueue]")
+{
+    cloud.reset();
+    setConnected(false);
+    particle::mock_type::FileQueue file;
+    Result r;
+    {
+        PublishQueue queue(&file);
+        REQUIRE(queue.publish("old", nullptr, 60, 'e', handlerFor(r)) == SYSTEM_ERROR_NONE);
+        REQUIRE(queue.flush() == SYSTEM_ERROR_NONE);
+    }
+    REQUIRE(r.calls == 1);
+    REQUIRE(r.error == SYSTEM_ERROR_ABORTED);
+
+    PublishQueue queue(&file);
+    Result other;
+    setConnected(true);
+    REQUIRE(queue.publish("new", nullptr, 60, 'e', handlerFor(other)) == SYSTEM_ERROR_NONE);
+    REQUIRE(queue.process(cloud.now) == 2);
+    REQUIRE(cloud.sent == std::vector<std::string>{ "old", "new" });
+    REQUIRE(other.calls == 1);
+    REQUIRE(file.count() == 0);
+}
+
+SCENARIO("Handlers of events in a corrupted record are completed", "[PublishQueue]")
+{
+    cloud.reset();
+    rtcTime = 1000000;
+    setConnected(false);
+    particle::mock_type::FileQueue file;
+    PublishQueue queue(&file);
+
+    Result lost[3], kept[2];
+    for (Result& r: lost)
+    {
+        REQUIRE(queue.publish("lost", "data", 60, 'e', handlerFor(r)) == SYSTEM_ERROR_NONE);
+    }
+    REQUIRE(queue.flush() == SYSTEM_ERROR_NONE);
+    for (Result& r: kept)
+    {
+        REQUIRE(queue.publish("kept", "data", 60, 'e', handlerFor(r)) == SYSTEM_ERROR_NONE);
+    }
+    REQUIRE(queue.flush() == SYSTEM_ERROR_NONE);
+    REQUIRE(file.count() == 2);
+
+    // Truncate the last event of the first record
+    file.entries().front().resize(file.entries().front().size() - 3);
+    setConnected(true);
+    REQUIRE(queue.process(cloud.now) == SYSTEM_ERROR_BAD_DATA);
+    for (const Result& r: lost)
+    {
+        REQUIRE(r.calls == 1);
+        REQUIRE(r.error == SYSTEM_ERROR_BAD_DATA);
+    }
+    REQUIRE(queue.storedRecords() == 1);
+
+    REQUIRE(queue.process(cloud.now) == 2);
+    REQUIRE(cloud.sent == std::vector<std::string>{ "kept", "kept" });
+    for (const Result& r: kept)
+    {
+        REQUIRE(r.calls == 1);
+        REQUIRE(r.error == SYSTEM_ERROR_NONE);
+    }
+    REQUIRE(queue.isEmpty());
+    REQUIRE(file.count() == 0);
+
+    // No handler slots were leaked
+    setConnected(false);
+    Result results[PUBLISH_QUEUE_MAX_HANDLERS];
+    for (Result& r: results)
+    {
+        REQUIRE(queue.publish("h", nullptr, 60, 'e', handlerFor(r)) == SYSTEM_ERROR_NONE);
+    }
+}
+
+SCENARIO("Sustained publish throughput and flash writes per event", "[PublishQueue][.benchmark]")
+{
+    cloud.reset();
+    rtcTime = 1000000;
+    particle::mock_type::FileQueue file;
+    PublishQueue queue(&file);
+
+    // 2 events per second with a 64 byte payload, offline for the first minute
+    const std::string data(64, 'd');
+    const unsigned total = 300;
+    unsigned published = 0;
+    setConnected(false);
+    while ((published < total || !queue.isEmpty()) && cloud.now < 600000)
+    {
+        if (cloud.now == 60000)
+        {
+            setConnected(true);
+        }
+        if (published < total && cloud.now % 500 == 0)
+        {
+            REQUIRE(queue.publish("bench", data.c_str(), 3600, 'e', CompletionHandler()) == SYSTEM_ERROR_NONE);
+            published++;
+        }
+        queue.process(cloud.now);
+        cloud.now += 10;
+    }
+    REQUIRE(cloud.sent.size() == total);
+    const double writesPerEvent = double(file.writes) / total;
+    const double throughput = double(total) * 1000 / cloud.now;
+    WARN("sent " << total << " events in " << cloud.now << "ms (" << throughput << " events/s), "
+            << file.writes << " flash writes (" << writesPerEvent << " per event)");
+    REQUIRE(writesPerEvent < 0.25);
+}
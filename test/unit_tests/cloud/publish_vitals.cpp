@@ -15,7 +15,12 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <map>
+#include <vector>
 
 #include "active_object.h"
 #include "protocol_selector.h"
@@ -33,6 +38,22 @@ int spark_cloud_flag_connected_result;
 bool spark_protocol_post_description_called;
 int spark_protocol_post_description_result;
 
+// Simulated clock
+system_tick_t hal_timer_millis;
+
+// Simulated diagnostic sources
+struct TestSource
+{
+    diag_source src;
+    uint32_t value;
+};
+std::vector<TestSource*> test_sources;
+
+// Values known to the cloud, and the number of payload bytes sent
+std::map<uint16_t, uint32_t> cloud_values;
+size_t metrics_bytes_sent;
+size_t metrics_messages_sent;
+
 ISRTaskQueue SystemISRTaskQueue;
 
 void ISRTaskQueue::enqueue(ISRTaskQueue::Task*)
@@ -51,9 +72,28 @@ extern "C"
         return nullptr;
     }
 
-    int spark_protocol_post_description(ProtocolFacade*, int, void*)
+    int spark_protocol_post_description(ProtocolFacade*, int, void* reserved)
     {
         spark_protocol_post_description_called = true;
+        if (spark_protocol_post_description_result == 0)
+        {
+            // Binary metrics payload: packet type, ID and value sizes, and an ID/value pair per source
+            const auto metrics = static_cast<const spark_protocol_describe_metrics*>(reserved);
+            size_t count = 0;
+            for (const TestSource* ts : test_sources)
+            {
+                if (metrics && metrics->ids &&
+                    std::find(metrics->ids, metrics->ids + metrics->count, ts->src.id) ==
+                        metrics->ids + metrics->count)
+                {
+                    continue;
+                }
+                cloud_values[ts->src.id] = ts->value;
+                ++count;
+            }
+            metrics_bytes_sent += 3 + 4 + count * (sizeof(uint16_t) + sizeof(int32_t));
+            ++metrics_messages_sent;
+        }
         return spark_protocol_post_description_result;
     }
 
@@ -61,8 +101,101 @@ extern "C"
     {
         return error;
     }
+
+    int diag_enum_sources(diag_enum_sources_callback callback, size_t* count, void* data, void*)
+    {
+        for (const TestSource* ts : test_sources)
+        {
+            const int ret = callback(&ts->src, data);
+            if (ret != 0)
+            {
+                return ret;
+            }
+        }
+        if (count)
+        {
+            *count = test_sources.size();
+        }
+        return 0;
+    }
+
+    system_tick_t HAL_Timer_Get_Milli_Seconds(void)
+    {
+        return hal_timer_millis;
+    }
+}
+
+namespace
+{
+
+int getTestSourceValue(const diag_source* src, int cmd, void* data)
+{
+    if (cmd != DIAG_SOURCE_CMD_GET)
+    {
+        return SYSTEM_ERROR_NOT_SUPPORTED;
+    }
+    const auto cmd_data = static_cast<diag_source_get_cmd_data*>(data);
+    const auto ts = static_cast<const TestSource*>(src->data);
+    memcpy(cmd_data->data, &ts->value, sizeof(ts->value));
+    cmd_data->data_size = sizeof(ts->value);
+    return 0;
+}
+
+// Registers a diagnostic source for the lifetime of the object
+class ScopedTestSource
+{
+public:
+    ScopedTestSource(uint16_t id, diag_type type, uint32_t value)
+    {
+        _source.src = {sizeof(diag_source), 0, id, (uint16_t)type, "test", &_source, getTestSourceValue};
+        _source.value = value;
+        test_sources.push_back(&_source);
+    }
+
+    ~ScopedTestSource(void)
+    {
+        test_sources.erase(std::find(test_sources.begin(), test_sources.end(), &_source));
+    }
+
+    uint32_t& value(void)
+    {
+        return _source.value;
+    }
+
+private:
+    TestSource _source;
+};
+
+// Timer that accepts any period
+class TestTimer : public particle::mock_type::Timer
+{
+public:
+    TestTimer(void) : Timer(0, nullptr, false)
+    {
+    }
+
+    bool changePeriod(const size_t period_ms) override
+    {
+        this->period_ms = period_ms;
+        return true;
+    }
+
+    size_t period_ms = 0;
+};
+
+void resetCloud(void)
+{
+    spark_cloud_flag_connected_result = true;
+    spark_protocol_post_description_called = false;
+    spark_protocol_post_description_result = 0;
+    hal_timer_millis = 0;
+    cloud_values.clear();
+    metrics_bytes_sent = 0;
+    metrics_messages_sent = 0;
 }
 
+} // namespace
+
 // ASSUMPTION!!! - Period "getter" method works correctly - without being testing.
 
 TEST_CASE("Construction", "[VitalsPublisher::VitalsPublisher]")
@@ -378,3 +511,226 @@ TEST_CASE("Publishing vitals", "[VitalsPublisher::publish]")
         }
     }
 }
+
+TEST_CASE("Publishing vitals changes", "[VitalsPublisher::publishChanges]")
+{
+    using particle::system::VitalsPublisher;
+
+    resetCloud();
+    ScopedTestSource uptime(DIAG_ID_SYSTEM_UPTIME, DIAG_TYPE_UINT, 0);
+    ScopedTestSource rssi(DIAG_ID_NETWORK_RSSI, DIAG_TYPE_INT, (uint32_t)-60);
+    ScopedTestSource disconnects(DIAG_ID_CLOUD_DISCONNECTS, DIAG_TYPE_UINT, 0);
+    TestTimer timer;
+
+    SECTION("Delta publishing disabled")
+    {
+        GIVEN("A VitalsPublisher with a period")
+        {
+            VitalsPublisher<particle::mock_type::Timer> vp(&timer);
+            vp.period(60);
+
+            WHEN("Invoked without any changes")
+            {
+                hal_timer_millis = 1000;
+                CHECK(0 == vp.publishChanges());
+                CHECK(0 == vp.publishChanges());
+
+                THEN("Every message includes all sources")
+                {
+                    CHECK(2 == metrics_messages_sent);
+                    CHECK(2 * (7 + 3 * 6) == metrics_bytes_sent);
+                }
+            }
+        }
+    }
+
+    SECTION("Delta publishing enabled")
+    {
+        GIVEN("A VitalsPublisher that published the initial snapshot")
+        {
+            VitalsPublisher<particle::mock_type::Timer> vp(&timer);
+            vp.period(60);
+            vp.enableDeltaPublish();
+            REQUIRE(0 == vp.threshold(DIAG_ID_NETWORK_RSSI, 5));
+            REQUIRE(0 == vp.publish());
+            REQUIRE(1 == metrics_messages_sent);
+            metrics_bytes_sent = 0;
+
+            WHEN("The period has not elapsed")
+            {
+                hal_timer_millis = 30000;
+                uptime.value() = 30;
+                CHECK(0 == vp.publishChanges());
+
+                THEN("No message is sent")
+                {
+                    CHECK(1 == metrics_messages_sent);
+                }
+            }
+
+            WHEN("The period has elapsed")
+            {
+                hal_timer_millis = 60000;
+                uptime.value() = 60;
+                rssi.value() = (uint32_t)-63;
+                CHECK(0 == vp.publishChanges());
+
+                THEN("Only the sources changed beyond their thresholds are sent")
+                {
+                    CHECK(2 == metrics_messages_sent);
+                    CHECK(7 + 6 == metrics_bytes_sent);
+                    CHECK(60 == cloud_values[DIAG_ID_SYSTEM_UPTIME]);
+                    CHECK((uint32_t)-60 == cloud_values[DIAG_ID_NETWORK_RSSI]);
+                }
+
+                THEN("Nothing is sent when no source changed")
+                {
+                    hal_timer_millis = 180000;
+                    CHECK(0 == vp.publishChanges());
+                    CHECK(2 == metrics_messages_sent);
+                }
+            }
+
+            WHEN("A trigger source changes beyond its threshold")
+            {
+                REQUIRE(0 == vp.threshold(DIAG_ID_CLOUD_DISCONNECTS, 0, true));
+                hal_timer_millis = 10000;
+                uptime.value() = 10;
+                disconnects.value() = 1;
+                CHECK(0 == vp.publishChanges());
+
+                THEN("A message is sent ahead of the period")
+                {
+                    CHECK(2 == metrics_messages_sent);
+                    CHECK(1 == cloud_values[DIAG_ID_CLOUD_DISCONNECTS]);
+                    CHECK(10 == cloud_values[DIAG_ID_SYSTEM_UPTIME]);
+                }
+            }
+
+            WHEN("The message cannot be sent")
+            {
+                hal_timer_millis = 60000;
+                uptime.value() = 60;
+                spark_protocol_post_description_result = SYSTEM_ERROR_IO;
+                CHECK(SYSTEM_ERROR_IO == vp.publishChanges());
+                spark_protocol_post_description_result = 0;
+                hal_timer_millis = 61000;
+                CHECK(0 == vp.publishChanges());
+
+                THEN("The changes are sent with the next message")
+                {
+                    CHECK(60 == cloud_values[DIAG_ID_SYSTEM_UPTIME]);
+                }
+            }
+        }
+
+        GIVEN("A sample period")
+        {
+            VitalsPublisher<particle::mock_type::Timer> vp(&timer);
+            vp.period(300);
+            vp.samplePeriod(10);
+
+            WHEN("Delta publishing is enabled")
+            {
+                vp.enableDeltaPublish();
+
+                THEN("The timer expires at the sample period")
+                {
+                    CHECK(10000 == timer.period_ms);
+                }
+            }
+
+            WHEN("Delta publishing is disabled")
+            {
+                vp.disableDeltaPublish();
+
+                THEN("The timer expires at the publishing period")
+                {
+                    CHECK(300000 == timer.period_ms);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Vitals payload size over a simulated day", "[VitalsPublisher::publishChanges]")
+{
+    using particle::system::VitalsPublisher;
+
+    const system_tick_t PERIOD_S = 300;
+    const system_tick_t SAMPLE_S = 10;
+    const system_tick_t DAY_S = 24 * 60 * 60;
+
+    // Runs a day of typical device activity and returns the number of bytes sent
+    const auto simulateDay = [&](bool delta) -> size_t {
+        resetCloud();
+        ScopedTestSource uptime(DIAG_ID_SYSTEM_UPTIME, DIAG_TYPE_UINT, 0);
+        ScopedTestSource free_mem(DIAG_ID_SYSTEM_FREE_MEMORY, DIAG_TYPE_UINT, 60000);
+        ScopedTestSource battery(DIAG_ID_SYSTEM_BATTERY_CHARGE, DIAG_TYPE_INT, 100);
+        ScopedTestSource rssi(DIAG_ID_NETWORK_RSSI, DIAG_TYPE_INT, (uint32_t)-60);
+        ScopedTestSource transmitted(DIAG_ID_CLOUD_TRANSMITTED_MESSAGES, DIAG_TYPE_UINT, 0);
+        ScopedTestSource net_status(DIAG_ID_NETWORK_CONNECTION_STATUS, DIAG_TYPE_UINT, 1);
+        ScopedTestSource cloud_status(DIAG_ID_CLOUD_CONNECTION_STATUS, DIAG_TYPE_UINT, 1);
+        ScopedTestSource disconnects(DIAG_ID_CLOUD_DISCONNECTS, DIAG_TYPE_UINT, 0);
+        ScopedTestSource reset_reason(DIAG_ID_SYSTEM_LAST_RESET_REASON, DIAG_TYPE_INT, 40);
+        ScopedTestSource total_ram(DIAG_ID_SYSTEM_TOTAL_RAM, DIAG_TYPE_UINT, 131072);
+        ScopedTestSource country(DIAG_ID_NETWORK_COUNTRY_CODE, DIAG_TYPE_UINT, 310);
+
+        TestTimer timer;
+        VitalsPublisher<particle::mock_type::Timer> vp(&timer);
+        vp.period(PERIOD_S);
+        if (delta)
+        {
+            vp.samplePeriod(SAMPLE_S);
+            vp.enableDeltaPublish();
+            vp.threshold(DIAG_ID_SYSTEM_UPTIME, 3600);
+            vp.threshold(DIAG_ID_SYSTEM_FREE_MEMORY, 4096);
+            vp.threshold(DIAG_ID_NETWORK_RSSI, 5);
+            vp.threshold(DIAG_ID_CLOUD_TRANSMITTED_MESSAGES, 100);
+            vp.threshold(DIAG_ID_CLOUD_CONNECTION_STATUS, 0, true);
+            vp.threshold(DIAG_ID_CLOUD_DISCONNECTS, 0, true);
+        }
+        REQUIRE(0 == vp.publish());
+
+        std::srand(1);
+        const system_tick_t tick_s = delta ? SAMPLE_S : PERIOD_S;
+        for (system_tick_t t = SAMPLE_S; t <= DAY_S; t += SAMPLE_S)
+        {
+            hal_timer_millis = t * 1000;
+            uptime.value() = t;
+            free_mem.value() = 60000 + std::rand() % 2048 - 1024;
+            battery.value() = 100 - t * 40 / DAY_S;
+            rssi.value() = (uint32_t)(-60 + std::rand() % 7 - 3);
+            if (t % 60 == 0)
+            {
+                ++transmitted.value();
+            }
+            // The cloud connection is lost three times a day for a minute
+            if (t % (8 * 60 * 60) == 0)
+            {
+                cloud_status.value() = 0;
+                ++disconnects.value();
+            }
+            else if (t % (8 * 60 * 60) == 60)
+            {
+                cloud_status.value() = 1;
+            }
+            if (t % tick_s == 0)
+            {
+                REQUIRE(0 == vp.publishChanges());
+                if (delta)
+                {
+                    // Trigger sources are known to the cloud as soon as they are sampled
+                    CHECK(cloud_status.value() == cloud_values[DIAG_ID_CLOUD_CONNECTION_STATUS]);
+                    CHECK(disconnects.value() == cloud_values[DIAG_ID_CLOUD_DISCONNECTS]);
+                }
+            }
+        }
+        return metrics_bytes_sent;
+    };
+
+    const size_t full_bytes = simulateDay(false);
+    const size_t delta_bytes = simulateDay(true);
+    WARN("Full vitals: " << full_bytes << " bytes/day, delta vitals: " << delta_bytes << " bytes/day");
+    CHECK(delta_bytes < full_bytes / 4);
+}
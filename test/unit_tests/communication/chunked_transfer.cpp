@@ -0,0 +1,443 @@
+/**
+ ******************************************************************************
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include "chunked_transfer.h"
+#include "coap.h"
+
+#include <catch2/catch.hpp>
+
+#include <vector>
+
+using namespace particle::protocol;
+
+namespace
+{
+
+const uint16_t CHUNK_SIZE = 256;
+const uint32_t FILE_ADDRESS = 0x1000;
+
+/**
+ * A message channel that records the messages sent.
+ */
+class TestChannel : public MessageChannel
+{
+	uint8_t buffer[1024];
+	uint8_t response_buffer[1024];
+
+public:
+	std::vector<std::vector<uint8_t>> sent;
+
+	bool is_unreliable() override { return true; }
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+	ProtocolError receive(Message& msg) override { return NO_ERROR; }
+	ProtocolError command(Command cmd, void* arg=nullptr) override { return NO_ERROR; }
+	ProtocolError notify_established() override { return NO_ERROR; }
+	void notify_client_messages_processed() override {}
+
+	ProtocolError send(Message& msg) override
+	{
+		sent.push_back(std::vector<uint8_t>(msg.buf(), msg.buf() + msg.length()));
+		return NO_ERROR;
+	}
+
+	ProtocolError create(Message& msg, size_t size) override
+	{
+		msg.set_buffer(buffer, sizeof(buffer));
+		return NO_ERROR;
+	}
+
+	ProtocolError response(Message& original, Message& response, size_t required) override
+	{
+		response.set_buffer(response_buffer, sizeof(response_buffer));
+		return NO_ERROR;
+	}
+
+	/**
+	 * Returns the chunk indices requested by the last missing chunks request.
+	 */
+	std::vector<chunk_index_t> requested_chunks()
+	{
+		for (auto it = sent.rbegin(); it != sent.rend(); ++it)
+		{
+			const std::vector<uint8_t>& msg = *it;
+			if (msg.size() >= 7 && msg[1] == 0x01 && msg[5] == 'c')
+			{
+				std::vector<chunk_index_t> chunks;
+				for (size_t i = 7; i + 1 < msg.size(); i += 2)
+				{
+					chunks.push_back((msg[i] << 8) | msg[i + 1]);
+				}
+				return chunks;
+			}
+		}
+		return std::vector<chunk_index_t>();
+	}
+};
+
+/**
+ * Stores the firmware in memory and records the calls made.
+ */
+struct TestCallbacks : public ChunkedTransfer::Callbacks
+{
+	std::vector<uint8_t> flash;
+	std::vector<uint32_t> prepare_flags;
+	std::vector<uint32_t> finish_flags;
+	// address and size of each write
+	std::vector<std::pair<uint32_t, uint32_t>> writes;
+	int fail_writes = 0;
+	// error returned by the failing writes
+	int write_error = -1;
+	uint8_t format = 0;
+	// encoded data is only accepted in order, like the system's decoder does
+	bool in_order = false;
+
+	int prepare_for_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		prepare_flags.push_back(flags);
+		format = data.format;
+		if (!(flags & PrepareFlag::DRY_RUN))
+		{
+			flash.assign(data.file_length, 0xFF);
+		}
+		return 0;
+	}
+
+	int save_firmware_chunk(FileTransfer::Descriptor& descriptor, const unsigned char* chunk, void*) override
+	{
+		if (fail_writes)
+		{
+			--fail_writes;
+			return write_error;
+		}
+		const uint32_t end = writes.empty() ? FILE_ADDRESS : writes.back().first + writes.back().second;
+		if (in_order && descriptor.chunk_address != end)
+		{
+			return -1;
+		}
+		writes.push_back(std::make_pair(uint32_t(descriptor.chunk_address), uint32_t(descriptor.chunk_size)));
+		const uint32_t offset = descriptor.chunk_address - FILE_ADDRESS;
+		REQUIRE(offset + descriptor.chunk_size <= flash.size());
+		memcpy(flash.data() + offset, chunk, descriptor.chunk_size);
+		return 0;
+	}
+
+	int finish_firmware_update(FileTransfer::Descriptor& data, uint32_t flags, void*) override
+	{
+		if (!(flags & UpdateFlag::VALIDATE_ONLY))
+			finish_flags.push_back(flags);
+		return 0;
+	}
+
+	uint32_t calculate_crc(const unsigned char* buf, uint32_t length) override
+	{
+		uint32_t h = 2166136261u;
+		for (uint32_t i = 0; i < length; i++)
+			h = (h ^ buf[i]) * 16777619u;
+		return h;
+	}
+
+	system_tick_t millis() override
+	{
+		return 0;
+	}
+};
+
+class Transfer
+{
+	uint8_t buf[1024];
+
+	Message& message(size_t length)
+	{
+		msg.set_buffer(buf, sizeof(buf) - 1);	// a terminating 0 may be written after the message
+		msg.set_length(length);
+		return msg;
+	}
+
+	Message msg;
+
+public:
+	TestChannel channel;
+	TestCallbacks callbacks;
+	ChunkedTransfer transfer;
+	std::vector<uint8_t> image;
+
+	Transfer(size_t length)
+	{
+		for (size_t i = 0; i < length; i++)
+			image.push_back(uint8_t(i * 7 + i / 256));
+		transfer.init(&callbacks);
+	}
+
+	size_t chunk_count() const
+	{
+		return (image.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	}
+
+	void begin(uint8_t flags = 0x01)
+	{
+		memset(buf, 0, sizeof(buf));
+		buf[0] = 0x41;	// CON, 1 byte token
+		buf[1] = 0x02;	// POST
+		buf[2] = 0x12;
+		buf[3] = 0x34;
+		buf[4] = 0x01;	// token
+		buf[5] = 0xB1;	// Uri-Path "u"
+		buf[6] = 'u';
+		buf[7] = 0xFF;
+		buf[8] = flags;	// fast OTA
+		buf[9] = CHUNK_SIZE >> 8;
+		buf[10] = CHUNK_SIZE & 0xFF;
+		const uint32_t length = image.size();
+		buf[11] = length >> 24;
+		buf[12] = length >> 16;
+		buf[13] = length >> 8;
+		buf[14] = length;
+		buf[15] = FileTransfer::Store::FIRMWARE;
+		buf[16] = FILE_ADDRESS >> 24;
+		buf[17] = FILE_ADDRESS >> 16;
+		buf[18] = FILE_ADDRESS >> 8;
+		buf[19] = FILE_ADDRESS & 0xFF;
+		REQUIRE(transfer.handle_update_begin(0x01, message(20), channel) == NO_ERROR);
+		REQUIRE(transfer.is_updating());
+	}
+
+	void chunk(chunk_index_t idx, bool corrupt = false)
+	{
+		const size_t offset = idx * CHUNK_SIZE;
+		const size_t length = std::min(size_t(CHUNK_SIZE), image.size() - offset);
+		uint32_t crc = callbacks.calculate_crc(image.data() + offset, length);
+		if (corrupt)
+			crc++;
+		buf[0] = 0x51;	// NON, 1 byte token
+		buf[1] = 0x02;	// POST
+		buf[2] = 0;
+		buf[3] = 0;
+		buf[4] = 0x01;
+		buf[5] = 0xB1;	// Uri-Path "c"
+		buf[6] = 'c';
+		buf[7] = 0x44;	// Uri-Query with the CRC
+		buf[8] = crc >> 24;
+		buf[9] = crc >> 16;
+		buf[10] = crc >> 8;
+		buf[11] = crc;
+		buf[12] = 0x02;	// chunk index
+		buf[13] = idx >> 8;
+		buf[14] = idx & 0xFF;
+		buf[15] = 0xFF;
+		memcpy(buf + 16, image.data() + offset, length);
+		REQUIRE(transfer.handle_chunk(0x01, message(16 + length), channel) == NO_ERROR);
+	}
+
+	void done()
+	{
+		buf[0] = 0x41;
+		buf[1] = 0x03;	// PUT
+		buf[2] = 0x56;
+		buf[3] = 0x78;
+		buf[4] = 0x01;
+		buf[5] = 0xB1;	// Uri-Path "u"
+		buf[6] = 'u';
+		channel.sent.clear();
+		REQUIRE(transfer.handle_update_done(0x01, message(7), channel) == NO_ERROR);
+	}
+
+	bool complete()
+	{
+		return !callbacks.finish_flags.empty() && callbacks.finish_flags.back() == UpdateFlag::SUCCESS &&
+				callbacks.flash == image;
+	}
+};
+
+} // namespace
+
+SCENARIO("chunks received in order are saved in buffer sized writes")
+{
+	Transfer t(CHUNK_SIZE * 10 + 100);
+	t.begin();
+	for (chunk_index_t i = 0; i < t.chunk_count(); i++)
+		t.chunk(i);
+	t.done();
+	REQUIRE(t.complete());
+	const uint32_t chunks_per_write = CHUNKED_TRANSFER_WRITE_BUFFER_SIZE / CHUNK_SIZE;
+	REQUIRE(t.callbacks.writes.size() == (t.chunk_count() + chunks_per_write - 1) / chunks_per_write);
+	for (size_t i = 0; i + 1 < t.callbacks.writes.size(); i++)
+	{
+		REQUIRE(t.callbacks.writes[i].first == FILE_ADDRESS + i * CHUNKED_TRANSFER_WRITE_BUFFER_SIZE);
+		REQUIRE(t.callbacks.writes[i].second == CHUNKED_TRANSFER_WRITE_BUFFER_SIZE);
+	}
+	REQUIRE(!t.transfer.is_updating());
+}
+
+SCENARIO("chunks can be received out of order")
+{
+	Transfer t(CHUNK_SIZE * 20);
+	t.begin();
+	for (chunk_index_t i = 0; i < t.chunk_count(); i += 2)
+		t.chunk(i);
+	for (chunk_index_t i = 1; i < t.chunk_count(); i += 2)
+		t.chunk(i);
+	t.done();
+	REQUIRE(t.complete());
+}
+
+SCENARIO("missing, corrupt and duplicate chunks")
+{
+	Transfer t(CHUNK_SIZE * 20);
+	t.begin();
+	for (chunk_index_t i = 0; i < t.chunk_count(); i++)
+	{
+		if (i == 3 || i == 17)
+			continue;
+		t.chunk(i, i == 9);
+		if (i == 5)
+			t.chunk(i);
+	}
+	t.done();
+	REQUIRE(t.callbacks.finish_flags.empty());
+	REQUIRE(t.channel.requested_chunks() == std::vector<chunk_index_t>({ 3, 9, 17 }));
+
+	t.chunk(17);
+	t.chunk(3);
+	t.chunk(9);
+	t.done();
+	REQUIRE(t.complete());
+	// every chunk is written exactly once
+	size_t written = 0;
+	for (const auto& w: t.callbacks.writes)
+		written += w.second;
+	REQUIRE(written == t.image.size());
+}
+
+SCENARIO("chunks that cannot be saved are requested again")
+{
+	Transfer t(CHUNK_SIZE * 8);
+	t.begin();
+	t.callbacks.fail_writes = 1;
+	for (chunk_index_t i = 0; i < t.chunk_count(); i++)
+		t.chunk(i);
+	t.done();
+	const uint32_t chunks_per_write = CHUNKED_TRANSFER_WRITE_BUFFER_SIZE / CHUNK_SIZE;
+	std::vector<chunk_index_t> expected;
+	for (chunk_index_t i = 0; i < chunks_per_write; i++)
+		expected.push_back(i);
+	REQUIRE(t.channel.requested_chunks() == expected);
+
+	for (chunk_index_t i: expected)
+		t.chunk(i);
+	t.done();
+	REQUIRE(t.complete());
+}
+
+SCENARIO("a transfer is aborted when its data cannot be saved at all")
+{
+	Transfer t(CHUNK_SIZE * 8);
+	t.begin();
+	t.callbacks.fail_writes = 1;
+	t.callbacks.write_error = SYSTEM_ERROR_ABORTED;
+	for (chunk_index_t i = 0; i < t.chunk_count(); i++)
+		t.chunk(i);
+	REQUIRE(!t.transfer.is_updating());
+	REQUIRE(t.callbacks.finish_flags == std::vector<uint32_t>({ 0 }));
+	REQUIRE(t.callbacks.writes.empty());
+
+	t.done();
+	THEN("no chunks are requested again and the server is notified of the failure")
+	{
+		REQUIRE(t.channel.requested_chunks().empty());
+		REQUIRE(t.channel.sent.size() == 1);
+		REQUIRE(t.channel.sent.front()[1] == ChunkReceivedCode::BAD);
+		REQUIRE(t.callbacks.finish_flags == std::vector<uint32_t>({ 0 }));
+	}
+}
+
+SCENARIO("encoded files are saved in order")
+{
+	Transfer t(CHUNK_SIZE * 20);
+	t.callbacks.in_order = true;
+	t.begin(0x01 | (FileTransfer::Format::DELTA << 1));
+	REQUIRE(t.callbacks.format == FileTransfer::Format::DELTA);
+	for (chunk_index_t i = 0; i < t.chunk_count(); i += 2)
+		t.chunk(i);
+	for (chunk_index_t i = 1; i < t.chunk_count(); i += 2)
+		t.chunk(i);
+	t.done();
+	// chunks received too far ahead of the saved data are requested again
+	for (int i = 0; i < 10 && !t.complete(); i++)
+	{
+		const auto requested = t.channel.requested_chunks();
+		REQUIRE(!requested.empty());
+		for (chunk_index_t idx: requested)
+			t.chunk(idx);
+		t.done();
+	}
+	REQUIRE(t.complete());
+	size_t written = 0;
+	for (const auto& w: t.callbacks.writes)
+		written += w.second;
+	REQUIRE(written == t.image.size());
+}
+
+SCENARIO("encoded chunks received out of order are held until the missing chunk arrives")
+{
+	Transfer t(CHUNK_SIZE * 12 + 100);
+	t.callbacks.in_order = true;
+	t.begin(0x01 | (FileTransfer::Format::COMPRESSED << 1));
+	const chunk_index_t chunks_per_write = CHUNKED_TRANSFER_WRITE_BUFFER_SIZE / CHUNK_SIZE;
+	REQUIRE(chunks_per_write > 2);
+
+	WHEN("a chunk arrives after the chunks that follow it")
+	{
+		t.chunk(0);
+		for (chunk_index_t i = 2; i < chunks_per_write; i++)
+			t.chunk(i);
+		REQUIRE(t.callbacks.writes.empty());
+		t.chunk(1);
+		THEN("the held chunks are saved with it")
+		{
+			REQUIRE(t.callbacks.writes.size() == 1);
+			REQUIRE(t.callbacks.writes[0].second == CHUNKED_TRANSFER_WRITE_BUFFER_SIZE);
+		}
+	}
+
+	WHEN("a chunk is lost")
+	{
+		for (chunk_index_t i = 0; i < t.chunk_count(); i++)
+		{
+			if (i != 1)
+				t.chunk(i);
+		}
+		t.done();
+		THEN("only the lost chunk and the chunks that didn't fit in the buffer are requested again")
+		{
+			std::vector<chunk_index_t> expected({ 1 });
+			for (chunk_index_t i = chunks_per_write; i < t.chunk_count(); i++)
+				expected.push_back(i);
+			REQUIRE(t.channel.requested_chunks() == expected);
+
+			for (chunk_index_t idx: expected)
+				t.chunk(idx);
+			t.done();
+			REQUIRE(t.complete());
+			size_t written = 0;
+			for (const auto& w: t.callbacks.writes)
+				written += w.second;
+			REQUIRE(written == t.image.size());
+		}
+	}
+}
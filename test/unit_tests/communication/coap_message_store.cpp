@@ -0,0 +1,228 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "coap_channel.h"
+#include "messages.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle::protocol;
+
+namespace {
+
+class NullChannel : public Channel
+{
+public:
+	ProtocolError receive(Message& msg) override { return NO_ERROR; }
+	ProtocolError send(Message& msg) override { return NO_ERROR; }
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+};
+
+void send_confirmable(CoAPMessageStore& store, message_id_t id, size_t payload)
+{
+	uint8_t buf[PROTOCOL_BUFFER_SIZE] = { 0x40, 0x02, uint8_t(id >> 8), uint8_t(id) };	// CON POST
+	Message m(buf, sizeof(buf), 4 + payload);
+	m.decode_id();
+	REQUIRE(store.send(m, 0)==NO_ERROR);
+}
+
+/**
+ * Fills a store with `count` outstanding messages and returns the average time in
+ * nanoseconds taken to handle the acknowledgement of each one, in random order.
+ */
+double ack_time_ns(unsigned count, unsigned rounds)
+{
+	NullChannel channel;
+	std::mt19937 rng(count);
+	std::vector<message_id_t> ids(count);
+	std::chrono::nanoseconds total(0);
+	for (unsigned r = 0; r < rounds; r++)
+	{
+		CoAPMessageStore store;
+		for (unsigned i = 0; i < count; i++)
+		{
+			ids[i] = message_id_t(r * count + i + 1);
+			send_confirmable(store, ids[i], 16);
+		}
+		std::shuffle(ids.begin(), ids.end(), rng);
+		uint8_t buf[4];
+		Message ack(buf, sizeof(buf));
+		const auto start = std::chrono::steady_clock::now();
+		for (message_id_t id: ids)
+		{
+			ack.set_length(Messages::empty_ack(buf, id >> 8, id & 0xFF));
+			store.receive(ack, channel, 0);
+		}
+		total += std::chrono::steady_clock::now() - start;
+		REQUIRE(!store.has_messages());
+	}
+	return double(total.count()) / (double(count) * rounds);
+}
+
+} // namespace
+
+SCENARIO("messages are retrieved and removed by ID regardless of the number of stored messages", "[reliability]")
+{
+	GIVEN("a store with 500 outstanding confirmable messages")
+	{
+		CoAPMessageStore store;
+		for (message_id_t id = 1; id <= 500; id++)
+			send_confirmable(store, id, 8);
+
+		THEN("every message can be found by its ID")
+		{
+			for (message_id_t id = 1; id <= 500; id++)
+			{
+				CoAPMessage* msg = store.from_id(id);
+				REQUIRE(msg!=nullptr);
+				REQUIRE(msg->get_id()==id);
+			}
+			REQUIRE(store.from_id(501)==nullptr);
+			REQUIRE(store.has_unacknowledged_requests());
+		}
+		WHEN("every other message is removed")
+		{
+			for (message_id_t id = 1; id <= 500; id += 2)
+				REQUIRE(store.clear_message(id));
+			THEN("only the remaining messages can be found")
+			{
+				for (message_id_t id = 1; id <= 500; id++)
+					REQUIRE((store.from_id(id)!=nullptr)==(id % 2==0));
+				REQUIRE(store.in_flight()==250);
+			}
+			AND_WHEN("the rest are removed")
+			{
+				for (message_id_t id = 2; id <= 500; id += 2)
+				{
+					CoAPMessage* msg = store.remove(id);
+					REQUIRE(msg!=nullptr);
+					delete msg;
+				}
+				THEN("the store is empty")
+				{
+					REQUIRE(!store.has_messages());
+					REQUIRE(!store.has_unacknowledged_requests());
+					REQUIRE(store.in_flight()==0);
+				}
+				for (message_id_t id = 2; id <= 500; id += 2)
+					REQUIRE(store.from_id(id)==nullptr);
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("message IDs that collide in the index are stored independently", "[reliability]")
+{
+	CoAPMessageStore store;
+	// IDs that wrap around the 16-bit space
+	const message_id_t ids[] = { 0, 1, 0x8000, 0xFFFF, 0x7FFF, 0x0100, 0x0101 };
+	for (message_id_t id: ids)
+		send_confirmable(store, id, 0);
+	for (message_id_t id: ids)
+		REQUIRE(store.from_id(id)!=nullptr);
+	REQUIRE(store.clear_message(0x8000));
+	REQUIRE(store.from_id(0x8000)==nullptr);
+	for (message_id_t id: ids)
+		REQUIRE((store.from_id(id)!=nullptr)==(id!=0x8000));
+	store.clear();
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("the message index stops growing at its maximum capacity", "[reliability]")
+{
+	std::vector<CoAPMessage> messages;
+	messages.reserve(0x10000);
+	{
+		CoAPMessageIndex index;
+		unsigned inserted = 0;
+		for (unsigned id = 0; id <= 0xFFFF; id++)
+		{
+			messages.emplace_back(message_id_t(id));
+			if (!index.insert(&messages.back()))
+				break;
+			inserted++;
+		}
+		// the load factor is kept at or below 3/4 of 0x8000 slots
+		REQUIRE(inserted==0x6000);
+		REQUIRE(index.size()==inserted);
+		for (unsigned id = 0; id < inserted; id++)
+			REQUIRE(index.find(message_id_t(id))==&messages[id]);
+	}
+	messages.clear();
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("CoAP messages are allocated from the message pool", "[reliability]")
+{
+	CoAPMessagePool& pool = CoAPMessagePool::instance();
+	REQUIRE(pool.in_use()==0);
+	GIVEN("a store")
+	{
+		CoAPMessageStore store;
+		WHEN("a small and a large message are sent")
+		{
+			const size_t heap = pool.heap_allocations();
+			send_confirmable(store, 1, 4);
+			send_confirmable(store, 2, PROTOCOL_BUFFER_SIZE - 4);
+			THEN("both are allocated from the pool")
+			{
+				REQUIRE(pool.in_use()==2);
+				REQUIRE(pool.heap_allocations()==heap);
+			}
+			AND_WHEN("the messages are acknowledged")
+			{
+				store.clear();
+				THEN("the pool blocks are released")
+				{
+					REQUIRE(pool.in_use()==0);
+				}
+			}
+		}
+		WHEN("more messages are sent than the pool holds")
+		{
+			const size_t heap = pool.heap_allocations();
+			const unsigned count = COAP_MESSAGE_POOL_SMALL_COUNT + COAP_MESSAGE_POOL_LARGE_COUNT + 10;
+			for (unsigned i = 1; i <= count; i++)
+				send_confirmable(store, i, 4);
+			THEN("the remaining messages are allocated on the heap")
+			{
+				REQUIRE(pool.in_use()==COAP_MESSAGE_POOL_SMALL_COUNT + COAP_MESSAGE_POOL_LARGE_COUNT);
+				REQUIRE(pool.heap_allocations()==heap + 10);
+				REQUIRE(CoAPMessage::messages()==count);
+			}
+			store.clear();
+			REQUIRE(pool.in_use()==0);
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("acknowledgement handling time with a growing number of outstanding messages", "[reliability][.benchmark]")
+{
+	const double t10 = ack_time_ns(10, 200);
+	const double t100 = ack_time_ns(100, 20);
+	const double t500 = ack_time_ns(500, 4);
+	WARN("ACK handling: " << t10 << "ns @10, " << t100 << "ns @100, " << t500 << "ns @500 outstanding messages");
+}
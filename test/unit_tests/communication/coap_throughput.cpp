@@ -0,0 +1,324 @@
+/**
+ ******************************************************************************
+ Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation, either
+ version 3 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+#include <deque>
+#include <vector>
+
+#include "coap_channel.h"
+#include "forward_message_channel.h"
+#include "messages.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle::protocol;
+
+namespace {
+
+/**
+ * A message channel that acknowledges every confirmable message it is sent after
+ * a simulated round trip time, dropping a fraction of the packets in either direction.
+ */
+class LoopbackMessageChannel : public MessageChannel
+{
+	struct Packet
+	{
+		system_tick_t due;
+		uint8_t data[4];
+	};
+
+	const system_tick_t& now;
+	system_tick_t rtt;
+	unsigned loss_percent;
+	uint32_t seed;
+	std::deque<Packet> acks;
+	uint8_t buffer[64];
+
+	bool lost()
+	{
+		// deterministic LCG so the results are repeatable
+		seed = seed * 1103515245 + 12345;
+		return ((seed >> 16) % 100) < loss_percent;
+	}
+
+public:
+	unsigned sent;
+	// the last byte of the ID of each message sent
+	std::vector<uint8_t> sent_ids;
+
+	LoopbackMessageChannel(const system_tick_t& now, system_tick_t rtt, unsigned loss_percent) :
+			now(now), rtt(rtt), loss_percent(loss_percent), seed(1), sent(0)
+	{
+	}
+
+	bool is_unreliable() override { return true; }
+
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+
+	ProtocolError create(Message& msg, size_t size) override
+	{
+		msg.set_buffer(buffer, sizeof(buffer));
+		msg.set_length(0);
+		return NO_ERROR;
+	}
+
+	ProtocolError response(Message& original, Message& response, size_t required) override
+	{
+		return create(response, required);
+	}
+
+	ProtocolError send(Message& msg) override
+	{
+		sent++;
+		sent_ids.push_back(msg.buf()[3]);
+		if (CoAP::type(msg.buf())==CoAPType::CON && !lost() && !lost())
+		{
+			Packet p;
+			p.due = now + rtt;
+			Messages::empty_ack(p.data, msg.buf()[2], msg.buf()[3]);
+			acks.push_back(p);
+		}
+		return NO_ERROR;
+	}
+
+	ProtocolError receive(Message& msg) override
+	{
+		msg.set_length(0);
+		if (!acks.empty() && time_has_passed(now, acks.front().due))
+		{
+			memcpy(msg.buf(), acks.front().data, 4);
+			msg.set_length(4);
+			acks.pop_front();
+		}
+		return NO_ERROR;
+	}
+
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+
+	ProtocolError notify_established() override { return NO_ERROR; }
+
+	void notify_client_messages_processed() override {}
+};
+
+template <typename M>
+class ForwardCoAPReliableChannel: public CoAPReliableChannel<ForwardMessageChannel, M>
+{
+	using super = CoAPReliableChannel<ForwardMessageChannel, M>;
+
+public:
+
+	ForwardCoAPReliableChannel(MessageChannel& ch, M m) : super(m)
+	{
+		this->setForward(&ch);
+	}
+};
+
+struct ThroughputResult
+{
+	system_tick_t elapsed;
+	unsigned sent;
+	unsigned max_in_flight;
+};
+
+/**
+ * Publishes `count` confirmable messages as quickly as the channel accepts them and
+ * measures the simulated time until all are acknowledged.
+ */
+ThroughputResult run_throughput(uint8_t nstart, unsigned count, system_tick_t rtt, unsigned loss_percent)
+{
+	system_tick_t now = 0;
+	LoopbackMessageChannel loopback(now, rtt, loss_percent);
+	auto millis = [&now]() { return now; };
+	ForwardCoAPReliableChannel<decltype(millis)> channel(loopback, millis);
+	channel.set_nstart(nstart);
+
+	ThroughputResult result = {};
+	for (unsigned i = 0; i < count; i++)
+	{
+		uint8_t buf[4] = { 0x40, 0x02, uint8_t((i + 1) >> 8), uint8_t(i + 1) };	// CON POST
+		Message m(buf, sizeof(buf), sizeof(buf));
+		m.decode_id();
+		REQUIRE(channel.send(m)==NO_ERROR);
+	}
+
+	while (channel.has_unacknowledged_client_requests() && now < 3600 * 1000)
+	{
+		now += 10;
+		Message msg;
+		channel.create(msg, 0);
+		REQUIRE(channel.receive(msg)==NO_ERROR);
+		const unsigned in_flight = channel.client_messages().in_flight();
+		if (in_flight > result.max_in_flight)
+			result.max_in_flight = in_flight;
+	}
+	result.elapsed = now;
+	result.sent = loopback.sent;
+	return result;
+}
+
+} // namespace
+
+SCENARIO("acknowledged messages are delivered with the configured number of messages in flight", "[reliability][throughput]")
+{
+	const unsigned count = 50;
+	const system_tick_t rtt = 600;
+
+	GIVEN("a lossless link")
+	{
+		ThroughputResult r1 = run_throughput(1, count, rtt, 0);
+		ThroughputResult r4 = run_throughput(4, count, rtt, 0);
+		ThroughputResult r8 = run_throughput(8, count, rtt, 0);
+
+		THEN("the number of messages in flight never exceeds NSTART")
+		{
+			REQUIRE(r1.max_in_flight==1);
+			REQUIRE(r4.max_in_flight==4);
+			REQUIRE(r8.max_in_flight==8);
+		}
+		THEN("each message is sent once")
+		{
+			REQUIRE(r1.sent==count);
+			REQUIRE(r4.sent==count);
+			REQUIRE(r8.sent==count);
+		}
+		THEN("a larger window completes in proportionally less time")
+		{
+			REQUIRE(r1.elapsed >= count * rtt);
+			REQUIRE(r4.elapsed * 3 < r1.elapsed);
+			REQUIRE(r8.elapsed < r4.elapsed);
+		}
+	}
+
+	GIVEN("a link with 5% packet loss in each direction")
+	{
+		ThroughputResult r1 = run_throughput(1, count, rtt, 5);
+		ThroughputResult r4 = run_throughput(4, count, rtt, 5);
+
+		THEN("lost messages are retransmitted and the window still improves throughput")
+		{
+			REQUIRE(r1.sent > count);
+			REQUIRE(r4.sent > count);
+			REQUIRE(r4.max_in_flight <= 4);
+			REQUIRE(r4.elapsed < r1.elapsed);
+		}
+	}
+}
+
+TEST_CASE("acknowledged message throughput benchmark", "[reliability][throughput][.benchmark]")
+{
+	const unsigned count = 50;
+	const system_tick_t rtt = 600;
+
+	ThroughputResult r1 = run_throughput(1, count, rtt, 0);
+	ThroughputResult r4 = run_throughput(4, count, rtt, 0);
+	ThroughputResult r8 = run_throughput(8, count, rtt, 0);
+	WARN("lossless: NSTART=1 " << r1.elapsed << "ms, NSTART=4 " << r4.elapsed << "ms, NSTART=8 " << r8.elapsed << "ms");
+
+	r1 = run_throughput(1, count, rtt, 5);
+	r4 = run_throughput(4, count, rtt, 5);
+	WARN("lossy: NSTART=1 " << r1.elapsed << "ms (" << r1.sent << " sent), NSTART=4 " << r4.elapsed << "ms (" << r4.sent << " sent)");
+}
+
+SCENARIO("messages sent while the send window is full are deferred and sent in order", "[reliability]")
+{
+	GIVEN("a reliable channel with NSTART=2")
+	{
+		system_tick_t now = 0;
+		LoopbackMessageChannel loopback(now, 100, 0);
+		auto millis = [&now]() { return now; };
+		ForwardCoAPReliableChannel<decltype(millis)> channel(loopback, millis);
+		channel.set_nstart(2);
+
+		WHEN("three confirmable messages are sent")
+		{
+			for (uint8_t id = 1; id <= 3; id++)
+			{
+				uint8_t buf[4] = { 0x40, 0x02, 0, id };
+				Message m(buf, sizeof(buf), sizeof(buf));
+				m.decode_id();
+				REQUIRE(channel.send(m)==NO_ERROR);
+			}
+			THEN("only the first two are transmitted")
+			{
+				REQUIRE(loopback.sent==2);
+				REQUIRE(channel.client_messages().in_flight()==2);
+				REQUIRE(channel.client_messages().is_deferred(3));
+				REQUIRE(!channel.client_messages().is_deferred(1));
+			}
+			AND_WHEN("the first message is acknowledged")
+			{
+				now = 100;
+				Message msg;
+				channel.create(msg, 0);
+				REQUIRE(channel.receive(msg)==NO_ERROR);
+				THEN("the deferred message is transmitted")
+				{
+					REQUIRE(loopback.sent==3);
+					REQUIRE(channel.client_messages().from_id(1)==nullptr);
+					REQUIRE(!channel.client_messages().is_deferred(3));
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("messages sent while earlier messages are deferred are sent after them", "[reliability]")
+{
+	GIVEN("a reliable channel with a deferred message")
+	{
+		system_tick_t now = 0;
+		LoopbackMessageChannel loopback(now, 100, 0);
+		auto millis = [&now]() { return now; };
+		ForwardCoAPReliableChannel<decltype(millis)> channel(loopback, millis);
+		channel.set_nstart(1);
+		for (uint8_t id = 1; id <= 2; id++)
+		{
+			uint8_t buf[4] = { 0x40, 0x02, 0, id };
+			Message m(buf, sizeof(buf), sizeof(buf));
+			m.decode_id();
+			REQUIRE(channel.send(m)==NO_ERROR);
+		}
+		REQUIRE(channel.client_messages().is_deferred(2));
+
+		WHEN("the send window opens before the deferred message is transmitted")
+		{
+			channel.set_nstart(2);
+			uint8_t buf[4] = { 0x40, 0x02, 0, 3 };
+			Message m(buf, sizeof(buf), sizeof(buf));
+			m.decode_id();
+			REQUIRE(channel.send(m)==NO_ERROR);
+			THEN("a new message is deferred too")
+			{
+				REQUIRE(channel.client_messages().is_deferred(3));
+				REQUIRE(loopback.sent_ids==std::vector<uint8_t>({ 1 }));
+			}
+			AND_WHEN("the channel is processed")
+			{
+				Message msg;
+				channel.create(msg, 0);
+				REQUIRE(channel.receive(msg)==NO_ERROR);
+				now = 100;
+				REQUIRE(channel.receive(msg)==NO_ERROR);
+				THEN("the messages are transmitted in the order they were sent")
+				{
+					REQUIRE(loopback.sent_ids==std::vector<uint8_t>({ 1, 2, 3 }));
+				}
+			}
+		}
+	}
+}
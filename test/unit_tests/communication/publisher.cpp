@@ -19,6 +19,9 @@
 
 #include "publisher.h"
 
+#include <thread>
+#include <vector>
+
 #include <catch2/catch.hpp>
 
 using namespace particle::protocol;
@@ -91,3 +94,248 @@ SCENARIO("publisher")
 		}
 	}
 }
+
+SCENARIO("event rate limits can be configured per event name prefix")
+{
+	Publisher publisher(nullptr);
+
+	GIVEN("a limit of 2 events per 100ms for events starting with \"sensor/\"")
+	{
+		REQUIRE(publisher.set_rate_limit("sensor/", 50, 2)==NO_ERROR);
+
+		THEN("matching events use their own budget")
+		{
+			REQUIRE(publisher.take_token("sensor/temp", 0)==0);
+			REQUIRE(publisher.take_token("sensor/humidity", 0)==0);
+			REQUIRE(publisher.take_token("sensor/temp", 0)<0);
+			REQUIRE(publisher.take_token("sensor/temp", 50)==0);
+		}
+
+		THEN("other events are not affected")
+		{
+			REQUIRE(publisher.take_token("sensor/temp", 0)==0);
+			REQUIRE(publisher.take_token("sensor/temp", 0)==0);
+			for (int i=0; i<4; i++) {
+				REQUIRE(publisher.take_token("status", 0)==0);
+			}
+			REQUIRE(publisher.take_token("status", 0)<0);
+			REQUIRE(publisher.take_token("spark/status", 0)==0);
+		}
+
+		AND_GIVEN("a limit for a longer prefix")
+		{
+			REQUIRE(publisher.set_rate_limit("sensor/fast", 0, 1)==NO_ERROR);
+			THEN("the longest matching prefix is used")
+			{
+				for (int i=0; i<100; i++) {
+					REQUIRE(publisher.take_token("sensor/fast/accel", 0)==0);
+				}
+				REQUIRE(publisher.take_token("sensor/temp", 0)==0);
+			}
+		}
+
+		WHEN("the limit is changed")
+		{
+			REQUIRE(publisher.set_rate_limit("sensor/", 50, 0)==NO_ERROR);
+			THEN("the existing rule is updated")
+			{
+				REQUIRE(publisher.rate_limiter().bucket_for("sensor/temp")->get_burst()==0);
+				REQUIRE(publisher.take_token("sensor/temp", 0)<0);
+			}
+		}
+	}
+
+	GIVEN("an empty prefix")
+	{
+		REQUIRE(publisher.set_rate_limit("", 100, 10)==NO_ERROR);
+		THEN("the default application limit is changed")
+		{
+			for (int i=0; i<10; i++) {
+				REQUIRE(publisher.take_token("status", 0)==0);
+			}
+			REQUIRE(publisher.take_token("status", 0)<0);
+			REQUIRE(publisher.take_token("status", 100)==0);
+		}
+	}
+
+	GIVEN("the maximum number of rules")
+	{
+		for (size_t i=0; i<MAX_EVENT_RATE_LIMIT_RULES; i++) {
+			const std::string prefix = "rule" + std::to_string(i);
+			REQUIRE(publisher.set_rate_limit(prefix.c_str(), 1000, 1)==NO_ERROR);
+		}
+		THEN("no more rules can be added")
+		{
+			REQUIRE(publisher.set_rate_limit("another", 1000, 1)==INSUFFICIENT_STORAGE);
+			REQUIRE(publisher.set_rate_limit("rule0", 100, 1)==NO_ERROR);
+		}
+	}
+
+	THEN("prefixes that are too long are rejected")
+	{
+		REQUIRE(publisher.set_rate_limit("a/very/long/event/prefix", 1000, 1)==INSUFFICIENT_STORAGE);
+	}
+}
+
+SCENARIO("application events are rate limited across a tick counter wrap")
+{
+	Publisher publisher(nullptr);
+	const system_tick_t start = system_tick_t(-500);
+	for (int i=0; i<4; i++) {
+		REQUIRE(publisher.is_rate_limited(false, start - 10000)==false);
+	}
+	for (int i=0; i<4; i++) {
+		REQUIRE(publisher.is_rate_limited(false, start)==false);
+	}
+	REQUIRE(publisher.is_rate_limited(false, start + 999)==true);
+	REQUIRE(publisher.is_rate_limited(false, start + 1000)==false);
+}
+
+SCENARIO("events can wait for a token instead of being rate limited")
+{
+	Publisher publisher(nullptr);
+	publisher.set_max_wait(2000);
+	REQUIRE(publisher.set_rate_limit("sensor/", 1000, 4)==NO_ERROR);
+	for (int i=0; i<4; i++) {
+		REQUIRE(publisher.take_token("sensor/temp", 0)==0);
+	}
+
+	THEN("tokens are reserved in order")
+	{
+		REQUIRE(publisher.take_token("sensor/temp", 0)==1000);
+		REQUIRE(publisher.take_token("sensor/temp", 0)==2000);
+		REQUIRE(publisher.take_token("sensor/temp", 0)<0);
+		REQUIRE(publisher.rate_limiter().bucket_for("sensor/temp")->wait_time(0)==3000);
+	}
+
+	THEN("the wait is shortened by elapsed time")
+	{
+		REQUIRE(publisher.take_token("sensor/temp", 400)==600);
+		REQUIRE(publisher.take_token("sensor/temp", 1500)==500);
+	}
+
+	THEN("events subject to the default limits don't wait")
+	{
+		for (int i=0; i<4; i++) {
+			REQUIRE(publisher.take_token("status", 0)==0);
+		}
+		REQUIRE(publisher.take_token("status", 0)<0);
+	}
+}
+
+namespace {
+
+// Message channel that counts the messages sent
+class CountingChannel : public MessageChannel
+{
+	uint8_t buf[PROTOCOL_BUFFER_SIZE];
+
+public:
+	unsigned sent = 0;
+	ProtocolError error = NO_ERROR;
+
+	bool is_unreliable() override { return false; }
+	ProtocolError establish(uint32_t& flags, uint32_t app_state_crc) override { return NO_ERROR; }
+	ProtocolError receive(Message& msg) override { return NO_ERROR; }
+	ProtocolError command(Command cmd, void* arg) override { return NO_ERROR; }
+	ProtocolError response(Message& original, Message& response, size_t required) override { return NO_ERROR; }
+	ProtocolError notify_established() override { return NO_ERROR; }
+	void notify_client_messages_processed() override {}
+
+	ProtocolError create(Message& msg, size_t size) override
+	{
+		msg.set_buffer(buf, sizeof(buf));
+		return NO_ERROR;
+	}
+
+	ProtocolError send(Message& msg) override
+	{
+		if (error == NO_ERROR) {
+			++sent;
+		}
+		return error;
+	}
+};
+
+struct Results
+{
+	std::vector<int> errors;
+
+	particle::CompletionHandler handler()
+	{
+		return particle::CompletionHandler([](int error, const void* data, void* callback_data, void* reserved) {
+			static_cast<Results*>(callback_data)->errors.push_back(error);
+		}, this);
+	}
+};
+
+} // namespace
+
+SCENARIO("events waiting for a token are deferred")
+{
+	Results results;
+	CountingChannel channel;
+	Publisher publisher(nullptr);
+	publisher.set_max_wait(10000);
+	REQUIRE(publisher.set_rate_limit("sensor/", 100, 1)==NO_ERROR);
+	REQUIRE(publisher.send_event(channel, "sensor/temp", "1", 60, EventType::PRIVATE, 0, 0, results.handler())==NO_ERROR);
+	REQUIRE(channel.sent==1);
+	for (size_t i=0; i<MAX_DEFERRED_EVENTS; i++) {
+		REQUIRE(publisher.send_event(channel, "sensor/temp", "2", 60, EventType::PRIVATE, 0, 0, results.handler())==NO_ERROR);
+	}
+	REQUIRE(channel.sent==1);
+	REQUIRE(publisher.deferred_events()==MAX_DEFERRED_EVENTS);
+	REQUIRE(results.errors.size()==1);
+
+	THEN("no more events are deferred when the queue is full")
+	{
+		REQUIRE(publisher.send_event(channel, "sensor/temp", "3", 60, EventType::PRIVATE, 0, 0, results.handler())==BANDWIDTH_EXCEEDED);
+	}
+
+	THEN("events whose token is available are sent from the event loop")
+	{
+		publisher.process_deferred(channel, 99);
+		REQUIRE(channel.sent==1);
+		publisher.process_deferred(channel, 250);
+		REQUIRE(channel.sent==3);
+		REQUIRE(publisher.deferred_events()==MAX_DEFERRED_EVENTS - 2);
+		REQUIRE(results.errors==std::vector<int>({ 0, 0, 0 }));
+	}
+
+	THEN("a failure to send a deferred event is reported to its completion handler")
+	{
+		channel.error = IO_ERROR;
+		publisher.process_deferred(channel, 100);
+		REQUIRE(results.errors.size()==2);
+		REQUIRE(results.errors[1]==SYSTEM_ERROR_IO);
+	}
+
+	THEN("pending events are cancelled")
+	{
+		publisher.cancel_deferred();
+		REQUIRE(publisher.deferred_events()==0);
+		REQUIRE(results.errors.size()==1 + MAX_DEFERRED_EVENTS);
+		REQUIRE(results.errors.back()==SYSTEM_ERROR_CANCELLED);
+	}
+}
+
+SCENARIO("tokens can be taken from several threads")
+{
+	TokenBucket bucket(1000, 1000);
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> taken(0);
+	for (int t=0; t<4; t++) {
+		threads.emplace_back([&]() {
+			for (int i=0; i<1000; i++) {
+				if (bucket.take(0)==0) {
+					taken++;
+				}
+			}
+		});
+	}
+	for (auto& t: threads) {
+		t.join();
+	}
+	REQUIRE(taken==1000);
+	REQUIRE(bucket.take(0)<0);
+}
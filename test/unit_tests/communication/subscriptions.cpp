@@ -0,0 +1,322 @@
+/**
+ ******************************************************************************
+  Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ ******************************************************************************
+ */
+
+// subscriptions.h relies on protocol.h for its dependencies
+#include "protocol.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace particle::protocol;
+
+namespace
+{
+
+struct Received
+{
+	std::string handler;
+	std::string event;
+};
+
+std::vector<Received> received;
+
+void record_event(void* handler_data, const char* event_name, const char* data)
+{
+	received.push_back({ (const char*)handler_data, event_name });
+}
+
+void other_handler(const char* event_name, const char* data)
+{
+}
+
+uint32_t test_crc(const uint8_t* data, uint32_t length)
+{
+	// FNV-1a is good enough to detect changes here
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < length; i++)
+		h = (h ^ data[i]) * 16777619u;
+	return h;
+}
+
+/**
+ * Delivers an event to the subscriptions and returns the handlers that received it.
+ */
+std::vector<std::string> deliver(Subscriptions& subscriptions, const char* event_name)
+{
+	uint8_t buf[256];
+	Message message;
+	message.set_buffer(buf, sizeof(buf));
+	message.set_length(Messages::event(buf, 0x1234, event_name, "data", 60, EventType::PUBLIC, false));
+	received.clear();
+	MessageChannel* channel = nullptr;	// channel is not used for non-confirmable events
+	REQUIRE(subscriptions.handle_event(message, nullptr, *channel) == NO_ERROR);
+	std::vector<std::string> handlers;
+	for (const Received& r: received)
+	{
+		REQUIRE(r.event == event_name);
+		handlers.push_back(r.handler);
+	}
+	std::sort(handlers.begin(), handlers.end());
+	return handlers;
+}
+
+ProtocolError subscribe(Subscriptions& subscriptions, const char* filter)
+{
+	// The filter doubles as the handler data to identify the handler that was called
+	return subscriptions.add_event_handler(filter, (EventHandler)record_event, (void*)filter, SubscriptionScope::MY_DEVICES, nullptr);
+}
+
+uint32_t recomputed_checksum(Subscriptions& subscriptions)
+{
+	// A different CRC function forces the checksum to be computed from scratch
+	struct Crc
+	{
+		static uint32_t calculate(const uint8_t* data, uint32_t length)
+		{
+			return test_crc(data, length);
+		}
+	};
+	return subscriptions.compute_subscriptions_checksum(Crc::calculate);
+}
+
+} // namespace
+
+SCENARIO("events are dispatched to every subscription that is a prefix of the event name")
+{
+	Subscriptions subscriptions;
+	subscriptions.set_limit(20);
+	REQUIRE(subscribe(subscriptions, "") == NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "temp") == NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "temp/") == NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "temp/kitchen") == NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "hum") == NO_ERROR);
+	REQUIRE(subscriptions.size() == 5);
+
+	REQUIRE(deliver(subscriptions, "temp/kitchen") == std::vector<std::string>({ "", "temp", "temp/", "temp/kitchen" }));
+	REQUIRE(deliver(subscriptions, "temp/kitchen/2") == std::vector<std::string>({ "", "temp", "temp/", "temp/kitchen" }));
+	REQUIRE(deliver(subscriptions, "temperature") == std::vector<std::string>({ "", "temp" }));
+	REQUIRE(deliver(subscriptions, "te") == std::vector<std::string>({ "" }));
+	REQUIRE(deliver(subscriptions, "humidity") == std::vector<std::string>({ "", "hum" }));
+
+	WHEN("a subscription is removed")
+	{
+		subscriptions.remove_event_handlers("temp/");
+		THEN("it no longer receives events")
+		{
+			REQUIRE(subscriptions.size() == 4);
+			REQUIRE(deliver(subscriptions, "temp/kitchen") == std::vector<std::string>({ "", "temp", "temp/kitchen" }));
+		}
+	}
+
+	WHEN("all subscriptions are removed")
+	{
+		subscriptions.remove_event_handlers(nullptr);
+		THEN("no handler receives events")
+		{
+			REQUIRE(subscriptions.size() == 0);
+			REQUIRE(deliver(subscriptions, "temp/kitchen").empty());
+		}
+	}
+}
+
+SCENARIO("several handlers can subscribe to the same filter")
+{
+	Subscriptions subscriptions;
+	static const char* first = "first";
+	static const char* second = "second";
+	REQUIRE(subscriptions.add_event_handler("a", (EventHandler)record_event, (void*)first, SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+	REQUIRE(subscriptions.add_event_handler("a", (EventHandler)record_event, (void*)second, SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+	REQUIRE(deliver(subscriptions, "ab") == std::vector<std::string>({ "first", "second" }));
+}
+
+SCENARIO("handlers can change subscriptions while an event is dispatched")
+{
+	static Subscriptions* current = nullptr;
+	struct Resubscribe
+	{
+		static void handler(const char* event_name, const char* data)
+		{
+			received.push_back({ "resubscribe", event_name });
+			current->remove_event_handlers(nullptr);
+			subscribe(*current, "b");
+		}
+	};
+	Subscriptions subscriptions;
+	current = &subscriptions;
+	REQUIRE(subscriptions.add_event_handler("a", Resubscribe::handler, nullptr, SubscriptionScope::MY_DEVICES, nullptr) == NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "ab") == NO_ERROR);
+	REQUIRE(deliver(subscriptions, "abc") == std::vector<std::string>({ "resubscribe" }));
+	REQUIRE(subscriptions.size() == 1);
+	REQUIRE(deliver(subscriptions, "abc").empty());
+	REQUIRE(deliver(subscriptions, "bc") == std::vector<std::string>({ "b" }));
+}
+
+SCENARIO("the number of subscriptions is limited by configuration")
+{
+	Subscriptions subscriptions;
+	std::vector<std::string> filters;
+	for (int i = 0; i < 50; i++)
+	{
+		// Fixed width so that no filter is a prefix of another
+		filters.push_back("topic/" + std::to_string(100 + i));
+	}
+
+	GIVEN("the default limit")
+	{
+		THEN("MAX_SUBSCRIPTIONS handlers can be added")
+		{
+			REQUIRE(subscriptions.get_limit() == MAX_SUBSCRIPTIONS);
+			for (int i = 0; i < MAX_SUBSCRIPTIONS; i++)
+			{
+				REQUIRE(subscribe(subscriptions, filters[i].c_str()) == NO_ERROR);
+			}
+			REQUIRE(subscribe(subscriptions, filters[MAX_SUBSCRIPTIONS].c_str()) == INSUFFICIENT_STORAGE);
+		}
+	}
+
+	GIVEN("a limit of 50")
+	{
+		subscriptions.set_limit(50);
+		for (const std::string& filter: filters)
+		{
+			REQUIRE(subscribe(subscriptions, filter.c_str()) == NO_ERROR);
+		}
+		REQUIRE(subscribe(subscriptions, "another") == INSUFFICIENT_STORAGE);
+
+		THEN("each subscription receives its events")
+		{
+			for (const std::string& filter: filters)
+			{
+				const std::vector<std::string> handlers = deliver(subscriptions, (filter + "/x").c_str());
+				REQUIRE(handlers == std::vector<std::string>({ filter }));
+			}
+		}
+
+		THEN("handler addresses do not change when more handlers are added")
+		{
+			std::vector<FilteringEventHandler*> before;
+			subscriptions.for_each([&](FilteringEventHandler& h) { before.push_back(&h); return NO_ERROR; });
+			subscriptions.remove_event_handlers(filters[3].c_str());
+			subscriptions.set_limit(60);
+			for (int i = 0; i < 10; i++)
+			{
+				REQUIRE(subscribe(subscriptions, ("more/" + std::to_string(i)).c_str()) == NO_ERROR);
+			}
+			std::vector<FilteringEventHandler*> after;
+			subscriptions.for_each([&](FilteringEventHandler& h) { after.push_back(&h); return NO_ERROR; });
+			for (size_t i = 0; i < before.size(); i++)
+			{
+				if (i != 3)
+				{
+					REQUIRE(before[i] == after[i]);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("blocks of handlers are freed once the handlers at the end are removed")
+{
+	Subscriptions subscriptions;
+	subscriptions.set_limit(50);
+	std::vector<std::string> filters;
+	for (int i = 0; i < 50; i++)
+	{
+		filters.push_back("topic/" + std::to_string(100 + i));
+	}
+	for (const std::string& filter: filters)
+	{
+		REQUIRE(subscribe(subscriptions, filter.c_str()) == NO_ERROR);
+	}
+	const size_t capacity = subscriptions.get_capacity();
+	REQUIRE(capacity >= 50);
+
+	WHEN("handlers before the last block are removed")
+	{
+		subscriptions.remove_event_handlers(filters[MAX_SUBSCRIPTIONS].c_str());
+		subscriptions.remove_event_handlers(filters[0].c_str());
+		THEN("no block is freed")
+		{
+			REQUIRE(subscriptions.get_capacity() == capacity);
+		}
+	}
+
+	WHEN("the handlers in the last blocks are removed")
+	{
+		for (size_t i = MAX_SUBSCRIPTIONS + SUBSCRIPTION_BLOCK_SIZE; i < filters.size(); i++)
+		{
+			subscriptions.remove_event_handlers(filters[i].c_str());
+		}
+		THEN("the empty blocks are freed and the remaining handlers receive their events")
+		{
+			REQUIRE(subscriptions.get_capacity() == MAX_SUBSCRIPTIONS + SUBSCRIPTION_BLOCK_SIZE);
+			for (size_t i = 0; i < MAX_SUBSCRIPTIONS + SUBSCRIPTION_BLOCK_SIZE; i++)
+			{
+				REQUIRE(deliver(subscriptions, filters[i].c_str()) == std::vector<std::string>({ filters[i] }));
+			}
+			REQUIRE(deliver(subscriptions, filters.back().c_str()).empty());
+		}
+	}
+
+	WHEN("all handlers are removed")
+	{
+		subscriptions.remove_event_handlers(nullptr);
+		THEN("all blocks are freed and handlers can be added again")
+		{
+			REQUIRE(subscriptions.get_capacity() == MAX_SUBSCRIPTIONS);
+			for (const std::string& filter: filters)
+			{
+				REQUIRE(subscribe(subscriptions, filter.c_str()) == NO_ERROR);
+			}
+			REQUIRE(subscriptions.get_capacity() == capacity);
+		}
+	}
+}
+
+SCENARIO("the subscription checksum is updated as subscriptions change")
+{
+	Subscriptions subscriptions;
+	subscriptions.set_limit(20);
+	const uint32_t empty = subscriptions.compute_subscriptions_checksum(test_crc);
+	REQUIRE(empty == recomputed_checksum(subscriptions));
+
+	REQUIRE(subscribe(subscriptions, "a") == NO_ERROR);
+	REQUIRE(subscribe(subscriptions, "b") == NO_ERROR);
+	REQUIRE(subscriptions.add_event_handler("c", other_handler, nullptr, SubscriptionScope::MY_DEVICES, "0123456789ab") == NO_ERROR);
+	const uint32_t three = subscriptions.compute_subscriptions_checksum(test_crc);
+	REQUIRE(three != empty);
+	REQUIRE(three == recomputed_checksum(subscriptions));
+
+	subscriptions.remove_event_handlers("b");
+	const uint32_t two = subscriptions.compute_subscriptions_checksum(test_crc);
+	REQUIRE(two != three);
+	REQUIRE(two == recomputed_checksum(subscriptions));
+
+	// The checksum does not depend on the order in which subscriptions were added
+	Subscriptions other;
+	REQUIRE(other.add_event_handler("c", other_handler, nullptr, SubscriptionScope::MY_DEVICES, "0123456789ab") == NO_ERROR);
+	REQUIRE(subscribe(other, "a") == NO_ERROR);
+	REQUIRE(other.compute_subscriptions_checksum(test_crc) == two);
+
+	subscriptions.remove_event_handlers(nullptr);
+	REQUIRE(subscriptions.compute_subscriptions_checksum(test_crc) == empty);
+}
@@ -2,6 +2,10 @@
 #define MOCK_TYPES_H
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
 
 #include "spark_wiring_timer.h"
 
@@ -45,6 +49,72 @@ public:
     }
 };
 
+// In-memory queue that is API compatible with particle::fs::FileQueue
+class FileQueue
+{
+public:
+    struct QueueEntry
+    {
+        uint16_t size;
+        uint16_t flags;
+    };
+
+    // Number of write operations that would have been made to flash
+    size_t writes = 0;
+
+    virtual ~FileQueue(void) = default;
+    virtual int pushBack(void* item, uint16_t size)
+    {
+        ++writes;
+        const uint8_t* p = static_cast<const uint8_t*>(item);
+        entries_.emplace_back(p, p + size);
+        return 0;
+    }
+    virtual int front(QueueEntry& entry, void* buffer, uint16_t length)
+    {
+        if (entries_.empty())
+        {
+            return -1;
+        }
+        if (entries_.front().size() > length)
+        {
+            return -1;
+        }
+        entry.size = entries_.front().size() + sizeof(QueueEntry);
+        entry.flags = 1;
+        memcpy(buffer, entries_.front().data(), entries_.front().size());
+        return 0;
+    }
+    virtual int popFront(void)
+    {
+        if (entries_.empty())
+        {
+            return -1;
+        }
+        ++writes;
+        entries_.pop_front();
+        return 0;
+    }
+    virtual int clear(void)
+    {
+        entries_.clear();
+        return 0;
+    }
+    virtual int count(void)
+    {
+        return entries_.size();
+    }
+
+    // Stored records, e.g. for corrupting them
+    std::deque<std::vector<uint8_t>>& entries()
+    {
+        return entries_;
+    }
+
+private:
+    std::deque<std::vector<uint8_t>> entries_;
+};
+
 } // namespace mock_type
 } // namespace particle
 
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CATCH_CONFIG_MAIN
+
+#include "at_parser.h"
+#include "at_command.h"
+#include "at_response.h"
+
+#include "fake_modem.h"
+
+#include "c_string.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace particle;
+using namespace particle::test;
+
+namespace {
+
+struct UrcLog {
+    std::vector<std::string> lines;
+
+    static int handler(AtResponseReader* reader, const char* prefix, void* data) {
+        auto self = (UrcLog*)data;
+        const CString line = reader->readLine();
+        self->lines.push_back(std::string(prefix) + "|" + (const char*)line);
+        return 0;
+    }
+};
+
+struct CommandLog {
+    std::vector<std::string> lines;
+    std::vector<int> results;
+
+    // Reads all response lines and the final result code
+    static void readAll(AtResponse* resp, void* data) {
+        auto self = (CommandLog*)data;
+        std::string lines;
+        while (resp->hasNextLine()) {
+            const CString line = resp->readLine();
+            lines += (const char*)line;
+            lines += ";";
+        }
+        self->lines.push_back(lines);
+        self->results.push_back(resp->readResult());
+    }
+
+    // Leaves reading the final result code to the parser
+    static void ignore(AtResponse* resp, void* data) {
+        auto self = (CommandLog*)data;
+        self->lines.push_back("");
+        self->results.push_back(resp->error());
+    }
+};
+
+AtParser makeParser(FakeModem* modem) {
+    AtParser parser;
+    REQUIRE(parser.init(AtParserConfig().stream(modem).commandTimeout(10000)) == 0);
+    return parser;
+}
+
+} // namespace
+
+TEST_CASE("AtParser") {
+    FakeModem modem;
+    auto parser = makeParser(&modem);
+
+    SECTION("executes a command") {
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        CHECK(parser.execCommand("AT") == AtResponse::OK);
+        CHECK(modem.done());
+        CHECK(modem.mismatches() == 0);
+    }
+
+    SECTION("reads response lines and error codes") {
+        modem.expect("AT+CGMR", "\r\nL0.0.00.00.05.06 [Mar 06 2019 17:26:16]\r\n\r\nOK\r\n", 20);
+        modem.expect("AT+CCID", "\r\n+CME ERROR: 10\r\n", 20);
+        auto resp = parser.sendCommand("AT+CGMR");
+        const CString ver = resp.readLine();
+        CHECK(strcmp(ver, "L0.0.00.00.05.06 [Mar 06 2019 17:26:16]") == 0);
+        CHECK(resp.readResult() == AtResponse::OK);
+        auto resp2 = parser.sendCommand("AT+CCID");
+        CHECK(resp2.readResult() == AtResponse::CME_ERROR);
+        CHECK(resp2.resultErrorCode() == 10);
+    }
+
+    SECTION("dispatches URCs to the handler with the longest matching prefix") {
+        UrcLog log;
+        REQUIRE(parser.addUrcHandler("+CG", UrcLog::handler, &log) == 0);
+        REQUIRE(parser.addUrcHandler("+CGREG", UrcLog::handler, &log) == 0);
+        REQUIRE(parser.addUrcHandler("+CEREG", UrcLog::handler, &log) == 0);
+        REQUIRE(parser.addUrcHandler("+UUSORD", UrcLog::handler, &log) == 0);
+        modem.send("\r\n+CGREG: 5\r\n");
+        modem.send("\r\n+CGEV: ME PDN ACT 1\r\n");
+        modem.expect("AT+COPS?", "\r\n+CEREG: 1\r\n+COPS: 0,0,\"AT&T\",7\r\n\r\nOK\r\n+UUSORD: 0,16\r\n", 50);
+        CHECK(parser.processUrc(100) == 1);
+        CHECK(parser.processUrc(100) == 1);
+        auto resp = parser.sendCommand("AT+COPS?");
+        const CString line = resp.readLine();
+        CHECK(strcmp(line, "+COPS: 0,0,\"AT&T\",7") == 0);
+        CHECK(resp.readResult() == AtResponse::OK);
+        CHECK(parser.processUrc(100) == 1);
+        REQUIRE(log.lines.size() == 4);
+        CHECK(log.lines[0] == "+CGREG|+CGREG: 5");
+        CHECK(log.lines[1] == "+CG|+CGEV: ME PDN ACT 1");
+        CHECK(log.lines[2] == "+CEREG|+CEREG: 1");
+        CHECK(log.lines[3] == "+UUSORD|+UUSORD: 0,16");
+
+        parser.removeUrcHandler("+CGREG");
+        modem.send("\r\n+CGREG: 1\r\n");
+        CHECK(parser.processUrc(100) == 1);
+        CHECK(log.lines.back() == "+CG|+CGREG: 1");
+        parser.removeUrcHandler("+CG");
+        modem.send("\r\n+CGREG: 2\r\n\r\n+CEREG: 2\r\n");
+        CHECK(parser.processUrc(100) == 1);
+        CHECK(log.lines.back() == "+CEREG|+CEREG: 2");
+    }
+
+    SECTION("reads lines longer than the initial input buffer") {
+        std::string list = "+COPS: ";
+        for (int i = 0; i < 12; ++i) {
+            list += "(2,\"Operator " + std::to_string(i) + "\",\"OP" + std::to_string(i) + "\",\"3102" + std::to_string(10 + i) + "\",7),";
+        }
+        list += ",(0-4),(0-2)";
+        REQUIRE(list.size() > 300);
+        modem.expect("AT+COPS=?", ("\r\n" + list + "\r\n\r\nOK\r\n").c_str(), 1000);
+        auto resp = parser.sendCommand("AT+COPS=?");
+        const CString line = resp.readLine();
+        CHECK(list == (const char*)line);
+        CHECK(resp.readResult() == AtResponse::OK);
+    }
+
+    SECTION("sends queued commands in order") {
+        CommandLog log;
+        UrcLog urcs;
+        REQUIRE(parser.addUrcHandler("+CIEV", UrcLog::handler, &urcs) == 0);
+        modem.expect("AT+CMEE=2", "\r\nOK\r\n", 10);
+        modem.expect("AT+CGSN", "\r\n+CIEV: 2,3\r\n\r\n352753090000000\r\n\r\nOK\r\n", 10);
+        modem.expect("AT+CIMI", "\r\n310410000000000\r\n\r\nOK\r\n", 10);
+        modem.expect("AT+CPIN?", "\r\n+CME ERROR: SIM not inserted\r\n", 10);
+        modem.expect("AT+CSQ", "\r\n+CSQ: 20,99\r\n\r\nOK\r\n", 10);
+        REQUIRE(parser.queueCommand(CommandLog::readAll, &log, "AT+CMEE=%d", 2) == 0);
+        REQUIRE(parser.queueCommand(CommandLog::readAll, &log, "AT+CGSN") == 0);
+        REQUIRE(parser.queueCommand(CommandLog::ignore, &log, "AT+CIMI") == 0);
+        REQUIRE(parser.queueCommand(5000, CommandLog::readAll, &log, "AT+CPIN?") == 0);
+        REQUIRE(parser.queueCommand(nullptr, nullptr, "AT+CSQ") == 0);
+        CHECK(parser.queuedCommands() == 5);
+        CHECK(parser.processCommands() == 5);
+        CHECK(parser.queuedCommands() == 0);
+        CHECK(modem.done());
+        CHECK(modem.mismatches() == 0);
+        REQUIRE(log.lines.size() == 4);
+        CHECK(log.lines[0] == "");
+        CHECK(log.lines[1] == "352753090000000;");
+        CHECK(log.lines[2] == "");
+        CHECK(log.lines[3] == "");
+        CHECK(log.results == std::vector<int>({ AtResponse::OK, AtResponse::OK, 0, AtResponse::CME_ERROR }));
+        REQUIRE(urcs.lines.size() == 1);
+        CHECK(urcs.lines[0] == "+CIEV|+CIEV: 2,3");
+    }
+
+    SECTION("continues with the queue after a command times out") {
+        CommandLog log;
+        modem.expect("AT+COPS=0", "", 0);
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        REQUIRE(parser.queueCommand(1000, CommandLog::readAll, &log, "AT+COPS=0") == 0);
+        REQUIRE(parser.queueCommand(CommandLog::readAll, &log, "AT") == 0);
+        CHECK(parser.processCommands() == 2);
+        CHECK(log.results == std::vector<int>({ SYSTEM_ERROR_TIMEOUT, AtResponse::OK }));
+    }
+
+    SECTION("doesn't send queued commands while a command is active") {
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        auto resp = parser.sendCommand("AT");
+        REQUIRE(parser.queueCommand(nullptr, nullptr, "AT+CSQ") == 0);
+        CHECK(parser.processCommands() == SYSTEM_ERROR_BUSY);
+        CHECK(parser.queuedCommands() == 1);
+        CHECK(resp.readResult() == AtResponse::OK);
+    }
+}
+
+TEST_CASE("AT bring-up benchmark", "[.benchmark]") {
+    // Initialization sequence of a SARA-R410 with the latencies observed on a device, and the
+    // URCs it reports while registering
+    struct Step {
+        const char* cmd;
+        const char* resp;
+        unsigned latency;
+    };
+    const Step steps[] = {
+        { "AT", "\r\nOK\r\n", 15 },
+        { "AT+CMEE=2", "\r\nOK\r\n", 15 },
+        { "ATI9", "\r\nL0.0.00.00.05.08,A.02.04\r\n\r\nOK\r\n", 20 },
+        { "AT+CGMR", "\r\nL0.0.00.00.05.08 [Apr 17 2019 19:34:02]\r\n\r\nOK\r\n", 20 },
+        { "AT+IFC?", "\r\n+IFC: 2,2\r\n\r\nOK\r\n", 15 },
+        { "AT+CCID", "\r\n+CCID: 89014103211118510720\r\n\r\nOK\r\n", 30 },
+        { "AT+CGSN", "\r\n352753090000000\r\n\r\nOK\r\n", 15 },
+        { "AT+CIMI", "\r\n310410000000000\r\n\r\nOK\r\n", 20 },
+        { "AT+UMNOPROF?", "\r\n+UMNOPROF: 2\r\n\r\nOK\r\n", 20 },
+        { "AT+UBANDMASK?", "\r\n+UBANDMASK: 0,6170,1,6170\r\n\r\nOK\r\n", 20 },
+        { "AT+CGDCONT?", "\r\n+CGDCONT: 1,\"IP\",\"broadband\",\"10.0.0.1\",0,0,0,0\r\n\r\nOK\r\n", 25 },
+        { "AT+CEREG=2", "\r\nOK\r\n", 15 },
+        { "AT+CREG=2", "\r\nOK\r\n", 15 },
+        { "AT+CGREG=2", "\r\nOK\r\n", 15 },
+        { "AT+CFUN=1", "\r\nOK\r\n+CEREG: 2\r\n", 500 },
+        { "AT+COPS=0,2", "\r\nOK\r\n", 200 },
+        { "AT+CSQ", "\r\n+CSQ: 16,99\r\n\r\nOK\r\n", 15 },
+        { "AT+CEREG?", "\r\n+CEREG: 2,5,\"2B2D\",\"A7D1E10\",7\r\n\r\nOK\r\n", 15 },
+        { "AT+COPS?", "\r\n+COPS: 0,2,\"310410\",7\r\n\r\nOK\r\n", 20 },
+        { "AT+CGATT?", "\r\n+CGATT: 1\r\n\r\nOK\r\n", 15 },
+        { "AT+UPSV=0", "\r\nOK\r\n", 15 },
+        { "AT+CMUX=0,0,,1509,253,3,,,", "\r\nOK\r\n", 30 }
+    };
+    const unsigned ROUNDS = 200;
+    const char* const URC_PREFIXES[] = { "+CREG", "+CGREG", "+CEREG", "+UUSORD", "+UUSORF", "+UUSOCL",
+            "+UUSOLI", "+UUPSDD", "+UUPSDA", "+CIEV", "+UUHTTPCR", "+UULOC", "+UUSIMSTAT", "+CGEV", "+UUFWINSTALL" };
+
+    UrcLog urcs;
+    FakeModem modem;
+    auto parser = makeParser(&modem);
+    for (auto prefix: URC_PREFIXES) {
+        REQUIRE(parser.addUrcHandler(prefix, UrcLog::handler, &urcs) == 0);
+    }
+
+    // Sequential commands, as sent by the NCP clients today
+    const auto t1 = g_millis;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        for (const auto& s: steps) {
+            modem.expect(s.cmd, s.resp, s.latency);
+            REQUIRE(parser.execCommand(s.cmd) == AtResponse::OK);
+        }
+    }
+    const auto seqUsec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    const auto seqMillis = (g_millis - t1) / ROUNDS;
+    const auto seqReads = modem.reads();
+
+    // Queued commands
+    CommandLog log;
+    const auto t2 = g_millis;
+    start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < ROUNDS; ++i) {
+        for (const auto& s: steps) {
+            modem.expect(s.cmd, s.resp, s.latency);
+            REQUIRE(parser.queueCommand(CommandLog::readAll, &log, "%s", s.cmd) == 0);
+        }
+        REQUIRE(parser.processCommands() == (int)(sizeof(steps) / sizeof(steps[0])));
+    }
+    const auto queueUsec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    const auto queueMillis = (g_millis - t2) / ROUNDS;
+    CHECK(modem.mismatches() == 0);
+    CHECK(std::all_of(log.results.begin(), log.results.end(), [](int r) { return r == AtResponse::OK; }));
+    // The response to AT+CEREG? is dispatched to the URC handler as well, like on a device
+    CHECK(urcs.lines.size() == 4 * ROUNDS);
+
+    const auto commands = ROUNDS * (sizeof(steps) / sizeof(steps[0]));
+    WARN("Bring-up latency: sequential " << seqMillis << " ms, queued " << queueMillis << " ms");
+    WARN("Parser CPU time per command: sequential " << (double)seqUsec / commands << " us, queued "
+            << (double)queueUsec / commands << " us");
+    WARN("Stream reads per command: " << (double)seqReads / commands);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "at_profiler.h"
+#include "at_parser.h"
+#include "at_response.h"
+
+#include "fake_modem.h"
+
+#include <catch2/catch.hpp>
+
+using namespace particle;
+using namespace particle::test;
+
+TEST_CASE("AtProfiler") {
+    FakeModem modem;
+    AtProfiler profiler(&modem);
+    AtParser parser;
+    REQUIRE(parser.init(AtParserConfig().stream(&profiler).commandTimeout(1000)) == 0);
+    const auto t0 = g_millis;
+
+    SECTION("records the latency of each command") {
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        modem.expect("AT+CCID", "\r\n+CCID: 89014103211118510720\r\n\r\nOK\r\n", 30);
+        modem.expect("AT+CPIN?", "\r\n+CME ERROR: SIM busy\r\n", 50);
+        CHECK(parser.execCommand("AT") == AtResponse::OK);
+        CHECK(parser.execCommand("AT+CCID") == AtResponse::OK);
+        g_millis += 1000; // HAL_Delay_Milliseconds()
+        CHECK(parser.execCommand("AT+CPIN?") == AtResponse::CME_ERROR);
+        REQUIRE(profiler.stepCount() == 3);
+        CHECK(strcmp(profiler.step(0).command, "AT") == 0);
+        CHECK(profiler.step(0).start == t0);
+        CHECK(profiler.step(0).latency == 10);
+        CHECK(profiler.step(0).idle == 0);
+        CHECK(profiler.step(1).latency == 30);
+        CHECK(profiler.step(1).idle == 0);
+        CHECK(strcmp(profiler.step(2).command, "AT+CPIN?") == 0);
+        CHECK(profiler.step(2).latency == 50);
+        CHECK(profiler.step(2).idle == 1000);
+        CHECK(profiler.step(2).done);
+        CHECK(profiler.totalTime() == 1090);
+        CHECK(profiler.commandTime() == 90);
+        CHECK(profiler.idleTime() == 1000);
+    }
+
+    SECTION("records commands that time out") {
+        modem.expect("AT+COPS=0", "", 0);
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        CHECK(parser.execCommand(500, "AT+COPS=0") == SYSTEM_ERROR_TIMEOUT);
+        CHECK(parser.execCommand("AT") == AtResponse::OK);
+        REQUIRE(profiler.stepCount() == 2);
+        CHECK(!profiler.step(0).done);
+        CHECK(profiler.step(0).latency == 0);
+        CHECK(profiler.step(1).idle == 500);
+        CHECK(profiler.step(1).done);
+        CHECK(profiler.totalTime() == 510);
+    }
+
+    SECTION("ignores response lines that look like result codes") {
+        modem.expect("AT+COPS=?", "\r\n+COPS: (1,\"OK\",\"OK\",\"310410\",7)\r\n\r\nOK\r\n", 2000);
+        CHECK(parser.execCommand(5000, "AT+COPS=?") == AtResponse::OK);
+        REQUIRE(profiler.stepCount() == 1);
+        CHECK(profiler.step(0).latency == 2000);
+    }
+
+    SECTION("sees the data skipped by the parser") {
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        CHECK(profiler.write("AT\r\n", 4) == 4);
+        g_millis += 10;
+        CHECK(profiler.skip(100) == 9);
+        REQUIRE(profiler.stepCount() == 1);
+        CHECK(profiler.step(0).done);
+        CHECK(profiler.step(0).latency == 10);
+    }
+
+    SECTION("truncates long command lines and limits the number of steps") {
+        AtProfiler p(&modem, 2);
+        AtParser parser2;
+        REQUIRE(parser2.init(AtParserConfig().stream(&p)) == 0);
+        modem.expect("AT+CGDCONT=1,\"IP\",\"CHAP:broadband.example.com\"", "\r\nOK\r\n", 10);
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        modem.expect("AT", "\r\nOK\r\n", 10);
+        CHECK(parser2.execCommand("AT+CGDCONT=1,\"IP\",\"CHAP:broadband.example.com\"") == AtResponse::OK);
+        CHECK(parser2.execCommand("AT") == AtResponse::OK);
+        CHECK(parser2.execCommand("AT") == AtResponse::OK);
+        REQUIRE(p.stepCount() == 2);
+        CHECK(strcmp(p.step(0).command, "AT+CGDCONT=1,\"IP\",\"CHAP:broadba") == 0);
+        p.reset();
+        CHECK(p.stepCount() == 0);
+        CHECK(p.totalTime() == 0);
+    }
+
+    CHECK(modem.mismatches() == 0);
+}
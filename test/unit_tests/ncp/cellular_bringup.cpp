@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "network/ncp/cellular/cellular_ncp_init.h"
+
+#include "at_profiler.h"
+#include "at_parser.h"
+#include "at_response.h"
+
+#include "fake_modem.h"
+
+#include <catch2/catch.hpp>
+
+#include <cstring>
+
+using namespace particle;
+using namespace particle::test;
+
+namespace {
+
+const int NCP_ID = 0x02; // PLATFORM_NCP_SARA_R410
+const int SIM_TYPE = 1; // SimType::INTERNAL
+
+const char* const OK = "\r\nOK\r\n";
+const char* const REGISTERED = "\r\n+CEREG: 2,1,\"2B2D\",\"A7D1E10\",7\r\n\r\nOK\r\n";
+const char* const SEARCHING = "\r\n+CEREG: 2,2\r\n\r\nOK\r\n";
+
+const unsigned COPS_LATENCY = 3000;
+
+struct BootResult {
+    system_tick_t regStartTime; // Time until the client starts polling the registration state
+    system_tick_t commandTime;
+    system_tick_t idleTime;
+    unsigned commands;
+    bool registered;
+};
+
+// Runs the SARA-R410 command sequence of SaraNcpClient::initReady(), connect() and registerNet()
+// against responses and latencies recorded on a device. The steps that are skipped, deferred or
+// retried are decided by CellularNcpInit, which the client uses as well. The fixed delays of the
+// client are added to the virtual time, the time spent in the muxer and serial I/O is not
+class Bringup {
+public:
+    explicit Bringup(CellularNcpCache* cache) :
+            profiler_(&modem_),
+            init_(cache),
+            registered_(false) {
+        REQUIRE(parser_.init(AtParserConfig().stream(&profiler_).commandTimeout(5 * 60 * 1000)) == 0);
+    }
+
+    void initReady() {
+        init_.begin(NCP_ID, SIM_TYPE);
+        REQUIRE(exec("AT", OK, 15, 1000) == 0);
+        REQUIRE(init_.apply(CellularNcpCache::SIM_SELECTED, [this]() {
+            exec("AT+UGPIOC?", "\r\n+UGPIOC:\r\n16,255\r\n23,0\r\n24,255\r\n\r\nOK\r\n", 25, 1000);
+            return exec("AT+UGPIOR=23", "\r\n+UGPIO: 23,1\r\n\r\nOK\r\n", 20);
+        }) == 0);
+        REQUIRE(exec("AT+CPIN?", "\r\n+CPIN: READY\r\n\r\nOK\r\n", 30) == 0);
+        REQUIRE(exec("AT+COPS=3,2", OK, 20) == 0);
+        REQUIRE(init_.firmwareVersion([this]() {
+            return (exec("ATI9", "\r\nL0.0.00.00.05.08,A.02.04\r\n\r\nOK\r\n", 20) == 0) ? 204 : SYSTEM_ERROR_AT_NOT_OK;
+        }) == 204);
+        REQUIRE(exec("AT+IPR=115200", OK, 15) == 0);
+        REQUIRE(exec("AT", OK, 15, 1000) == 0);
+        REQUIRE(exec("AT+IFC=2,2", OK, 15) == 0);
+        REQUIRE(exec("AT", OK, 15) == 0);
+        REQUIRE(init_.apply(CellularNcpCache::RADIO_CONFIGURED, [this]() {
+            exec("AT+UMNOPROF?", "\r\n+UMNOPROF: 1\r\n\r\nOK\r\n", 20);
+            exec("AT+URAT?", "\r\n+URAT: 7\r\n\r\nOK\r\n", 20);
+            exec("AT+CEDRXS?", "\r\n+CEDRXS: 7,\"0000\"\r\n+CEDRXS: 8,\"0000\"\r\n\r\nOK\r\n", 25);
+            exec("AT+CEDRXS=3,7", OK, 210);
+            exec("AT+CEDRXS=3,8", OK, 190);
+            return exec("AT+CPSMS=0", OK, 150);
+        }) == 0);
+        REQUIRE(exec("AT+CMUX=0,0,,1509,,,,,", OK, 30) == 0);
+        // Muxer start-up and the AT channel
+        REQUIRE(exec("AT", OK, 15, 1200) == 0);
+        REQUIRE(CellularNcpInit::queueInfoQueries(&parser_) == 0);
+    }
+
+    void connect(bool modemRegistered) {
+        char imsi[32] = {};
+        modem_.expect("AT+CIMI", "\r\n310410000000000\r\n\r\nOK\r\n", 20);
+        REQUIRE(CellularNcpInit::readImsi(&parser_, imsi, sizeof(imsi), 1 /* attempts */) == AtResponse::OK);
+        REQUIRE(exec("AT+CGDCONT=1,\"IP\",\"broadband\"", OK, 20) == 0);
+        REQUIRE(exec("AT+CEREG=2", OK, 15) == 0);
+        REQUIRE(init_.registerNet([this, modemRegistered]() -> int {
+            modem_.expect("AT+CEREG?", modemRegistered ? REGISTERED : SEARCHING, 15);
+            auto resp = parser_.sendCommand("AT+CEREG?");
+            int stat = 0;
+            if (resp.scanf("+CEREG: %*d,%d", &stat) != 1 || resp.readResult() != AtResponse::OK) {
+                return SYSTEM_ERROR_AT_NOT_OK;
+            }
+            registered_ = (stat == 1);
+            return 0;
+        }, [this]() {
+            return registered_;
+        }, [this]() {
+            return exec("AT+COPS=0,2", OK, COPS_LATENCY);
+        }) == 0);
+    }
+
+    // SaraNcpClient::processEventsImpl() sends the deferred queries while polling the registration state
+    void processEvents() {
+        modem_.expect("AT+CCID", "\r\n+CCID: 89014103211118510720\r\n\r\nOK\r\n", 40);
+        CHECK(parser_.processCommands() == 1);
+        CHECK(parser_.queuedCommands() == 0);
+    }
+
+    CellularNcpInit& init() {
+        return init_;
+    }
+
+    BootResult boot(bool modemRegistered) {
+        const auto t0 = g_millis;
+        initReady();
+        connect(modemRegistered);
+        const auto regStartTime = g_millis - t0;
+        processEvents();
+        CHECK(modem_.done());
+        CHECK(modem_.mismatches() == 0);
+        // The modem registers eventually
+        init_.registered(true);
+        return { regStartTime, profiler_.commandTime(), profiler_.idleTime(), (unsigned)profiler_.stepCount(), registered_ };
+    }
+
+private:
+    FakeModem modem_;
+    AtProfiler profiler_;
+    AtParser parser_;
+    CellularNcpInit init_;
+    bool registered_;
+
+    int exec(const char* cmd, const char* resp, unsigned latency, unsigned delay = 0) {
+        g_millis += delay;
+        modem_.expect(cmd, resp, latency);
+        return (parser_.execCommand("%s", cmd) == AtResponse::OK) ? 0 : SYSTEM_ERROR_AT_NOT_OK;
+    }
+};
+
+struct BootResults {
+    BootResult cold;
+    BootResult warm;
+    BootResult warmRegistered;
+};
+
+BootResults replayBoots() {
+    CellularNcpCache cache;
+    memset(&cache, 0, sizeof(cache));
+
+    BootResults r;
+    // First boot: the cache gets populated
+    r.cold = Bringup(&cache).boot(false /* modemRegistered */);
+    {
+        // The device is reset and the modem is power cycled
+        Bringup b(&cache);
+        b.init().registered(false);
+        r.warm = b.boot(false);
+    }
+    // The device is reset while the modem stays registered
+    r.warmRegistered = Bringup(&cache).boot(true);
+    return r;
+}
+
+} // namespace
+
+TEST_CASE("CellularNcpCache") {
+    CellularNcpCache cache;
+    memset(&cache, 0xa5, sizeof(cache)); // Retained memory is not initialized on a cold boot
+
+    SECTION("is invalid until initialized") {
+        CHECK(!cache.isValid(NCP_ID, SIM_TYPE));
+        cache.init(NCP_ID, SIM_TYPE);
+        CHECK(cache.isValid(NCP_ID, SIM_TYPE));
+        CHECK(!cache.has(CellularNcpCache::SIM_SELECTED, NCP_ID, SIM_TYPE));
+        CHECK(!cache.has(CellularNcpCache::REGISTERED, NCP_ID, SIM_TYPE));
+        CHECK(cache.fwVersion == 0);
+    }
+
+    SECTION("keeps the cached state across initializations for the same configuration") {
+        cache.init(NCP_ID, SIM_TYPE);
+        cache.set(CellularNcpCache::SIM_SELECTED);
+        cache.firmwareVersion(204);
+        cache.init(NCP_ID, SIM_TYPE);
+        CHECK(cache.has(CellularNcpCache::SIM_SELECTED, NCP_ID, SIM_TYPE));
+        CHECK(cache.has(CellularNcpCache::FIRMWARE_VERSION, NCP_ID, SIM_TYPE));
+        CHECK(cache.fwVersion == 204);
+        cache.set(CellularNcpCache::SIM_SELECTED, false);
+        CHECK(!cache.has(CellularNcpCache::SIM_SELECTED, NCP_ID, SIM_TYPE));
+        CHECK(cache.has(CellularNcpCache::FIRMWARE_VERSION, NCP_ID, SIM_TYPE));
+    }
+
+    SECTION("is discarded when the configuration changes") {
+        cache.init(NCP_ID, SIM_TYPE);
+        cache.set(CellularNcpCache::SIM_SELECTED);
+        CHECK(!cache.has(CellularNcpCache::SIM_SELECTED, NCP_ID, 2 /* SimType::EXTERNAL */));
+        CHECK(!cache.has(CellularNcpCache::SIM_SELECTED, 0x01 /* PLATFORM_NCP_SARA_U201 */, SIM_TYPE));
+        cache.init(NCP_ID, 2);
+        CHECK(!cache.has(CellularNcpCache::SIM_SELECTED, NCP_ID, 2));
+        CHECK(!cache.isValid(NCP_ID, SIM_TYPE));
+    }
+
+    SECTION("detects corrupted contents") {
+        cache.init(NCP_ID, SIM_TYPE);
+        cache.set(CellularNcpCache::RADIO_CONFIGURED);
+        cache.flags |= CellularNcpCache::REGISTERED;
+        CHECK(!cache.isValid(NCP_ID, SIM_TYPE));
+    }
+
+    SECTION("can be invalidated") {
+        cache.init(NCP_ID, SIM_TYPE);
+        cache.set(CellularNcpCache::RADIO_CONFIGURED);
+        cache.invalidate();
+        CHECK(!cache.has(CellularNcpCache::RADIO_CONFIGURED, NCP_ID, SIM_TYPE));
+        cache.init(NCP_ID, SIM_TYPE);
+        CHECK(!cache.has(CellularNcpCache::RADIO_CONFIGURED, NCP_ID, SIM_TYPE));
+    }
+}
+
+TEST_CASE("Cellular bring-up replay") {
+    SECTION("skips the cached steps on a warm boot") {
+        const auto boots = replayBoots();
+        CHECK(!boots.cold.registered);
+        CHECK(!boots.warm.registered);
+        CHECK(boots.warmRegistered.registered);
+        CHECK(boots.warm.regStartTime < boots.cold.regStartTime);
+        CHECK(boots.warmRegistered.regStartTime < boots.warm.regStartTime);
+        CHECK(boots.warm.commands < boots.cold.commands);
+        CHECK(boots.warmRegistered.commands < boots.warm.commands);
+    }
+
+    SECTION("runs all steps again after a failed initialization") {
+        CellularNcpCache cache;
+        memset(&cache, 0, sizeof(cache));
+        const auto cold = Bringup(&cache).boot(false);
+        {
+            Bringup b(&cache);
+            b.initReady();
+            b.init().failed();
+        }
+        const auto next = Bringup(&cache).boot(false);
+        CHECK(next.commands == cold.commands);
+    }
+
+    SECTION("retries reading the IMSI") {
+        FakeModem modem;
+        AtParser parser;
+        REQUIRE(parser.init(AtParserConfig().stream(&modem)) == 0);
+        modem.expect("AT+CIMI", "\r\n+CME ERROR: 10\r\n", 20);
+        modem.expect("AT+CIMI", "\r\n310410000000000\r\n\r\nOK\r\n", 20);
+        char imsi[32] = {};
+        const auto t0 = g_millis;
+        CHECK(CellularNcpInit::readImsi(&parser, imsi, sizeof(imsi), 3 /* attempts */) == AtResponse::OK);
+        CHECK(strcmp(imsi, "310410000000000") == 0);
+        CHECK(g_millis - t0 >= 1000);
+        CHECK(modem.done());
+    }
+}
+
+TEST_CASE("Cellular bring-up replay benchmark", "[.benchmark]") {
+    const auto boots = replayBoots();
+    const auto& cold = boots.cold;
+    const auto& warm = boots.warm;
+    const auto& warmRegistered = boots.warmRegistered;
+
+    WARN("Cold boot: " << cold.regStartTime << " ms until registration polling, " << cold.commands
+            << " commands, " << cold.commandTime << " ms in commands, " << cold.idleTime << " ms idle");
+    WARN("Warm boot: " << warm.regStartTime << " ms until registration polling, " << warm.commands
+            << " commands, " << warm.commandTime << " ms in commands, " << warm.idleTime << " ms idle");
+    WARN("Warm boot, registered: " << warmRegistered.regStartTime << " ms until registered, " << warmRegistered.commands
+            << " commands, " << warmRegistered.commandTime << " ms in commands, " << warmRegistered.idleTime << " ms idle");
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "stream.h"
+#include "system_error.h"
+#include "system_tick_hal.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <string>
+
+namespace particle {
+
+namespace test {
+
+// Virtual time, advanced by the fake modem while the parser is waiting for data
+extern system_tick_t g_millis;
+
+// A DCE that answers the expected command lines with scripted responses after a given latency
+class FakeModem: public Stream {
+public:
+    FakeModem() :
+            echo_(true),
+            reads_(0),
+            mismatches_(0) {
+    }
+
+    // Expects a command line and sends a raw response, which normally ends with a final result code
+    FakeModem& expect(const char* cmd, const char* resp, unsigned latency = 0) {
+        script_.push_back({ cmd, resp, latency });
+        return *this;
+    }
+
+    // Sends data after a delay, without waiting for a command
+    FakeModem& send(const char* data, unsigned delay = 0) {
+        if (!*data) {
+            return *this;
+        }
+        output_.push_back({ g_millis + delay, data });
+        std::stable_sort(output_.begin(), output_.end(), [](const Chunk& a, const Chunk& b) {
+            return a.time < b.time;
+        });
+        return *this;
+    }
+
+    void echo(bool enabled) {
+        echo_ = enabled;
+    }
+
+    bool done() const {
+        return script_.empty() && output_.empty();
+    }
+
+    unsigned reads() const {
+        return reads_;
+    }
+
+    unsigned mismatches() const {
+        return mismatches_;
+    }
+
+    int read(char* data, size_t size) override {
+        ++reads_;
+        const int n = peek(data, size);
+        skip(n);
+        return n;
+    }
+
+    int peek(char* data, size_t size) override {
+        size_t n = 0;
+        for (auto it = output_.begin(); it != output_.end() && it->time <= g_millis && n < size; ++it) {
+            const size_t m = std::min(size - n, it->data.size() - it->offs);
+            memcpy(data + n, it->data.data() + it->offs, m);
+            n += m;
+        }
+        return n;
+    }
+
+    int skip(size_t size) override {
+        size_t n = 0;
+        while (!output_.empty() && output_.front().time <= g_millis && n < size) {
+            auto& c = output_.front();
+            const size_t m = std::min(size - n, c.data.size() - c.offs);
+            c.offs += m;
+            n += m;
+            if (c.offs == c.data.size()) {
+                output_.pop_front();
+            }
+        }
+        return n;
+    }
+
+    int availForRead() override {
+        size_t n = 0;
+        for (auto it = output_.begin(); it != output_.end() && it->time <= g_millis; ++it) {
+            n += it->data.size() - it->offs;
+        }
+        return n;
+    }
+
+    int write(const char* data, size_t size) override {
+        for (size_t i = 0; i < size; ++i) {
+            const char c = data[i];
+            if (c == '\n') {
+                continue;
+            }
+            if (c != '\r') {
+                line_ += c;
+                continue;
+            }
+            if (echo_) {
+                send((line_ + "\r").c_str());
+            }
+            if (!script_.empty() && script_.front().cmd == line_) {
+                const auto& e = script_.front();
+                send(e.resp.c_str(), e.latency);
+                script_.pop_front();
+            } else {
+                ++mismatches_;
+                send("\r\nERROR\r\n");
+            }
+            line_.clear();
+        }
+        return size;
+    }
+
+    int flush() override {
+        return 0;
+    }
+
+    int availForWrite() override {
+        return 1024;
+    }
+
+    int waitEvent(unsigned flags, unsigned timeout) override {
+        if (flags & Stream::WRITABLE) {
+            return Stream::WRITABLE;
+        }
+        if (availForRead() > 0) {
+            return Stream::READABLE;
+        }
+        if (!output_.empty() && output_.front().time - g_millis <= timeout) {
+            g_millis = output_.front().time;
+            return Stream::READABLE;
+        }
+        g_millis += timeout;
+        return SYSTEM_ERROR_TIMEOUT;
+    }
+
+private:
+    struct Entry {
+        std::string cmd;
+        std::string resp;
+        unsigned latency;
+    };
+
+    struct Chunk {
+        system_tick_t time;
+        std::string data;
+        size_t offs;
+
+        Chunk(system_tick_t time, std::string data) :
+                time(time),
+                data(std::move(data)),
+                offs(0) {
+        }
+    };
+
+    std::deque<Entry> script_;
+    std::deque<Chunk> output_;
+    std::string line_;
+    bool echo_;
+    unsigned reads_;
+    unsigned mismatches_;
+};
+
+} // particle::test
+
+} // particle
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fake_modem.h"
+
+#include "timer_hal.h"
+#include "delay_hal.h"
+
+namespace particle {
+
+namespace test {
+
+system_tick_t g_millis = 0;
+
+} // particle::test
+
+} // particle
+
+system_tick_t HAL_Timer_Get_Milli_Seconds() {
+    return particle::test::g_millis;
+}
+
+void HAL_Delay_Milliseconds(uint32_t millis) {
+    particle::test::g_millis += millis;
+}
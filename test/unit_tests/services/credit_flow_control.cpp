@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "credit_flow_control.h"
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace particle;
+
+namespace {
+
+struct FlowState {
+    std::atomic<bool> suspended;
+    std::atomic<unsigned> suspends;
+    std::atomic<unsigned> resumes;
+    std::atomic<bool> repeated;
+
+    FlowState() :
+            suspended(false),
+            suspends(0),
+            resumes(0),
+            repeated(false) {
+    }
+
+    static void callback(bool suspend, void* ctx) {
+        auto self = (FlowState*)ctx;
+        if (self->suspended.exchange(suspend) == suspend) {
+            self->repeated = true;
+        }
+        if (suspend) {
+            ++self->suspends;
+        } else {
+            ++self->resumes;
+        }
+    }
+};
+
+// Sizes of the frames received on the PPP channel of the muxer while downloading over TCP: full
+// segments interleaved with short LCP/IPCP and ACK frames
+const size_t MUXER_FRAME_SIZES[] = { 1509, 1509, 1509, 1509, 62, 1509, 1509, 1509, 58, 1509, 1509, 340 };
+
+// A queue between the muxer thread and the TCP/IP thread that is backed by a fixed pool of
+// buffers, similar to PBUF_POOL
+class InputQueue {
+public:
+    explicit InputQueue(size_t poolSize) :
+            poolSize_(poolSize),
+            poolUsed_(0),
+            done_(false) {
+    }
+
+    bool put(const uint8_t* data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (poolUsed_ + size > poolSize_) {
+            return false;
+        }
+        poolUsed_ += size;
+        queue_.emplace_back(data, data + size);
+        cond_.notify_one();
+        return true;
+    }
+
+    bool get(std::vector<uint8_t>* data) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return !queue_.empty() || done_; });
+        if (queue_.empty()) {
+            return false;
+        }
+        *data = std::move(queue_.front());
+        queue_.pop_front();
+        poolUsed_ -= data->size();
+        return true;
+    }
+
+    void done() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        cond_.notify_one();
+    }
+
+private:
+    std::deque<std::vector<uint8_t>> queue_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t poolSize_;
+    size_t poolUsed_;
+    bool done_;
+};
+
+struct ReplayResult {
+    double mbps; // Delivered bytes
+    size_t dropped;
+};
+
+// Feeds the trace from a muxer thread to a TCP/IP thread that parses it. The modem keeps sending
+// a few frames after the channel has been suspended, like a real one does until it processes the
+// MSC command
+ReplayResult replay(const std::vector<std::vector<uint8_t>>& trace, size_t poolSize, bool flowControl) {
+    const unsigned MODEM_LAG_FRAMES = 2;
+    InputQueue queue(poolSize);
+    FlowState flow;
+    CreditFlowControl credits(poolSize / 2, poolSize / 8, &FlowState::callback, &flow);
+    size_t dropped = 0;
+    size_t delivered = 0;
+    uint32_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread tcpip([&]() {
+        std::vector<uint8_t> chunk;
+        while (queue.get(&chunk)) {
+            // HDLC unescaping and FCS calculation touch every byte
+            for (auto b: chunk) {
+                checksum = (checksum >> 8) ^ ((checksum ^ b) * 0x01000193u);
+            }
+            delivered += chunk.size();
+            if (flowControl) {
+                credits.release(chunk.size());
+            }
+        }
+    });
+    unsigned lag = 0;
+    for (const auto& frame: trace) {
+        if (flowControl) {
+            if (!flow.suspended) {
+                lag = 0;
+            } else if (lag < MODEM_LAG_FRAMES) {
+                ++lag;
+            } else {
+                while (flow.suspended) {
+                    std::this_thread::yield();
+                }
+                lag = 0;
+            }
+            credits.take(frame.size());
+        }
+        if (!queue.put(frame.data(), frame.size())) {
+            ++dropped;
+            if (flowControl) {
+                credits.release(frame.size());
+            }
+        }
+    }
+    queue.done();
+    tcpip.join();
+    const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    CHECK(checksum != 0);
+    CHECK(credits.outstanding() == 0);
+    return { (double)delivered / (usec ? usec : 1), dropped };
+}
+
+} // namespace
+
+TEST_CASE("CreditFlowControl") {
+    FlowState flow;
+    CreditFlowControl credits(1000, 200, &FlowState::callback, &flow);
+
+    SECTION("suspends at the high watermark and resumes at the low watermark") {
+        credits.take(600);
+        CHECK(!credits.suspended());
+        credits.take(400);
+        CHECK(credits.suspended());
+        CHECK(flow.suspended);
+        credits.take(500);
+        CHECK(flow.suspends == 1);
+        credits.release(1000);
+        CHECK(credits.suspended());
+        CHECK(credits.outstanding() == 500);
+        credits.release(300);
+        CHECK(!credits.suspended());
+        CHECK(!flow.suspended);
+        CHECK(flow.resumes == 1);
+        credits.release(200);
+        CHECK(credits.outstanding() == 0);
+        CHECK(flow.resumes == 1);
+    }
+
+    SECTION("works without a callback") {
+        CreditFlowControl c(10, 5);
+        c.take(20);
+        CHECK(c.suspended());
+        c.release(20);
+        CHECK(!c.suspended());
+    }
+
+    SECTION("state changes from concurrent threads are applied in order") {
+        const unsigned CHUNKS = 200000;
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<size_t> queue;
+        bool done = false;
+        std::thread consumer([&]() {
+            for (;;) {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]() { return !queue.empty() || done; });
+                if (queue.empty()) {
+                    break;
+                }
+                auto size = queue.front();
+                queue.pop_front();
+                lock.unlock();
+                credits.release(size);
+            }
+        });
+        std::mt19937 gen(1);
+        for (unsigned i = 0; i < CHUNKS; ++i) {
+            while (flow.suspended) {
+                std::this_thread::yield();
+            }
+            size_t size = gen() % 300 + 1;
+            credits.take(size);
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(size);
+            cond.notify_one();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            cond.notify_one();
+        }
+        consumer.join();
+        CHECK(credits.outstanding() == 0);
+        CHECK(!credits.suspended());
+        CHECK(!flow.suspended);
+        CHECK(!flow.repeated);
+        CHECK(flow.suspends == flow.resumes);
+    }
+}
+
+TEST_CASE("PPP receive replay benchmark", "[.benchmark]") {
+    // 16 pool buffers of TCP_MSS + headers, see lwipopts.h
+    const size_t POOL_SIZE = 16 * 592;
+    const size_t TRACE_BYTES = 8 * 1024 * 1024;
+
+    std::vector<std::vector<uint8_t>> trace;
+    std::mt19937 gen(1);
+    size_t bytes = 0;
+    for (size_t i = 0; bytes < TRACE_BYTES; ++i) {
+        const auto size = MUXER_FRAME_SIZES[i % (sizeof(MUXER_FRAME_SIZES) / sizeof(MUXER_FRAME_SIZES[0]))];
+        std::vector<uint8_t> frame(size);
+        for (auto& b: frame) {
+            b = gen();
+        }
+        trace.push_back(std::move(frame));
+        bytes += size;
+    }
+
+    const auto uncontrolled = replay(trace, POOL_SIZE, false);
+    const auto controlled = replay(trace, POOL_SIZE, true);
+    WARN("Frames: " << trace.size() << ", bytes: " << bytes);
+    WARN("Fixed pool: " << uncontrolled.mbps << " MB/s, dropped frames: " << uncontrolled.dropped);
+    WARN("Credit flow control: " << controlled.mbps << " MB/s, dropped frames: " << controlled.dropped);
+    CHECK(controlled.dropped == 0);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filesystem.h"
+
+#include <cstring>
+
+namespace {
+
+uint8_t g_flash[FILESYSTEM_BLOCK_SIZE * FILESYSTEM_BLOCK_COUNT];
+size_t g_progBytes = 0;
+size_t g_eraseCount = 0;
+
+filesystem_t g_fs = {};
+
+int fs_read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
+    memcpy(buffer, g_flash + block * c->block_size + off, size);
+    return 0;
+}
+
+int fs_prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size) {
+    uint8_t* p = g_flash + block * c->block_size + off;
+    const uint8_t* b = (const uint8_t*)buffer;
+    for (lfs_size_t i = 0; i < size; ++i) {
+        /* NOR flash can only clear bits */
+        p[i] &= b[i];
+    }
+    g_progBytes += size;
+    return 0;
+}
+
+int fs_erase(const struct lfs_config* c, lfs_block_t block) {
+    memset(g_flash + block * c->block_size, 0xff, c->block_size);
+    ++g_eraseCount;
+    return 0;
+}
+
+int fs_sync(const struct lfs_config* c) {
+    return 0;
+}
+
+} // namespace
+
+int filesystem_mount(filesystem_t* fs) {
+    if (fs->state) {
+        return 0;
+    }
+
+    fs->config.read = &fs_read;
+    fs->config.prog = &fs_prog;
+    fs->config.erase = &fs_erase;
+    fs->config.sync = &fs_sync;
+    fs->config.read_size = FILESYSTEM_READ_SIZE;
+    fs->config.prog_size = FILESYSTEM_PROG_SIZE;
+    fs->config.block_size = FILESYSTEM_BLOCK_SIZE;
+    fs->config.block_count = FILESYSTEM_BLOCK_COUNT;
+    fs->config.lookahead = FILESYSTEM_LOOKAHEAD;
+
+    int ret = lfs_mount(&fs->instance, &fs->config);
+    if (ret) {
+        ret = lfs_format(&fs->instance, &fs->config);
+        if (ret) {
+            return ret;
+        }
+        ret = lfs_mount(&fs->instance, &fs->config);
+    }
+
+    fs->state = !ret;
+
+    return ret;
+}
+
+int filesystem_unmount(filesystem_t* fs) {
+    if (!fs->state) {
+        return 0;
+    }
+
+    fs->state = false;
+
+    return lfs_unmount(&fs->instance);
+}
+
+filesystem_t* filesystem_get_instance(void* reserved) {
+    return &g_fs;
+}
+
+int filesystem_lock(filesystem_t* fs) {
+    return 0;
+}
+
+int filesystem_unlock(filesystem_t* fs) {
+    return 0;
+}
+
+namespace particle { namespace test {
+
+void filesystem_reset() {
+    filesystem_unmount(&g_fs);
+    memset(g_flash, 0xff, sizeof(g_flash));
+    g_progBytes = 0;
+    g_eraseCount = 0;
+}
+
+size_t filesystem_prog_bytes() {
+    return g_progBytes;
+}
+
+size_t filesystem_erase_count() {
+    return g_eraseCount;
+}
+
+} } /* particle::test */
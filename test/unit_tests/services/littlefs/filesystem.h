@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * LittleFS instance backed by a RAM block device, with the same interface as the filesystem
+ * HAL of the nRF52840 platform.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <lfs_util.h>
+#include <lfs.h>
+
+#define FILESYSTEM_PROG_SIZE    (256)
+#define FILESYSTEM_READ_SIZE    (256)
+#define FILESYSTEM_BLOCK_SIZE   (4096)
+#define FILESYSTEM_BLOCK_COUNT  (256)
+#define FILESYSTEM_LOOKAHEAD    (128)
+
+typedef struct {
+    struct lfs_config config;
+    lfs_t instance;
+
+    bool state;
+} filesystem_t;
+
+int filesystem_mount(filesystem_t* fs);
+int filesystem_unmount(filesystem_t* fs);
+filesystem_t* filesystem_get_instance(void* reserved);
+
+int filesystem_lock(filesystem_t* fs);
+int filesystem_unlock(filesystem_t* fs);
+
+#ifdef __cplusplus
+}
+
+namespace particle { namespace fs {
+
+struct FsLock {
+    FsLock(filesystem_t* fs)
+            : fs_(fs) {
+        lock();
+    }
+
+    ~FsLock() {
+        unlock();
+    }
+
+    void lock() {
+        filesystem_lock(fs_);
+    }
+
+    void unlock() {
+        filesystem_unlock(fs_);
+    }
+
+private:
+    filesystem_t* fs_;
+};
+
+} } /* particle::fs */
+
+namespace particle { namespace test {
+
+/**
+ * Erases the block device and discards the mounted filesystem.
+ */
+void filesystem_reset();
+
+/**
+ * Total number of bytes programmed to the block device and number of erased blocks.
+ */
+size_t filesystem_prog_bytes();
+size_t filesystem_erase_count();
+
+} } /* particle::test */
+
+#endif /* __cplusplus */
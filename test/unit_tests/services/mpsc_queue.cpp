@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mpsc_queue.h"
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace particle;
+
+namespace {
+
+const unsigned PRODUCER_COUNT = 4;
+const unsigned ITEMS_PER_PRODUCER = 100000;
+const size_t QUEUE_SIZE = 50; // Same as the system thread queue
+
+// Producer index in the upper bits, sequence number in the lower bits
+uintptr_t makeItem(unsigned producer, unsigned seq) {
+    return ((uintptr_t)producer << 24) | seq;
+}
+
+// The queue that was used before: a bounded queue protected by a lock, with
+// blocking put and take like os_queue_put() and os_queue_take()
+class LockingQueue {
+public:
+    void init(size_t size) {
+        size_ = size;
+    }
+
+    void put(uintptr_t item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this]() { return items_.size() < size_; });
+        items_.push_back(item);
+        notEmpty_.notify_one();
+    }
+
+    uintptr_t take() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this]() { return !items_.empty(); });
+        const uintptr_t item = items_.front();
+        items_.pop_front();
+        notFull_.notify_one();
+        return item;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::deque<uintptr_t> items_;
+    size_t size_ = 0;
+};
+
+// Binary semaphore with the semantics of os_semaphore_t
+class Semaphore {
+public:
+    void give() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        given_ = true;
+        cond_.notify_one();
+    }
+
+    void take(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait_for(lock, timeout, [this]() { return given_; });
+        given_ = false;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool given_ = false;
+};
+
+// Blocking wrapper around MpscQueue that mirrors MpscQueueStrategy: a thread only
+// sleeps after it has announced that it is waiting, and is only signalled if it did
+class WaitingMpscQueue {
+public:
+    void init(size_t size) {
+        queue_.init(size);
+    }
+
+    void put(uintptr_t item) {
+        while (!queue_.push(item)) {
+            blocked_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (queue_.push(item)) {
+                blocked_.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            space_.take(std::chrono::milliseconds(100));
+            blocked_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_relaxed) && waiting_.exchange(false, std::memory_order_relaxed)) {
+            signal_.give();
+        }
+    }
+
+    uintptr_t take() {
+        uintptr_t item = 0;
+        while (!queue_.pop(item)) {
+            waiting_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (queue_.pop(item)) {
+                waiting_.store(false, std::memory_order_relaxed);
+                break;
+            }
+            signal_.take(std::chrono::milliseconds(100));
+            waiting_.store(false, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (blocked_.load(std::memory_order_relaxed)) {
+            space_.give();
+        }
+        return item;
+    }
+
+private:
+    MpscQueue<uintptr_t> queue_;
+    std::atomic<bool> waiting_{false};
+    std::atomic<unsigned> blocked_{0};
+    Semaphore signal_;
+    Semaphore space_;
+};
+
+// Simulates the work a thread does between two calls into the system thread
+void doWork(unsigned iterations) {
+    volatile unsigned n = 0;
+    for (unsigned i = 0; i < iterations; ++i) {
+        n = n + i;
+    }
+}
+
+struct ContentionResult {
+    double itemsPerSec;
+    double putNs; // Average time a producer spends posting an item
+};
+
+// Runs several producer threads posting to a single consumer thread
+template<typename QueueT>
+ContentionResult runContention(unsigned producers, unsigned itemsPerProducer, unsigned work = 0) {
+    QueueT queue;
+    queue.init(QUEUE_SIZE);
+    std::vector<unsigned> next(producers, 0);
+    bool ordered = true;
+    const auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]() {
+        for (unsigned i = 0; i < producers * itemsPerProducer; ++i) {
+            const uintptr_t item = queue.take();
+            const unsigned producer = item >> 24;
+            const unsigned seq = item & 0xffffff;
+            if (producer >= producers || next[producer] != seq) {
+                ordered = false;
+            } else {
+                ++next[producer];
+            }
+        }
+    });
+    std::vector<std::thread> threads;
+    std::vector<std::chrono::nanoseconds> putTime(producers);
+    for (unsigned p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, &putTime, p, itemsPerProducer, work]() {
+            for (unsigned i = 0; i < itemsPerProducer; ++i) {
+                doWork(work);
+                const auto t = std::chrono::steady_clock::now();
+                queue.put(makeItem(p, i));
+                putTime[p] += std::chrono::steady_clock::now() - t;
+            }
+        });
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+    consumer.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    CHECK(ordered);
+    for (unsigned p = 0; p < producers; ++p) {
+        CHECK(next[p] == itemsPerProducer);
+    }
+    std::chrono::nanoseconds totalPutTime(0);
+    for (const auto& t: putTime) {
+        totalPutTime += t;
+    }
+    const double items = producers * itemsPerProducer;
+    return { items / elapsed.count(), totalPutTime.count() / items };
+}
+
+} // namespace
+
+TEST_CASE("MpscQueue") {
+    SECTION("capacity is rounded up to a power of two") {
+        MpscQueue<int> q;
+        CHECK(q.capacity() == 0);
+        CHECK(q.init(50));
+        CHECK(q.capacity() == 64);
+        CHECK(q.init(1));
+        CHECK(q.capacity() == 2);
+    }
+
+    SECTION("an uninitialized queue rejects items") {
+        MpscQueue<int> q;
+        int v = 0;
+        CHECK(!q.push(1));
+        CHECK(!q.pop(v));
+        CHECK(q.empty());
+    }
+
+    SECTION("items are taken in FIFO order") {
+        MpscQueue<int> q;
+        REQUIRE(q.init(4));
+        CHECK(q.empty());
+        for (int round = 0; round < 10; ++round) {
+            for (int i = 0; i < 3; ++i) {
+                CHECK(q.push(round * 10 + i));
+            }
+            CHECK(!q.empty());
+            for (int i = 0; i < 3; ++i) {
+                int v = -1;
+                CHECK(q.pop(v));
+                CHECK(v == round * 10 + i);
+            }
+            CHECK(q.empty());
+        }
+    }
+
+    SECTION("push fails when the queue is full") {
+        MpscQueue<int> q;
+        REQUIRE(q.init(4));
+        for (int i = 0; i < 4; ++i) {
+            CHECK(q.push(i));
+        }
+        CHECK(!q.push(4));
+        int v = -1;
+        CHECK(q.pop(v));
+        CHECK(v == 0);
+        CHECK(q.push(4));
+        for (int i = 1; i <= 4; ++i) {
+            CHECK(q.pop(v));
+            CHECK(v == i);
+        }
+        CHECK(!q.pop(v));
+    }
+
+    SECTION("items from concurrent producers are all delivered in per-producer order") {
+        runContention<WaitingMpscQueue>(PRODUCER_COUNT, 20000);
+    }
+}
+
+TEST_CASE("MpscQueue contention benchmark", "[.benchmark]") {
+    for (unsigned work: { 0, 200, 2000 }) {
+        const auto locking = runContention<LockingQueue>(PRODUCER_COUNT, ITEMS_PER_PRODUCER, work);
+        const auto lockFree = runContention<WaitingMpscQueue>(PRODUCER_COUNT, ITEMS_PER_PRODUCER, work);
+        WARN(PRODUCER_COUNT << " producers, 1 consumer, " << work << " work iterations per item: "
+                << "lock-free " << (unsigned)(lockFree.itemsPerSec / 1000) << "k items/s, " << (unsigned)lockFree.putNs << "ns per put; "
+                << "locking " << (unsigned)(locking.itemsPerSec / 1000) << "k items/s, " << (unsigned)locking.putNs << "ns per put");
+    }
+}
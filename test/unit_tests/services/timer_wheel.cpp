@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timer_wheel.h"
+#include "intrusive_hash_table.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace particle;
+
+namespace {
+
+struct Timer: TimerWheelNode<Timer> {
+    unsigned id = 0;
+    uint32_t expiredAt = 0;
+    bool expired = false;
+};
+
+// Address and port of a translated flow, similar to the transport addresses of NAT64 BIB entries
+struct Flow: TimerWheelNode<Flow> {
+    Flow* next = nullptr; // List and hash chain
+    uint32_t addr[4] = {};
+    uint16_t port = 0;
+    uint32_t lifetime = 0; // For the linear expiry
+    bool active = false;
+
+    bool matches(const uint32_t* a, uint16_t p) const {
+        return port == p && addr[0] == a[0] && addr[1] == a[1] && addr[2] == a[2] && addr[3] == a[3];
+    }
+};
+
+size_t flowHash(const uint32_t* addr, uint16_t port) {
+    size_t h = port;
+    for (int i = 0; i < 4; ++i) {
+        h = h * 31 + addr[i];
+    }
+    return h ^ (h >> 16);
+}
+
+} // namespace
+
+TEST_CASE("TimerWheel") {
+    SECTION("items expire at their expiry tick") {
+        typedef TimerWheel<Timer, 3, 2> Wheel; // 8 slots per level, small enough to exercise the higher levels
+        for (uint32_t start: { 0u, 0xffffff00u }) {
+            Wheel wheel(start);
+            std::mt19937 gen(start);
+            std::vector<Timer> timers(500);
+            for (unsigned i = 0; i < timers.size(); ++i) {
+                timers[i].id = i;
+                // Include delays beyond the range of the wheel
+                wheel.add(&timers[i], start + 1 + gen() % (Wheel::MAX_DELAY * 3));
+            }
+            REQUIRE(wheel.size() == timers.size());
+            while (wheel.size() > 0) {
+                wheel.advance(1 + gen() % 5, [&](Timer* t) {
+                    t->expired = true;
+                    t->expiredAt = wheel.now();
+                });
+                // Every item should expire at the latest at the end of the advanced interval
+                for (const auto& t: timers) {
+                    if ((int32_t)(t.expiry() - wheel.now()) <= 0) {
+                        REQUIRE(t.expired);
+                    } else {
+                        REQUIRE_FALSE(t.expired);
+                    }
+                }
+            }
+        }
+    }
+
+    SECTION("items expire exactly at their expiry tick when advanced one tick at a time") {
+        TimerWheel<Timer, 2, 3> wheel;
+        std::vector<Timer> timers(200);
+        for (unsigned i = 0; i < timers.size(); ++i) {
+            wheel.add(&timers[i], 1 + i);
+        }
+        while (wheel.size() > 0) {
+            wheel.advance(1, [&](Timer* t) {
+                CHECK(t->expiry() == wheel.now());
+                t->expired = true;
+            });
+        }
+        for (const auto& t: timers) {
+            CHECK(t.expired);
+        }
+    }
+
+    SECTION("postponed items expire at the new expiry tick") {
+        TimerWheel<Timer, 3, 2> wheel;
+        Timer t1, t2;
+        wheel.add(&t1, 10);
+        wheel.add(&t2, 10);
+        wheel.advance(5, [](Timer* t) { FAIL(); });
+        wheel.postpone(&t1, 100);
+        unsigned count = 0;
+        wheel.advance(5, [&](Timer* t) {
+            CHECK(t == &t2);
+            ++count;
+        });
+        CHECK(count == 1);
+        wheel.advance(89, [](Timer* t) { FAIL(); });
+        wheel.advance(1, [&](Timer* t) {
+            CHECK(t == &t1);
+            CHECK(wheel.now() == 100);
+            ++count;
+        });
+        CHECK(count == 2);
+        CHECK(wheel.size() == 0);
+    }
+
+    SECTION("expired items can be added again from the callback") {
+        TimerWheel<Timer> wheel;
+        Timer t;
+        wheel.add(&t, 3);
+        unsigned count = 0;
+        wheel.advance(30, [&](Timer* t) {
+            ++count;
+            wheel.add(t, wheel.now() + 3);
+        });
+        CHECK(count == 10);
+        CHECK(wheel.size() == 1);
+    }
+}
+
+TEST_CASE("IntrusiveHashTable") {
+    IntrusiveHashTable<Flow, 4, &Flow::next> table;
+    std::vector<Flow> flows(20);
+    for (unsigned i = 0; i < flows.size(); ++i) {
+        flows[i].addr[3] = i;
+        flows[i].port = i;
+        table.insert(&flows[i], flowHash(flows[i].addr, flows[i].port));
+    }
+    CHECK(table.size() == flows.size());
+
+    for (auto& f: flows) {
+        auto found = table.find(flowHash(f.addr, f.port), [&](const Flow* e) { return e->matches(f.addr, f.port); });
+        CHECK(found == &f);
+    }
+
+    CHECK(table.remove(&flows[5], flowHash(flows[5].addr, flows[5].port)));
+    CHECK_FALSE(table.remove(&flows[5], flowHash(flows[5].addr, flows[5].port)));
+    CHECK(table.size() == flows.size() - 1);
+    CHECK(table.find(flowHash(flows[5].addr, flows[5].port), [&](const Flow* e) { return e->matches(flows[5].addr, flows[5].port); }) == nullptr);
+    CHECK(table.find(flowHash(flows[6].addr, flows[6].port), [&](const Flow* e) { return e->matches(flows[6].addr, flows[6].port); }) == &flows[6]);
+}
+
+// Replays a packet trace of a number of UDP flows through the lookup and expiry structures used
+// by NAT64, and compares them with the linked lists they replaced
+TEST_CASE("NAT64 flow replay benchmark", "[.benchmark]") {
+    using Clock = std::chrono::steady_clock;
+    const unsigned PACKETS_PER_TICK = 200;
+    const unsigned TICKS = 300;
+    const uint32_t LIFETIME = 120; // Ticks of 1s, see DEFAULT_UDP_NAT_LIFETIME
+
+    for (unsigned flowCount: { 10u, 100u, 1000u }) {
+        std::vector<Flow> flows(flowCount);
+        std::mt19937 gen(flowCount);
+        for (unsigned i = 0; i < flowCount; ++i) {
+            flows[i].addr[0] = 0xfd000000;
+            flows[i].addr[3] = gen();
+            flows[i].port = 1024 + i;
+        }
+        // Flows become idle and expire while others keep sending
+        std::vector<unsigned> trace;
+        for (unsigned i = 0; i < PACKETS_PER_TICK * TICKS; ++i) {
+            trace.push_back(gen() % flowCount);
+        }
+
+        // Linear lookup and a full walk on every tick
+        Flow* list = nullptr;
+        auto start = Clock::now();
+        for (unsigned tick = 0; tick < TICKS; ++tick) {
+            for (unsigned i = tick * PACKETS_PER_TICK; i < (tick + 1) * PACKETS_PER_TICK; ++i) {
+                Flow* f = &flows[trace[i]];
+                Flow* found = nullptr;
+                for (Flow* e = list; e != nullptr; e = e->next) {
+                    if (e->matches(f->addr, f->port)) {
+                        found = e;
+                        break;
+                    }
+                }
+                if (!found) {
+                    f->next = list;
+                    list = f;
+                    found = f;
+                }
+                found->lifetime = LIFETIME;
+            }
+            for (Flow** p = &list; *p != nullptr;) {
+                if ((*p)->lifetime <= 1) {
+                    *p = (*p)->next;
+                } else {
+                    --(*p)->lifetime;
+                    p = &(*p)->next;
+                }
+            }
+        }
+        const double listNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / trace.size();
+
+        // Hashed lookup and a timer wheel
+        IntrusiveHashTable<Flow, 64, &Flow::next> table;
+        TimerWheel<Flow> wheel;
+        start = Clock::now();
+        for (unsigned tick = 0; tick < TICKS; ++tick) {
+            for (unsigned i = tick * PACKETS_PER_TICK; i < (tick + 1) * PACKETS_PER_TICK; ++i) {
+                Flow* f = &flows[trace[i]];
+                const size_t h = flowHash(f->addr, f->port);
+                Flow* found = table.find(h, [f](const Flow* e) { return e->matches(f->addr, f->port); });
+                if (!found) {
+                    table.insert(f, h);
+                    wheel.add(f, wheel.now() + LIFETIME);
+                } else {
+                    wheel.postpone(found, wheel.now() + LIFETIME);
+                }
+            }
+            wheel.advance(1, [&table](Flow* e) {
+                table.remove(e, flowHash(e->addr, e->port));
+            });
+        }
+        const double hashNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / trace.size();
+
+        WARN(flowCount << " flows: " << listNs << "ns per packet with lists, " << hashNs << "ns with a hash table and a timer wheel");
+    }
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tlv_file.h"
+#include "system_error.h"
+
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <string>
+
+using namespace particle::services::settings;
+using namespace particle::test;
+
+namespace {
+
+const char* const PATH = "/sys/test.dat";
+
+std::string getString(TlvFile& file, uint16_t key, int index = 0) {
+    char buf[256];
+    auto n = file.get(key, (uint8_t*)buf, sizeof(buf), index);
+    if (n < 0) {
+        return std::string();
+    }
+    return std::string(buf, n);
+}
+
+int setString(TlvFile& file, uint16_t key, const std::string& value, int index = -1) {
+    return file.set(key, (const uint8_t*)value.data(), value.size(), index);
+}
+
+int addString(TlvFile& file, uint16_t key, const std::string& value) {
+    return file.add(key, (const uint8_t*)value.data(), value.size());
+}
+
+// Returns the magic number stored in the file footer
+uint32_t footerMagick(const char* path) {
+    auto fs = filesystem_get_instance(nullptr);
+    lfs_file_t f = {};
+    uint32_t magick = 0;
+    if (lfs_file_open(&fs->instance, &f, path, LFS_O_RDONLY) == 0) {
+        if (lfs_file_seek(&fs->instance, &f, -(lfs_soff_t)sizeof(magick), LFS_SEEK_END) >= 0) {
+            lfs_file_read(&fs->instance, &f, &magick, sizeof(magick));
+        }
+        lfs_file_close(&fs->instance, &f);
+    }
+    return magick;
+}
+
+} // namespace
+
+TEST_CASE("TlvFile") {
+    filesystem_reset();
+    TlvFile file(PATH);
+    REQUIRE(file.init() == 0);
+
+    SECTION("get() returns the most recently set value") {
+        REQUIRE(setString(file, 1, "abc") == 0);
+        REQUIRE(setString(file, 2, "defg") == 0);
+        REQUIRE(setString(file, 1, "hi") == 0);
+        CHECK(getString(file, 1) == "hi");
+        CHECK(getString(file, 2) == "defg");
+        char c;
+        CHECK(file.get(3, (uint8_t*)&c, sizeof(c)) == SYSTEM_ERROR_NOT_FOUND);
+    }
+
+    SECTION("entries with the same key are addressed by index") {
+        REQUIRE(addString(file, 5, "a") == 0);
+        REQUIRE(addString(file, 4, "x") == 0);
+        REQUIRE(addString(file, 5, "b") == 0);
+        REQUIRE(addString(file, 5, "c") == 0);
+        CHECK(getString(file, 5, 0) == "a");
+        CHECK(getString(file, 5, 1) == "b");
+        CHECK(getString(file, 5, 2) == "c");
+        CHECK(getString(file, 5, -1) == "c");
+        CHECK(getString(file, 5, 3) == "");
+
+        REQUIRE(file.del(5, 1) == 0);
+        CHECK(getString(file, 5, 0) == "a");
+        CHECK(getString(file, 5, 1) == "c");
+        CHECK(getString(file, 4) == "x");
+
+        REQUIRE(file.del(5) == 0);
+        CHECK(file.del(5) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(getString(file, 4) == "x");
+    }
+
+    SECTION("directory is rebuilt when the file is reopened") {
+        REQUIRE(setString(file, 1, "one") == 0);
+        REQUIRE(addString(file, 2, "two") == 0);
+        REQUIRE(addString(file, 2, "three") == 0);
+        REQUIRE(setString(file, 1, "four") == 0);
+        REQUIRE(file.del(2, 0) == 0);
+        REQUIRE(file.deInit() == 0);
+
+        TlvFile file2(PATH);
+        REQUIRE(file2.init() == 0);
+        CHECK(getString(file2, 1) == "four");
+        CHECK(getString(file2, 2, 0) == "three");
+        CHECK(getString(file2, 2, 1) == "");
+        file2.deInit();
+    }
+
+    SECTION("changes made in a batch are committed together") {
+        REQUIRE(file.beginBatch() == 0);
+        for (int i = 0; i < 10; ++i) {
+            REQUIRE(setString(file, i, std::to_string(i)) == 0);
+        }
+        REQUIRE(file.commitBatch() == 0);
+        CHECK(file.commitBatch() == SYSTEM_ERROR_INVALID_STATE);
+
+        REQUIRE(file.deInit() == 0);
+        TlvFile file2(PATH);
+        REQUIRE(file2.init() == 0);
+        for (int i = 0; i < 10; ++i) {
+            CHECK(getString(file2, i) == std::to_string(i));
+        }
+        file2.deInit();
+    }
+
+    SECTION("a file containing deleted entries uses a different magic number") {
+        REQUIRE(addString(file, 1, "a") == 0);
+        REQUIRE(addString(file, 2, "b") == 0);
+        CHECK(footerMagick(PATH) == TLV_FILE_MAGICK);
+        REQUIRE(file.del(1) == 0);
+        CHECK(footerMagick(PATH) == TLV_FILE_DELETED_MAGICK);
+
+        REQUIRE(file.deInit() == 0);
+        TlvFile file2(PATH);
+        REQUIRE(file2.init() == 0);
+        CHECK(getString(file2, 1) == "");
+        CHECK(getString(file2, 2) == "b");
+        REQUIRE(file2.compact() == 0);
+        CHECK(footerMagick(PATH) == TLV_FILE_MAGICK);
+        CHECK(getString(file2, 2) == "b");
+        file2.deInit();
+    }
+
+    SECTION("deleted entries are compacted") {
+        const std::string value(100, 'x');
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(setString(file, i % 3, value + std::to_string(i)) == 0);
+            CHECK(file.size() < (ssize_t)(TlvFile::COMPACTION_THRESHOLD * 2 + 3 * (value.size() + 20)));
+        }
+        REQUIRE(setString(file, 10, "y") == 0);
+        REQUIRE(file.del(10) == 0);
+        const auto sizeBefore = file.size();
+        REQUIRE(file.compact() == 0);
+        CHECK(file.size() < sizeBefore);
+        CHECK(file.size() == (ssize_t)(3 * (8 + value.size() + 2) + 16));
+        CHECK(getString(file, 0) == value + "99");
+        CHECK(getString(file, 1) == value + "97");
+        CHECK(getString(file, 2) == value + "98");
+        CHECK(getString(file, 10) == "");
+
+        REQUIRE(file.deInit() == 0);
+        TlvFile file2(PATH);
+        REQUIRE(file2.init() == 0);
+        CHECK(getString(file2, 0) == value + "99");
+        CHECK(file2.size() == (ssize_t)(3 * (8 + value.size() + 2) + 16));
+        file2.deInit();
+    }
+
+    file.deInit();
+}
+
+TEST_CASE("TlvFile benchmark", "[.benchmark]") {
+    using Clock = std::chrono::steady_clock;
+    const int KEY_COUNT = 50;
+    const int ITERATIONS = 20;
+
+    filesystem_reset();
+    TlvFile file(PATH);
+    REQUIRE(file.init() == 0);
+    uint8_t value[32] = {};
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        REQUIRE(file.set(i, value, sizeof(value)) == 0);
+    }
+
+    auto start = Clock::now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        for (int i = 0; i < KEY_COUNT; ++i) {
+            REQUIRE(file.get(i, value, sizeof(value)) == sizeof(value));
+        }
+    }
+    const auto getUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / (ITERATIONS * KEY_COUNT);
+
+    size_t progBytes = filesystem_prog_bytes();
+    start = Clock::now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        for (int i = 0; i < KEY_COUNT; ++i) {
+            REQUIRE(file.set(i, value, sizeof(value)) == 0);
+        }
+    }
+    const auto setUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / (ITERATIONS * KEY_COUNT);
+    const size_t setBytes = (filesystem_prog_bytes() - progBytes) / (ITERATIONS * KEY_COUNT);
+
+    progBytes = filesystem_prog_bytes();
+    start = Clock::now();
+    for (int n = 0; n < ITERATIONS; ++n) {
+        REQUIRE(file.beginBatch() == 0);
+        for (int i = 0; i < KEY_COUNT; ++i) {
+            REQUIRE(file.set(i, value, sizeof(value)) == 0);
+        }
+        REQUIRE(file.commitBatch() == 0);
+    }
+    const auto batchUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / (ITERATIONS * KEY_COUNT);
+    const size_t batchBytes = (filesystem_prog_bytes() - progBytes) / (ITERATIONS * KEY_COUNT);
+
+    WARN("get(): " << getUs << "us, set(): " << setUs << "us, " << setBytes << " bytes programmed, "
+            "set() in a batch: " << batchUs << "us, " << batchBytes << " bytes programmed");
+    CHECK(batchBytes <= setBytes);
+
+    file.deInit();
+}
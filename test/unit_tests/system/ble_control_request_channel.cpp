@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CATCH_CONFIG_MAIN
+
+#include "ble_control_request_channel.h"
+
+#include "fake_ble_hal.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace particle;
+using namespace particle::system;
+using namespace particle::test;
+
+namespace {
+
+// Request message: message header, request header and payload
+std::string requestMessage(uint16_t id, uint16_t type, const std::string& data) {
+    std::string s;
+    const uint16_t size = data.size();
+    s.append((const char*)&size, sizeof(size));
+    s.append((const char*)&id, sizeof(id));
+    s.append((const char*)&type, sizeof(type));
+    s.append(2, '\0'); // Reserved
+    s.append(data);
+    return s;
+}
+
+// Reply message: message header, reply header and payload
+std::string replyMessage(uint16_t id, int32_t result, const std::string& data) {
+    std::string s;
+    const uint16_t size = data.size();
+    s.append((const char*)&size, sizeof(size));
+    s.append((const char*)&id, sizeof(id));
+    s.append((const char*)&result, sizeof(result));
+    s.append(data);
+    return s;
+}
+
+std::string pattern(size_t size) {
+    std::string s;
+    for (size_t i = 0; i < size; ++i) {
+        s += (char)('a' + i % 26);
+    }
+    return s;
+}
+
+// Replies with a pattern of the size requested in the request data
+class TestHandler: public ControlRequestHandler {
+public:
+    TestHandler() :
+            deferred_(false) {
+    }
+
+    void processRequest(ctrl_request* req, ControlRequestChannel* channel) override {
+        requests_.push_back(std::string(req->request_data, req->request_size));
+        if (deferred_) {
+            pending_.push_back(req);
+            return;
+        }
+        reply(req, channel);
+    }
+
+    void completePending(ControlRequestChannel* channel, ctrl_completion_handler_fn handler = nullptr, void* data = nullptr) {
+        for (auto req: pending_) {
+            reply(req, channel, handler, data);
+        }
+        pending_.clear();
+    }
+
+    void defer(bool enabled) {
+        deferred_ = enabled;
+    }
+
+    const std::vector<std::string>& requests() const {
+        return requests_;
+    }
+
+private:
+    std::vector<std::string> requests_;
+    std::vector<ctrl_request*> pending_;
+    bool deferred_;
+
+    static void reply(ctrl_request* req, ControlRequestChannel* channel, ctrl_completion_handler_fn handler = nullptr,
+            void* data = nullptr) {
+        const size_t size = std::stoul(std::string(req->request_data, req->request_size));
+        if (size > 0) {
+            REQUIRE(channel->allocReplyData(req, size) == 0);
+            const auto s = pattern(size);
+            memcpy(req->reply_data, s.data(), size);
+        }
+        channel->setResult(req, 0, handler, data);
+    }
+};
+
+// Runs the channel until the client receives the given number of bytes
+void runUntilReceived(BleControlRequestChannel* channel, FakeBleHal* hal, size_t size) {
+    for (unsigned i = 0; i < 1000 && hal->received().size() < size; ++i) {
+        channel->run();
+        hal->connectionEvent();
+    }
+    REQUIRE(hal->received().size() == size);
+}
+
+// Number of connection events in which any data was sent
+size_t activeEventCount(const FakeBleHal& hal) {
+    const auto& events = hal.bytesPerEvent();
+    return std::count_if(events.begin(), events.end(), [](size_t n) {
+        return n > 0;
+    });
+}
+
+} // namespace
+
+TEST_CASE("BleControlRequestChannel") {
+    FakeBleHal hal(4 /* txQueueSize */);
+    TestHandler handler;
+    BleControlRequestChannel channel(&handler);
+    REQUIRE(channel.init() == 0);
+
+    SECTION("sends multiple notifications per connection event") {
+        hal.connect(BLE_MAX_ATT_MTU_SIZE);
+        hal.write(requestMessage(1, 10, "4096"));
+        const auto reply = replyMessage(1, 0, pattern(4096));
+        runUntilReceived(&channel, &hal, reply.size());
+        CHECK(hal.received() == reply);
+        const size_t packetSize = BLE_ATTR_VALUE_PACKET_SIZE(BLE_MAX_ATT_MTU_SIZE);
+        const size_t packets = (reply.size() + packetSize - 1) / packetSize;
+        CHECK(hal.notifyCalls() == packets);
+        CHECK(activeEventCount(hal) <= (packets + 3) / 4 + 1);
+        CHECK(*std::max_element(hal.bytesPerEvent().begin(), hal.bytesPerEvent().end()) == packetSize * 4);
+        const auto& stats = channel.stats();
+        CHECK(stats.bytesSent == reply.size());
+        CHECK(stats.packetsSent == packets);
+        CHECK(stats.repliesSent == 1);
+        CHECK(stats.bytesReceived == requestMessage(1, 10, "4096").size());
+        CHECK(stats.packetsReceived == 1);
+    }
+
+    SECTION("reassembles requests split across multiple packets") {
+        hal.connect(BLE_MIN_ATT_MTU_SIZE);
+        const std::string data = "0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000016";
+        const auto req = requestMessage(2, 20, data);
+        hal.write(req);
+        const auto reply = replyMessage(2, 0, pattern(16));
+        runUntilReceived(&channel, &hal, reply.size());
+        REQUIRE(handler.requests().size() == 1);
+        CHECK(handler.requests()[0] == data);
+        CHECK(hal.received() == reply);
+        const size_t packetSize = BLE_MIN_ATTR_VALUE_PACKET_SIZE;
+        CHECK(channel.stats().packetsReceived == (req.size() + packetSize - 1) / packetSize);
+        CHECK(channel.stats().bytesReceived == req.size());
+    }
+
+    SECTION("combines small replies into a single packet") {
+        hal.connect(BLE_MAX_ATT_MTU_SIZE, false /* subscribe */);
+        hal.write(requestMessage(3, 30, "4"));
+        hal.write(requestMessage(4, 30, "0"));
+        for (int i = 0; i < 4; ++i) {
+            channel.run();
+        }
+        CHECK(hal.notifyCalls() == 0);
+        hal.subscribe();
+        const auto reply = replyMessage(3, 0, pattern(4)) + replyMessage(4, 0, "");
+        runUntilReceived(&channel, &hal, reply.size());
+        CHECK(hal.received() == reply);
+        CHECK(hal.notifyCalls() == 1);
+        CHECK(channel.stats().repliesSent == 2);
+    }
+
+    SECTION("measures the reply latency and invokes the completion handler") {
+        hal.connect(BLE_MAX_ATT_MTU_SIZE);
+        handler.defer(true);
+        hal.write(requestMessage(5, 50, "1000"));
+        channel.run();
+        REQUIRE(handler.requests().size() == 1);
+        g_millis += 500;
+        int result = 1;
+        handler.completePending(&channel, [](int result, void* data) {
+            *(int*)data = result;
+        }, &result);
+        const auto reply = replyMessage(5, 0, pattern(1000));
+        runUntilReceived(&channel, &hal, reply.size());
+        CHECK(hal.received() == reply);
+        channel.run();
+        CHECK(result == 0);
+        CHECK(channel.stats().maxReplyLatency >= 500);
+        CHECK(channel.stats().totalReplyLatency == channel.stats().maxReplyLatency);
+    }
+}
+
+TEST_CASE("BleControlRequestChannel throughput", "[.benchmark]") {
+    for (size_t attMtu: { (size_t)BLE_MIN_ATT_MTU_SIZE, (size_t)BLE_MAX_ATT_MTU_SIZE }) {
+        FakeBleHal hal(4 /* txQueueSize */, 30 /* connInterval */);
+        TestHandler handler;
+        BleControlRequestChannel channel(&handler);
+        REQUIRE(channel.init() == 0);
+        hal.connect(attMtu);
+        hal.write(requestMessage(1, 10, "8192"));
+        const auto reply = replyMessage(1, 0, pattern(8192));
+        const auto t = g_millis;
+        runUntilReceived(&channel, &hal, reply.size());
+        const auto events = activeEventCount(hal);
+        WARN("ATT_MTU " << attMtu << ": " << reply.size() / events << " bytes per connection interval, " <<
+                reply.size() * 1000 / (g_millis - t) << " bytes/s");
+        CHECK(reply.size() / events >= BLE_ATTR_VALUE_PACKET_SIZE(attMtu) * 3);
+    }
+}
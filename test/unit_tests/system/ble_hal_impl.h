@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+
+#include <sys/types.h>
+// Host replacement for the platform-specific part of the BLE HAL, see hal/src/nRF52840/ble_hal_impl.h
+
+#define BLE_INVALID_CONN_HANDLE                     0xffff
+#define BLE_INVALID_ATTR_HANDLE                     0x0000
+
+#define BLE_MAX_ATT_MTU_SIZE                        247
+#define BLE_MIN_ATT_MTU_SIZE                        23
+#define BLE_DEFAULT_ATT_MTU_SIZE                    BLE_MIN_ATT_MTU_SIZE
+
+#define BLE_ATT_OPCODE_SIZE                         1
+#define BLE_ATT_HANDLE_SIZE                         2
+
+#define BLE_MIN_ATTR_VALUE_PACKET_SIZE              (BLE_MIN_ATT_MTU_SIZE - BLE_ATT_OPCODE_SIZE - BLE_ATT_HANDLE_SIZE)
+#define BLE_MAX_ATTR_VALUE_PACKET_SIZE              (BLE_MAX_ATT_MTU_SIZE - BLE_ATT_OPCODE_SIZE - BLE_ATT_HANDLE_SIZE)
+#define BLE_ATTR_VALUE_PACKET_SIZE(ATT_MTU)         (ATT_MTU - BLE_ATT_OPCODE_SIZE - BLE_ATT_HANDLE_SIZE)
+
+#define BLE_MAX_ADV_DATA_LEN                        31
+#define BLE_MAX_SCAN_REPORT_BUF_LEN                 31
+#define BLE_MAX_DEV_NAME_LEN                        20
+#define BLE_MAX_DESC_LEN                            20
+
+#define BLE_MAX_PERIPHERAL_COUNT                    1
+#define BLE_MAX_CENTRAL_COUNT                       1
+
+typedef uint16_t hal_ble_attr_handle_t;
+typedef uint16_t hal_ble_conn_handle_t;
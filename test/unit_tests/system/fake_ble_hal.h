@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "ble_hal.h"
+#include "system_tick_hal.h"
+
+#include <string>
+#include <vector>
+
+namespace particle {
+
+namespace test {
+
+// Virtual time, advanced by the fake BLE stack on each connection event
+extern system_tick_t g_millis;
+
+// A BLE stack with a single peripheral link. Notifications are queued and sent in connection
+// events, up to the size of the TX queue per event. Similarly to the SoftDevice, a notification
+// call blocks until the next connection event if the queue is full
+class FakeBleHal {
+public:
+    // Connection handle of the simulated link
+    static const hal_ble_conn_handle_t CONN_HANDLE = 1;
+
+    explicit FakeBleHal(unsigned txQueueSize = 4, system_tick_t connInterval = 30);
+    ~FakeBleHal();
+
+    // Simulates a client connecting, negotiating the ATT MTU and optionally subscribing to the
+    // notifications
+    void connect(size_t attMtu = BLE_MAX_ATT_MTU_SIZE, bool subscribe = true);
+    void subscribe();
+    void disconnect();
+
+    // Writes data to the writable characteristic, splitting it into packets of the maximum size
+    void write(const std::string& data);
+
+    // Sends the queued notifications
+    void connectionEvent();
+
+    // Data received by the client
+    const std::string& received() const {
+        return received_;
+    }
+
+    // Number of bytes sent in each connection event
+    const std::vector<size_t>& bytesPerEvent() const {
+        return bytesPerEvent_;
+    }
+
+    unsigned notifyCalls() const {
+        return notifyCalls_;
+    }
+
+    // Implementation of the HAL functions
+    int addCharacteristic(const hal_ble_char_init_t* init, hal_ble_char_handles_t* handles);
+    ssize_t notify(hal_ble_attr_handle_t handle, const uint8_t* data, size_t size);
+    int disconnect(hal_ble_conn_handle_t conn);
+    void setLinkCallback(hal_ble_on_link_evt_cb_t callback, void* context);
+    hal_ble_attr_handle_t nextHandle();
+
+    static FakeBleHal* instance();
+
+private:
+    struct Characteristic {
+        hal_ble_char_handles_t handles;
+        hal_ble_on_char_evt_cb_t callback;
+        void* context;
+        uint8_t properties;
+    };
+
+    std::vector<Characteristic> chars_;
+    std::vector<std::string> txQueue_;
+    std::vector<size_t> bytesPerEvent_;
+    std::string received_;
+    hal_ble_on_link_evt_cb_t linkCallback_;
+    void* linkContext_;
+    size_t attMtu_;
+    system_tick_t connInterval_;
+    unsigned txQueueSize_;
+    unsigned notifyCalls_;
+    hal_ble_attr_handle_t lastHandle_;
+    bool connected_;
+
+    const Characteristic* findChar(uint8_t properties) const;
+
+    static FakeBleHal* s_instance;
+};
+
+} // particle::test
+
+} // particle
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "firmware_decoder.h"
+
+#include "ota_flash_hal.h"
+#include "core_hal.h"
+#include "module_info.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+using namespace particle;
+using namespace particle::system;
+
+namespace {
+
+const unsigned MODULE_FUNCTION = MODULE_FUNCTION_USER_PART;
+const unsigned MODULE_INDEX = 1;
+
+// Module installed on the device
+std::string g_module;
+
+int findModule(unsigned moduleFunction, unsigned moduleIndex, const uint8_t** data, size_t* size) {
+    if (moduleFunction != MODULE_FUNCTION || moduleIndex != MODULE_INDEX || g_module.empty()) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    *data = (const uint8_t*)g_module.data();
+    *size = g_module.size();
+    return 0;
+}
+
+std::string randomData(size_t size, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::string s;
+    for (size_t i = 0; i < size; ++i) {
+        s += (char)dist(gen);
+    }
+    return s;
+}
+
+// Encodes a delta operation by operation
+class DeltaBuilder {
+public:
+    DeltaBuilder(const std::string& source, size_t targetSize) {
+        FirmwareDeltaHeader h = {};
+        h.magic = FirmwareDeltaHeader::MAGIC;
+        h.version = FirmwareDeltaHeader::VERSION;
+        h.moduleFunction = MODULE_FUNCTION;
+        h.moduleIndex = MODULE_INDEX;
+        h.sourceSize = source.size();
+        h.sourceCrc = HAL_Core_Compute_CRC32((const uint8_t*)source.data(), source.size());
+        h.targetSize = targetSize;
+        data_.append((const char*)&h, sizeof(h));
+    }
+
+    DeltaBuilder& copy(int offset, size_t size) {
+        varint((size << 2) | FirmwareDeltaHeader::COPY);
+        varint(((uint32_t)offset << 1) ^ (uint32_t)(offset >> 31));
+        return *this;
+    }
+
+    DeltaBuilder& add(const std::string& data) {
+        varint((data.size() << 2) | FirmwareDeltaHeader::ADD);
+        data_ += data;
+        return *this;
+    }
+
+    DeltaBuilder& insert(const std::string& data) {
+        varint((data.size() << 2) | FirmwareDeltaHeader::INSERT);
+        data_ += data;
+        return *this;
+    }
+
+    const std::string& data() const {
+        return data_;
+    }
+
+private:
+    std::string data_;
+
+    void varint(uint32_t v) {
+        while (v >= 0x80) {
+            data_ += (char)(v | 0x80);
+            v >>= 7;
+        }
+        data_ += (char)v;
+    }
+};
+
+// Computes a delta between two binaries by finding matches of the target data in the source binary
+std::string makeDelta(const std::string& source, const std::string& target) {
+    const size_t KEY_SIZE = 8;
+    const size_t MIN_MATCH_SIZE = 16;
+    std::unordered_map<std::string, size_t> index;
+    for (size_t i = 0; i + KEY_SIZE <= source.size(); ++i) {
+        index.emplace(source.substr(i, KEY_SIZE), i);
+    }
+    DeltaBuilder delta(source, target.size());
+    size_t srcPos = 0;
+    std::string literal;
+    size_t pos = 0;
+    while (pos < target.size()) {
+        size_t matchPos = 0;
+        size_t matchSize = 0;
+        if (pos + KEY_SIZE <= target.size()) {
+            // Prefer continuing at the current position in the source binary
+            bool found = false;
+            if (srcPos + KEY_SIZE <= source.size() && source.compare(srcPos, KEY_SIZE, target, pos, KEY_SIZE) == 0) {
+                matchPos = srcPos;
+                found = true;
+            } else {
+                const auto it = index.find(target.substr(pos, KEY_SIZE));
+                if (it != index.end()) {
+                    matchPos = it->second;
+                    found = true;
+                }
+            }
+            while (found && matchPos + matchSize < source.size() && pos + matchSize < target.size() &&
+                    source[matchPos + matchSize] == target[pos + matchSize]) {
+                ++matchSize;
+            }
+        }
+        if (matchSize < MIN_MATCH_SIZE) {
+            literal += target[pos++];
+            continue;
+        }
+        if (!literal.empty()) {
+            delta.insert(literal);
+            literal.clear();
+        }
+        delta.copy((int)matchPos - (int)srcPos, matchSize);
+        srcPos = matchPos + matchSize;
+        pos += matchSize;
+    }
+    if (!literal.empty()) {
+        delta.insert(literal);
+    }
+    return delta.data();
+}
+
+// Applies encoded data using the OTA HAL, writing the data in portions of the given size
+int decode(FirmwareDecoder* decoder, const std::string& data, size_t portionSize, std::string* result) {
+    const auto address = HAL_OTA_FlashAddress();
+    REQUIRE(HAL_FLASH_Begin(address, HAL_OTA_FlashLength(), nullptr));
+    int ret = decoder->init(FileTransfer::Format::DELTA, data.size(), address, HAL_OTA_FlashLength(), findModule);
+    for (size_t offs = 0; offs < data.size() && ret == 0; offs += portionSize) {
+        const size_t n = std::min(portionSize, data.size() - offs);
+        ret = decoder->write(offs, (const uint8_t*)data.data() + offs, n);
+    }
+    HAL_FLASH_End(nullptr);
+    std::ifstream file("output.bin", std::ios::binary);
+    result->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("FirmwareDecoder") {
+    g_module = randomData(4096, 1);
+    FirmwareDecoder decoder;
+    std::string result;
+
+    SECTION("applies all delta operations") {
+        std::string diff(100, '\0');
+        diff[10] = 1;
+        diff[20] = -1;
+        std::string target = "header" + g_module.substr(0, 1000);
+        std::string added = g_module.substr(1000, 100);
+        added[10] += 1;
+        added[20] -= 1;
+        target += added + g_module.substr(500, 200) + g_module.substr(3000);
+        const auto delta = DeltaBuilder(g_module, target.size())
+                .insert("header")
+                .copy(0, 1000)
+                .add(diff)
+                .copy(-600, 200)
+                .copy(2300, g_module.size() - 3000)
+                .data();
+        CHECK(decode(&decoder, delta, 512, &result) == 0);
+        CHECK(decoder.isDone());
+        CHECK(decoder.bytesRead() == delta.size());
+        CHECK(decoder.bytesWritten() == target.size());
+        CHECK(result == target);
+    }
+
+    SECTION("decodes data split at arbitrary boundaries") {
+        auto target = g_module;
+        target.replace(100, 10, "0123456789");
+        target.insert(2000, "inserted");
+        const auto delta = makeDelta(g_module, target);
+        for (size_t portionSize: { 1, 3, 7, 64, 1000 }) {
+            FirmwareDecoder d;
+            CHECK(decode(&d, delta, portionSize, &result) == 0);
+            CHECK(result == target);
+        }
+    }
+
+    SECTION("skips data that has already been decoded") {
+        const auto target = g_module.substr(100) + "appended";
+        const auto delta = makeDelta(g_module, target);
+        REQUIRE(delta.size() > 30);
+        const auto address = HAL_OTA_FlashAddress();
+        REQUIRE(HAL_FLASH_Begin(address, HAL_OTA_FlashLength(), nullptr));
+        REQUIRE(decoder.init(FileTransfer::Format::DELTA, delta.size(), address, HAL_OTA_FlashLength(), findModule) == 0);
+        const auto data = (const uint8_t*)delta.data();
+        CHECK(decoder.write(0, data, 20) == 0);
+        // Data that doesn't continue the stream is rejected without affecting the decoder
+        CHECK(decoder.write(25, data + 25, 5) == SYSTEM_ERROR_OUT_OF_RANGE);
+        CHECK(decoder.write(0, data, 10) == 0);
+        CHECK(decoder.bytesRead() == 20);
+        CHECK(decoder.write(10, data + 10, delta.size() - 10) == 0);
+        CHECK(decoder.isDone());
+        HAL_FLASH_End(nullptr);
+        std::ifstream file("output.bin", std::ios::binary);
+        result.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        CHECK(result == target);
+    }
+
+    SECTION("rejects a delta that is not based on the installed module") {
+        const auto delta = makeDelta(g_module, g_module + "appended");
+        g_module[0] ^= 1;
+        CHECK(decode(&decoder, delta, 512, &result) == SYSTEM_ERROR_NOT_FOUND);
+        g_module.clear();
+        CHECK(decode(&decoder, delta, 512, &result) == SYSTEM_ERROR_NOT_FOUND);
+    }
+
+    SECTION("rejects invalid deltas") {
+        const auto target = g_module + "appended";
+        auto delta = makeDelta(g_module, target);
+        // Truncated delta
+        CHECK(decode(&decoder, delta.substr(0, delta.size() - 1), 512, &result) == SYSTEM_ERROR_BAD_DATA);
+        CHECK(!decoder.isDone());
+        // Trailing data
+        CHECK(decode(&decoder, delta + "x", 512, &result) == SYSTEM_ERROR_BAD_DATA);
+        // Errors are sticky
+        CHECK(decoder.error() == SYSTEM_ERROR_BAD_DATA);
+        CHECK(decoder.write(delta.size() + 1, (const uint8_t*)"x", 1) == SYSTEM_ERROR_ABORTED);
+        // Copying past the end of the source binary
+        delta = DeltaBuilder(g_module, 200).copy(g_module.size() - 100, 200).data();
+        CHECK(decode(&decoder, delta, 512, &result) == SYSTEM_ERROR_BAD_DATA);
+        // Producing more data than specified in the header
+        delta = DeltaBuilder(g_module, 100).insert(std::string(200, 'x')).data();
+        CHECK(decode(&decoder, delta, 512, &result) == SYSTEM_ERROR_BAD_DATA);
+        // Invalid header
+        delta = DeltaBuilder(g_module, 100).insert(std::string(100, 'x')).data();
+        delta[0] = 'X';
+        CHECK(decode(&decoder, delta, 512, &result) == SYSTEM_ERROR_BAD_DATA);
+        // Target binary larger than the OTA section
+        delta = DeltaBuilder(g_module, HAL_OTA_FlashLength() + 1).data();
+        CHECK(decode(&decoder, delta, 512, &result) == SYSTEM_ERROR_TOO_LARGE);
+    }
+
+    SECTION("supports delta-encoded binaries") {
+        CHECK(FirmwareDecoder::isSupported(FileTransfer::Format::BINARY));
+        CHECK(FirmwareDecoder::isSupported(FileTransfer::Format::DELTA));
+        CHECK(FirmwareDecoder::isSupported(FileTransfer::Format::COMPRESSED) == (bool)HAL_PLATFORM_COMPRESSED_BINARIES);
+        CHECK(!FirmwareDecoder::isSupported(0x80));
+    }
+}
+
+TEST_CASE("FirmwareDecoder delta size", "[.benchmark]") {
+    // A binary with a few small changes that shift the code following them
+    g_module = randomData(96 * 1024, 2);
+    std::string target = g_module;
+    target.replace(5000, 64, randomData(64, 3));
+    target.insert(20000, randomData(300, 4));
+    target.erase(60000, 500);
+    target.replace(90000, 1000, randomData(2000, 5));
+    const auto delta = makeDelta(g_module, target);
+    FirmwareDecoder decoder;
+    std::string result;
+    CHECK(decode(&decoder, delta, 512, &result) == 0);
+    CHECK(result == target);
+    WARN("Target size: " << target.size() << " bytes, delta size: " << delta.size() << " bytes");
+    CHECK(delta.size() < target.size() / 20);
+}
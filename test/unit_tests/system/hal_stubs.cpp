@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fake_ble_hal.h"
+
+#include "timer_hal.h"
+#include "deviceid_hal.h"
+#include "concurrent_hal.h"
+#include "hal_irq_flag.h"
+#include "core_hal.h"
+#include "device_config.h"
+#include "system_error.h"
+
+#include <boost/crc.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace particle {
+
+namespace test {
+
+system_tick_t g_millis = 0;
+
+FakeBleHal* FakeBleHal::s_instance = nullptr;
+
+FakeBleHal::FakeBleHal(unsigned txQueueSize, system_tick_t connInterval) :
+        linkCallback_(nullptr),
+        linkContext_(nullptr),
+        attMtu_(BLE_MIN_ATT_MTU_SIZE),
+        connInterval_(connInterval),
+        txQueueSize_(txQueueSize),
+        notifyCalls_(0),
+        lastHandle_(0),
+        connected_(false) {
+    s_instance = this;
+}
+
+FakeBleHal::~FakeBleHal() {
+    s_instance = nullptr;
+}
+
+void FakeBleHal::connect(size_t attMtu, bool subscribe) {
+    connected_ = true;
+    attMtu_ = BLE_MIN_ATT_MTU_SIZE;
+    hal_ble_link_evt_t linkEvent = {};
+    linkEvent.type = BLE_EVT_CONNECTED;
+    linkEvent.conn_handle = CONN_HANDLE;
+    linkCallback_(&linkEvent, linkContext_);
+    attMtu_ = attMtu;
+    linkEvent = {};
+    linkEvent.type = BLE_EVT_ATT_MTU_UPDATED;
+    linkEvent.conn_handle = CONN_HANDLE;
+    linkEvent.params.att_mtu_updated.att_mtu_size = attMtu;
+    linkCallback_(&linkEvent, linkContext_);
+    if (subscribe) {
+        this->subscribe();
+    }
+}
+
+void FakeBleHal::subscribe() {
+    const auto c = findChar(BLE_SIG_CHAR_PROP_NOTIFY);
+    hal_ble_char_evt_t charEvent = {};
+    charEvent.type = BLE_EVT_CHAR_CCCD_UPDATED;
+    charEvent.conn_handle = CONN_HANDLE;
+    charEvent.attr_handle = c->handles.cccd_handle;
+    charEvent.params.cccd_config.value = BLE_SIG_CCCD_VAL_NOTIFICATION;
+    c->callback(&charEvent, c->context);
+}
+
+void FakeBleHal::disconnect() {
+    connected_ = false;
+    txQueue_.clear();
+    hal_ble_link_evt_t linkEvent = {};
+    linkEvent.type = BLE_EVT_DISCONNECTED;
+    linkEvent.conn_handle = CONN_HANDLE;
+    linkCallback_(&linkEvent, linkContext_);
+}
+
+void FakeBleHal::write(const std::string& data) {
+    const auto c = findChar(BLE_SIG_CHAR_PROP_WRITE);
+    const size_t maxSize = BLE_ATTR_VALUE_PACKET_SIZE(attMtu_);
+    for (size_t offs = 0; offs < data.size(); offs += maxSize) {
+        std::string packet = data.substr(offs, maxSize);
+        hal_ble_char_evt_t charEvent = {};
+        charEvent.type = BLE_EVT_DATA_WRITTEN;
+        charEvent.conn_handle = CONN_HANDLE;
+        charEvent.attr_handle = c->handles.value_handle;
+        charEvent.params.data_written.data = (uint8_t*)&packet[0];
+        charEvent.params.data_written.len = packet.size();
+        c->callback(&charEvent, c->context);
+    }
+}
+
+void FakeBleHal::connectionEvent() {
+    size_t bytes = 0;
+    for (const auto& packet: txQueue_) {
+        received_ += packet;
+        bytes += packet.size();
+    }
+    txQueue_.clear();
+    bytesPerEvent_.push_back(bytes);
+    g_millis += connInterval_;
+}
+
+int FakeBleHal::addCharacteristic(const hal_ble_char_init_t* init, hal_ble_char_handles_t* handles) {
+    Characteristic c = {};
+    c.handles.value_handle = nextHandle();
+    if (init->properties & (BLE_SIG_CHAR_PROP_NOTIFY | BLE_SIG_CHAR_PROP_INDICATE)) {
+        c.handles.cccd_handle = nextHandle();
+    }
+    c.callback = init->callback;
+    c.context = init->context;
+    c.properties = init->properties;
+    chars_.push_back(c);
+    *handles = c.handles;
+    return 0;
+}
+
+ssize_t FakeBleHal::notify(hal_ble_attr_handle_t handle, const uint8_t* data, size_t size) {
+    ++notifyCalls_;
+    if (!connected_) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    size = std::min(size, (size_t)BLE_ATTR_VALUE_PACKET_SIZE(attMtu_));
+    if (txQueue_.size() >= txQueueSize_) {
+        connectionEvent(); // Wait until the queued notifications are sent
+    }
+    txQueue_.push_back(std::string((const char*)data, size));
+    return size;
+}
+
+int FakeBleHal::disconnect(hal_ble_conn_handle_t conn) {
+    if (!connected_ || conn != CONN_HANDLE) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    disconnect();
+    return 0;
+}
+
+void FakeBleHal::setLinkCallback(hal_ble_on_link_evt_cb_t callback, void* context) {
+    linkCallback_ = callback;
+    linkContext_ = context;
+}
+
+hal_ble_attr_handle_t FakeBleHal::nextHandle() {
+    return ++lastHandle_;
+}
+
+FakeBleHal* FakeBleHal::instance() {
+    return s_instance;
+}
+
+const FakeBleHal::Characteristic* FakeBleHal::findChar(uint8_t properties) const {
+    for (const auto& c: chars_) {
+        if (c.properties & properties) {
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+} // particle::test
+
+} // particle
+
+using particle::test::FakeBleHal;
+
+system_tick_t HAL_Timer_Get_Milli_Seconds() {
+    return particle::test::g_millis;
+}
+
+int hal_get_device_secret(char* data, size_t size, void* reserved) {
+    memset(data, '0', size);
+    return size;
+}
+
+int hal_ble_stack_init(void* reserved) {
+    return 0;
+}
+
+int hal_ble_gatt_server_add_service(uint8_t type, const hal_ble_uuid_t* uuid, hal_ble_attr_handle_t* handle, void* reserved) {
+    *handle = FakeBleHal::instance()->nextHandle();
+    return 0;
+}
+
+int hal_ble_gatt_server_add_characteristic(const hal_ble_char_init_t* char_init, hal_ble_char_handles_t* char_handles, void* reserved) {
+    return FakeBleHal::instance()->addCharacteristic(char_init, char_handles);
+}
+
+ssize_t hal_ble_gatt_server_set_characteristic_value(hal_ble_attr_handle_t value_handle, const uint8_t* buf, size_t len, void* reserved) {
+    return len;
+}
+
+ssize_t hal_ble_gatt_server_notify_characteristic_value(hal_ble_attr_handle_t value_handle, const uint8_t* buf, size_t len, void* reserved) {
+    return FakeBleHal::instance()->notify(value_handle, buf, len);
+}
+
+int hal_ble_gap_disconnect(hal_ble_conn_handle_t conn_handle, void* reserved) {
+    return FakeBleHal::instance()->disconnect(conn_handle);
+}
+
+int hal_ble_set_callback_on_periph_link_events(hal_ble_on_link_evt_cb_t callback, void* context, void* reserved) {
+    FakeBleHal::instance()->setLinkCallback(callback, context);
+    return 0;
+}
+
+// The channel is tested in a single thread
+int os_mutex_create(os_mutex_t* mutex) {
+    *mutex = (os_mutex_t)1;
+    return 0;
+}
+
+int os_mutex_destroy(os_mutex_t mutex) {
+    return 0;
+}
+
+int os_mutex_lock(os_mutex_t mutex) {
+    return 0;
+}
+
+int os_mutex_unlock(os_mutex_t mutex) {
+    return 0;
+}
+
+int HAL_disable_irq() {
+    return 0;
+}
+
+void HAL_enable_irq(int mask) {
+}
+
+uint32_t HAL_Core_Compute_CRC32(const uint8_t* buf, uint32_t size) {
+    boost::crc_32_type crc;
+    crc.process_bytes(buf, size);
+    return crc.checksum();
+}
+
+bool HAL_Feature_Get(HAL_Feature feature) {
+    return false;
+}
+
+DeviceConfig deviceConfig;
@@ -2,6 +2,10 @@
 
 #include "catch2/catch.hpp"
 
+#include <chrono>
+#include <climits>
+#include <string>
+
 namespace {
 
 using namespace particle;
@@ -135,3 +139,186 @@ TEST_CASE("Print tests for all types") {
     }
 
 }
+
+namespace {
+
+class StringPrint : public Print {
+public:
+    size_t write(const uint8_t* data, size_t size) override {
+        str_.append((const char*)data, size);
+        return size;
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    std::string take() {
+        std::string s;
+        s.swap(str_);
+        return s;
+    }
+
+private:
+    std::string str_;
+};
+
+class NullPrint : public Print {
+public:
+    size_t write(const uint8_t* data, size_t size) override {
+        return size;
+    }
+
+    size_t write(uint8_t c) override {
+        return 1;
+    }
+};
+
+template<typename... ArgsT>
+std::string runtimeFormat(const char* fmt, const ArgsT&... args) {
+    char buf[256];
+    const int n = snprintf(buf, sizeof(buf), fmt, args...);
+    return std::string(buf, n);
+}
+
+} // namespace
+
+// Checks that the output matches the one of the C library
+#define CHECK_FORMAT(_fmt, ...) \
+        do { \
+            StringPrint p; \
+            const size_t n = p.printf(PARTICLE_FORMAT(_fmt), ##__VA_ARGS__); \
+            const std::string s = p.take(); \
+            CHECK(s == runtimeFormat(_fmt, ##__VA_ARGS__)); \
+            CHECK(n == s.size()); \
+        } while (false)
+
+TEST_CASE("Print::printf() with a compile-time format string") {
+    SECTION("literal text") {
+        CHECK_FORMAT("");
+        CHECK_FORMAT("abc");
+        CHECK_FORMAT("100%%");
+        CHECK_FORMAT("%%%%abc%%");
+    }
+
+    SECTION("signed integers") {
+        CHECK_FORMAT("%d", 0);
+        CHECK_FORMAT("%d %i", 123, -123);
+        CHECK_FORMAT("%d", INT_MIN);
+        CHECK_FORMAT("%lld", LLONG_MIN);
+        CHECK_FORMAT("%lld", LLONG_MAX);
+        CHECK_FORMAT("%hhd %hd", (signed char)-5, (short)-300);
+        CHECK_FORMAT("[%5d] [%-5d] [%05d] [%+d] [% d]", -42, 42, -42, 42, 42);
+        CHECK_FORMAT("[%.3d] [%8.3d] [%-8.3d] [%08.3d]", 7, -7, 7, 7);
+        CHECK_FORMAT("[%.0d] [%5.0d]", 0, 0);
+        CHECK_FORMAT("%d", TEST_ENUM_VALUE);
+    }
+
+    SECTION("unsigned integers") {
+        CHECK_FORMAT("%u", 0u);
+        CHECK_FORMAT("%u", UINT_MAX);
+        CHECK_FORMAT("%llu", ULLONG_MAX);
+        CHECK_FORMAT("%x %X %o", 0xbeefu, 0xbeefu, 0755u);
+        CHECK_FORMAT("[%#x] [%#X] [%#o] [%#o] [%#x]", 255u, 255u, 8u, 0u, 0u);
+        CHECK_FORMAT("[%#.0o] [%#.3o] [%#10x] [%#010x]", 0u, 8u, 255u, 255u);
+        CHECK_FORMAT("[%-8x] [%08X] [%.4x]", 0xabu, 0xabu, 0xabu);
+        CHECK_FORMAT("%x", -1); // Negative value formatted as unsigned
+        CHECK_FORMAT("%lx", (unsigned long)0x123456789abcdefULL);
+        CHECK_FORMAT("%zu", sizeof(int));
+    }
+
+    SECTION("characters") {
+        CHECK_FORMAT("%c%c%c", 'a', 'b', 'c');
+        CHECK_FORMAT("[%3c] [%-3c]", 'x', 'y');
+    }
+
+    SECTION("strings") {
+        const char* str = "hello";
+        char mutableStr[] = "world";
+        CHECK_FORMAT("%s, %s!", str, mutableStr);
+        CHECK_FORMAT("[%10s] [%-10s] [%.3s] [%10.2s]", str, str, str, str);
+        CHECK_FORMAT("[%s] [%.0s]", "", str);
+        char noNull[3] = { 'a', 'b', 'c' };
+        StringPrint p;
+        p.printf(PARTICLE_FORMAT("%.3s"), noNull);
+        CHECK(p.take() == "abc");
+        p.printf(PARTICLE_FORMAT("%s"), (const char*)nullptr);
+        CHECK(p.take() == "(null)");
+    }
+
+    SECTION("pointers") {
+        int x = 0;
+        CHECK_FORMAT("%p", &x);
+        CHECK_FORMAT("%p", (const void*)0x1234);
+        CHECK_FORMAT("[%20p] [%-20p]", &x, &x);
+    }
+
+    SECTION("floating point numbers") {
+        CHECK_FORMAT("%f", 1.5);
+        CHECK_FORMAT("%.2f %e %g", 3.14159, 31415.9, 0.0001);
+        CHECK_FORMAT("[%10.3f] [%-10.1f] [%+.0f] [%010.2f]", 2.5, -2.5, 2.5, -2.5);
+        CHECK_FORMAT("%f", 1e100); // Doesn't fit in the internal buffer
+        CHECK_FORMAT("%f", 1.25f);
+    }
+
+    SECTION("mixed arguments") {
+        CHECK_FORMAT("%s: %d/%u (%.1f%%) at %p", "progress", -1, 10u, 12.5, (const void*)0x20000000);
+    }
+
+    SECTION("printlnf() appends a newline") {
+        StringPrint p;
+        CHECK(p.printlnf(PARTICLE_FORMAT("%d + %d"), 2, 2) == 7);
+        CHECK(p.take() == "2 + 2\r\n");
+    }
+
+    SECTION("the format string is parsed at compile time") {
+        using namespace particle::detail;
+        const auto fmt = PARTICLE_FORMAT("a%-08.3lx%%b%s");
+        using FormatT = decltype(fmt);
+        static_assert(FormatT::specCount() == 3, "");
+        static_assert(FormatT::argCount() == 2, "");
+        constexpr auto specs = FormatT::specs();
+        static_assert(specs.specs[0].literalSize == 1, "");
+        static_assert(specs.specs[0].conv == 'x', "");
+        static_assert(specs.specs[0].width == 8, "");
+        static_assert(specs.specs[0].precision == 3, "");
+        static_assert(specs.specs[0].flags == (FORMAT_FLAG_LEFT | FORMAT_FLAG_ZERO), "");
+        static_assert(specs.specs[1].conv == '%', "");
+        static_assert(specs.specs[2].literalSize == 1, "");
+        static_assert(specs.specs[2].conv == 's', "");
+        static_assert(specs.specs[3].literalSize == 0, "");
+        static_assert(isFormatArgValid<int>('d'), "");
+        static_assert(!isFormatArgValid<int>('s'), "");
+        static_assert(!isFormatArgValid<double>('d'), "");
+        static_assert(isFormatArgValid<const char*>('p'), "");
+        static_assert(!isFormatStringValid("%y"), "");
+        static_assert(!isFormatStringValid("%*d"), "");
+        static_assert(!isFormatStringValid("abc%"), "");
+    }
+}
+
+TEST_CASE("Print::printf() benchmark", "[.benchmark]") {
+    using namespace std::chrono;
+    const unsigned iterations = 100000;
+    NullPrint p;
+    const char* name = "temperature";
+    int value = -273;
+    unsigned count = 0;
+    size_t n = 0;
+
+    auto t = steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i) {
+        n += p.printf("%s: %d (%u) 0x%08x\r\n", name, value, count++, i);
+    }
+    const auto runtimeNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / iterations;
+
+    t = steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i) {
+        n += p.printf(PARTICLE_FORMAT("%s: %d (%u) 0x%08x\r\n"), name, value, count++, i);
+    }
+    const auto compiledNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / iterations;
+
+    CHECK(n > 0);
+    WARN("Runtime format string: " << runtimeNs << " ns per call");
+    WARN("Compile-time format string: " << compiledNs << " ns per call");
+}
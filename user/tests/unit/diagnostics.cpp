@@ -4,6 +4,10 @@
 
 #include <functional>
 #include <unordered_set>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
 #include <cassert>
 
 namespace {
@@ -667,3 +671,149 @@ TEST_CASE("Wiring API") {
         // testPersistentEnumDiagnosticData<PersistentEnumDiagnosticData, AtomicConcurrency>(diag);
     }
 }
+
+TEST_CASE("HistogramDiagnosticData") {
+    DiagService diag;
+    HistogramDiagnosticData<> d(1);
+    diag.start();
+
+    SECTION("uses log-linear buckets") {
+        std::mt19937 gen(1);
+        std::uniform_int_distribution<uint32_t> dist(0, 1000000);
+        for (unsigned i = 0; i < 10000; ++i) {
+            const uint32_t val = dist(gen) >> (i % 20);
+            const unsigned index = AbstractHistogramDiagnosticData::bucketIndex(val, 2, 128);
+            const uint32_t lower = AbstractHistogramDiagnosticData::bucketLowerBound(index, 2);
+            const uint32_t upper = AbstractHistogramDiagnosticData::bucketUpperBound(index, 2);
+            CHECK(lower <= val);
+            CHECK(upper >= val);
+            // The size of a bucket is at most 1/4 of its lower bound
+            const uint32_t size = upper - lower;
+            CHECK(size <= std::max(lower / 4, 1u));
+        }
+        // Values that don't fit in the last bucket are counted in that bucket
+        CHECK(AbstractHistogramDiagnosticData::bucketIndex(UINT32_MAX, 2, 48) == 47);
+        CHECK(AbstractHistogramDiagnosticData::bucketIndex(UINT32_MAX, 2, 124) == 123);
+        CHECK(AbstractHistogramDiagnosticData::bucketUpperBound(123, 2) == UINT32_MAX);
+    }
+
+    SECTION("record()") {
+        CHECK(d.count() == 0);
+        CHECK(d.min() == 0);
+        CHECK(d.max() == 0);
+        CHECK(d.percentile(50) == 0);
+        for (uint32_t i = 1; i <= 100; ++i) {
+            d.record(i);
+        }
+        CHECK(d.count() == 100);
+        CHECK(d.min() == 1);
+        CHECK(d.max() == 100);
+        CHECK(d.percentile(50) >= 50);
+        CHECK(d.percentile(50) <= 55);
+        CHECK(d.percentile(99) >= 99);
+        CHECK(d.percentile(99) <= 100);
+        CHECK(d.percentile(100) == 100);
+        d.reset();
+        CHECK(d.count() == 0);
+        CHECK(d.max() == 0);
+    }
+
+    SECTION("get()") {
+        for (unsigned i = 0; i < 900; ++i) {
+            d.record(10);
+        }
+        for (unsigned i = 0; i < 100; ++i) {
+            d.record(1000);
+        }
+        d.record(5);
+        HistogramDiagnosticSummary s = {};
+        REQUIRE(AbstractHistogramDiagnosticData::get(1, s) == 0);
+        CHECK(s.count == 1001);
+        CHECK(s.min == 5);
+        CHECK(s.max == 1000);
+        CHECK(s.p50 == 11);
+        CHECK(s.p90 == 11);
+        CHECK(s.p99 == 1000);
+    }
+
+    SECTION("serializes data compactly") {
+        d.record(10);
+        d.record(10);
+        d.record(1000);
+        size_t size = 0;
+        REQUIRE(AbstractDiagnosticData::get(1, nullptr, size) == 0);
+        // Header, 2 bytes for the maximum value, and a delta/count pair per non-empty bucket
+        CHECK(size == 6 + 1 + 4);
+        uint8_t buf[32] = {};
+        size = 4;
+        CHECK(AbstractDiagnosticData::get(1, buf, size) == SYSTEM_ERROR_TOO_LARGE);
+        size = sizeof(buf);
+        REQUIRE(AbstractDiagnosticData::get(1, buf, size) == 0);
+        CHECK(size == 11);
+        CHECK(buf[0] == DIAG_HISTOGRAM_FORMAT_VERSION);
+        CHECK(buf[1] == 2); // Sub-bucket bits
+        CHECK(buf[2] == 48); // Bucket count
+        CHECK(buf[3] == 3); // Total count
+        CHECK(buf[4] == 10); // Minimum value
+        CHECK(buf[7] == AbstractHistogramDiagnosticData::bucketIndex(10, 2, 48)); // Index of the first bucket
+        CHECK(buf[8] == 2); // Count
+    }
+
+    SECTION("can be updated concurrently") {
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < 4; ++i) {
+            threads.emplace_back([&d, i]() {
+                for (uint32_t j = 0; j < 10000; ++j) {
+                    d.record(j * (i + 1));
+                }
+            });
+        }
+        for (auto& t: threads) {
+            t.join();
+        }
+        CHECK(d.count() == 40000);
+        CHECK(d.min() == 0);
+        CHECK(d.max() == 9999 * 4);
+    }
+
+    SECTION("ScopedDiagnosticTimer") {
+        {
+            const ScopedDiagnosticMicrosTimer<decltype(d)> t(d);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        CHECK(d.count() == 1);
+        CHECK(d.min() >= 2000);
+    }
+}
+
+TEST_CASE("HistogramDiagnosticData benchmark", "[.][benchmark]") {
+    using namespace std::chrono;
+    DiagService diag;
+    AtomicUnsignedIntegerDiagnosticData counter(1);
+    HistogramDiagnosticData<64> histogram(2);
+    diag.start();
+    const unsigned count = 1000000;
+
+    auto t = steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        ++counter;
+    }
+    const auto counterNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() * 1000 / count;
+
+    t = steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        histogram.record(i & 0xffff);
+    }
+    const auto recordNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() * 1000 / count;
+
+    histogram.reset();
+    t = steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        const ScopedDiagnosticMicrosTimer<decltype(histogram)> timer(histogram);
+    }
+    const auto timerNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() * 1000 / count;
+    CHECK(histogram.count() == count);
+
+    CATCH_WARN("Per operation: counter increment " << counterNs / 1000.0 << "ns, histogram record() "
+            << recordNs / 1000.0 << "ns, scoped timer " << timerNs / 1000.0 << "ns");
+}
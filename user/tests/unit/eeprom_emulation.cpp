@@ -4,6 +4,8 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <random>
 #include "eeprom_emulation.h"
 #include "flash_storage.h"
 
@@ -19,6 +21,7 @@ const size_t PageSize2 = TestPageSize / 4;
 
 using TestStore = RAMFlashStorage<TestBase, TestPageCount, TestPageSize>;
 using TestEEPROM = EEPROMEmulation<TestStore, PageBase1, PageSize1, PageBase2, PageSize2>;
+using IndexedTestEEPROM = EEPROMEmulation<TestStore, PageBase1, PageSize1, PageBase2, PageSize2, true>;
 using Record = TestEEPROM::Record;
 
 // Alias some constants, otherwise the linker is having issues when
@@ -1338,3 +1341,180 @@ TEST_CASE("Page swap with data in multiple batches", "[eeprom]")
         REQUIRE(dataRead == data);
     }
 }
+
+// Reads the whole EEPROM through a non-indexed instance loaded from the same flash contents
+template <typename EEPROM>
+std::vector<uint8_t> reloadContents(const EEPROM &eeprom)
+{
+    std::unique_ptr<TestEEPROM> reloaded(new TestEEPROM());
+    reloaded->store = eeprom.store;
+    reloaded->init();
+    std::vector<uint8_t> data(TestEEPROM::capacity());
+    reloaded->get(0, data.data(), data.size());
+    return data;
+}
+
+template <typename EEPROM>
+std::vector<uint8_t> contents(EEPROM &eeprom)
+{
+    std::vector<uint8_t> data(EEPROM::capacity());
+    eeprom.get(0, data.data(), data.size());
+    return data;
+}
+
+TEST_CASE("RAM index", "[eeprom]")
+{
+    std::unique_ptr<IndexedTestEEPROM> eeprom(new IndexedTestEEPROM());
+    std::unique_ptr<TestEEPROM> reference(new TestEEPROM());
+    eeprom->init();
+    reference->init();
+
+    SECTION("Reads and writes match the non-indexed implementation")
+    {
+        std::mt19937 gen(1);
+        std::uniform_int_distribution<int> op(0, 9);
+        for(int i = 0; i < 3000; i++)
+        {
+            const uint16_t length = std::uniform_int_distribution<int>(1, 16)(gen);
+            const uint16_t index = std::uniform_int_distribution<int>(0, TestEEPROM::capacity() - length)(gen);
+            uint8_t data[16];
+            for(uint16_t j = 0; j < length; j++)
+            {
+                // Erased values are written too, to check that they replace older values
+                data[j] = (op(gen) == 0) ? 0xFF : gen();
+            }
+            eeprom->put(index, data, length);
+            reference->put(index, data, length);
+
+            // Sometimes leave the erase to the next page swap
+            if(op(gen) < 7)
+            {
+                eeprom->performPendingErase();
+                reference->performPendingErase();
+            }
+
+            uint8_t value = 0;
+            uint8_t expected = 0;
+            eeprom->get(index, value);
+            reference->get(index, expected);
+            REQUIRE(value == expected);
+            if(i % 100 == 0)
+            {
+                CAPTURE(i);
+                REQUIRE(contents(*eeprom) == contents(*reference));
+                REQUIRE(reloadContents(*eeprom) == contents(*reference));
+            }
+        }
+        REQUIRE(contents(*eeprom) == contents(*reference));
+        REQUIRE(reloadContents(*eeprom) == contents(*reference));
+    }
+
+    SECTION("Page swaps are spread over several writes")
+    {
+        for(uint16_t index = 0; index < IndexedTestEEPROM::capacity(); index++)
+        {
+            eeprom->put(index, (uint8_t)index);
+            reference->put(index, (uint8_t)index);
+        }
+
+        // Measure the largest number of bytes programmed by a single write
+        // across 3 page swaps, erasing the old page in between like an
+        // application calling performPendingErase() would
+        auto maxWriteSize = [](auto &eeprom)
+        {
+            int maxBytes = 0;
+            for(int i = 0; i < 6000; i++)
+            {
+                const int before = eeprom.store.getWriteCount();
+                eeprom.put(0, (uint8_t)i);
+                maxBytes = std::max(maxBytes, before - eeprom.store.getWriteCount());
+                REQUIRE(eeprom.hasPendingErase() == (eeprom.readPageStatus(eeprom.getAlternatePage()) == PAGE_INACTIVE));
+                eeprom.performPendingErase();
+            }
+            return maxBytes;
+        };
+
+        const int indexedMax = maxWriteSize(*eeprom);
+        const int referenceMax = maxWriteSize(*reference);
+        CHECK(eeprom->store.getEraseCount() == reference->store.getEraseCount());
+        CHECK(referenceMax >= (int)(IndexedTestEEPROM::capacity() * sizeof(Record)));
+        CHECK(indexedMax <= (int)(2 * IndexedTestEEPROM::IncrementalCopyBatchSize * sizeof(Record)));
+        REQUIRE(contents(*eeprom) == contents(*reference));
+        REQUIRE(reloadContents(*eeprom) == contents(*reference));
+    }
+
+    SECTION("A reset during an incremental page swap discards the copy")
+    {
+        for(uint16_t index = 0; index < IndexedTestEEPROM::capacity(); index++)
+        {
+            eeprom->put(index, (uint8_t)index);
+        }
+        int i = 0;
+        while(eeprom->readPageStatus(eeprom->getAlternatePage()) != PAGE_COPY)
+        {
+            eeprom->put(0, (uint8_t)i++);
+        }
+        const auto expected = contents(*eeprom);
+
+        std::unique_ptr<IndexedTestEEPROM> reloaded(new IndexedTestEEPROM());
+        reloaded->store = eeprom->store;
+        reloaded->init();
+        REQUIRE(contents(*reloaded) == expected);
+        REQUIRE(reloaded->hasPendingErase() == true);
+
+        // The next page swap erases the partial copy
+        const auto activePage = reloaded->getActivePage();
+        while(reloaded->getActivePage() == activePage)
+        {
+            reloaded->put(1, (uint8_t)i++);
+        }
+        auto updated = expected;
+        updated[1] = (uint8_t)(i - 1);
+        REQUIRE(contents(*reloaded) == updated);
+        REQUIRE(reloadContents(*reloaded) == updated);
+    }
+}
+
+TEST_CASE("RAM index benchmark", "[eeprom][.][benchmark]")
+{
+    struct Point
+    {
+        double x, y;
+    };
+
+    // Fill the active page almost completely with updates of a struct
+    auto run = [](auto &eeprom, const char *name)
+    {
+        using Clock = std::chrono::steady_clock;
+        eeprom.init();
+        for(int i = 0; i < 180; i++)
+        {
+            Point p { (double)i, (double)i };
+            eeprom.put(0, &p, sizeof(p));
+        }
+
+        const int count = 1000;
+        Point p;
+        auto start = Clock::now();
+        for(int i = 0; i < count; i++)
+        {
+            eeprom.get(0, &p, sizeof(p));
+        }
+        const auto getNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / count;
+
+        start = Clock::now();
+        for(int i = 0; i < count; i++)
+        {
+            uint8_t value = i;
+            eeprom.put(100 + i % 100, value);
+        }
+        const auto putNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / count;
+
+        WARN(name << ": get(Point) " << getNs << "ns, put(byte) " << putNs << "ns");
+    };
+
+    std::unique_ptr<TestEEPROM> eeprom(new TestEEPROM());
+    run(*eeprom, "Without RAM index");
+    std::unique_ptr<IndexedTestEEPROM> indexed(new IndexedTestEEPROM());
+    run(*indexed, "With RAM index");
+}
@@ -0,0 +1,138 @@
+// Off device tests for the file-backed EEPROM of the virtual device
+
+#include "catch.hpp"
+#include "eeprom_hal.h"
+#include "eeprom_file.h"
+#include "filesystem.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace {
+
+const char* const EEPROM_FILE = "test_eeprom.bin";
+
+std::string readFile(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const char* filename, const std::string& data) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file << data;
+}
+
+// Removes the test file and restores the transient EEPROM storage
+struct EepromFileFixture {
+    EepromFileFixture() {
+        std::remove(EEPROM_FILE);
+        GCC_EEPROM_Unload();
+        HAL_EEPROM_Clear();
+    }
+
+    ~EepromFileFixture() {
+        GCC_EEPROM_Unload();
+        HAL_EEPROM_Clear();
+        std::remove(EEPROM_FILE);
+    }
+};
+
+template<typename F>
+double writesPerSecond(unsigned count, F fn) {
+    const auto t1 = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        fn(i);
+    }
+    const auto t2 = std::chrono::steady_clock::now();
+    const double s = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+    return count / s;
+}
+
+} // namespace
+
+TEST_CASE_METHOD(EepromFileFixture, "EEPROM file") {
+    const size_t size = HAL_EEPROM_Length();
+
+    SECTION("an empty file is initialized with the erased EEPROM contents") {
+        writeFile(EEPROM_FILE, "");
+        GCC_EEPROM_Load(EEPROM_FILE);
+        CHECK(readFile(EEPROM_FILE) == std::string(size, '\xff'));
+    }
+
+    SECTION("a shorter file keeps its contents and is extended") {
+        writeFile(EEPROM_FILE, "abc");
+        GCC_EEPROM_Load(EEPROM_FILE);
+        CHECK(HAL_EEPROM_Read(0) == 'a');
+        CHECK(HAL_EEPROM_Read(2) == 'c');
+        CHECK(HAL_EEPROM_Read(3) == 0xff);
+        CHECK(readFile(EEPROM_FILE) == "abc" + std::string(size - 3, '\xff'));
+    }
+
+    SECTION("writes are visible in the file without a flush") {
+        writeFile(EEPROM_FILE, "");
+        GCC_EEPROM_Load(EEPROM_FILE);
+        HAL_EEPROM_Put(100, "hello", 5);
+        HAL_EEPROM_Write(size - 1, 'x');
+        auto data = readFile(EEPROM_FILE);
+        CHECK(data.size() == size);
+        CHECK(data.substr(100, 5) == "hello");
+        CHECK(data[size - 1] == 'x');
+        GCC_EEPROM_Flush();
+        GCC_EEPROM_Unload();
+        // The EEPROM keeps its contents after the file is unloaded, but no longer modifies the file
+        HAL_EEPROM_Write(100, 'j');
+        CHECK(HAL_EEPROM_Read(100) == 'j');
+        CHECK(HAL_EEPROM_Read(101) == 'e');
+        CHECK(readFile(EEPROM_FILE).substr(100, 5) == "hello");
+        // Reloading the file restores the persisted contents
+        GCC_EEPROM_Load(EEPROM_FILE);
+        char buf[5] = {};
+        HAL_EEPROM_Get(100, buf, sizeof(buf));
+        CHECK(std::string(buf, sizeof(buf)) == "hello");
+    }
+
+    SECTION("clearing the EEPROM erases the file") {
+        writeFile(EEPROM_FILE, std::string(size, 'a'));
+        GCC_EEPROM_Load(EEPROM_FILE);
+        HAL_EEPROM_Init();
+        CHECK(HAL_EEPROM_Read(0) == 'a');
+        HAL_EEPROM_Clear();
+        CHECK(readFile(EEPROM_FILE) == std::string(size, '\xff'));
+    }
+
+    SECTION("a missing file can't be read") {
+        char buf[16];
+        CHECK_THROWS(read_file(EEPROM_FILE, buf, sizeof(buf)));
+    }
+
+    SECTION("read_file() reads at most the size of the file") {
+        writeFile(EEPROM_FILE, "0123456789");
+        char buf[16] = {};
+        read_file(EEPROM_FILE, buf, 4);
+        CHECK(std::string(buf) == "0123");
+        read_file(EEPROM_FILE, buf, sizeof(buf));
+        CHECK(std::string(buf) == "0123456789");
+    }
+}
+
+TEST_CASE_METHOD(EepromFileFixture, "EEPROM file benchmark", "[.][benchmark]") {
+    writeFile(EEPROM_FILE, "");
+    GCC_EEPROM_Load(EEPROM_FILE);
+    const size_t size = HAL_EEPROM_Length();
+    const double mapped = writesPerSecond(100000, [size](unsigned i) {
+        HAL_EEPROM_Write(i % size, (uint8_t)i);
+    });
+    GCC_EEPROM_Flush();
+    CHECK(readFile(EEPROM_FILE)[99999 % size] == (char)(99999 & 0xff));
+    // Previous implementation: the entire file is rewritten on every write
+    GCC_EEPROM_Unload();
+    std::string data(size, '\xff');
+    const double rewritten = writesPerSecond(2000, [&data](unsigned i) {
+        data[i % data.size()] = (char)i;
+        write_file(EEPROM_FILE, data.data(), data.size());
+    });
+    WARN("EEPROM writes per second: mapped file " << (unsigned)mapped << ", rewriting the file "
+            << (unsigned)rewritten);
+}
@@ -1,5 +1,6 @@
 #include "spark_wiring_json.h"
 #include "spark_wiring_print.h"
+#include "spark_wiring_stream.h"
 
 #include "tools/stream.h"
 #include "tools/buffer.h"
@@ -8,6 +9,7 @@
 
 #include <deque>
 #include <string>
+#include <chrono>
 #include <cstdlib>
 #include <cfloat> // for constants
 
@@ -178,6 +180,74 @@ inline Checker check(const char *json) {
     return Checker(parse(json));
 }
 
+// Returns a textual representation of the events produced by the parser
+std::string events(JSONStreamParser &p, size_t chunkSize, const std::string &json) {
+    std::string s;
+    size_t offs = 0;
+    for (;;) {
+        const JSONEvent e = p.next();
+        switch (e) {
+        case JSON_EVENT_NONE: {
+            if (offs == json.size()) {
+                p.finish();
+            } else {
+                const size_t n = std::min(chunkSize, json.size() - offs);
+                p.feed(json.data() + offs, n);
+                offs += n;
+            }
+            continue;
+        }
+        case JSON_EVENT_BEGIN_OBJECT:
+            s += '{';
+            break;
+        case JSON_EVENT_END_OBJECT:
+            s += '}';
+            break;
+        case JSON_EVENT_BEGIN_ARRAY:
+            s += '[';
+            break;
+        case JSON_EVENT_END_ARRAY:
+            s += ']';
+            break;
+        case JSON_EVENT_NAME:
+            s += std::string(p.data(), p.dataSize()) + ':';
+            break;
+        case JSON_EVENT_VALUE:
+            if (p.type() == JSON_TYPE_STRING) {
+                s += '\'' + std::string(p.data(), p.dataSize()) + '\'';
+            } else {
+                s += p.data();
+            }
+            break;
+        case JSON_EVENT_END:
+            return s;
+        default:
+            return s + "!";
+        }
+        s += ' ';
+    }
+}
+
+std::string events(const std::string &json, size_t chunkSize = 1024, size_t bufSize = 64) {
+    std::unique_ptr<char[]> buf(new char[bufSize]);
+    JSONStreamParser p(buf.get(), bufSize);
+    return events(p, chunkSize, json);
+}
+
+// Configuration update with a large array of schedule entries preceding the property of interest
+std::string makeConfig(unsigned entries) {
+    std::string s = "{\"version\":3,\"name\":\"greenhouse-controller\",\"schedule\":[";
+    for (unsigned i = 0; i < entries; ++i) {
+        if (i) {
+            s += ',';
+        }
+        s += "{\"zone\":" + std::to_string(i % 8) + ",\"start\":\"0" + std::to_string(i % 10) +
+                ":30\",\"duration\":" + std::to_string(i * 15) + ",\"days\":[1,2,3,4,5],\"enabled\":true}";
+    }
+    s += "],\"sensors\":{\"interval\":60,\"threshold\":{\"low\":12.5,\"high\":31.0}},\"interval\":300}";
+    return s;
+}
+
 } // namespace
 
 namespace spark {
@@ -1117,3 +1187,255 @@ TEST_CASE("JSONBufferWriter") {
         CHECK(buf.isPaddingValid());
     }
 }
+
+TEST_CASE("JSONStreamParser") {
+    SECTION("primitive values") {
+        CHECK(events("null") == "null ");
+        CHECK(events("true") == "true ");
+        CHECK(events(" false ") == "false ");
+        CHECK(events("-12.5e+3") == "-12.5e+3 ");
+        CHECK(events("\"abc\"") == "'abc' ");
+        CHECK(events("\"\\\"\\/\\\\\\b\\f\\n\\r\\t\"") == "'\"/\\\b\f\n\r\t' ");
+        CHECK(events("\"\\u0041\\u2014\"") == "'A\\u2014' "); // Unicode characters are not processed
+    }
+
+    SECTION("arrays and objects") {
+        const std::string json = "{\"a\":[1,[],{}],\"b\":{\"c\":null,\"d\":\"e\"}, \"f\" : [ true , false ] }";
+        const std::string expected = "{ a: [ 1 [ ] { } ] b: { c: null d: 'e' } f: [ true false ] } ";
+        CHECK(events(json) == expected);
+        // Feed the data in chunks of various sizes, including single characters
+        for (size_t n = 1; n <= 8; ++n) {
+            CHECK(events(json, n) == expected);
+        }
+    }
+
+    SECTION("value conversion") {
+        char buf[16];
+        JSONStreamParser p(buf, sizeof(buf));
+        const std::string json = "[true,\"0\",123,3.5,null]";
+        p.feed(json.data(), json.size());
+        CHECK(p.next() == JSON_EVENT_BEGIN_ARRAY);
+        CHECK(p.type() == JSON_TYPE_ARRAY);
+        CHECK(p.depth() == 1);
+        REQUIRE(p.next() == JSON_EVENT_VALUE);
+        CHECK(p.type() == JSON_TYPE_BOOL);
+        CHECK(p.toBool() == true);
+        CHECK(p.toInt() == 1);
+        REQUIRE(p.next() == JSON_EVENT_VALUE);
+        CHECK(p.type() == JSON_TYPE_STRING);
+        CHECK(p.toBool() == false);
+        REQUIRE(p.next() == JSON_EVENT_VALUE);
+        CHECK(p.type() == JSON_TYPE_NUMBER);
+        CHECK(p.toInt() == 123);
+        REQUIRE(p.next() == JSON_EVENT_VALUE);
+        CHECK(p.toDouble() == 3.5);
+        REQUIRE(p.next() == JSON_EVENT_VALUE);
+        CHECK(p.type() == JSON_TYPE_NULL);
+        CHECK(p.next() == JSON_EVENT_END_ARRAY);
+        CHECK(p.depth() == 0);
+        CHECK(p.next() == JSON_EVENT_END);
+        CHECK(p.next() == JSON_EVENT_END);
+    }
+
+    SECTION("skipping values") {
+        char buf[8];
+        JSONStreamParser p(buf, sizeof(buf));
+        const std::string json = "{\"a\":\"very long string value\",\"b\":[{\"very long name\":1}],\"c\":2}";
+        p.feed(json.data(), json.size());
+        CHECK(p.skip() == false); // Nothing to skip
+        CHECK(p.next() == JSON_EVENT_BEGIN_OBJECT);
+        REQUIRE(p.next() == JSON_EVENT_NAME);
+        CHECK(p.skip() == true); // Skip the string value that doesn't fit the buffer
+        REQUIRE(p.next() == JSON_EVENT_NAME);
+        CHECK(strcmp(p.data(), "b") == 0);
+        CHECK(p.next() == JSON_EVENT_BEGIN_ARRAY);
+        CHECK(p.skip() == true); // Skip the rest of the array
+        REQUIRE(p.next() == JSON_EVENT_NAME);
+        CHECK(strcmp(p.data(), "c") == 0);
+        REQUIRE(p.next() == JSON_EVENT_VALUE);
+        CHECK(p.toInt() == 2);
+        CHECK(p.next() == JSON_EVENT_END_OBJECT);
+        CHECK(p.next() == JSON_EVENT_END);
+    }
+
+    SECTION("finding properties") {
+        char buf[32];
+        JSONStreamParser p(buf, sizeof(buf));
+        const std::string json = makeConfig(10);
+        size_t offs = 0;
+        // Feed the data in small chunks
+        auto feed = [&]() {
+            const size_t n = std::min((size_t)7, json.size() - offs);
+            REQUIRE(n > 0);
+            p.feed(json.data() + offs, n);
+            offs += n;
+        };
+        auto find = [&](const char *name) {
+            JSONEvent e = JSON_EVENT_NONE;
+            while ((e = p.find(name)) == JSON_EVENT_NONE) {
+                feed();
+            }
+            return e;
+        };
+        p.feed(json.data(), 1);
+        offs = 1;
+        REQUIRE(p.next() == JSON_EVENT_BEGIN_OBJECT);
+        REQUIRE(find("sensors") == JSON_EVENT_NAME);
+        REQUIRE(p.next() == JSON_EVENT_BEGIN_OBJECT);
+        REQUIRE(find("threshold") == JSON_EVENT_NAME);
+        REQUIRE(p.next() == JSON_EVENT_BEGIN_OBJECT);
+        CHECK(find("none") == JSON_EVENT_END_OBJECT); // End of the "threshold" object
+        CHECK(find("none") == JSON_EVENT_END_OBJECT); // End of the "sensors" object
+        REQUIRE(find("interval") == JSON_EVENT_NAME);
+        JSONEvent e = JSON_EVENT_NONE;
+        while ((e = p.next()) == JSON_EVENT_NONE) {
+            feed();
+        }
+        REQUIRE(e == JSON_EVENT_VALUE);
+        CHECK(p.toInt() == 300);
+    }
+
+    SECTION("reading from a stream") {
+        class InputStream: public Stream {
+        public:
+            explicit InputStream(const std::string &data) :
+                    d_(data),
+                    offs_(0) {
+            }
+
+            int available() override {
+                return d_.size() - offs_;
+            }
+
+            int read() override {
+                return (offs_ < d_.size()) ? (uint8_t)d_[offs_++] : -1;
+            }
+
+            int peek() override {
+                return (offs_ < d_.size()) ? (uint8_t)d_[offs_] : -1;
+            }
+
+            void flush() override {
+            }
+
+            size_t write(uint8_t) override {
+                return 0;
+            }
+
+        private:
+            std::string d_;
+            size_t offs_;
+        };
+        InputStream strm("{\"a\":[1,2]}");
+        char buf[8];
+        JSONStreamParser p(buf, sizeof(buf));
+        CHECK(p.next(strm) == JSON_EVENT_BEGIN_OBJECT);
+        CHECK(p.next(strm) == JSON_EVENT_NAME);
+        CHECK(p.next(strm) == JSON_EVENT_BEGIN_ARRAY);
+        CHECK(p.next(strm) == JSON_EVENT_VALUE);
+        CHECK(p.next(strm) == JSON_EVENT_VALUE);
+        CHECK(p.toInt() == 2);
+        CHECK(p.next(strm) == JSON_EVENT_END_ARRAY);
+        CHECK(p.next(strm) == JSON_EVENT_END_OBJECT);
+        CHECK(p.next(strm) == JSON_EVENT_END);
+    }
+
+    SECTION("parsing errors") {
+        CHECK(events("") == "!"); // Empty source data
+        CHECK(events("[") == "[ !"); // Malformed array
+        CHECK(events("]") == "!");
+        CHECK(events("[1,") == "[ 1 !");
+        CHECK(events("[1,]") == "[ 1 !");
+        CHECK(events("[1}") == "[ 1 !");
+        CHECK(events("{") == "{ !"); // Malformed object
+        CHECK(events("}") == "!");
+        CHECK(events("{null") == "{ !");
+        CHECK(events("{1") == "{ !");
+        CHECK(events("{\"1\"") == "{ 1: !");
+        CHECK(events("{\"1\":") == "{ 1: !");
+        CHECK(events("{\"1\" 1}") == "{ 1: !");
+        CHECK(events("nul") == "!"); // Malformed primitive values
+        CHECK(events("1a") == "!");
+        CHECK(events("\"\\x\"") == "!"); // Unknown escaped character
+        CHECK(events("\"\\U0001\"") == "!"); // Uppercase 'U'
+        CHECK(events("\"\\u000x\"") == "!"); // Invalid hex value
+        CHECK(events("\"\\u01\"") == "!");
+        CHECK(events("\"abcd\"", 1024, 4) == "!"); // Buffer is too small
+        CHECK(events("\"abc\"", 1024, 4) == "'abc' ");
+        const unsigned depth = JSONStreamParser::MAX_DEPTH;
+        std::string expected;
+        for (unsigned i = 0; i < depth; ++i) {
+            expected += "[ ";
+        }
+        for (unsigned i = 0; i < depth; ++i) {
+            expected += "] ";
+        }
+        CHECK(events(std::string(depth, '[') + std::string(depth, ']')) == expected);
+        CHECK(events(std::string(depth + 1, '[') + std::string(depth + 1, ']')) == expected.substr(0, depth * 2) + "!");
+    }
+}
+
+TEST_CASE("JSON parsing benchmark", "[.][benchmark]") {
+    using namespace std::chrono;
+    const std::string json = makeConfig(40); // ~4KB
+    const unsigned count = 200;
+
+    // Two-pass tokenization that the JSONValue parser used to perform
+    auto t = steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        jsmn_parser parser;
+        parser.size = sizeof(jsmn_parser);
+        jsmn_init(&parser, nullptr);
+        const int n = jsmn_parse(&parser, json.data(), json.size(), nullptr, 0, nullptr);
+        REQUIRE(n > 0);
+        std::unique_ptr<jsmntok_t[]> tokens(new jsmntok_t[n]);
+        jsmn_init(&parser, nullptr);
+        REQUIRE(jsmn_parse(&parser, json.data(), json.size(), tokens.get(), n, nullptr) == n);
+    }
+    const auto twoPassNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / count;
+
+    // JSONValue with a property lookup
+    t = steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        const JSONValue v = JSONValue::parseCopy(json.data(), json.size());
+        JSONObjectIterator it(v);
+        int interval = 0;
+        while (it.next()) {
+            if (it.name() == "interval") {
+                interval = it.value().toInt();
+            }
+        }
+        REQUIRE(interval == 300);
+    }
+    const auto valueNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / count;
+
+    // JSONStreamParser with the same lookup, data is fed in 64-byte chunks
+    t = steady_clock::now();
+    for (unsigned i = 0; i < count; ++i) {
+        char buf[32];
+        JSONStreamParser p(buf, sizeof(buf));
+        size_t offs = 0;
+        auto feed = [&]() {
+            const size_t n = std::min((size_t)64, json.size() - offs);
+            p.feed(json.data() + offs, n);
+            offs += n;
+        };
+        JSONEvent e = JSON_EVENT_NONE;
+        while ((e = p.next()) == JSON_EVENT_NONE) {
+            feed();
+        }
+        REQUIRE(e == JSON_EVENT_BEGIN_OBJECT);
+        while ((e = p.find("interval")) == JSON_EVENT_NONE) {
+            feed();
+        }
+        REQUIRE(e == JSON_EVENT_NAME);
+        while ((e = p.next()) == JSON_EVENT_NONE) {
+            feed();
+        }
+        REQUIRE(p.toInt() == 300);
+    }
+    const auto streamNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / count;
+
+    CATCH_WARN("Parsing " << json.size() << " bytes of JSON: two-pass tokenization " << twoPassNs << "ns, "
+            << "JSONValue::parseCopy() " << valueNs << "ns, JSONStreamParser::find() " << streamNs << "ns");
+}
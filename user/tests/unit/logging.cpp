@@ -18,6 +18,7 @@
 
 #include <queue>
 #include <map>
+#include <chrono>
 
 #define CHECK_LOG_ATTR_FLAG(flag, value) \
         do { \
@@ -459,6 +460,57 @@ std::string fileName(const std::string &path) {
     return path;
 }
 
+// Enables asynchronous logging for the lifetime of an object
+class AsyncLogMode {
+public:
+    explicit AsyncLogMode(size_t bufferSize = LOG_ASYNC_BUFFER_SIZE, LogOverflowPolicy policy = LogOverflowPolicy::DROP) {
+        REQUIRE(LogManager::instance()->enableAsyncMode(bufferSize, policy));
+    }
+
+    ~AsyncLogMode() {
+        LogManager::instance()->disableAsyncMode();
+    }
+};
+
+// Stream log handler that spends some time formatting every message, like a handler writing to a serial port
+class SlowLogHandler: public StreamLogHandler {
+public:
+    explicit SlowLogHandler(Print &stream) :
+            StreamLogHandler(stream, LOG_LEVEL_ALL) {
+        LogManager::instance()->addHandler(this);
+    }
+
+    ~SlowLogHandler() {
+        LogManager::instance()->removeHandler(this);
+    }
+
+protected:
+    virtual void write(const char *data, size_t size) override {
+        volatile unsigned n = 0;
+        for (size_t i = 0; i < size * 100; ++i) {
+            n = n + i;
+        }
+        StreamLogHandler::write(data, size);
+    }
+};
+
+// Returns average time in nanoseconds spent by the caller in Logger::info()
+template<typename FlushT>
+double measureLogCall(unsigned count, FlushT flush) {
+    const Logger logger("bench");
+    std::chrono::nanoseconds total(0);
+    for (unsigned i = 0; i < count; ++i) {
+        const auto t = std::chrono::steady_clock::now();
+        logger.info("Sensor %s: value = %d, voltage = %.3f", "temp", (int)i, 3.3);
+        total += std::chrono::steady_clock::now() - t;
+        if (i % 8 == 7) {
+            flush();
+        }
+    }
+    flush();
+    return (double)total.count() / count;
+}
+
 size_t NamedLogHandler::s_count = 0;
 size_t NamedOutputStream::s_count = 0;
 
@@ -924,6 +976,32 @@ TEST_CASE("Logger API") {
         logger.dump("\x02", 1);
         check(log.stream()).equals("abcdef0102");
     }
+    SECTION("compile-time format strings") {
+        DefaultLogHandler log(LOG_LEVEL_ALL);
+        Logger logger;
+        logger.trace(PARTICLE_FORMAT("%s %d"), "trace", 1);
+        log.checkNext().messageEquals("trace 1").levelEquals(LOG_LEVEL_TRACE).categoryEquals(LOG_MODULE_CATEGORY);
+        logger.info(PARTICLE_FORMAT("%s %u"), "info", 2u);
+        log.checkNext().messageEquals("info 2").levelEquals(LOG_LEVEL_INFO);
+        logger.warn(PARTICLE_FORMAT("%s %x"), "warn", 0xau);
+        log.checkNext().messageEquals("warn a").levelEquals(LOG_LEVEL_WARN);
+        logger.error(PARTICLE_FORMAT("%s %.1f"), "error", 1.5);
+        log.checkNext().messageEquals("error 1.5").levelEquals(LOG_LEVEL_ERROR);
+        logger.log(PARTICLE_FORMAT("default"));
+        log.checkNext().messageEquals("default").levelEquals(Logger::DEFAULT_LEVEL);
+        std::string s = test::randomString(LOG_MAX_STRING_LENGTH * 3 / 2); // Larger than the internal buffer
+        logger.log(LOG_LEVEL_INFO, PARTICLE_FORMAT("%s"), s.c_str());
+        log.checkNext().messageEquals(s.substr(0, LOG_MAX_STRING_LENGTH - 2) + '~');
+        // Direct logging doesn't truncate the output
+        logger.printf(LOG_LEVEL_WARN, PARTICLE_FORMAT("%s%s"), s.c_str(), s.c_str());
+        logger.printf(PARTICLE_FORMAT("%c"), 'x');
+        check(log.stream()).equals(s + s + "x");
+        // Filtered messages are not formatted
+        DefaultLogHandler warnLog(LOG_LEVEL_WARN);
+        logger.info(PARTICLE_FORMAT("%d"), 1);
+        logger.printf(LOG_LEVEL_INFO, PARTICLE_FORMAT("%d"), 1);
+        CHECK(!warnLog.hasNext());
+    }
     SECTION("basic filtering") {
         DefaultLogHandler log(LOG_LEVEL_WARN); // TRACE and INFO should be filtered out
         Logger logger;
@@ -1238,3 +1316,142 @@ TEST_CASE("Configuration requests") {
     CHECK(NamedOutputStream::instanceCount() == 0);
     CHECK(NamedLogHandler::instanceCount() == 0);
 }
+
+TEST_CASE("Asynchronous logging") {
+    DefaultLogHandler log(LOG_LEVEL_ALL);
+    SECTION("messages are passed to handlers when flushed") {
+        AsyncLogMode async;
+        CHECK(LogManager::instance()->isAsyncMode());
+        LOG(INFO, "info");
+        LOG_ATTR(WARN, (code = -1, details = "details"), "warn");
+        CHECK(!log.hasNext());
+        LogManager::instance()->flush();
+        log.checkNext().messageEquals("info").levelEquals(LOG_LEVEL_INFO).categoryEquals(LOG_THIS_CATEGORY()).fileEquals(SOURCE_FILE)
+                .hasCode(false).hasDetails(false);
+        log.checkNext().messageEquals("warn").levelEquals(LOG_LEVEL_WARN).categoryEquals(LOG_THIS_CATEGORY()).fileEquals(SOURCE_FILE)
+                .codeEquals(-1).detailsEquals("details");
+        log.checkAtEnd();
+    }
+    SECTION("message formatting") {
+        AsyncLogMode async;
+        const std::string s = test::randomString(LOG_MAX_STRING_LENGTH / 2);
+        std::string tmp = "abcdef";
+        const char *str = tmp.c_str(); // Strings are copied when a message is logged
+        LOG(INFO, "%d %i %u %x %c %s %.3s %-5s| %*d %.*f %ld %lld %zu %p %%", -1, 2, 3u, 0xab, 'c', str, str, "ab", 4, 5,
+                2, 3.14159, -6L, 7LL, (size_t)8, (void*)0x10);
+        LOG(INFO, "%s", s.c_str());
+        LOG(INFO, "%s %f %e %hhd %hd %jd %td", (const char*)nullptr, 1.5, 100.0, (char)-1, (short)-2, (intmax_t)-3, (ptrdiff_t)-4);
+        const std::string large = test::randomString(LOG_MAX_STRING_LENGTH * 3 / 2); // Doesn't fit the record
+        LOG(WARN, "%s", large.c_str());
+        int n = 0;
+        LOG(INFO, "abc%n", &n); // Not supported, formatted by the caller
+        tmp[0] = 'x';
+        LogManager::instance()->flush();
+        char expected[LOG_MAX_STRING_LENGTH];
+        snprintf(expected, sizeof(expected), "%d %i %u %x %c %s %.3s %-5s| %*d %.*f %ld %lld %zu %p %%", -1, 2, 3u, 0xab, 'c',
+                "abcdef", "abcdef", "ab", 4, 5, 2, 3.14159, -6L, 7LL, (size_t)8, (void*)0x10);
+        log.checkNext().messageEquals(expected);
+        log.checkNext().messageEquals(s);
+        log.checkNext().messageEquals("(null) 1.500000 1.000000e+02 -1 -2 -3 -4");
+        log.checkNext().messageEquals(large.substr(0, LOG_MAX_STRING_LENGTH - 2) + '~').levelEquals(LOG_LEVEL_WARN);
+        log.checkNext().messageEquals("abc");
+        CHECK(n == 3);
+        log.checkAtEnd();
+    }
+    SECTION("direct logging") {
+        AsyncLogMode async;
+        const std::string s1 = test::randomString(1, 100);
+        LOG_WRITE(INFO, s1.c_str(), s1.size());
+        LOG(INFO, "info");
+        check(log.stream()).isEmpty();
+        LogManager::instance()->flush();
+        check(log.stream()).equals(s1);
+        log.checkNext().messageEquals("info");
+    }
+    SECTION("large direct logging output") {
+        AsyncLogMode async(4096);
+        const std::string s = test::randomBytes(LOG_MAX_STRING_LENGTH * 3); // Split into several records
+        LOG_DUMP(WARN, s.c_str(), s.size());
+        check(log.stream()).isEmpty();
+        LogManager::instance()->flush();
+        check(log.stream()).unhex().equals(s);
+    }
+    SECTION("messages are dropped when the buffer is full") {
+        AsyncLogMode async(0, LogOverflowPolicy::DROP); // Use minimum buffer size
+        const unsigned count = 100;
+        for (unsigned i = 0; i < count; ++i) {
+            LOG(INFO, "message %u", i);
+        }
+        const size_t dropped = LogManager::instance()->droppedMessageCount();
+        CHECK(dropped > 0);
+        LogManager::instance()->flush();
+        unsigned received = 0;
+        while (log.hasNext()) {
+            log.checkNext().messageEquals("message " + std::to_string(received++));
+        }
+        const size_t total = received + dropped;
+        CHECK(total == count);
+    }
+    SECTION("the caller writes out buffered messages when the buffer is full") {
+        AsyncLogMode async(0, LogOverflowPolicy::BLOCK);
+        const unsigned count = 100;
+        for (unsigned i = 0; i < count; ++i) {
+            LOG(INFO, "message %u", i);
+        }
+        LogManager::instance()->flush();
+        for (unsigned i = 0; i < count; ++i) {
+            log.checkNext().messageEquals("message " + std::to_string(i));
+        }
+        log.checkAtEnd();
+        CHECK(LogManager::instance()->droppedMessageCount() == 0);
+    }
+    SECTION("buffered messages are written out when asynchronous mode is disabled") {
+        {
+            AsyncLogMode async;
+            LOG(INFO, "info");
+            CHECK(!log.hasNext());
+        }
+        CHECK(!LogManager::instance()->isAsyncMode());
+        log.checkNext().messageEquals("info");
+        LOG(INFO, "sync");
+        log.checkNext().messageEquals("sync");
+    }
+}
+
+TEST_CASE("Asynchronous logging (filtering)") {
+    DefaultLogHandler log(LOG_LEVEL_WARN, {
+        { "app", LOG_LEVEL_ERROR }
+    });
+    AsyncLogMode async;
+    // Messages below the lowest level enabled for any category are discarded by the caller
+    CHECK(!LOG_ENABLED(INFO));
+    CHECK(LOG_ENABLED(WARN));
+    LOG(INFO, "info");
+    LOG(WARN, "warn");
+    LOG_C(WARN, "app", "app");
+    LOG_C(ERROR, "app", "error");
+    LogManager::instance()->flush();
+    log.checkNext().messageEquals("warn");
+    log.checkNext().messageEquals("error");
+    log.checkAtEnd();
+    // The level is updated when a handler is added
+    DefaultLogHandler all(LOG_LEVEL_ALL);
+    CHECK(LOG_ENABLED(INFO));
+}
+
+TEST_CASE("Asynchronous logging benchmark", "[.][benchmark]") {
+    test::OutputStream stream;
+    SlowLogHandler handler(stream);
+    const unsigned count = 2000;
+    const double syncNs = measureLogCall(count, []() {});
+    double asyncNs = 0;
+    {
+        AsyncLogMode async(4096, LogOverflowPolicy::DROP);
+        asyncNs = measureLogCall(count, []() {
+            LogManager::instance()->flush();
+        });
+        CHECK(LogManager::instance()->droppedMessageCount() == 0);
+    }
+    CATCH_WARN("Logger::info() with a slow stream handler: synchronous " << (unsigned)syncNs << "ns per call, "
+            << "asynchronous " << (unsigned)asyncNs << "ns per call");
+}
@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <chrono>
 #include <limits.h>
 #include "catch.hpp"
 
@@ -101,3 +102,171 @@ TEST_CASE("Substring with left and right after the end returns until the end of
 TEST_CASE("Substring with flipped left and right returns the correct substring") {
     REQUIRE(String("test123").substring(5, 3)==String("t1"));
 }
+
+namespace {
+
+template<typename ArenaT>
+bool inArena(const String& s, const ArenaT& arena) {
+    const char* p = s.c_str();
+    const char* begin = (const char*)&arena;
+    return p >= begin && p < begin + sizeof(arena);
+}
+
+// Exposes the buffer capacity, which changes on every (re)allocation of the buffer
+class TestString: public String {
+public:
+    using String::String;
+
+    unsigned bufferCapacity() const {
+        return capacity;
+    }
+};
+
+// Builds an event name the way application code usually does
+template<typename StringT>
+unsigned buildEventName(StringT& s, int i) {
+    unsigned reallocs = 0;
+    unsigned capacity = s.bufferCapacity();
+    auto check = [&]() {
+        if (s.bufferCapacity() != capacity) {
+            capacity = s.bufferCapacity();
+            ++reallocs;
+        }
+    };
+    s += "sensors/";
+    check();
+    s += "greenhouse-";
+    check();
+    s += i;
+    check();
+    s += "/temperature";
+    check();
+    return reallocs;
+}
+
+} // namespace
+
+TEST_CASE("Concatenation grows the buffer geometrically") {
+    TestString s;
+    unsigned reallocs = 0;
+    unsigned capacity = s.bufferCapacity();
+    for (int i = 0; i < 1000; ++i) {
+        s += 'a';
+        if (s.bufferCapacity() != capacity) {
+            ++reallocs;
+            capacity = s.bufferCapacity();
+        }
+    }
+    REQUIRE(s.length() == 1000);
+    REQUIRE(String(s.c_str() + 990) == "aaaaaaaaaa");
+    REQUIRE(reallocs < 20);
+}
+
+TEST_CASE("String can use an arena") {
+    StaticStringArena<128> arena;
+    SECTION("short strings are allocated from the arena") {
+        String s1(arena, "abc");
+        String s2(arena);
+        REQUIRE(s1 == "abc");
+        REQUIRE(s2 == "");
+        REQUIRE(inArena(s1, arena));
+        REQUIRE(inArena(s2, arena));
+        REQUIRE(arena.available() < arena.size());
+    }
+    SECTION("the most recent allocation grows in place") {
+        String s(arena, "abc");
+        const char* p = s.c_str();
+        s += "defghijklmnopqrstuvwxyz";
+        REQUIRE(s == "abcdefghijklmnopqrstuvwxyz");
+        REQUIRE(s.c_str() == p);
+    }
+    SECTION("strings are moved to the heap when the arena is exhausted") {
+        String s1(arena, "abc");
+        String s2(arena, "def");
+        for (int i = 0; i < 20; ++i) {
+            s1 += "0123456789";
+        }
+        REQUIRE(s1.length() == 203);
+        REQUIRE(!inArena(s1, arena));
+        REQUIRE(s1.startsWith("abc0123456789"));
+        REQUIRE(inArena(s2, arena));
+        s2 += "ghi";
+        REQUIRE(s2 == "defghi");
+    }
+    SECTION("memory of the most recent allocation is released") {
+        const size_t avail = arena.available();
+        {
+            String s(arena, "abc");
+            REQUIRE(arena.available() < avail);
+        }
+        REQUIRE(arena.available() == avail);
+    }
+    SECTION("copies use the heap") {
+        String s1(arena, "abc");
+        String s2(s1);
+        String s3;
+        s3 = s1;
+        REQUIRE(s2 == "abc");
+        REQUIRE(s3 == "abc");
+        REQUIRE(!inArena(s2, arena));
+        REQUIRE(!inArena(s3, arena));
+    }
+    SECTION("moves transfer the arena buffer") {
+        String s1(arena, "abc");
+        const char* p = s1.c_str();
+        String s2(std::move(s1));
+        REQUIRE(s2.c_str() == p);
+        s2 += "def";
+        REQUIRE(s2 == "abcdef");
+        String s3(arena, "ghi");
+        s3 = String("0123456789012345678901234567890123456789"); // Heap buffer replaces the arena one
+        REQUIRE(!inArena(s3, arena));
+        s3 += "!";
+        REQUIRE(s3.endsWith("89!"));
+    }
+    SECTION("arena can be reset") {
+        {
+            String s(arena, "abc");
+            String s2(arena, "def");
+        }
+        REQUIRE(arena.available() < arena.size());
+        arena.reset();
+        REQUIRE(arena.available() == arena.size());
+    }
+}
+
+TEST_CASE("String benchmark", "[.][benchmark]") {
+    using namespace std::chrono;
+    const int count = 10000;
+
+    auto t = steady_clock::now();
+    unsigned reallocs = 0;
+    for (int i = 0; i < count; ++i) {
+        TestString s;
+        reallocs += buildEventName(s, i);
+    }
+    const auto heapNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / count;
+
+    t = steady_clock::now();
+    unsigned heapAllocs = 0;
+    for (int i = 0; i < count; ++i) {
+        StaticStringArena<64> arena;
+        TestString s(arena);
+        buildEventName(s, i);
+        if (!inArena(s, arena)) {
+            ++heapAllocs;
+        }
+    }
+    const auto arenaNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / count;
+    REQUIRE(heapAllocs == 0);
+
+    t = steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        String s = String::format("%s/%d", "sensors", i);
+        REQUIRE(s.length() > 0);
+    }
+    const auto formatNs = duration_cast<nanoseconds>(steady_clock::now() - t).count() / count;
+
+    WARN("Building an event name: heap " << heapNs << "ns (" << (double)reallocs / count << " reallocations per name), "
+            << "arena " << arenaNs << "ns (no heap allocations); String::format() " << formatNs << "ns");
+}
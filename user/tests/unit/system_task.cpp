@@ -25,14 +25,18 @@
 #include "system_version.h"
 #include "spark_macros.h"
 #include "spark_wiring_system.h"
+#include "system_wakeup.h"
 #undef WARN
 #undef INFO
 
 #include "catch.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <thread>
 
 using std::min;
+using namespace particle::system;
 
 SCENARIO("Backoff period after 0 attempts should be 0", "[system_task]") {
 
@@ -84,6 +88,41 @@ SCENARIO("System version info is retrieved", "[system,version]") {
     REQUIRE(System.version()==info.versionString);
 }
 
+TEST_CASE("SystemWakeup", "[system_task]") {
+    const auto wakeup = SystemWakeup::instance();
+    wakeup->loopIteration(); // Clear wakeups posted by other tests
+
+    SECTION("wait() returns false when no wakeup is posted before the timeout") {
+        const auto start = std::chrono::steady_clock::now();
+        CHECK(!wakeup->wait(20));
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        CHECK(elapsed >= std::chrono::milliseconds(19));
+        CHECK(wakeup->loopIteration() == WAKEUP_REASON_TIMEOUT);
+    }
+
+    SECTION("wait() returns immediately if a wakeup is pending") {
+        system_wakeup(WAKEUP_REASON_CLOUD);
+        CHECK(wakeup->wait(10000));
+        CHECK(wakeup->wait(10000)); // Reasons are only consumed by loopIteration()
+        CHECK(wakeup->loopIteration() == WAKEUP_REASON_CLOUD);
+        CHECK(!wakeup->pending());
+    }
+
+    SECTION("a wakeup posted by another thread ends the wait") {
+        std::thread t([]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            system_wakeup(WAKEUP_REASON_SOCKET);
+            system_wakeup(WAKEUP_REASON_NETWORK);
+        });
+        const auto start = std::chrono::steady_clock::now();
+        CHECK(wakeup->wait(10000));
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        t.join();
+        CHECK(elapsed < std::chrono::milliseconds(5000));
+        CHECK((wakeup->loopIteration() & WAKEUP_REASON_SOCKET) != 0);
+    }
+}
+
 // these symbols needed for successful link
 
 volatile uint8_t SPARK_CLOUD_CONNECT;
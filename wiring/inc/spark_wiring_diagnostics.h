@@ -26,8 +26,12 @@
 #include "combine_hash.h"
 #include "underlying_type.h"
 #include "debug.h"
+#include "timer_hal.h"
 
+#include <algorithm>
 #include <atomic>
+#include <memory>
+#include <new>
 
 #define PARTICLE_RETAINED_INTEGER_DIAGNOSTIC_DATA(_var, _id, _name, _val, ...) \
         PARTICLE_RETAINED ::particle::RetainedIntegerDiagnosticDataStorage _storage##_id; \
@@ -327,6 +331,60 @@ private:
     }
 };
 
+template<>
+class UnsignedIntegerDiagnosticData<AtomicConcurrency>: public AbstractUnsignedIntegerDiagnosticData {
+public:
+    explicit UnsignedIntegerDiagnosticData(DiagnosticDataId id, IntType val = 0) :
+            UnsignedIntegerDiagnosticData(id, nullptr, val) {
+    }
+
+    UnsignedIntegerDiagnosticData(DiagnosticDataId id, const char* name, IntType val = 0) :
+            AbstractUnsignedIntegerDiagnosticData(id, name),
+            val_(val) {
+    }
+
+    IntType operator++() {
+        return (val_.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+
+    IntType operator++(int) {
+        return val_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    IntType operator--() {
+        return (val_.fetch_sub(1, std::memory_order_relaxed) - 1);
+    }
+
+    IntType operator--(int) {
+        return val_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    IntType operator+=(IntType val) {
+        return (val_.fetch_add(val, std::memory_order_relaxed) + val);
+    }
+
+    IntType operator-=(IntType val) {
+        return (val_.fetch_sub(val, std::memory_order_relaxed) - val);
+    }
+
+    UnsignedIntegerDiagnosticData& operator=(IntType val) {
+        val_.store(val, std::memory_order_relaxed);
+        return *this;
+    }
+
+    operator IntType() const {
+        return val_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<IntType> val_;
+
+    virtual int get(IntType& val) override { // AbstractUnsignedIntegerDiagnosticData
+        val = val_.load(std::memory_order_relaxed);
+        return SYSTEM_ERROR_NONE;
+    }
+};
+
 template<typename StorageT, typename ConcurrencyT = NoConcurrency>
 class PersistentIntegerDiagnosticData:
         public AbstractIntegerDiagnosticData,
@@ -570,6 +628,137 @@ private:
     }
 };
 
+// Summary of the values recorded by a histogram data source
+struct HistogramDiagnosticSummary {
+    uint32_t count; // Number of recorded values
+    uint32_t min; // Minimum value
+    uint32_t max; // Maximum value
+    uint32_t p50; // 50th percentile
+    uint32_t p90; // 90th percentile
+    uint32_t p99; // 99th percentile
+};
+
+// Base abstract class for a data source containing a histogram of values.
+//
+// Values are counted in log-linear buckets: every power of two range is split into 2^SubBucketBits
+// buckets of equal size, so the relative precision doesn't depend on the magnitude of the value.
+// Values that are too large for the last bucket are counted in that bucket
+class AbstractHistogramDiagnosticData: public AbstractDiagnosticData {
+public:
+    static int get(DiagnosticDataId id, HistogramDiagnosticSummary& summary);
+    static int get(const diag_source* src, HistogramDiagnosticSummary& summary);
+
+    static unsigned bucketIndex(uint32_t val, unsigned subBucketBits, unsigned bucketCount);
+    static uint32_t bucketLowerBound(unsigned index, unsigned subBucketBits);
+    static uint32_t bucketUpperBound(unsigned index, unsigned subBucketBits);
+
+protected:
+    explicit AbstractHistogramDiagnosticData(DiagnosticDataId id, const char* name = nullptr);
+
+    static int encode(const uint32_t* counts, unsigned bucketCount, unsigned subBucketBits, uint32_t min,
+            uint32_t max, void* data, size_t& size);
+    static uint32_t percentile(const uint32_t* counts, unsigned bucketCount, unsigned subBucketBits, uint32_t min,
+            uint32_t max, unsigned percent);
+};
+
+// Lock-free histogram data source. Values can be recorded concurrently from any thread or ISR
+template<unsigned BucketCountT = 48, unsigned SubBucketBitsT = 2>
+class HistogramDiagnosticData: public AbstractHistogramDiagnosticData {
+public:
+    static_assert(BucketCountT > (1u << SubBucketBitsT) && BucketCountT <= ((33 - SubBucketBitsT) << SubBucketBitsT),
+            "Invalid number of buckets");
+
+    explicit HistogramDiagnosticData(DiagnosticDataId id, const char* name = nullptr) :
+            AbstractHistogramDiagnosticData(id, name) {
+        reset();
+    }
+
+    void record(uint32_t val) {
+        buckets_[bucketIndex(val, SubBucketBitsT, BucketCountT)].fetch_add(1, std::memory_order_relaxed);
+        uint32_t v = min_.load(std::memory_order_relaxed);
+        while (val < v && !min_.compare_exchange_weak(v, val, std::memory_order_relaxed)) {
+        }
+        v = max_.load(std::memory_order_relaxed);
+        while (val > v && !max_.compare_exchange_weak(v, val, std::memory_order_relaxed)) {
+        }
+    }
+
+    void reset() {
+        for (auto& b: buckets_) {
+            b.store(0, std::memory_order_relaxed);
+        }
+        min_.store(UINT32_MAX, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint32_t count() const {
+        uint32_t n = 0;
+        for (const auto& b: buckets_) {
+            n += b.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    uint32_t min() const {
+        const uint32_t v = min_.load(std::memory_order_relaxed);
+        return (v == UINT32_MAX && !count()) ? 0 : v;
+    }
+
+    uint32_t max() const {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    // Returns an upper estimate of the given percentile of the recorded values
+    uint32_t percentile(unsigned percent) const {
+        uint32_t counts[BucketCountT];
+        snapshot(counts);
+        return AbstractHistogramDiagnosticData::percentile(counts, BucketCountT, SubBucketBitsT, min(), max(), percent);
+    }
+
+private:
+    std::atomic<uint32_t> buckets_[BucketCountT];
+    std::atomic<uint32_t> min_;
+    std::atomic<uint32_t> max_;
+
+    // The buckets are read only once, so that the total count is consistent with the bucket counts
+    void snapshot(uint32_t* counts) const {
+        for (unsigned i = 0; i < BucketCountT; ++i) {
+            counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    virtual int get(void* data, size_t& size) override { // AbstractDiagnosticData
+        uint32_t counts[BucketCountT];
+        snapshot(counts);
+        return encode(counts, BucketCountT, SubBucketBitsT, min(), max(), data, size);
+    }
+};
+
+// Records the time spent in a scope to a histogram data source
+template<typename HistogramT, system_tick_t(*ClockFn)() = HAL_Timer_Get_Milli_Seconds>
+class ScopedDiagnosticTimer {
+public:
+    explicit ScopedDiagnosticTimer(HistogramT& histogram) :
+            histogram_(histogram),
+            start_(ClockFn()) {
+    }
+
+    ~ScopedDiagnosticTimer() {
+        histogram_.record(ClockFn() - start_);
+    }
+
+    // This class is non-copyable
+    ScopedDiagnosticTimer(const ScopedDiagnosticTimer&) = delete;
+    ScopedDiagnosticTimer& operator=(const ScopedDiagnosticTimer&) = delete;
+
+private:
+    HistogramT& histogram_;
+    system_tick_t start_;
+};
+
+template<typename HistogramT>
+using ScopedDiagnosticMicrosTimer = ScopedDiagnosticTimer<HistogramT, HAL_Timer_Get_Micro_Seconds>;
+
 // Convenience typedefs
 typedef IntegerDiagnosticData<NoConcurrency> SimpleIntegerDiagnosticData;
 typedef UnsignedIntegerDiagnosticData<NoConcurrency> SimpleUnsignedIntegerDiagnosticData;
@@ -693,4 +882,161 @@ inline int AbstractUnsignedIntegerDiagnosticData::get(const diag_source* src, In
     return AbstractTypeDiagnosticData<IntType>::get(src, val);
 }
 
+inline AbstractHistogramDiagnosticData::AbstractHistogramDiagnosticData(DiagnosticDataId id, const char* name) :
+        AbstractDiagnosticData(id, name, DIAG_TYPE_HISTOGRAM) {
+}
+
+inline int AbstractHistogramDiagnosticData::get(DiagnosticDataId id, HistogramDiagnosticSummary& summary) {
+    const diag_source* src = nullptr;
+    const int ret = diag_get_source(id, &src, nullptr);
+    if (ret != SYSTEM_ERROR_NONE) {
+        return ret;
+    }
+    return get(src, summary);
+}
+
+inline int AbstractHistogramDiagnosticData::get(const diag_source* src, HistogramDiagnosticSummary& summary) {
+    SPARK_ASSERT(src->type == DIAG_TYPE_HISTOGRAM);
+    size_t size = 0;
+    int ret = AbstractDiagnosticData::get(src, nullptr, size);
+    if (ret != SYSTEM_ERROR_NONE) {
+        return ret;
+    }
+    std::unique_ptr<uint8_t[]> buf(new(std::nothrow) uint8_t[size]);
+    if (!buf) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    ret = AbstractDiagnosticData::get(src, buf.get(), size);
+    if (ret != SYSTEM_ERROR_NONE) {
+        return ret;
+    }
+    // Decode the header and buckets
+    const uint8_t* p = buf.get();
+    const uint8_t* const end = p + size;
+    const auto readVarint = [&p, end](uint32_t* val) {
+        uint32_t v = 0;
+        for (unsigned shift = 0; p != end && shift < 32; shift += 7) {
+            const uint8_t b = *p++;
+            v |= (uint32_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                *val = v;
+                return true;
+            }
+        }
+        return false;
+    };
+    uint32_t version = 0, subBucketBits = 0, bucketCount = 0;
+    summary = HistogramDiagnosticSummary();
+    if (!readVarint(&version) || version != DIAG_HISTOGRAM_FORMAT_VERSION || !readVarint(&subBucketBits) ||
+            subBucketBits > 8 || !readVarint(&bucketCount) || !readVarint(&summary.count) ||
+            !readVarint(&summary.min) || !readVarint(&summary.max)) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    const uint32_t target[] = { (uint32_t)(((uint64_t)summary.count * 50 + 99) / 100),
+            (uint32_t)(((uint64_t)summary.count * 90 + 99) / 100), (uint32_t)(((uint64_t)summary.count * 99 + 99) / 100) };
+    uint32_t* const result[] = { &summary.p50, &summary.p90, &summary.p99 };
+    uint32_t index = 0, total = 0;
+    bool first = true;
+    while (p != end) {
+        uint32_t delta = 0, n = 0;
+        if (!readVarint(&delta) || !readVarint(&n)) {
+            return SYSTEM_ERROR_BAD_DATA;
+        }
+        index += first ? delta : delta + 1;
+        first = false;
+        const uint32_t prevTotal = total;
+        total += n;
+        for (size_t i = 0; i < 3; ++i) {
+            if (prevTotal < target[i] && total >= target[i]) {
+                *result[i] = std::max(std::min(bucketUpperBound(index, subBucketBits), summary.max), summary.min);
+            }
+        }
+    }
+    return SYSTEM_ERROR_NONE;
+}
+
+inline unsigned AbstractHistogramDiagnosticData::bucketIndex(uint32_t val, unsigned subBucketBits, unsigned bucketCount) {
+    const uint32_t subBuckets = 1u << subBucketBits;
+    unsigned index = val;
+    if (val >= subBuckets) {
+        const unsigned shift = (31 - __builtin_clz(val)) - subBucketBits;
+        index = ((shift + 1) << subBucketBits) | ((val >> shift) & (subBuckets - 1));
+    }
+    return (index < bucketCount) ? index : bucketCount - 1;
+}
+
+inline uint32_t AbstractHistogramDiagnosticData::bucketLowerBound(unsigned index, unsigned subBucketBits) {
+    const uint32_t subBuckets = 1u << subBucketBits;
+    if (index < subBuckets) {
+        return index;
+    }
+    const unsigned shift = (index >> subBucketBits) - 1;
+    const uint64_t val = (uint64_t)(subBuckets | (index & (subBuckets - 1))) << shift;
+    return (val > UINT32_MAX) ? UINT32_MAX : val;
+}
+
+inline uint32_t AbstractHistogramDiagnosticData::bucketUpperBound(unsigned index, unsigned subBucketBits) {
+    const uint32_t next = bucketLowerBound(index + 1, subBucketBits);
+    return (next == UINT32_MAX) ? UINT32_MAX : next - 1;
+}
+
+inline int AbstractHistogramDiagnosticData::encode(const uint32_t* counts, unsigned bucketCount,
+        unsigned subBucketBits, uint32_t min, uint32_t max, void* data, size_t& size) {
+    const auto buf = static_cast<uint8_t*>(data);
+    size_t offs = 0;
+    const auto writeVarint = [buf, size, &offs](uint32_t val) {
+        do {
+            uint8_t b = val & 0x7f;
+            val >>= 7;
+            if (val) {
+                b |= 0x80;
+            }
+            if (buf && offs < size) {
+                buf[offs] = b;
+            }
+            ++offs;
+        } while (val);
+    };
+    uint32_t total = 0;
+    for (unsigned i = 0; i < bucketCount; ++i) {
+        total += counts[i];
+    }
+    writeVarint(DIAG_HISTOGRAM_FORMAT_VERSION);
+    writeVarint(subBucketBits);
+    writeVarint(bucketCount);
+    writeVarint(total);
+    writeVarint(total ? min : 0);
+    writeVarint(max);
+    unsigned next = 0;
+    for (unsigned i = 0; i < bucketCount; ++i) {
+        if (counts[i]) {
+            writeVarint(i - next);
+            writeVarint(counts[i]);
+            next = i + 1;
+        }
+    }
+    if (buf && offs > size) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    size = offs;
+    return SYSTEM_ERROR_NONE;
+}
+
+inline uint32_t AbstractHistogramDiagnosticData::percentile(const uint32_t* counts, unsigned bucketCount,
+        unsigned subBucketBits, uint32_t min, uint32_t max, unsigned percent) {
+    uint32_t total = 0;
+    for (unsigned i = 0; i < bucketCount; ++i) {
+        total += counts[i];
+    }
+    const uint32_t target = ((uint64_t)total * percent + 99) / 100;
+    uint32_t n = 0;
+    for (unsigned i = 0; i < bucketCount && total; ++i) {
+        n += counts[i];
+        if (n >= target) {
+            return std::max(std::min(bucketUpperBound(i, subBucketBits), max), min);
+        }
+    }
+    return max;
+}
+
 } // namespace particle
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+class Print;
+
+/**
+ * Creates a format string that is parsed at compile time.
+ *
+ * The returned object can be passed to `Print::printf()`, `Print::printlnf()` and the formatting
+ * methods of `Logger` instead of a regular format string, e.g.:
+ *
+ * ```
+ * Serial.printf(PARTICLE_FORMAT("%s: %d"), name, value);
+ * ```
+ *
+ * The types of the arguments are checked against the conversion specifiers at compile time.
+ * Length modifiers are accepted but ignored, since the arguments are formatted according to their
+ * actual types. The `*` width and precision, and the `%n` specifier are not supported.
+ */
+#define PARTICLE_FORMAT(_str) \
+        ([]() { \
+            struct S { \
+                static constexpr const char* str() { \
+                    return _str; \
+                } \
+            }; \
+            return ::particle::FormatString<S>(); \
+        }())
+
+namespace particle {
+
+namespace detail {
+
+enum FormatFlag {
+    FORMAT_FLAG_LEFT = 0x01, // '-'
+    FORMAT_FLAG_PLUS = 0x02, // '+'
+    FORMAT_FLAG_SPACE = 0x04, // ' '
+    FORMAT_FLAG_ALT = 0x08, // '#'
+    FORMAT_FLAG_ZERO = 0x10 // '0'
+};
+
+// Conversion specification and the literal text preceding it
+struct FormatSpec {
+    unsigned offset; // Offset of the literal text in the format string
+    unsigned literalSize; // Size of the literal text
+    unsigned specSize; // Size of the conversion specification, including '%'
+    int width; // 0 if not specified
+    int precision; // -1 if not specified
+    char conv; // Conversion specifier, or '\0' if the specification is not supported
+    unsigned char flags;
+};
+
+constexpr bool isFormatFlag(char c) {
+    return c == '-' || c == '+' || c == ' ' || c == '#' || c == '0';
+}
+
+constexpr bool isFormatConv(char c) {
+    return c == 'd' || c == 'i' || c == 'u' || c == 'o' || c == 'x' || c == 'X' || c == 'c' || c == 's' || c == 'p' ||
+            c == 'f' || c == 'F' || c == 'e' || c == 'E' || c == 'g' || c == 'G' || c == 'a' || c == 'A' || c == '%';
+}
+
+// Parses the literal text and the conversion specification starting at the given offset, and
+// returns the offset of the next literal text, or 0 if the end of the string is reached
+constexpr unsigned parseFormatSpec(const char* str, unsigned offs, FormatSpec* spec) {
+    spec->offset = offs;
+    spec->literalSize = 0;
+    spec->specSize = 0;
+    spec->width = 0;
+    spec->precision = -1;
+    spec->conv = '\0';
+    spec->flags = 0;
+    unsigned i = offs;
+    while (str[i] && str[i] != '%') {
+        ++i;
+    }
+    spec->literalSize = i - offs;
+    if (!str[i]) {
+        return 0;
+    }
+    const unsigned start = i++;
+    for (; isFormatFlag(str[i]); ++i) {
+        switch (str[i]) {
+        case '-':
+            spec->flags |= FORMAT_FLAG_LEFT;
+            break;
+        case '+':
+            spec->flags |= FORMAT_FLAG_PLUS;
+            break;
+        case ' ':
+            spec->flags |= FORMAT_FLAG_SPACE;
+            break;
+        case '#':
+            spec->flags |= FORMAT_FLAG_ALT;
+            break;
+        default:
+            spec->flags |= FORMAT_FLAG_ZERO;
+            break;
+        }
+    }
+    for (; str[i] >= '0' && str[i] <= '9'; ++i) {
+        spec->width = spec->width * 10 + (str[i] - '0');
+    }
+    if (str[i] == '.') {
+        spec->precision = 0;
+        for (++i; str[i] >= '0' && str[i] <= '9'; ++i) {
+            spec->precision = spec->precision * 10 + (str[i] - '0');
+        }
+    }
+    while (str[i] == 'h' || str[i] == 'l' || str[i] == 'j' || str[i] == 'z' || str[i] == 't' || str[i] == 'L') {
+        ++i;
+    }
+    if (str[i]) {
+        if (isFormatConv(str[i])) {
+            spec->conv = str[i];
+        }
+        ++i;
+    }
+    spec->specSize = i - start;
+    return i;
+}
+
+constexpr unsigned formatSpecCount(const char* str) {
+    unsigned n = 0;
+    FormatSpec spec = {};
+    for (unsigned offs = 0; (offs = parseFormatSpec(str, offs, &spec));) {
+        ++n;
+    }
+    return n;
+}
+
+// Conversion specifications of a format string. The last element describes the trailing literal text
+template<unsigned N>
+struct FormatSpecs {
+    FormatSpec specs[N + 1];
+};
+
+template<unsigned N>
+constexpr FormatSpecs<N> parseFormatSpecs(const char* str) {
+    FormatSpecs<N> s = {};
+    unsigned offs = 0;
+    for (unsigned i = 0; i <= N; ++i) {
+        offs = parseFormatSpec(str, offs, &s.specs[i]);
+    }
+    return s;
+}
+
+constexpr unsigned formatArgCount(const char* str) {
+    unsigned n = 0;
+    FormatSpec spec = {};
+    for (unsigned offs = 0; (offs = parseFormatSpec(str, offs, &spec));) {
+        if (spec.conv != '%') {
+            ++n;
+        }
+    }
+    return n;
+}
+
+constexpr bool isFormatStringValid(const char* str) {
+    FormatSpec spec = {};
+    for (unsigned offs = 0; (offs = parseFormatSpec(str, offs, &spec));) {
+        if (!spec.conv) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename T>
+constexpr bool isFormatArgValid(char conv) {
+    using U = std::decay_t<T>;
+    switch (conv) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+        return std::is_integral<U>::value || std::is_enum<U>::value;
+    case 's':
+        return std::is_same<U, const char*>::value || std::is_same<U, char*>::value;
+    case 'p':
+        return std::is_pointer<U>::value || std::is_same<U, std::nullptr_t>::value;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return std::is_floating_point<U>::value;
+    default:
+        return false;
+    }
+}
+
+// Runtime part of the formatting, see spark_wiring_print.cpp
+size_t formatLiteral(Print& p, const char* str, unsigned size);
+size_t formatSigned(Print& p, const FormatSpec& spec, long long val);
+size_t formatUnsigned(Print& p, const FormatSpec& spec, unsigned long long val);
+size_t formatString(Print& p, const FormatSpec& spec, const char* str);
+size_t formatPointer(Print& p, const FormatSpec& spec, const void* ptr);
+size_t formatDouble(Print& p, const FormatSpec& spec, const char* str, double val);
+
+template<typename T, std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value, int> = 0>
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, T val) {
+    if (spec.conv == 'd' || spec.conv == 'i' || spec.conv == 'c') {
+        return formatSigned(p, spec, val);
+    }
+    return formatUnsigned(p, spec, (std::make_unsigned_t<T>)val);
+}
+
+template<typename T, std::enable_if_t<std::is_integral<T>::value && std::is_unsigned<T>::value, int> = 0>
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, T val) {
+    return formatUnsigned(p, spec, val);
+}
+
+template<typename T, std::enable_if_t<std::is_enum<T>::value, int> = 0>
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, T val) {
+    return formatArg(p, spec, str, (std::underlying_type_t<T>)val);
+}
+
+template<typename T, std::enable_if_t<std::is_floating_point<T>::value, int> = 0>
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, T val) {
+    return formatDouble(p, spec, str, val);
+}
+
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, const char* val) {
+    if (spec.conv == 's') {
+        return formatString(p, spec, val);
+    }
+    return formatPointer(p, spec, val);
+}
+
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, char* val) {
+    return formatArg(p, spec, str, (const char*)val);
+}
+
+template<typename T>
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, T* val) {
+    return formatPointer(p, spec, val);
+}
+
+inline size_t formatArg(Print& p, const FormatSpec& spec, const char* str, std::nullptr_t) {
+    return formatPointer(p, spec, nullptr);
+}
+
+template<typename FormatT, unsigned I>
+inline size_t formatArgs(Print& p);
+
+template<typename FormatT, unsigned I, typename ArgT, typename... ArgsT>
+inline size_t formatArgs(Print& p, const ArgT& arg, const ArgsT&... args);
+
+// "%%"
+template<typename FormatT, unsigned I, typename... ArgsT>
+inline size_t formatSpec(Print& p, std::true_type, const ArgsT&... args) {
+    return formatLiteral(p, "%", 1) + formatArgs<FormatT, I + 1>(p, args...);
+}
+
+template<typename FormatT, unsigned I, typename ArgT, typename... ArgsT>
+inline size_t formatSpec(Print& p, std::false_type, const ArgT& arg, const ArgsT&... args) {
+    constexpr FormatSpec spec = FormatT::specs().specs[I];
+    static_assert(isFormatArgValid<ArgT>(spec.conv), "Argument type doesn't match the conversion specifier");
+    return formatArg(p, spec, FormatT::str(), arg) + formatArgs<FormatT, I + 1>(p, args...);
+}
+
+template<typename FormatT, unsigned I>
+inline size_t formatEnd(Print& p, std::true_type) {
+    return formatSpec<FormatT, I>(p, std::true_type());
+}
+
+template<typename FormatT, unsigned I>
+inline size_t formatEnd(Print& p, std::false_type) {
+    return 0;
+}
+
+// All arguments are formatted, the remaining specifications can only be "%%"
+template<typename FormatT, unsigned I>
+inline size_t formatArgs(Print& p) {
+    constexpr FormatSpec spec = FormatT::specs().specs[I];
+    const size_t n = formatLiteral(p, FormatT::str() + spec.offset, spec.literalSize);
+    return n + formatEnd<FormatT, I>(p, std::integral_constant<bool, (I < FormatT::specCount() && spec.conv == '%')>());
+}
+
+template<typename FormatT, unsigned I, typename ArgT, typename... ArgsT>
+inline size_t formatArgs(Print& p, const ArgT& arg, const ArgsT&... args) {
+    constexpr FormatSpec spec = FormatT::specs().specs[I];
+    const size_t n = formatLiteral(p, FormatT::str() + spec.offset, spec.literalSize);
+    return n + formatSpec<FormatT, I>(p, std::integral_constant<bool, spec.conv == '%'>(), arg, args...);
+}
+
+} // namespace detail
+
+/**
+ * Format string parsed at compile time.
+ *
+ * Use the `PARTICLE_FORMAT()` macro to create instances of this class.
+ */
+template<typename StringT>
+struct FormatString {
+    static constexpr const char* str() {
+        return StringT::str();
+    }
+
+    static constexpr unsigned specCount() {
+        return detail::formatSpecCount(StringT::str());
+    }
+
+    static constexpr unsigned argCount() {
+        return detail::formatArgCount(StringT::str());
+    }
+
+    static constexpr detail::FormatSpecs<specCount()> specs() {
+        return detail::parseFormatSpecs<specCount()>(StringT::str());
+    }
+};
+
+template<typename T>
+struct IsFormatString: std::false_type {
+};
+
+template<typename StringT>
+struct IsFormatString<FormatString<StringT>>: std::true_type {
+};
+
+/**
+ * Writes a formatted string to a `Print` instance.
+ *
+ * @param p Destination.
+ * @param fmt Format string created with `PARTICLE_FORMAT()`.
+ * @param args Arguments.
+ * @return Number of bytes written.
+ */
+template<typename FormatT, typename... ArgsT>
+inline size_t formatTo(Print& p, FormatT fmt, const ArgsT&... args) {
+    static_assert(IsFormatString<FormatT>::value, "Use PARTICLE_FORMAT() to create a format string");
+    static_assert(detail::isFormatStringValid(FormatT::str()), "Unsupported conversion specification");
+    static_assert(FormatT::argCount() == sizeof...(ArgsT), "Number of arguments doesn't match the format string");
+    return detail::formatArgs<FormatT, 0>(p, args...);
+}
+
+} // namespace particle
@@ -26,6 +26,8 @@
 #include <cstring>
 #include <memory>
 
+class Stream;
+
 namespace spark {
 
 namespace detail {
@@ -45,6 +47,18 @@ enum JSONType {
     JSON_TYPE_OBJECT
 };
 
+enum JSONEvent {
+    JSON_EVENT_NONE, // More data is needed
+    JSON_EVENT_BEGIN_OBJECT,
+    JSON_EVENT_END_OBJECT,
+    JSON_EVENT_BEGIN_ARRAY,
+    JSON_EVENT_END_ARRAY,
+    JSON_EVENT_NAME, // Name of an object's property
+    JSON_EVENT_VALUE, // Primitive value or string
+    JSON_EVENT_END, // End of the document
+    JSON_EVENT_ERROR
+};
+
 class JSONString;
 class JSONArrayIterator;
 class JSONObjectIterator;
@@ -159,6 +173,82 @@ private:
     JSONObjectIterator(const jsmntok_t *token, detail::JSONDataPtr data);
 };
 
+// Incremental JSON parser. Source data can be provided in chunks of arbitrary size or read from
+// a stream. The parser doesn't allocate memory dynamically: names and values are unescaped into
+// a buffer provided by the caller, which limits their maximum length
+class JSONStreamParser {
+public:
+    static const unsigned MAX_DEPTH = 32; // Maximum nesting level of arrays and objects
+
+    JSONStreamParser(char *buf, size_t size);
+
+    void feed(const char *data, size_t size); // Data needs to be valid until next() returns JSON_EVENT_NONE
+    void finish(); // Signals the end of the source data
+    void reset();
+
+    JSONEvent next();
+    JSONEvent next(Stream &stream); // Returns JSON_EVENT_NONE if no data is available in the stream
+
+    bool skip(); // Skips the current array or object, or the value of the current property
+    JSONEvent find(const char *name); // Finds a property of the current object, skipping other properties
+
+    JSONType type() const; // Returns type of the current value
+
+    bool toBool() const;
+    int toInt() const;
+    double toDouble() const;
+
+    const char* data() const; // Returns null-terminated name or value
+    size_t dataSize() const;
+
+    unsigned depth() const;
+
+private:
+    enum State {
+        VALUE, // Expecting a value
+        VALUE_OR_END, // Expecting first element of an array
+        NAME, // Expecting name of an object's property
+        NAME_OR_END, // Expecting name of the first property
+        COLON, // Expecting name separator
+        NEXT, // Expecting value separator or end of an array or object
+        DONE,
+        FAILED
+    };
+
+    enum Token {
+        NO_TOKEN,
+        STRING,
+        ESCAPE, // Escaped character
+        UNICODE, // Escaped character in the "\uXXXX" form
+        PRIMITIVE
+    };
+
+    const char *in_, *inEnd_;
+    char *buf_;
+    size_t bufSize_, n_;
+    uint32_t stack_; // Bit is set for each nesting level that is an object
+    unsigned depth_;
+    int skipDepth_; // Depth at which skipping ends, or -1
+    State state_;
+    Token tok_;
+    JSONType type_;
+    JSONEvent event_; // Last returned event
+    char hex_[4];
+    unsigned hexCount_;
+    char c_; // Character read from a stream
+    bool name_; // Whether current string is a property name
+    bool finished_;
+
+    JSONEvent parse();
+    JSONEvent beginCompound(bool object);
+    JSONEvent endCompound(bool object);
+    JSONEvent endString();
+    JSONEvent endPrimitive();
+    JSONEvent error();
+    bool append(char c);
+    bool inObject() const;
+};
+
 // Abstract JSON document writer
 class JSONWriter {
 public:
@@ -368,6 +458,38 @@ inline size_t spark::JSONObjectIterator::count() const {
     return n_;
 }
 
+// spark::JSONStreamParser
+inline spark::JSONStreamParser::JSONStreamParser(char *buf, size_t size) :
+        buf_(buf),
+        bufSize_(size) {
+    reset();
+}
+
+inline void spark::JSONStreamParser::feed(const char *data, size_t size) {
+    in_ = data;
+    inEnd_ = data + size;
+}
+
+inline void spark::JSONStreamParser::finish() {
+    finished_ = true;
+}
+
+inline spark::JSONType spark::JSONStreamParser::type() const {
+    return type_;
+}
+
+inline const char* spark::JSONStreamParser::data() const {
+    return buf_;
+}
+
+inline size_t spark::JSONStreamParser::dataSize() const {
+    return n_;
+}
+
+inline unsigned spark::JSONStreamParser::depth() const {
+    return depth_;
+}
+
 // spark::JSONWriter
 inline spark::JSONWriter::JSONWriter() :
         state_(BEGIN) {
@@ -18,6 +18,8 @@
 #ifndef SPARK_WIRING_LOGGING_H
 #define SPARK_WIRING_LOGGING_H
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <cstdarg>
 
@@ -34,6 +36,16 @@
 #include "system_control.h"
 #endif
 
+// Default size of the buffer allocated for each thread in asynchronous logging mode
+#ifndef LOG_ASYNC_BUFFER_SIZE
+#define LOG_ASYNC_BUFFER_SIZE 1024
+#endif
+
+// Maximum number of threads that can generate logging output in asynchronous logging mode
+#ifndef LOG_ASYNC_MAX_THREADS
+#define LOG_ASYNC_MAX_THREADS 6
+#endif
+
 namespace spark {
 
 class LogCategoryFilter;
@@ -51,6 +63,7 @@ public:
 
     LogLevel level() const;
     LogLevel level(const char *category) const;
+    LogLevel minLevel() const;
 
     // This class in non-copyable
     LogFilter(const LogFilter&) = delete;
@@ -62,12 +75,61 @@ private:
     Vector<String> cats_; // Category filter strings
     Vector<Node> nodes_; // Lookup table
     LogLevel level_; // Default level
+    LogLevel minLevel_; // Lowest level enabled for any category
 
     static int nodeIndex(const Vector<Node> &nodes, const char *name, size_t size, bool &found);
 };
 
+class AsyncLogger;
+
+// Buffer for a log message formatted with a compile-time format string
+class LogMessageBuffer: public Print {
+public:
+    LogMessageBuffer();
+
+    const char* str();
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t size) override;
+
+    using Print::write;
+
+private:
+    char buf_[LOG_MAX_STRING_LENGTH];
+    size_t size_;
+    bool overflow_;
+};
+
+// Writes data formatted with a compile-time format string directly to the log handlers
+class LogWriteBuffer: public Print {
+public:
+    LogWriteBuffer(LogLevel level, const char* category);
+    ~LogWriteBuffer();
+
+    void flush();
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t size) override;
+
+    using Print::write;
+
+private:
+    char buf_[LOG_MAX_STRING_LENGTH];
+    size_t size_;
+    const char* const category_;
+    const LogLevel level_;
+};
+
 } // namespace spark::detail
 
+/*!
+    \brief Determines what happens when a thread's buffer is full in asynchronous logging mode.
+*/
+enum class LogOverflowPolicy {
+    DROP, ///< The message is discarded and counted as dropped.
+    BLOCK ///< The calling thread writes out the buffered messages and then stores the message.
+};
+
 class LogCategoryFilter {
 public:
     LogCategoryFilter(String category, LogLevel level);
@@ -116,6 +178,10 @@ public:
         \param category Category name.
     */
     LogLevel level(const char *category) const;
+    /*!
+        \brief Returns the lowest logging level enabled for any category.
+    */
+    LogLevel minLevel() const;
     /*!
         \brief Returns level name.
         \param level Logging level.
@@ -383,6 +449,65 @@ public:
         \brief This method is an alias for \ref log(LogLevel, const char*, ...).
     */
     void operator()(LogLevel level, const char *fmt, ...) const __attribute__((format(printf, 3, 4)));
+    /*!
+        \brief Generates trace message.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+
+        The format string is parsed at compile time and the types of the arguments are checked
+        against it.
+    */
+    template<typename StringT, typename... ArgsT>
+    void trace(particle::FormatString<StringT> fmt, const ArgsT&... args) const;
+    /*!
+        \brief Generates info message.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+    */
+    template<typename StringT, typename... ArgsT>
+    void info(particle::FormatString<StringT> fmt, const ArgsT&... args) const;
+    /*!
+        \brief Generates warning message.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+    */
+    template<typename StringT, typename... ArgsT>
+    void warn(particle::FormatString<StringT> fmt, const ArgsT&... args) const;
+    /*!
+        \brief Generates error message.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+    */
+    template<typename StringT, typename... ArgsT>
+    void error(particle::FormatString<StringT> fmt, const ArgsT&... args) const;
+    /*!
+        \brief Generates log message.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+
+        This method uses default logging level (\ref DEFAULT_LEVEL).
+    */
+    template<typename StringT, typename... ArgsT>
+    void log(particle::FormatString<StringT> fmt, const ArgsT&... args) const;
+    /*!
+        \brief Generates log message.
+        \param level Logging level.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+    */
+    template<typename StringT, typename... ArgsT>
+    void log(LogLevel level, particle::FormatString<StringT> fmt, const ArgsT&... args) const;
+    /*!
+        \brief Writes formatted string to log.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+
+        Unlike \ref printf(const char*, ...), this method doesn't truncate the output.
+
+        This method uses default logging level (\ref DEFAULT_LEVEL).
+    */
+    template<typename StringT, typename... ArgsT>
+    void printf(particle::FormatString<StringT> fmt, const ArgsT&... args) const;
+    /*!
+        \brief Writes formatted string to log.
+        \param level Logging level.
+        \param fmt Format string created with `PARTICLE_FORMAT()`.
+    */
+    template<typename StringT, typename... ArgsT>
+    void printf(LogLevel level, particle::FormatString<StringT> fmt, const ArgsT&... args) const;
 
     // This class is non-copyable
     Logger(const Logger&) = delete;
@@ -563,6 +688,40 @@ public:
 
 #endif // Wiring_LogConfig
 
+    /*!
+        \brief Enables asynchronous logging.
+
+        In asynchronous mode, log messages are stored in a per-thread buffer in a compact binary
+        form instead of being formatted by the calling thread. A background writer formats the
+        buffered messages and passes them to the log handlers in batches, so that slow handlers
+        don't stall the threads generating logging output.
+
+        On platforms without threading support the buffered messages are written out by \ref flush().
+
+        \param bufferSize Size of the buffer allocated for each thread generating logging output.
+        \param policy Determines what happens when a thread's buffer is full.
+        \return `false` in case of error.
+    */
+    bool enableAsyncMode(size_t bufferSize = LOG_ASYNC_BUFFER_SIZE, LogOverflowPolicy policy = LogOverflowPolicy::DROP);
+    /*!
+        \brief Writes out the buffered messages and disables asynchronous logging.
+    */
+    void disableAsyncMode();
+    /*!
+        \brief Returns `true` if asynchronous logging is enabled.
+    */
+    bool isAsyncMode() const;
+    /*!
+        \brief Writes out the messages buffered in asynchronous mode.
+
+        This method is also invoked when the system enters a panic state.
+    */
+    void flush();
+    /*!
+        \brief Returns the number of messages dropped in asynchronous mode because a buffer was full.
+    */
+    size_t droppedMessageCount() const;
+
     /*!
         \brief Returns log manager's instance.
     */
@@ -579,6 +738,8 @@ private:
 
     bool outputActive_;
 
+    std::atomic<detail::AsyncLogger*> async_;
+
 #if Wiring_LogConfig
     Vector<FactoryHandler> factoryHandlers_;
     LogHandlerFactory *handlerFactory_;
@@ -597,13 +758,23 @@ private:
     void destroyFactoryHandlers();
 #endif
 
-    static void setSystemCallbacks();
+    void setSystemCallbacks();
     static void resetSystemCallbacks();
+    void updateAsyncMinLevel();
 
     // System callbacks
     static void logMessage(const char *msg, int level, const char *category, const LogAttributes *attr, void *reserved);
     static void logWrite(const char *data, size_t size, int level, const char *category, void *reserved);
     static int logEnabled(int level, const char *category, void *reserved);
+    static int logMessageAsync(int level, const char *category, const LogAttributes *attr, const char *fmt, va_list args,
+            void *reserved);
+    static void logFlush(void *reserved);
+
+    // Dispatches a message to the active handlers. The caller must hold the mutex
+    void dispatchMessage(const char *msg, int level, const char *category, const LogAttributes &attr);
+    void dispatchWrite(const char *data, size_t size, int level, const char *category);
+
+    friend class detail::AsyncLogger;
 
     bool isActive() const;
     void setActive(bool output_active);
@@ -632,6 +803,10 @@ inline LogLevel spark::detail::LogFilter::level() const {
     return level_;
 }
 
+inline LogLevel spark::detail::LogFilter::minLevel() const {
+    return minLevel_;
+}
+
 // spark::LogCategoryFilter
 inline spark::LogCategoryFilter::LogCategoryFilter(String category, LogLevel level) :
         cat_(category),
@@ -673,6 +848,10 @@ inline LogLevel spark::LogHandler::level(const char *category) const {
     return filter_.level(category);
 }
 
+inline LogLevel spark::LogHandler::minLevel() const {
+    return filter_.minLevel();
+}
+
 inline const char* spark::LogHandler::levelName(LogLevel level) {
     return log_level_name(level, nullptr);
 }
@@ -871,6 +1050,124 @@ inline void spark::Logger::log(LogLevel level, const char *fmt, va_list args) co
     log_message_v(level, name_, &attr, nullptr, fmt, args);
 }
 
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::trace(particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    log(LOG_LEVEL_TRACE, fmt, args...);
+}
+
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::info(particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    log(LOG_LEVEL_INFO, fmt, args...);
+}
+
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::warn(particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    log(LOG_LEVEL_WARN, fmt, args...);
+}
+
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::error(particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    log(LOG_LEVEL_ERROR, fmt, args...);
+}
+
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::log(particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    log(DEFAULT_LEVEL, fmt, args...);
+}
+
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::log(LogLevel level, particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    if (!isLevelEnabled(level)) {
+        return; // Don't format messages that would be discarded anyway
+    }
+    LogAttributes attr;
+    attr.size = sizeof(LogAttributes);
+    attr.flags = 0;
+    detail::LogMessageBuffer buf;
+    particle::formatTo(buf, fmt, args...);
+    log_message(level, name_, &attr, nullptr, "%s", buf.str());
+}
+
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::printf(particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    printf(DEFAULT_LEVEL, fmt, args...);
+}
+
+template<typename StringT, typename... ArgsT>
+inline void spark::Logger::printf(LogLevel level, particle::FormatString<StringT> fmt, const ArgsT&... args) const {
+    if (!isLevelEnabled(level)) {
+        return;
+    }
+    detail::LogWriteBuffer buf(level, name_);
+    particle::formatTo(buf, fmt, args...);
+}
+
+// spark::detail::LogMessageBuffer
+inline spark::detail::LogMessageBuffer::LogMessageBuffer() :
+        size_(0),
+        overflow_(false) {
+}
+
+inline const char* spark::detail::LogMessageBuffer::str() {
+    buf_[size_] = '\0';
+    if (overflow_) {
+        buf_[sizeof(buf_) - 2] = '~'; // Same as log_message()
+    }
+    return buf_;
+}
+
+inline size_t spark::detail::LogMessageBuffer::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+inline size_t spark::detail::LogMessageBuffer::write(const uint8_t* data, size_t size) {
+    size_t n = sizeof(buf_) - 1 - size_; // 1 character is reserved for term. null
+    if (size > n) {
+        overflow_ = true;
+    } else {
+        n = size;
+    }
+    memcpy(buf_ + size_, data, n);
+    size_ += n;
+    return size; // Pretend the entire data was written
+}
+
+// spark::detail::LogWriteBuffer
+inline spark::detail::LogWriteBuffer::LogWriteBuffer(LogLevel level, const char* category) :
+        size_(0),
+        category_(category),
+        level_(level) {
+}
+
+inline spark::detail::LogWriteBuffer::~LogWriteBuffer() {
+    flush();
+}
+
+inline void spark::detail::LogWriteBuffer::flush() {
+    if (size_ > 0) {
+        log_write(level_, category_, buf_, size_, nullptr);
+        size_ = 0;
+    }
+}
+
+inline size_t spark::detail::LogWriteBuffer::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+inline size_t spark::detail::LogWriteBuffer::write(const uint8_t* data, size_t size) {
+    size_t offs = 0;
+    while (offs < size) {
+        if (size_ == sizeof(buf_)) {
+            flush();
+        }
+        const size_t n = std::min(size - offs, sizeof(buf_) - size_);
+        memcpy(buf_ + size_, data + offs, n);
+        size_ += n;
+        offs += n;
+    }
+    return size;
+}
+
 // spark::AttributedLogger
 inline spark::AttributedLogger::AttributedLogger(const char *name) :
         name_(name) {
@@ -36,6 +36,7 @@
 #include "spark_wiring_string.h"
 #include "spark_wiring_printable.h"
 #include "spark_wiring_fixed_point.h"
+#include "spark_wiring_format.h"
 #include <climits>
 
 const unsigned char DEC = 10;
@@ -115,6 +116,21 @@ class Print
         return this->printf_impl(true, format, args...);
     }
 
+    // Overloads taking a format string created with PARTICLE_FORMAT()
+    template <typename StringT, typename... Args>
+    inline size_t printf(particle::FormatString<StringT> format, const Args&... args)
+    {
+        return particle::formatTo(*this, format, args...);
+    }
+
+    template <typename StringT, typename... Args>
+    inline size_t printlnf(particle::FormatString<StringT> format, const Args&... args)
+    {
+        size_t n = particle::formatTo(*this, format, args...);
+        n += println();
+        return n;
+    }
+
 };
 
 template <typename T, std::enable_if_t<std::is_integral<T>::value || std::is_convertible<T, unsigned long long>::value ||
@@ -51,6 +51,8 @@ class __FlashStringHelper;
 // result objects are assumed to be writable by subsequent concatenations.
 class StringSumHelper;
 
+class StringArena;
+
 // The string class
 class String
 {
@@ -68,6 +70,9 @@ public:
 	// be false).
 	String(const char *cstr = "");
 	String(const char *cstr, unsigned int length);
+	// creates a copy of the initial value in a buffer allocated from
+	// the arena.  if the arena is exhausted, the heap is used instead
+	explicit String(StringArena &arena, const char *cstr = "");
 	String(const String &str);
 	String(const __FlashStringHelper *pstr);
         String(const Printable& printable);
@@ -203,11 +208,17 @@ protected:
 	char *buffer;	        // the actual char array
 	unsigned int capacity;  // the array length minus one (for the '\0')
 	unsigned int len;       // the String length (not counting the '\0')
-	unsigned char flags;    // unused, for future features
+	unsigned char flags;    // see the enum below
 protected:
+	enum {
+		ARENA_BUFFER = 0x01     // the buffer is allocated from a StringArena
+	};
+
 	void init(void);
 	void invalidate(void);
 	unsigned char changeBuffer(unsigned int maxStrLen);
+	unsigned char grow(unsigned int size);
+	void freeBuffer(void);
 	unsigned char concat(const char *cstr, unsigned int length);
 
 	// copy and move
@@ -222,6 +233,54 @@ protected:
 
 };
 
+// A memory block backing temporary strings, such as the ones used to build
+// an event name or data.  Strings constructed with an arena don't use the
+// heap until the arena is exhausted.  Memory of a string is only reused if
+// it is the most recent allocation in the arena, so the arena is meant to
+// be reset or destroyed at the end of the scope where it is declared.  The
+// arena must outlive the strings that use it, and such strings must not be
+// passed to code in another firmware module that may modify them
+class StringArena
+{
+public:
+	StringArena(char *buf, size_t size);
+
+	// releases all memory.  strings using the arena must be destroyed
+	// before calling this method
+	void reset(void) { used = 0; last = NULL; }
+
+	size_t size(void) const { return bufSize; }
+	size_t available(void) const { return bufSize - used; }
+
+	// This class is non-copyable
+	StringArena(const StringArena&) = delete;
+	StringArena& operator=(const StringArena&) = delete;
+
+private:
+	char *buf;
+	size_t bufSize;
+	size_t used;
+	char *last;             // most recent allocation
+
+	char* alloc(size_t size);
+	char* realloc(char *ptr, size_t oldSize, size_t size);
+	void free(char *ptr);
+
+	static StringArena* owner(const char *ptr);
+
+	friend class String;
+};
+
+template<size_t N>
+class StaticStringArena : public StringArena
+{
+public:
+	StaticStringArena() : StringArena(data, N) {}
+
+private:
+	alignas(void*) char data[N];
+};
+
 class StringSumHelper : public String
 {
 public:
@@ -48,7 +48,7 @@ bool CloudClass::register_function(cloud_function_t fn, void* data, const char*
 }
 
 Future<bool> CloudClass::publish_event(const char *eventName, const char *eventData, int ttl, PublishFlags flags) {
-    if (!connected()) {
+    if (!connected() && !(flags & STORE)) {
         return Future<bool>(Error::INVALID_STATE);
     }
     spark_send_event_data d = { sizeof(spark_send_event_data) };
@@ -17,6 +17,8 @@
 
 #include "spark_wiring_json.h"
 
+#include "spark_wiring_stream.h"
+
 #include <algorithm>
 
 #include <cstdio>
@@ -62,6 +64,75 @@ bool hexToInt(const char *s, size_t size, uint32_t *val) {
     return true;
 }
 
+bool valueToBool(spark::JSONType type, const char *s) {
+    switch (type) {
+    case spark::JSON_TYPE_BOOL: {
+        return *s == 't';
+    }
+    case spark::JSON_TYPE_NUMBER: {
+        return strcmp(s, "0") != 0 && strcmp(s, "0.0") != 0;
+    }
+    case spark::JSON_TYPE_STRING: {
+        if (*s == '\0' || strcmp(s, "false") == 0 || strcmp(s, "0") == 0 || strcmp(s, "0.0") == 0) {
+            return false; // Empty string, "false", "0" or "0.0"
+        }
+        return true; // Any other string
+    }
+    default:
+        return false;
+    }
+}
+
+int valueToInt(spark::JSONType type, const char *s) {
+    switch (type) {
+    case spark::JSON_TYPE_BOOL: {
+        return *s == 't';
+    }
+    case spark::JSON_TYPE_NUMBER:
+    case spark::JSON_TYPE_STRING: {
+        // toInt() may produce incorrect results for floating point numbers, since we want to keep
+        // compile-time dependency on strtod() optional
+        return strtol(s, nullptr, 10);
+    }
+    default:
+        return 0;
+    }
+}
+
+double valueToDouble(spark::JSONType type, const char *s) {
+    switch (type) {
+    case spark::JSON_TYPE_BOOL: {
+        return *s == 't';
+    }
+    case spark::JSON_TYPE_NUMBER:
+    case spark::JSON_TYPE_STRING: {
+        return strtod(s, nullptr);
+    }
+    default:
+        return 0.0;
+    }
+}
+
+// Returns type of a primitive value, or JSON_TYPE_INVALID if the value is malformed
+spark::JSONType primitiveType(const char *s) {
+    if (strcmp(s, "null") == 0) {
+        return spark::JSON_TYPE_NULL;
+    }
+    if (strcmp(s, "true") == 0 || strcmp(s, "false") == 0) {
+        return spark::JSON_TYPE_BOOL;
+    }
+    if (*s != '-' && (*s < '0' || *s > '9')) {
+        return spark::JSON_TYPE_INVALID;
+    }
+    for (++s; *s; ++s) {
+        const char c = *s;
+        if ((c < '0' || c > '9') && c != '.' && c != 'e' && c != 'E' && c != '+' && c != '-') {
+            return spark::JSON_TYPE_INVALID;
+        }
+    }
+    return spark::JSON_TYPE_NUMBER;
+}
+
 } // namespace
 
 // spark::detail::JSONData
@@ -94,59 +165,18 @@ spark::JSONValue::JSONValue(const jsmntok_t *t, detail::JSONDataPtr d) :
 }
 
 bool spark::JSONValue::toBool() const {
-    switch (type()) {
-    case JSON_TYPE_BOOL: {
-        const char* const s = d_->json + t_->start;
-        return *s == 't';
-    }
-    case JSON_TYPE_NUMBER: {
-        const char* const s = d_->json + t_->start;
-        return strcmp(s, "0") != 0 && strcmp(s, "0.0") != 0;
-    }
-    case JSON_TYPE_STRING: {
-        const char* const s = d_->json + t_->start;
-        if (*s == '\0' || strcmp(s, "false") == 0 || strcmp(s, "0") == 0 || strcmp(s, "0.0") == 0) {
-            return false; // Empty string, "false", "0" or "0.0"
-        }
-        return true; // Any other string
-    }
-    default:
-        return false;
-    }
+    const JSONType t = type();
+    return (t != JSON_TYPE_INVALID) ? valueToBool(t, d_->json + t_->start) : false;
 }
 
 int spark::JSONValue::toInt() const {
-    switch (type()) {
-    case JSON_TYPE_BOOL: {
-        const char* const s = d_->json + t_->start;
-        return *s == 't';
-    }
-    case JSON_TYPE_NUMBER:
-    case JSON_TYPE_STRING: {
-        // toInt() may produce incorrect results for floating point numbers, since we want to keep
-        // compile-time dependency on strtod() optional
-        const char* const s = d_->json + t_->start;
-        return strtol(s, nullptr, 10);
-    }
-    default:
-        return 0;
-    }
+    const JSONType t = type();
+    return (t != JSON_TYPE_INVALID) ? valueToInt(t, d_->json + t_->start) : 0;
 }
 
 double spark::JSONValue::toDouble() const {
-    switch (type()) {
-    case JSON_TYPE_BOOL: {
-        const char* const s = d_->json + t_->start;
-        return *s == 't';
-    }
-    case JSON_TYPE_NUMBER:
-    case JSON_TYPE_STRING: {
-        const char* const s = d_->json + t_->start;
-        return strtod(s, nullptr);
-    }
-    default:
-        return 0.0;
-    }
+    const JSONType t = type();
+    return (t != JSON_TYPE_INVALID) ? valueToDouble(t, d_->json + t_->start) : 0.0;
 }
 
 spark::JSONType spark::JSONValue::type() const {
@@ -227,23 +257,46 @@ spark::JSONValue spark::JSONValue::parseCopy(const char *json, size_t size) {
 }
 
 bool spark::JSONValue::tokenize(const char *json, size_t size, jsmntok_t **tokens, size_t *count) {
-    jsmn_parser parser;
-    parser.size = sizeof(jsmn_parser);
-    jsmn_init(&parser, nullptr);
-    const int n = jsmn_parse(&parser, json, size, nullptr, 0, nullptr); // Get number of tokens
-    if (n <= 0) {
-        return false; // Parsing error
+    // Every token except the root one is preceded by one of the structural characters counted
+    // below, which gives an upper bound for the number of tokens in a well-formed document. This
+    // is much cheaper than running the parser twice to get the exact number of tokens
+    size_t n = 1;
+    for (size_t i = 0; i < size; ++i) {
+        const char c = json[i];
+        if (c == '{' || c == '[' || c == ',' || c == ':') {
+            ++n;
+        }
     }
     std::unique_ptr<jsmntok_t[]> t(new(std::nothrow) jsmntok_t[n]);
     if (!t) {
         return false;
     }
-    jsmn_init(&parser, nullptr); // Reset parser
-    if (jsmn_parse(&parser, json, size, t.get(), n, nullptr) <= 0) {
-        return false;
+    jsmn_parser parser;
+    parser.size = sizeof(jsmn_parser);
+    jsmn_init(&parser, nullptr);
+    for (;;) {
+        const int ret = jsmn_parse(&parser, json, size, t.get(), n, nullptr);
+        if (ret != JSMN_ERROR_NOMEM) {
+            if (ret < 0) {
+                return false; // Parsing error
+            }
+            break;
+        }
+        // The estimate doesn't hold for some inputs accepted by the non-strict parser, e.g. for
+        // primitive values separated by spaces. Grow the array and resume parsing
+        std::unique_ptr<jsmntok_t[]> t2(new(std::nothrow) jsmntok_t[n * 2]);
+        if (!t2) {
+            return false;
+        }
+        memcpy(t2.get(), t.get(), n * sizeof(jsmntok_t));
+        t = std::move(t2);
+        n *= 2;
+    }
+    if (!parser.toknext) {
+        return false; // No tokens
     }
     *tokens = t.release();
-    *count = n;
+    *count = parser.toknext;
     return true;
 }
 
@@ -403,6 +456,352 @@ bool spark::JSONArrayIterator::next() {
     return true;
 }
 
+// spark::JSONStreamParser
+void spark::JSONStreamParser::reset() {
+    in_ = nullptr;
+    inEnd_ = nullptr;
+    n_ = 0;
+    stack_ = 0;
+    depth_ = 0;
+    skipDepth_ = -1;
+    state_ = VALUE;
+    tok_ = NO_TOKEN;
+    type_ = JSON_TYPE_INVALID;
+    event_ = JSON_EVENT_NONE;
+    hexCount_ = 0;
+    c_ = 0;
+    name_ = false;
+    finished_ = false;
+    if (bufSize_) {
+        buf_[0] = '\0';
+    }
+}
+
+spark::JSONEvent spark::JSONStreamParser::next() {
+    for (;;) {
+        const JSONEvent e = parse();
+        if (skipDepth_ < 0 || e == JSON_EVENT_NONE || e == JSON_EVENT_ERROR || e == JSON_EVENT_END) {
+            event_ = e;
+            return e;
+        }
+        if ((int)depth_ == skipDepth_ && (e == JSON_EVENT_VALUE || e == JSON_EVENT_END_OBJECT ||
+                e == JSON_EVENT_END_ARRAY)) {
+            skipDepth_ = -1; // Skipped value ends here
+            type_ = JSON_TYPE_INVALID;
+        }
+    }
+}
+
+spark::JSONEvent spark::JSONStreamParser::next(Stream &stream) {
+    for (;;) {
+        const JSONEvent e = next();
+        if (e != JSON_EVENT_NONE) {
+            return e;
+        }
+        const int c = stream.read();
+        if (c < 0) {
+            return e;
+        }
+        c_ = c;
+        feed(&c_, 1);
+    }
+}
+
+bool spark::JSONStreamParser::skip() {
+    if (skipDepth_ >= 0) {
+        return true; // Already skipping
+    }
+    switch (event_) {
+    case JSON_EVENT_BEGIN_OBJECT:
+    case JSON_EVENT_BEGIN_ARRAY:
+        skipDepth_ = depth_ - 1;
+        return true;
+    case JSON_EVENT_NAME:
+        skipDepth_ = depth_;
+        return true;
+    default:
+        return false;
+    }
+}
+
+spark::JSONEvent spark::JSONStreamParser::find(const char *name) {
+    for (;;) {
+        const JSONEvent e = next();
+        switch (e) {
+        case JSON_EVENT_NAME:
+            if (strcmp(buf_, name) == 0) {
+                return e;
+            }
+            skip();
+            break;
+        case JSON_EVENT_NONE:
+        case JSON_EVENT_END_OBJECT:
+        case JSON_EVENT_END:
+        case JSON_EVENT_ERROR:
+            return e;
+        default:
+            return error(); // Not an object
+        }
+    }
+}
+
+bool spark::JSONStreamParser::toBool() const {
+    return valueToBool(type_, buf_);
+}
+
+int spark::JSONStreamParser::toInt() const {
+    return valueToInt(type_, buf_);
+}
+
+double spark::JSONStreamParser::toDouble() const {
+    return valueToDouble(type_, buf_);
+}
+
+spark::JSONEvent spark::JSONStreamParser::parse() {
+    if (state_ == DONE) {
+        return JSON_EVENT_END;
+    }
+    if (state_ == FAILED) {
+        return JSON_EVENT_ERROR;
+    }
+    if (state_ == NEXT && !depth_) {
+        state_ = DONE; // Root value is complete
+        return JSON_EVENT_END;
+    }
+    while (in_ != inEnd_) {
+        const char c = *in_;
+        switch (tok_) {
+        case STRING: {
+            ++in_;
+            if (c == '"') {
+                tok_ = NO_TOKEN;
+                return endString();
+            }
+            if (c == '\\') {
+                tok_ = ESCAPE;
+            } else if (!append(c)) {
+                return error();
+            }
+            continue;
+        }
+        case ESCAPE: {
+            ++in_;
+            char ch = 0;
+            switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                ch = c;
+                break;
+            case 'b': // Backspace
+                ch = 0x08;
+                break;
+            case 't': // Tab
+                ch = 0x09;
+                break;
+            case 'n': // Line feed
+                ch = 0x0a;
+                break;
+            case 'f': // Form feed
+                ch = 0x0c;
+                break;
+            case 'r': // Carriage return
+                ch = 0x0d;
+                break;
+            case 'u': // Arbitrary character, e.g. "\u001f"
+                tok_ = UNICODE;
+                hexCount_ = 0;
+                continue;
+            default:
+                return error(); // Invalid escaped sequence
+            }
+            if (!append(ch)) {
+                return error();
+            }
+            tok_ = STRING;
+            continue;
+        }
+        case UNICODE: {
+            ++in_;
+            hex_[hexCount_++] = c;
+            if (hexCount_ < sizeof(hex_)) {
+                continue;
+            }
+            uint32_t u = 0;
+            if (!hexToInt(hex_, sizeof(hex_), &u)) {
+                return error(); // Invalid escaped sequence
+            }
+            if (u <= 0x7f) { // Processing only code points within the basic latin block
+                if (!append(u)) {
+                    return error();
+                }
+            } else if (!append('\\') || !append('u') || !append(hex_[0]) || !append(hex_[1]) ||
+                    !append(hex_[2]) || !append(hex_[3])) {
+                return error();
+            }
+            tok_ = STRING;
+            continue;
+        }
+        case PRIMITIVE: {
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ']' || c == '}') {
+                tok_ = NO_TOKEN;
+                return endPrimitive(); // Delimiter is processed on the next call
+            }
+            ++in_;
+            if (c < 32 || c >= 127 || !append(c)) {
+                return error();
+            }
+            continue;
+        }
+        default:
+            break;
+        }
+        ++in_;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        switch (state_) {
+        case VALUE_OR_END:
+            if (c == ']') {
+                return endCompound(false);
+            }
+            // Fall through
+        case VALUE:
+            if (c == '{') {
+                return beginCompound(true);
+            }
+            if (c == '[') {
+                return beginCompound(false);
+            }
+            n_ = 0;
+            if (c == '"') {
+                tok_ = STRING;
+                name_ = false;
+                continue;
+            }
+            if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') {
+                tok_ = PRIMITIVE;
+                append(c);
+                continue;
+            }
+            return error();
+        case NAME_OR_END:
+            if (c == '}') {
+                return endCompound(true);
+            }
+            // Fall through
+        case NAME:
+            if (c == '"') {
+                n_ = 0;
+                tok_ = STRING;
+                name_ = true;
+                continue;
+            }
+            return error();
+        case COLON:
+            if (c == ':') {
+                state_ = VALUE;
+                continue;
+            }
+            return error();
+        case NEXT:
+            if (c == ',') {
+                state_ = inObject() ? NAME : VALUE;
+                continue;
+            }
+            if (c == '}' || c == ']') {
+                return endCompound(c == '}');
+            }
+            return error();
+        default:
+            return error();
+        }
+    }
+    if (!finished_) {
+        return JSON_EVENT_NONE;
+    }
+    if (tok_ == PRIMITIVE && !depth_) {
+        tok_ = NO_TOKEN;
+        return endPrimitive(); // Document consists of a single primitive value
+    }
+    return error(); // Unexpected end of data
+}
+
+spark::JSONEvent spark::JSONStreamParser::beginCompound(bool object) {
+    if (depth_ == MAX_DEPTH) {
+        return error();
+    }
+    if (object) {
+        stack_ |= (uint32_t)1 << depth_;
+        state_ = NAME_OR_END;
+        type_ = JSON_TYPE_OBJECT;
+    } else {
+        stack_ &= ~((uint32_t)1 << depth_);
+        state_ = VALUE_OR_END;
+        type_ = JSON_TYPE_ARRAY;
+    }
+    ++depth_;
+    return object ? JSON_EVENT_BEGIN_OBJECT : JSON_EVENT_BEGIN_ARRAY;
+}
+
+spark::JSONEvent spark::JSONStreamParser::endCompound(bool object) {
+    if (!depth_ || inObject() != object) {
+        return error(); // Unmatched closing bracket
+    }
+    --depth_;
+    state_ = NEXT;
+    type_ = JSON_TYPE_INVALID;
+    return object ? JSON_EVENT_END_OBJECT : JSON_EVENT_END_ARRAY;
+}
+
+spark::JSONEvent spark::JSONStreamParser::endString() {
+    if (skipDepth_ < 0) {
+        buf_[n_] = '\0';
+    }
+    if (name_) {
+        state_ = COLON;
+        type_ = JSON_TYPE_INVALID;
+        return JSON_EVENT_NAME;
+    }
+    state_ = NEXT;
+    type_ = JSON_TYPE_STRING;
+    return JSON_EVENT_VALUE;
+}
+
+spark::JSONEvent spark::JSONStreamParser::endPrimitive() {
+    state_ = NEXT;
+    if (skipDepth_ >= 0) {
+        return JSON_EVENT_VALUE; // Skipped values are not validated
+    }
+    buf_[n_] = '\0';
+    type_ = primitiveType(buf_);
+    if (type_ == JSON_TYPE_INVALID) {
+        return error();
+    }
+    return JSON_EVENT_VALUE;
+}
+
+spark::JSONEvent spark::JSONStreamParser::error() {
+    state_ = FAILED;
+    type_ = JSON_TYPE_INVALID;
+    return JSON_EVENT_ERROR;
+}
+
+bool spark::JSONStreamParser::append(char c) {
+    if (skipDepth_ >= 0) {
+        return true; // Skipped names and values are not stored
+    }
+    if (n_ + 1 >= bufSize_) {
+        return false; // Reserve space for term. null character
+    }
+    buf_[n_++] = c;
+    return true;
+}
+
+bool spark::JSONStreamParser::inObject() const {
+    return depth_ && (stack_ & ((uint32_t)1 << (depth_ - 1)));
+}
+
 // spark::JSONWriter
 spark::JSONWriter& spark::JSONWriter::beginArray() {
     writeSeparator();
@@ -24,6 +24,7 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <cstdlib>
 #include <memory>
 
 #include "spark_wiring_network.h"
@@ -387,11 +388,13 @@ struct spark::detail::LogFilter::Node {
 };
 
 spark::detail::LogFilter::LogFilter(LogLevel level) :
-        level_(level) {
+        level_(level),
+        minLevel_(level) {
 }
 
 spark::detail::LogFilter::LogFilter(LogLevel level, LogCategoryFilters filters) :
-        level_(LOG_LEVEL_NONE) { // Fallback level that will be used in case of construction errors
+        level_(LOG_LEVEL_NONE), // Fallback level that will be used in case of construction errors
+        minLevel_(LOG_LEVEL_NONE) {
     // Store category names
     Vector<String> cats;
     if (!cats.reserve(filters.size())) {
@@ -427,6 +430,10 @@ spark::detail::LogFilter::LogFilter(LogLevel level, LogCategoryFilters filters)
     swap(cats_, cats);
     swap(nodes_, nodes);
     level_ = level;
+    minLevel_ = level;
+    for (const LogCategoryFilter &filter: filters) {
+        minLevel_ = std::min(minLevel_, filter.level_);
+    }
 }
 
 spark::detail::LogFilter::~LogFilter() {
@@ -591,6 +598,972 @@ void spark::JSONStreamLogHandler::logMessage(const char *msg, LogLevel level, co
     this->stream()->write((const uint8_t*)"\r\n", 2);
 }
 
+// Asynchronous logging
+
+namespace {
+
+// Records are aligned to this boundary in a buffer
+const size_t LOG_RECORD_ALIGNMENT = 8;
+
+// Maximum size of a record that a thread assembles before copying it to its buffer
+const size_t LOG_RECORD_MAX_SIZE = LOG_MAX_STRING_LENGTH + 96;
+
+// Maximum size of a buffer. Record sizes are stored as 16-bit values
+const size_t LOG_ASYNC_MAX_BUFFER_SIZE = 32768;
+
+// Maximum length of a single conversion specification in a format string
+const size_t LOG_FORMAT_SPEC_MAX_SIZE = 24;
+
+// Number of records written out while holding the log manager's lock
+const size_t LOG_ASYNC_BATCH_SIZE = 16;
+
+#if PLATFORM_THREADING
+// How long the writer thread sleeps when there are no records to write out
+const system_tick_t LOG_ASYNC_WRITER_IDLE_TIMEOUT = 1000;
+#endif
+
+enum LogRecordType {
+    LOG_RECORD_PADDING = 0, // Unused space at the end of a buffer
+    LOG_RECORD_FORMAT = 1, // Format string and encoded arguments
+    LOG_RECORD_TEXT = 2, // Formatted message
+    LOG_RECORD_WRITE = 3 // Direct logging output
+};
+
+struct LogRecordHeader {
+    uint16_t size; // Record size, including the header and padding
+    uint8_t type; // Record type
+    uint8_t level; // Logging level
+    uint32_t seq; // Sequence number used to write out records of different threads in order
+};
+
+// Message attributes. Category, file and function names are stored by reference, as they are
+// expected to be string literals
+struct LogRecordAttributes {
+    const char *category;
+    const char *file;
+    const char *function;
+    intptr_t code;
+    uint32_t flags;
+    uint32_t time;
+    int line;
+};
+
+// Attributes of a direct logging output
+struct LogRecordWrite {
+    const char *category;
+    uint16_t size;
+};
+
+// Type of an argument consumed by a conversion specification
+enum LogArgType {
+    LOG_ARG_NONE, // "%%"
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LONG_LONG,
+    LOG_ARG_INTMAX,
+    LOG_ARG_SIZE,
+    LOG_ARG_PTRDIFF,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_LONG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER,
+    LOG_ARG_UNSUPPORTED
+};
+
+struct LogFormatSpec {
+    const char *str; // Specification string, starting with '%'
+    size_t size; // Length of the specification string
+    LogArgType type; // Argument type
+    unsigned stars; // Number of width and precision values passed as arguments
+    bool starPrecision; // Set if the precision is passed as an argument
+    int precision; // Precision, or -1 if not specified in the format string
+};
+
+// Parses a conversion specification. Returns a pointer to the character following the specification
+const char* parseFormatSpec(const char *s, LogFormatSpec *spec) {
+    spec->str = s++; // Skip '%'
+    spec->stars = 0;
+    spec->starPrecision = false;
+    spec->precision = -1;
+    // Flags
+    while (*s && strchr("-+ #0", *s)) {
+        ++s;
+    }
+    // Width
+    if (*s == '*') {
+        ++spec->stars;
+        ++s;
+    } else {
+        while (*s >= '0' && *s <= '9') {
+            ++s;
+        }
+    }
+    // Precision
+    if (*s == '.') {
+        ++s;
+        if (*s == '*') {
+            ++spec->stars;
+            spec->starPrecision = true;
+            ++s;
+        } else {
+            spec->precision = 0;
+            while (*s >= '0' && *s <= '9') {
+                spec->precision = spec->precision * 10 + (*s++ - '0');
+            }
+        }
+    }
+    // Length modifier
+    char len = 0;
+    if (*s == 'h' || *s == 'l') {
+        len = *s++;
+        if (*s == len) {
+            len = (len == 'l') ? 'q' : 'H'; // "ll" or "hh"
+            ++s;
+        }
+    } else if (*s == 'j' || *s == 'z' || *s == 't' || *s == 'L') {
+        len = *s++;
+    }
+    // Conversion
+    spec->type = LOG_ARG_UNSUPPORTED;
+    switch (*s) {
+    case '%':
+        spec->type = LOG_ARG_NONE;
+        break;
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        switch (len) {
+        case 0:
+        case 'h':
+        case 'H':
+            spec->type = LOG_ARG_INT;
+            break;
+        case 'l':
+            spec->type = LOG_ARG_LONG;
+            break;
+        case 'q':
+            spec->type = LOG_ARG_LONG_LONG;
+            break;
+        case 'j':
+            spec->type = LOG_ARG_INTMAX;
+            break;
+        case 'z':
+            spec->type = LOG_ARG_SIZE;
+            break;
+        case 't':
+            spec->type = LOG_ARG_PTRDIFF;
+            break;
+        }
+        break;
+    case 'c':
+        if (!len) {
+            spec->type = LOG_ARG_INT;
+        }
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->type = (len == 'L') ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
+        break;
+    case 's':
+        if (!len) {
+            spec->type = LOG_ARG_STRING;
+        }
+        break;
+    case 'p':
+        spec->type = LOG_ARG_POINTER;
+        break;
+    default: // Includes "%n"
+        break;
+    }
+    if (*s) {
+        ++s;
+    }
+    spec->size = s - spec->str;
+    if (spec->size >= LOG_FORMAT_SPEC_MAX_SIZE) {
+        spec->type = LOG_ARG_UNSUPPORTED;
+    }
+    return s;
+}
+
+// Assembles a record in a memory buffer
+class LogRecordWriter {
+public:
+    LogRecordWriter(char *buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            offs_(sizeof(LogRecordHeader)),
+            ok_(true) {
+    }
+
+    void write(const void *data, size_t size) {
+        if (!ok_ || size > size_ - offs_) {
+            ok_ = false;
+            return;
+        }
+        memcpy(buf_ + offs_, data, size);
+        offs_ += size;
+    }
+
+    template<typename T>
+    void write(const T &val) {
+        write(&val, sizeof(T));
+    }
+
+    void writeString(const char *str, size_t maxLength = (size_t)-1) {
+        size_t n = 0;
+        while (n < maxLength && str[n]) {
+            ++n;
+        }
+        write(str, n);
+        write('\0');
+    }
+
+    // Fills in the header and returns the record size
+    size_t finish(LogRecordType type, int level) {
+        offs_ = (offs_ + LOG_RECORD_ALIGNMENT - 1) / LOG_RECORD_ALIGNMENT * LOG_RECORD_ALIGNMENT;
+        if (offs_ > size_) {
+            ok_ = false;
+        }
+        LogRecordHeader* const h = (LogRecordHeader*)buf_;
+        h->size = offs_;
+        h->type = type;
+        h->level = level;
+        h->seq = 0;
+        return offs_;
+    }
+
+    bool ok() const {
+        return ok_;
+    }
+
+private:
+    char *buf_;
+    size_t size_, offs_;
+    bool ok_;
+};
+
+// Reads the fields of a record
+class LogRecordReader {
+public:
+    explicit LogRecordReader(const LogRecordHeader *h) :
+            p_((const char*)h + sizeof(LogRecordHeader)) {
+    }
+
+    template<typename T>
+    T read() {
+        T val;
+        memcpy(&val, p_, sizeof(T));
+        p_ += sizeof(T);
+        return val;
+    }
+
+    const char* readString() {
+        const char* const s = p_;
+        p_ += strlen(s) + 1;
+        return s;
+    }
+
+    const char* data(size_t size) {
+        const char* const d = p_;
+        p_ += size;
+        return d;
+    }
+
+private:
+    const char *p_;
+};
+
+// Copies the arguments consumed by the format string to a record
+bool encodeArgs(const char *fmt, va_list *args, LogRecordWriter *w) {
+    for (const char *s = fmt; (s = strchr(s, '%'));) {
+        LogFormatSpec spec;
+        s = parseFormatSpec(s, &spec);
+        if (spec.type == LOG_ARG_UNSUPPORTED) {
+            return false;
+        }
+        int precision = spec.precision;
+        for (unsigned i = 0; i < spec.stars; ++i) {
+            const int val = va_arg(*args, int);
+            w->write(val);
+            if (spec.starPrecision && i == spec.stars - 1) {
+                precision = val;
+            }
+        }
+        switch (spec.type) {
+        case LOG_ARG_INT:
+            w->write(va_arg(*args, int));
+            break;
+        case LOG_ARG_LONG:
+            w->write(va_arg(*args, long));
+            break;
+        case LOG_ARG_LONG_LONG:
+            w->write(va_arg(*args, long long));
+            break;
+        case LOG_ARG_INTMAX:
+            w->write(va_arg(*args, intmax_t));
+            break;
+        case LOG_ARG_SIZE:
+            w->write(va_arg(*args, size_t));
+            break;
+        case LOG_ARG_PTRDIFF:
+            w->write(va_arg(*args, ptrdiff_t));
+            break;
+        case LOG_ARG_DOUBLE:
+            w->write(va_arg(*args, double));
+            break;
+        case LOG_ARG_LONG_DOUBLE:
+            w->write(va_arg(*args, long double));
+            break;
+        case LOG_ARG_STRING: {
+            const char *str = va_arg(*args, const char*);
+            w->writeString(str ? str : "(null)", (precision >= 0) ? precision : (size_t)-1);
+            break;
+        }
+        case LOG_ARG_POINTER:
+            w->write(va_arg(*args, void*));
+            break;
+        default:
+            break;
+        }
+        if (!w->ok()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Formats a message into a fixed size buffer, truncating it the same way log_message() does
+class LogMessageFormatter {
+public:
+    LogMessageFormatter(char *buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            pos_(0) {
+    }
+
+    void append(const char *str, size_t size) {
+        if (pos_ < size_) {
+            memcpy(buf_ + pos_, str, std::min(size, size_ - pos_));
+        }
+        pos_ += size;
+    }
+
+    template<typename T>
+    void append(const char *spec, const int *stars, unsigned starCount, T val) {
+        char* const p = buf_ + std::min(pos_, size_);
+        const size_t n = (pos_ < size_) ? size_ - pos_ : 0;
+        int r = 0;
+        if (starCount == 0) {
+            r = snprintf(p, n, spec, val);
+        } else if (starCount == 1) {
+            r = snprintf(p, n, spec, stars[0], val);
+        } else {
+            r = snprintf(p, n, spec, stars[0], stars[1], val);
+        }
+        if (r > 0) {
+            pos_ += r;
+        }
+    }
+
+    const char* finish() {
+        if (pos_ > size_ - 1) {
+            buf_[size_ - 1] = '\0';
+            buf_[size_ - 2] = '~';
+        } else {
+            buf_[pos_] = '\0';
+        }
+        return buf_;
+    }
+
+private:
+    char *buf_;
+    size_t size_, pos_;
+};
+
+const char* formatMessage(const char *fmt, LogRecordReader *r, char *buf, size_t size) {
+    LogMessageFormatter f(buf, size);
+    const char *s = fmt;
+    for (;;) {
+        const char *s1 = strchr(s, '%');
+        if (!s1) {
+            f.append(s, strlen(s));
+            break;
+        }
+        f.append(s, s1 - s);
+        LogFormatSpec spec;
+        s = parseFormatSpec(s1, &spec);
+        if (spec.type == LOG_ARG_NONE) {
+            f.append("%", 1);
+            continue;
+        }
+        char str[LOG_FORMAT_SPEC_MAX_SIZE];
+        memcpy(str, spec.str, spec.size);
+        str[spec.size] = '\0';
+        int stars[2] = {};
+        for (unsigned i = 0; i < spec.stars; ++i) {
+            stars[i] = r->read<int>();
+        }
+        switch (spec.type) {
+        case LOG_ARG_INT:
+            f.append(str, stars, spec.stars, r->read<int>());
+            break;
+        case LOG_ARG_LONG:
+            f.append(str, stars, spec.stars, r->read<long>());
+            break;
+        case LOG_ARG_LONG_LONG:
+            f.append(str, stars, spec.stars, r->read<long long>());
+            break;
+        case LOG_ARG_INTMAX:
+            f.append(str, stars, spec.stars, r->read<intmax_t>());
+            break;
+        case LOG_ARG_SIZE:
+            f.append(str, stars, spec.stars, r->read<size_t>());
+            break;
+        case LOG_ARG_PTRDIFF:
+            f.append(str, stars, spec.stars, r->read<ptrdiff_t>());
+            break;
+        case LOG_ARG_DOUBLE:
+            f.append(str, stars, spec.stars, r->read<double>());
+            break;
+        case LOG_ARG_LONG_DOUBLE:
+            f.append(str, stars, spec.stars, r->read<long double>());
+            break;
+        case LOG_ARG_STRING:
+            f.append(str, stars, spec.stars, r->readString());
+            break;
+        case LOG_ARG_POINTER:
+            f.append(str, stars, spec.stars, r->read<void*>());
+            break;
+        default:
+            break;
+        }
+    }
+    return f.finish();
+}
+
+void writeAttributes(LogRecordWriter *w, const char *category, const LogAttributes &attr) {
+    LogRecordAttributes a = {};
+    a.category = category;
+    a.flags = attr.flags;
+    if (attr.has_file) {
+        a.file = attr.file;
+    }
+    if (attr.has_line) {
+        a.line = attr.line;
+    }
+    if (attr.has_function) {
+        a.function = attr.function;
+    }
+    if (attr.has_time) {
+        a.time = attr.time;
+    }
+    if (attr.has_code) {
+        a.code = attr.code;
+    }
+    w->write(a);
+}
+
+const char* readAttributes(LogRecordReader *r, LogAttributes *attr) {
+    const LogRecordAttributes a = r->read<LogRecordAttributes>();
+    memset(attr, 0, sizeof(LogAttributes));
+    attr->size = sizeof(LogAttributes);
+    attr->flags = a.flags;
+    attr->file = a.file;
+    attr->line = a.line;
+    attr->function = a.function;
+    attr->time = a.time;
+    attr->code = a.code;
+    return a.category;
+}
+
+// Buffer of records generated by a single thread
+class LogRingBuffer {
+public:
+    LogRingBuffer() :
+            buf_(nullptr),
+            size_(0),
+            head_(0),
+            tail_(0),
+            owner_(0),
+            ready_(false),
+            dropped_(0) {
+    }
+
+    ~LogRingBuffer() {
+        free(buf_);
+    }
+
+    // Claims the buffer for the calling thread
+    bool claim(uintptr_t owner, size_t size) {
+        uintptr_t expected = 0;
+        if (!owner_.compare_exchange_strong(expected, owner)) {
+            return false;
+        }
+        buf_ = (char*)malloc(size);
+        if (buf_) {
+            size_ = size;
+            ready_.store(true, std::memory_order_release);
+        }
+        return true;
+    }
+
+    uintptr_t owner() const {
+        return owner_.load(std::memory_order_relaxed);
+    }
+
+    bool ready() const {
+        return ready_.load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Called by the owner thread
+    bool write(const char *rec, size_t size) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_acquire);
+        size_t offs = tail & (size_ - 1);
+        size_t pad = 0;
+        if (offs + size > size_) {
+            pad = size_ - offs; // Records are not split at the end of the buffer
+        }
+        if (tail + pad + size - head > size_) {
+            return false;
+        }
+        if (pad) {
+            LogRecordHeader* const h = (LogRecordHeader*)(buf_ + offs);
+            h->size = pad;
+            h->type = LOG_RECORD_PADDING;
+            offs = 0;
+        }
+        memcpy(buf_ + offs, rec, size);
+        tail_.store(tail + pad + size, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the thread writing out the records
+    const LogRecordHeader* peek() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        while (head != tail) {
+            const LogRecordHeader* const h = (const LogRecordHeader*)(buf_ + (head & (size_ - 1)));
+            if (h->type != LOG_RECORD_PADDING) {
+                return h;
+            }
+            head += h->size;
+            head_.store(head, std::memory_order_release);
+        }
+        return nullptr;
+    }
+
+    void consume(const LogRecordHeader *h) {
+        head_.store(head_.load(std::memory_order_relaxed) + h->size, std::memory_order_release);
+    }
+
+    bool isEmpty() const {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+    void dropped() {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t droppedCount() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    char *buf_;
+    size_t size_;
+    std::atomic<size_t> head_, tail_;
+    std::atomic<uintptr_t> owner_;
+    std::atomic<bool> ready_;
+    std::atomic<size_t> dropped_;
+};
+
+// Number of threads currently accessing the asynchronous logger via the log manager
+std::atomic<int> g_asyncRefCount(0);
+
+inline uintptr_t currentThreadId() {
+#if PLATFORM_THREADING
+    return (uintptr_t)os_thread_current(nullptr);
+#else
+    return 1;
+#endif
+}
+
+} // namespace
+
+/*
+    Asynchronous logger. Every thread generating logging output is assigned a buffer where it
+    stores its records. The records are written out to the log handlers by a background thread,
+    or by LogManager::flush() on platforms without threading support.
+*/
+class spark::detail::AsyncLogger {
+public:
+    AsyncLogger(LogManager *mgr, LogOverflowPolicy policy) :
+            mgr_(mgr),
+            bufSize_(0),
+            policy_(policy),
+            seq_(0),
+            minLevel_(LOG_LEVEL_NONE),
+#if PLATFORM_THREADING
+            dispatchThread_(OS_THREAD_INVALID_HANDLE),
+            thread_(OS_THREAD_INVALID_HANDLE),
+            signal_(nullptr),
+            idle_(false),
+            stop_(false),
+#endif
+            dispatching_(false) {
+    }
+
+    ~AsyncLogger() {
+#if PLATFORM_THREADING
+        if (signal_) {
+            os_semaphore_destroy(signal_);
+        }
+#endif
+    }
+
+    bool init(size_t bufSize) {
+        // The buffer size is a power of two large enough for at least two records of the maximum size
+        size_t size = 256;
+        while ((size < bufSize || size < LOG_RECORD_MAX_SIZE * 2) && size < LOG_ASYNC_MAX_BUFFER_SIZE) {
+            size *= 2;
+        }
+        bufSize_ = size;
+#if PLATFORM_THREADING
+        if (os_semaphore_create(&signal_, 1, 0) != 0) {
+            signal_ = nullptr;
+            return false;
+        }
+        if (os_thread_create(&thread_, "log", OS_THREAD_PRIORITY_DEFAULT, run, this, OS_THREAD_STACK_SIZE_DEFAULT) != 0) {
+            thread_ = OS_THREAD_INVALID_HANDLE;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    void stop() {
+#if PLATFORM_THREADING
+        if (thread_ != OS_THREAD_INVALID_HANDLE) {
+            stop_.store(true);
+            os_semaphore_give(signal_, false);
+            os_thread_join(thread_);
+            thread_ = OS_THREAD_INVALID_HANDLE;
+        }
+#endif
+    }
+
+    // Returns false if the message needs to be formatted by the caller
+    bool format(int level, const char *category, const LogAttributes &attr, const char *fmt, va_list args) {
+        if (level < minLevel_.load(std::memory_order_relaxed) || isDispatchingThread()) {
+            return true;
+        }
+        LogRingBuffer* const ring = currentRing();
+        if (!ring) {
+            return false;
+        }
+        char buf[LOG_RECORD_MAX_SIZE];
+        LogRecordWriter w(buf, sizeof(buf));
+        writeAttributes(&w, category, attr);
+        w.writeString(fmt);
+        if (attr.has_details) {
+            w.writeString(attr.details);
+        }
+        va_list args2;
+        va_copy(args2, args);
+        const bool ok = encodeArgs(fmt, &args2, &w);
+        va_end(args2);
+        const size_t size = w.finish(LOG_RECORD_FORMAT, level);
+        if (!ok || !w.ok()) {
+            return false;
+        }
+        put(ring, buf, size);
+        return true;
+    }
+
+    // Returns false if the message needs to be written out by the caller
+    bool text(const char *msg, int level, const char *category, const LogAttributes &attr) {
+        if (level < minLevel_.load(std::memory_order_relaxed) || isDispatchingThread()) {
+            return true;
+        }
+        LogRingBuffer* const ring = currentRing();
+        if (!ring) {
+            return false;
+        }
+        char buf[LOG_RECORD_MAX_SIZE];
+        LogRecordWriter w(buf, sizeof(buf));
+        writeAttributes(&w, category, attr);
+        w.writeString(msg, LOG_MAX_STRING_LENGTH - 1);
+        if (attr.has_details) {
+            w.writeString(attr.details, LOG_RECORD_MAX_SIZE / 4);
+        }
+        const size_t size = w.finish(LOG_RECORD_TEXT, level);
+        if (!w.ok()) {
+            return false;
+        }
+        put(ring, buf, size);
+        return true;
+    }
+
+    // Returns false if the data needs to be written out by the caller
+    bool write(const char *data, size_t size, int level, const char *category) {
+        if (level < minLevel_.load(std::memory_order_relaxed) || isDispatchingThread()) {
+            return true;
+        }
+        LogRingBuffer* const ring = currentRing();
+        if (!ring) {
+            return false;
+        }
+        char buf[LOG_RECORD_MAX_SIZE];
+        const size_t maxChunkSize = sizeof(buf) - sizeof(LogRecordHeader) - sizeof(LogRecordWrite) - LOG_RECORD_ALIGNMENT;
+        do {
+            LogRecordWrite rw = {};
+            rw.category = category;
+            rw.size = std::min(size, maxChunkSize);
+            LogRecordWriter w(buf, sizeof(buf));
+            w.write(rw);
+            w.write(data, rw.size);
+            put(ring, buf, w.finish(LOG_RECORD_WRITE, level));
+            data += rw.size;
+            size -= rw.size;
+        } while (size);
+        return true;
+    }
+
+    // Writes out all buffered records. The caller must hold the log manager's lock
+    size_t drain(size_t maxCount) {
+        size_t count = 0;
+        dispatching_.store(true, std::memory_order_relaxed);
+#if PLATFORM_THREADING
+        dispatchThread_ = os_thread_current(nullptr);
+#endif
+        while (count < maxCount) {
+            // Find the oldest record among all buffers
+            LogRingBuffer *ring = nullptr;
+            const LogRecordHeader *rec = nullptr;
+            for (LogRingBuffer &r: rings_) {
+                if (!r.ready()) {
+                    continue;
+                }
+                const LogRecordHeader* const h = r.peek();
+                if (h && (!rec || (int32_t)(h->seq - rec->seq) < 0)) {
+                    rec = h;
+                    ring = &r;
+                }
+            }
+            if (!rec) {
+                break;
+            }
+            dispatch(rec);
+            ring->consume(rec);
+            ++count;
+        }
+        dispatching_.store(false, std::memory_order_relaxed);
+        return count;
+    }
+
+    void flush() {
+        LOG_WITH_LOCK(mgr_->mutex_) {
+            drain((size_t)-1);
+        }
+    }
+
+    void flushOnPanic() {
+#if PLATFORM_THREADING
+        // Other threads won't run anymore, so the records are written out even if the lock can't be acquired
+        const bool locked = mgr_->mutex_.trylock();
+        drain((size_t)-1);
+        if (locked) {
+            mgr_->mutex_.unlock();
+        }
+#else
+        drain((size_t)-1);
+#endif
+    }
+
+    bool isEnabled(int level) const {
+        return level >= minLevel_.load(std::memory_order_relaxed);
+    }
+
+    void setMinLevel(int level) {
+        minLevel_.store(level, std::memory_order_relaxed);
+    }
+
+    size_t droppedCount() const {
+        size_t count = 0;
+        for (const LogRingBuffer &r: rings_) {
+            count += r.droppedCount();
+        }
+        return count;
+    }
+
+private:
+    LogManager *mgr_;
+    LogRingBuffer rings_[LOG_ASYNC_MAX_THREADS];
+    size_t bufSize_;
+    LogOverflowPolicy policy_;
+    std::atomic<uint32_t> seq_;
+    std::atomic<int> minLevel_;
+#if PLATFORM_THREADING
+    os_thread_t dispatchThread_;
+    os_thread_t thread_;
+    os_semaphore_t signal_;
+    std::atomic<bool> idle_;
+    std::atomic<bool> stop_;
+#endif
+    std::atomic<bool> dispatching_;
+
+    LogRingBuffer* currentRing() {
+        const uintptr_t id = currentThreadId();
+        for (LogRingBuffer &r: rings_) {
+            const uintptr_t owner = r.owner();
+            if (owner == id) {
+                return r.ready() ? &r : nullptr;
+            }
+            if (!owner && r.claim(id, bufSize_)) {
+                return r.ready() ? &r : nullptr;
+            }
+        }
+        return nullptr; // Too many threads, the caller writes out its messages synchronously
+    }
+
+    bool isDispatchingThread() const {
+        if (!dispatching_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+#if PLATFORM_THREADING
+        return os_thread_is_current(dispatchThread_);
+#else
+        return true;
+#endif
+    }
+
+    void put(LogRingBuffer *ring, char *rec, size_t size) {
+        ((LogRecordHeader*)rec)->seq = seq_.fetch_add(1, std::memory_order_relaxed);
+        if (!ring->write(rec, size)) {
+            if (policy_ != LogOverflowPolicy::BLOCK || size > ring->size() / 2) {
+                ring->dropped();
+                return;
+            }
+            flush();
+            if (!ring->write(rec, size)) {
+                ring->dropped();
+                return;
+            }
+        }
+        notify();
+    }
+
+    void dispatch(const LogRecordHeader *h) {
+        LogRecordReader r(h);
+        switch (h->type) {
+        case LOG_RECORD_FORMAT:
+        case LOG_RECORD_TEXT: {
+            LogAttributes attr;
+            const char* const category = readAttributes(&r, &attr);
+            const char *msg = r.readString();
+            if (attr.has_details) {
+                attr.details = r.readString();
+            }
+            char buf[LOG_MAX_STRING_LENGTH];
+            if (h->type == LOG_RECORD_FORMAT) {
+                msg = formatMessage(msg, &r, buf, sizeof(buf));
+            }
+            mgr_->dispatchMessage(msg, h->level, category, attr);
+            break;
+        }
+        case LOG_RECORD_WRITE: {
+            const LogRecordWrite rw = r.read<LogRecordWrite>();
+            mgr_->dispatchWrite(r.data(rw.size), rw.size, h->level, rw.category);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void notify() {
+#if PLATFORM_THREADING
+        // Pairs with the fence in run(): either the writer sees the record, or this thread sees the idle flag
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_.load(std::memory_order_relaxed) && idle_.exchange(false, std::memory_order_relaxed)) {
+            os_semaphore_give(signal_, false);
+        }
+#endif
+    }
+
+#if PLATFORM_THREADING
+    bool hasRecords() const {
+        for (const LogRingBuffer &r: rings_) {
+            if (r.ready() && !r.isEmpty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static os_thread_return_t run(void *data) {
+        const auto that = static_cast<AsyncLogger*>(data);
+        while (!that->stop_.load()) {
+            size_t count = 0;
+            LOG_WITH_LOCK(that->mgr_->mutex_) {
+                count = that->drain(LOG_ASYNC_BATCH_SIZE);
+            }
+            if (!count) {
+                that->idle_.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!that->hasRecords()) {
+                    os_semaphore_take(that->signal_, LOG_ASYNC_WRITER_IDLE_TIMEOUT, false);
+                }
+                that->idle_.store(false, std::memory_order_relaxed);
+            }
+        }
+        os_thread_exit(nullptr);
+    }
+#endif
+};
+
+namespace {
+
+// Provides access to the asynchronous logger while the log manager may disable it concurrently
+class AsyncLoggerRef {
+public:
+    explicit AsyncLoggerRef(const std::atomic<spark::detail::AsyncLogger*> &async) {
+        g_asyncRefCount.fetch_add(1);
+        async_ = async.load();
+    }
+
+    ~AsyncLoggerRef() {
+        g_asyncRefCount.fetch_sub(1);
+    }
+
+    spark::detail::AsyncLogger* operator->() const {
+        return async_;
+    }
+
+    explicit operator bool() const {
+        return async_;
+    }
+
+private:
+    spark::detail::AsyncLogger *async_;
+};
+
+} // namespace
+
 #if Wiring_LogConfig
 
 // spark::DefaultLogHandlerFactory
@@ -690,9 +1663,11 @@ spark::LogManager::LogManager() {
     streamFactory_ = DefaultOutputStreamFactory::instance();
 #endif
     outputActive_ = false;
+    async_ = nullptr;
 }
 
 spark::LogManager::~LogManager() {
+    disableAsyncMode();
     resetSystemCallbacks();
 #if Wiring_LogConfig
     LOG_WITH_LOCK(mutex_) {
@@ -709,6 +1684,7 @@ bool spark::LogManager::addHandler(LogHandler *handler) {
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
+        updateAsyncMinLevel();
     }
     return true;
 }
@@ -718,6 +1694,7 @@ void spark::LogManager::removeHandler(LogHandler *handler) {
         if (activeHandlers_.removeOne(handler) && activeHandlers_.isEmpty()) {
             resetSystemCallbacks();
         }
+        updateAsyncMinLevel();
     }
 }
 
@@ -767,6 +1744,7 @@ bool spark::LogManager::addFactoryHandler(const char *id, const char *handlerTyp
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
+        updateAsyncMinLevel();
         handler.release(); // Release scope guard pointers
         stream.release();
     }
@@ -818,6 +1796,7 @@ void spark::LogManager::destroyFactoryHandler(const char *id) {
                 streamFactory_->destroyStream(h.stream);
             }
             factoryHandlers_.removeAt(i);
+            updateAsyncMinLevel();
             break;
         }
     }
@@ -835,18 +1814,91 @@ void spark::LogManager::destroyFactoryHandlers() {
         }
     }
     factoryHandlers_.clear();
+    updateAsyncMinLevel();
 }
 
 #endif // Wiring_LogConfig
 
+bool spark::LogManager::enableAsyncMode(size_t bufferSize, LogOverflowPolicy policy) {
+    LOG_WITH_LOCK(mutex_) {
+        if (async_.load()) {
+            return true;
+        }
+        std::unique_ptr<detail::AsyncLogger> async(new(std::nothrow) detail::AsyncLogger(this, policy));
+        if (!async || !async->init(bufferSize)) {
+            if (async) {
+                async->stop();
+            }
+            return false;
+        }
+        async_.store(async.release());
+        updateAsyncMinLevel();
+        if (!activeHandlers_.isEmpty()) {
+            setSystemCallbacks();
+        }
+    }
+    return true;
+}
+
+void spark::LogManager::disableAsyncMode() {
+    detail::AsyncLogger *async = nullptr;
+    LOG_WITH_LOCK(mutex_) {
+        async = async_.exchange(nullptr);
+        if (!async) {
+            return;
+        }
+        log_set_async_callbacks(nullptr, nullptr, nullptr);
+    }
+    async->stop();
+    // Wait until other threads are done storing their messages
+    while (g_asyncRefCount.load() > 0) {
+#if PLATFORM_THREADING
+        os_thread_yield();
+#endif
+    }
+    async->flush();
+    delete async;
+}
+
+bool spark::LogManager::isAsyncMode() const {
+    return async_.load();
+}
+
+void spark::LogManager::flush() {
+    const AsyncLoggerRef async(async_);
+    if (async) {
+        async->flush();
+    }
+}
+
+size_t spark::LogManager::droppedMessageCount() const {
+    const AsyncLoggerRef async(async_);
+    return async ? async->droppedCount() : 0;
+}
+
 void spark::LogManager::setSystemCallbacks() {
     log_set_callbacks(logMessage, logWrite, logEnabled, nullptr);
+    if (async_.load()) {
+        log_set_async_callbacks(logMessageAsync, logFlush, nullptr);
+    }
 }
 
 void spark::LogManager::resetSystemCallbacks() {
+    log_set_async_callbacks(nullptr, nullptr, nullptr);
     log_set_callbacks(nullptr, nullptr, nullptr, nullptr);
 }
 
+void spark::LogManager::updateAsyncMinLevel() {
+    detail::AsyncLogger* const async = async_.load();
+    if (async) {
+        int minLevel = LOG_LEVEL_NONE;
+        for (LogHandler *handler: activeHandlers_) {
+            minLevel = std::min<int>(minLevel, handler->minLevel());
+        }
+        async->setMinLevel(minLevel);
+    }
+}
+
 void spark::LogManager::logMessage(const char *msg, int level, const char *category, const LogAttributes *attr, void *reserved) {
 #ifndef LOG_FROM_ISR
     if (HAL_IsISR()) {
@@ -854,16 +1906,14 @@ void spark::LogManager::logMessage(const char *msg, int level, const char *categ
     }
 #endif
     LogManager *that = instance();
-    LOG_WITH_LOCK(that->mutex_) {
-        // prevent re-entry
-        if (that->isActive()) {
+    {
+        const AsyncLoggerRef async(that->async_);
+        if (async && async->text(msg, level, category, *attr)) {
             return;
         }
-        that->setActive(true);
-        for (LogHandler *handler: that->activeHandlers_) {
-            handler->message(msg, (LogLevel)level, category, *attr);
-        }
-        that->setActive(false);
+    }
+    LOG_WITH_LOCK(that->mutex_) {
+        that->dispatchMessage(msg, level, category, *attr);
     }
 }
 
@@ -874,16 +1924,14 @@ void spark::LogManager::logWrite(const char *data, size_t size, int level, const
     }
 #endif
     LogManager *that = instance();
-    LOG_WITH_LOCK(that->mutex_) {
-        // prevent re-entry
-        if (that->isActive()) {
+    {
+        const AsyncLoggerRef async(that->async_);
+        if (async && async->write(data, size, level, category)) {
             return;
         }
-        that->setActive(true);
-        for (LogHandler *handler: that->activeHandlers_) {
-            handler->write(data, size, (LogLevel)level, category);
-        }
-        that->setActive(false);
+    }
+    LOG_WITH_LOCK(that->mutex_) {
+        that->dispatchWrite(data, size, level, category);
     }
 }
 
@@ -894,6 +1942,13 @@ int spark::LogManager::logEnabled(int level, const char *category, void *reserve
     }
 #endif
     LogManager *that = instance();
+    {
+        // Avoid contention with the writer thread. Handlers still filter messages by category
+        const AsyncLoggerRef async(that->async_);
+        if (async) {
+            return async->isEnabled(level);
+        }
+    }
     int minLevel = LOG_LEVEL_NONE;
     LOG_WITH_LOCK(that->mutex_) {
         for (LogHandler *handler: that->activeHandlers_) {
@@ -906,6 +1961,48 @@ int spark::LogManager::logEnabled(int level, const char *category, void *reserve
     return (level >= minLevel);
 }
 
+int spark::LogManager::logMessageAsync(int level, const char *category, const LogAttributes *attr, const char *fmt,
+        va_list args, void *reserved) {
+#ifndef LOG_FROM_ISR
+    if (HAL_IsISR()) {
+        return 1; // Discard the message
+    }
+#endif
+    const AsyncLoggerRef async(instance()->async_);
+    return (async && async->format(level, category, *attr, fmt, args));
+}
+
+void spark::LogManager::logFlush(void *reserved) {
+    const AsyncLoggerRef async(instance()->async_);
+    if (async) {
+        async->flushOnPanic();
+    }
+}
+
+void spark::LogManager::dispatchMessage(const char *msg, int level, const char *category, const LogAttributes &attr) {
+    // prevent re-entry
+    if (isActive()) {
+        return;
+    }
+    setActive(true);
+    for (LogHandler *handler: activeHandlers_) {
+        handler->message(msg, (LogLevel)level, category, attr);
+    }
+    setActive(false);
+}
+
+void spark::LogManager::dispatchWrite(const char *data, size_t size, int level, const char *category) {
+    // prevent re-entry
+    if (isActive()) {
+        return;
+    }
+    setActive(true);
+    for (LogHandler *handler: activeHandlers_) {
+        handler->write(data, size, (LogLevel)level, category);
+    }
+    setActive(false);
+}
+
 inline bool spark::LogManager::isActive() const {
     return outputActive_;
 }
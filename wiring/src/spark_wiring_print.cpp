@@ -237,3 +237,181 @@ size_t Print::printf_impl(bool newline, const char* format, ...)
     return n;
 }
 
+
+// Compile-time formatting, see spark_wiring_format.h ///////////////////////////
+
+namespace {
+
+using particle::detail::FormatSpec;
+
+size_t writePadding(Print& p, char c, int count)
+{
+    char buf[16];
+    memset(buf, c, sizeof(buf));
+    size_t n = 0;
+    while (count > 0) {
+        const int chunk = (count < (int)sizeof(buf)) ? count : (int)sizeof(buf);
+        n += p.write((const uint8_t*)buf, chunk);
+        count -= chunk;
+    }
+    return n;
+}
+
+// Writes a formatted value with the prefix and padding required by the specification
+size_t writeField(Print& p, const FormatSpec& spec, const char* prefix, size_t prefixLen, int zeros,
+        const char* digits, size_t digitsLen)
+{
+    using namespace particle::detail;
+    int pad = spec.width - (int)(prefixLen + zeros + digitsLen);
+    size_t n = 0;
+    if (!(spec.flags & FORMAT_FLAG_LEFT)) {
+        if ((spec.flags & FORMAT_FLAG_ZERO) && spec.precision < 0 && spec.conv != 's' && spec.conv != 'c') {
+            zeros += (pad > 0) ? pad : 0;
+        } else {
+            n += writePadding(p, ' ', pad);
+        }
+        pad = 0;
+    }
+    if (prefixLen) {
+        n += p.write((const uint8_t*)prefix, prefixLen);
+    }
+    n += writePadding(p, '0', zeros);
+    if (digitsLen) {
+        n += p.write((const uint8_t*)digits, digitsLen);
+    }
+    n += writePadding(p, ' ', pad);
+    return n;
+}
+
+size_t writeInteger(Print& p, const FormatSpec& spec, unsigned long long val, const char* sign)
+{
+    using namespace particle::detail;
+    unsigned base = 10;
+    const char* alpha = "0123456789abcdef";
+    if (spec.conv == 'x' || spec.conv == 'p') {
+        base = 16;
+    } else if (spec.conv == 'X') {
+        base = 16;
+        alpha = "0123456789ABCDEF";
+    } else if (spec.conv == 'o') {
+        base = 8;
+    }
+    char buf[24]; // Enough for a 64-bit value in octal
+    char* const end = buf + sizeof(buf);
+    char* d = end;
+    if (val || spec.precision != 0) {
+        do {
+            *--d = alpha[val % base];
+            val /= base;
+        } while (val);
+    }
+    const size_t digitsLen = end - d;
+    int zeros = (spec.precision > (int)digitsLen) ? spec.precision - (int)digitsLen : 0;
+    char prefix[2] = {};
+    size_t prefixLen = 0;
+    if (sign) {
+        prefix[prefixLen++] = *sign;
+    } else if (spec.conv == 'p' || ((spec.flags & FORMAT_FLAG_ALT) && base == 16 && digitsLen && *d != '0')) {
+        prefix[prefixLen++] = '0';
+        prefix[prefixLen++] = (spec.conv == 'X') ? 'X' : 'x';
+    } else if ((spec.flags & FORMAT_FLAG_ALT) && base == 8 && !zeros && (!digitsLen || *d != '0')) {
+        zeros = 1;
+    }
+    return writeField(p, spec, prefix, prefixLen, zeros, d, digitsLen);
+}
+
+} // namespace
+
+size_t particle::detail::formatLiteral(Print& p, const char* str, unsigned size)
+{
+    return size ? p.write((const uint8_t*)str, size) : 0;
+}
+
+size_t particle::detail::formatSigned(Print& p, const FormatSpec& spec, long long val)
+{
+    if (spec.conv == 'c') {
+        const char c = val;
+        return writeField(p, spec, nullptr, 0, 0, &c, 1);
+    }
+    const char* sign = nullptr;
+    if (val < 0) {
+        sign = "-";
+    } else if (spec.flags & FORMAT_FLAG_PLUS) {
+        sign = "+";
+    } else if (spec.flags & FORMAT_FLAG_SPACE) {
+        sign = " ";
+    }
+    const unsigned long long v = (val < 0) ? -(unsigned long long)val : val;
+    return writeInteger(p, spec, v, sign);
+}
+
+size_t particle::detail::formatUnsigned(Print& p, const FormatSpec& spec, unsigned long long val)
+{
+    if (spec.conv == 'c') {
+        const char c = val;
+        return writeField(p, spec, nullptr, 0, 0, &c, 1);
+    }
+    if (spec.conv == 'd' || spec.conv == 'i') {
+        const char* sign = nullptr;
+        if (spec.flags & FORMAT_FLAG_PLUS) {
+            sign = "+";
+        } else if (spec.flags & FORMAT_FLAG_SPACE) {
+            sign = " ";
+        }
+        return writeInteger(p, spec, val, sign);
+    }
+    return writeInteger(p, spec, val, nullptr);
+}
+
+size_t particle::detail::formatString(Print& p, const FormatSpec& spec, const char* str)
+{
+    if (!str) {
+        str = "(null)";
+    }
+    size_t len = 0;
+    if (spec.precision >= 0) {
+        len = strnlen(str, spec.precision);
+    } else {
+        len = strlen(str);
+    }
+    return writeField(p, spec, nullptr, 0, 0, str, len);
+}
+
+size_t particle::detail::formatPointer(Print& p, const FormatSpec& spec, const void* ptr)
+{
+    return writeInteger(p, spec, (uintptr_t)ptr, nullptr);
+}
+
+size_t particle::detail::formatDouble(Print& p, const FormatSpec& spec, const char* str, double val)
+{
+    // Floating point conversions are delegated to the C library. The specification is rebuilt
+    // without the length modifiers, since the argument is always passed as a double
+    char fmt[24];
+    size_t n = 0;
+    fmt[n++] = '%';
+    static const char flagChars[] = { '-', '+', ' ', '#', '0' };
+    for (unsigned i = 0; i < sizeof(flagChars); ++i) {
+        if (spec.flags & (1 << i)) {
+            fmt[n++] = flagChars[i];
+        }
+    }
+    if (spec.width > 0) {
+        n += snprintf(fmt + n, sizeof(fmt) - n, "%d", spec.width);
+    }
+    if (spec.precision >= 0) {
+        n += snprintf(fmt + n, sizeof(fmt) - n, ".%d", spec.precision);
+    }
+    fmt[n++] = spec.conv;
+    fmt[n] = '\0';
+    char buf[32];
+    const int len = snprintf(buf, sizeof(buf), fmt, val);
+    if (len < 0) {
+        return 0;
+    }
+    if ((size_t)len < sizeof(buf)) {
+        return p.write((const uint8_t*)buf, len);
+    }
+    char bigger[len + 1];
+    snprintf(bigger, sizeof(bigger), fmt, val);
+    return p.write((const uint8_t*)bigger, len);
+}
@@ -31,8 +31,21 @@
 #include <limits.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "string_convert.h"
 
+// size of a string buffer for the given maximum length of the string.  The
+// heap allocator rounds the block size up to the alignment of its chunks
+// anyway, so rounding here gives the spare bytes to the string instead of
+// wasting them, and saves reallocations when short strings grow
+static inline size_t bufferSize(unsigned int maxStrLen)
+{
+	const size_t align = 8;
+	const size_t minSize = 16;
+	const size_t size = ((size_t)maxStrLen + align) & ~(align - 1);
+	return (size < minSize) ? minSize : size;
+}
+
 //These are very crude implementations - will refine later
 //------------------------------------------------------------------------------------------
 
@@ -78,6 +91,21 @@ String::String(const char *cstr, unsigned int length)
 	if (cstr) copy(cstr, length);
 }
 
+String::String(StringArena &arena, const char *cstr)
+{
+	init();
+	const unsigned int length = cstr ? strlen(cstr) : 0;
+	const size_t size = bufferSize(length);
+	char *p = arena.alloc(size);
+	if (p) {
+		buffer = p;
+		capacity = size - 1;
+		flags |= ARENA_BUFFER;
+		buffer[0] = 0;
+	}
+	if (cstr) copy(cstr, length);
+}
+
 String::String(const String &value)
 {
 	init();
@@ -170,7 +198,7 @@ String::String(double value, int decimalPlaces)
 }
 String::~String()
 {
-	free(buffer);
+	freeBuffer();
 }
 
 /*********************************************/
@@ -187,11 +215,21 @@ inline void String::init(void)
 
 void String::invalidate(void)
 {
-	if (buffer) free(buffer);
+	if (buffer) freeBuffer();
 	buffer = NULL;
 	capacity = len = 0;
 }
 
+void String::freeBuffer(void)
+{
+	if (flags & ARENA_BUFFER) {
+		StringArena::owner(buffer)->free(buffer);
+		flags &= ~ARENA_BUFFER;
+	} else {
+		free(buffer);
+	}
+}
+
 unsigned char String::reserve(unsigned int size)
 {
 	if (buffer && capacity >= size) return 1;
@@ -202,12 +240,40 @@ unsigned char String::reserve(unsigned int size)
 	return 0;
 }
 
+// grows the buffer geometrically, so that repeated concatenations take
+// an amortized constant number of reallocations
+unsigned char String::grow(unsigned int size)
+{
+	if (buffer && capacity >= size) return 1;
+	const unsigned int n = capacity + capacity / 2;
+	if (n > size && changeBuffer(n)) {
+		if (len == 0) buffer[0] = 0;
+		return 1;
+	}
+	return reserve(size);
+}
+
 unsigned char String::changeBuffer(unsigned int maxStrLen)
 {
-	char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
+	const size_t size = bufferSize(maxStrLen);
+	char *newbuffer = NULL;
+	if (flags & ARENA_BUFFER) {
+		StringArena *arena = StringArena::owner(buffer);
+		newbuffer = arena->realloc(buffer, capacity + 1, size);
+		if (!newbuffer) {
+			// the arena is exhausted, move the string to the heap
+			newbuffer = (char *)malloc(size);
+			if (!newbuffer) return 0;
+			memcpy(newbuffer, buffer, (size < capacity + 1) ? size : capacity + 1);
+			arena->free(buffer);
+			flags &= ~ARENA_BUFFER;
+		}
+	} else {
+		newbuffer = (char *)realloc(buffer, size);
+	}
 	if (newbuffer) {
 		buffer = newbuffer;
-		capacity = maxStrLen;
+		capacity = size - 1;
 		return 1;
 	}
 	return 0;
@@ -243,15 +309,17 @@ void String::move(String &rhs)
 			rhs.len = 0;
 			return;
 		} else {
-			free(buffer);
+			freeBuffer();
 		}
 	}
 	buffer = rhs.buffer;
 	capacity = rhs.capacity;
 	len = rhs.len;
+	flags = (flags & ~ARENA_BUFFER) | (rhs.flags & ARENA_BUFFER);
 	rhs.buffer = NULL;
 	rhs.capacity = 0;
 	rhs.len = 0;
+	rhs.flags &= ~ARENA_BUFFER;
 }
 #endif
 
@@ -309,7 +377,7 @@ unsigned char String::concat(const char *cstr, unsigned int length)
 	unsigned int newlen = len + length;
 	if (!cstr) return 0;
 	if (length == 0) return 1;
-	if (!reserve(newlen)) return 0;
+	if (!grow(newlen)) return 0;
 	strcpy(buffer + len, cstr);
 	len = newlen;
 	return 1;
@@ -831,6 +899,80 @@ String String::format(const char* fmt, ...)
     return result;
 }
 
+/*********************************************/
+/*  StringArena                              */
+/*********************************************/
+
+// each allocation is prefixed with a pointer to the arena, so that a string
+// can find the arena its buffer belongs to
+static const size_t ARENA_HEADER_SIZE = sizeof(StringArena*);
+static const size_t ARENA_ALIGN = sizeof(StringArena*);
+
+static inline size_t arenaBlockSize(size_t size)
+{
+	return (ARENA_HEADER_SIZE + size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+StringArena::StringArena(char *buf, size_t size)
+{
+	// align the beginning of the block
+	const size_t offs = (ARENA_ALIGN - ((uintptr_t)buf & (ARENA_ALIGN - 1))) & (ARENA_ALIGN - 1);
+	if (size > offs) {
+		this->buf = buf + offs;
+		bufSize = (size - offs) & ~(ARENA_ALIGN - 1);
+	} else {
+		this->buf = buf;
+		bufSize = 0;
+	}
+	reset();
+}
+
+char* StringArena::alloc(size_t size)
+{
+	const size_t n = arenaBlockSize(size);
+	if (n > bufSize - used) return NULL;
+	char *p = buf + used;
+	StringArena *self = this;
+	memcpy(p, &self, sizeof(self));
+	last = p;
+	used += n;
+	return p + ARENA_HEADER_SIZE;
+}
+
+char* StringArena::realloc(char *ptr, size_t oldSize, size_t size)
+{
+	char *block = ptr - ARENA_HEADER_SIZE;
+	if (block == last) {
+		// the most recent allocation can be resized in place
+		const size_t offs = block - buf;
+		const size_t n = arenaBlockSize(size);
+		if (n > bufSize - offs) return NULL;
+		used = offs + n;
+		return ptr;
+	}
+	char *p = alloc(size);
+	if (p) {
+		memcpy(p, ptr, (size < oldSize) ? size : oldSize);
+	}
+	return p;
+}
+
+void StringArena::free(char *ptr)
+{
+	char *block = ptr - ARENA_HEADER_SIZE;
+	if (block == last) {
+		used = block - buf;
+		last = NULL;
+	}
+}
+
+StringArena* StringArena::owner(const char *ptr)
+{
+	StringArena *arena = NULL;
+	memcpy(&arena, ptr - ARENA_HEADER_SIZE, sizeof(arena));
+	return arena;
+}
+
 std::ostream& operator << ( std::ostream& os, const String& value ) {
     os << '"' << value.c_str() << '"';
     return os;